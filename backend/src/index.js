@@ -6,11 +6,12 @@ const mongoose = require('mongoose');
 const morgan = require('morgan');
 
 const logger = require('./utils/logger');
-const { errorHandler, rateLimiter } = require('./middleware/auth');
+const { errorHandler, rateLimiter, uploadRateLimiter } = require('./middleware/auth');
 
 const authRoutes = require('./routes/authRoutes');
 const canRoutes = require('./routes/canRoutes');
 const anomalyRoutes = require('./routes/anomalyRoutes');
+const uploadRoutes = require('./routes/uploadRoutes');
 
 const app = express();
 
@@ -39,6 +40,7 @@ mongoose.connect(process.env.MONGODB_URI, {
 app.use('/api/auth', rateLimiter, authRoutes);
 app.use('/api/can', rateLimiter, canRoutes);
 app.use('/api/anomalies', rateLimiter, anomalyRoutes);
+app.use('/api/uploads', uploadRateLimiter, uploadRoutes);
 
 // Health check endpoint
 app.get('/health', (req, res) => {
@@ -53,7 +55,8 @@ app.get('/api', (req, res) => {
         endpoints: {
             auth: '/api/auth',
             can: '/api/can',
-            anomalies: '/api/anomalies'
+            anomalies: '/api/anomalies',
+            uploads: '/api/uploads'
         }
     });
 });
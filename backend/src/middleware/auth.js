@@ -55,9 +55,18 @@ const rateLimiter = require('express-rate-limit')({
     message: 'Too many requests, please try again later.'
 });
 
+// A segment upload is hundreds of chunk requests; this still caps a
+// client well above a logger's UPLOAD_MAX_KBPS (4 KB chunks)
+const uploadRateLimiter = require('express-rate-limit')({
+    windowMs: 60 * 1000,  // 1 minute
+    max: 1200,  // 20 chunks/s, 80 KB/s
+    message: 'Too many requests, please try again later.'
+});
+
 module.exports = {
     authenticate,
     authorize,
     errorHandler,
-    rateLimiter
+    rateLimiter,
+    uploadRateLimiter
 };
@@ -28,6 +28,15 @@ const canLogSchema = new mongoose.Schema(
                 message: 'Data must contain up to 8 bytes (0-255)'
             }
         },
+        channel: {
+            type: Number,
+            default: 0
+        },
+        // Identical repeats the logger's change filter elided before this frame
+        suppressed: {
+            type: Number,
+            default: 0
+        },
         deviceId: {
             type: String,
             required: true,
@@ -0,0 +1,76 @@
+const express = require('express');
+const UploadService = require('../services/uploadService');
+const Device = require('../models/Device');
+
+const router = express.Router();
+
+// Resumable journal segment uploads from registered, active devices
+// (protocol in firmware/include/segment_uploader.h)
+
+router.param('deviceId', async (req, res, next, deviceId) => {
+    if (!/^[\w-]{1,64}$/.test(deviceId)) {
+        return res.status(400).json({ error: 'Invalid deviceId' });
+    }
+    try {
+        if (!await Device.exists({ deviceId, isActive: true })) {
+            return res.status(403).json({ error: 'Unknown device' });
+        }
+        next();
+    } catch (error) {
+        next(error);
+    }
+});
+
+router.param('segment', (req, res, next, segment) => {
+    if (!/^\d{1,10}$/.test(segment) || parseInt(segment) === 0) {
+        return res.status(400).json({ error: 'Invalid segment' });
+    }
+    next();
+});
+
+// Bytes already received, where the device resumes
+router.get(
+    '/:deviceId/:segment',
+    async (req, res, next) => {
+        try {
+            res.json(await UploadService.getOffset(req.params.deviceId, parseInt(req.params.segment)));
+        } catch (error) {
+            next(error);
+        }
+    }
+);
+
+// One chunk at ?offset=&total=, CRC-32 in X-Chunk-Crc32
+router.put(
+    '/:deviceId/:segment',
+    express.raw({ type: 'application/octet-stream', limit: '64kb' }),
+    async (req, res, next) => {
+        const offset = parseInt(req.query.offset);
+        const total = parseInt(req.query.total);
+        const checksum = parseInt(req.get('X-Chunk-Crc32'), 16);
+        if (isNaN(offset) || isNaN(total) || isNaN(checksum) || !Buffer.isBuffer(req.body)) {
+            return res.status(400).json({ error: 'offset, total, X-Chunk-Crc32 and a binary body required' });
+        }
+        if (offset < 0 || total <= 0 || total > UploadService.MAX_SEGMENT_BYTES) {
+            return res.status(400).json({ error: `total must be 1-${UploadService.MAX_SEGMENT_BYTES} bytes` });
+        }
+
+        try {
+            res.json(await UploadService.appendChunk(
+                req.params.deviceId,
+                parseInt(req.params.segment),
+                offset,
+                total,
+                checksum,
+                req.body
+            ));
+        } catch (error) {
+            if (error.offset !== undefined) {
+                return res.status(error.statusCode).json({ error: error.message, offset: error.offset });
+            }
+            next(error);
+        }
+    }
+);
+
+module.exports = router;
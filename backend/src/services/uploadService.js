@@ -0,0 +1,107 @@
+const fs = require('fs');
+const path = require('path');
+const logger = require('../utils/logger');
+
+// Journal segments uploaded by devices, stored as
+// UPLOAD_DIR/<deviceId>/seg_NNNNNNNN.bin (.part until the last byte
+// arrives) so they can be decoded with tools/journal_tool
+
+const UPLOAD_DIR = process.env.UPLOAD_DIR || 'uploads';
+
+// JOURNAL_SEGMENT_BLOCKS x JOURNAL_BLOCK_SIZE (firmware/include/config.h,
+// types.h); no closed segment is larger
+const MAX_SEGMENT_BYTES = 2048 * 512;
+
+// Tail of the chunk chain per segment, so a retried PUT racing the original
+// cannot pass the offset check alongside it and append twice
+const segmentChains = new Map();
+
+// CRC-32 (IEEE, reflected), as firmware/include/crc32.h
+const CRC_TABLE = new Int32Array(256).map((_, n) => {
+    let c = n;
+    for (let k = 0; k < 8; k++) {
+        c = c & 1 ? 0xEDB88320 ^ (c >>> 1) : c >>> 1;
+    }
+    return c;
+});
+
+function crc32(buffer) {
+    let crc = -1;
+    for (let i = 0; i < buffer.length; i++) {
+        crc = CRC_TABLE[(crc ^ buffer[i]) & 0xFF] ^ (crc >>> 8);
+    }
+    return (crc ^ -1) >>> 0;
+}
+
+function statusError(message, statusCode, offset) {
+    const error = new Error(message);
+    error.statusCode = statusCode;
+    error.offset = offset;
+    return error;
+}
+
+class UploadService {
+    static get MAX_SEGMENT_BYTES() {
+        return MAX_SEGMENT_BYTES;
+    }
+
+    static segmentPath(deviceId, segment, partial) {
+        const name = `seg_${String(segment).padStart(8, '0')}.bin${partial ? '.part' : ''}`;
+        return path.join(UPLOAD_DIR, deviceId, name);
+    }
+
+    // Bytes held for a segment; a completed segment reports its full size
+    static async getOffset(deviceId, segment) {
+        for (const partial of [false, true]) {
+            try {
+                const stat = await fs.promises.stat(this.segmentPath(deviceId, segment, partial));
+                return { offset: stat.size, complete: !partial };
+            } catch (error) {
+                if (error.code !== 'ENOENT') throw error;
+            }
+        }
+        return { offset: 0, complete: false };
+    }
+
+    // Runs task after every earlier one for the same segment has settled
+    static serialize(deviceId, segment, task) {
+        const key = `${deviceId}/${segment}`;
+        const run = (segmentChains.get(key) || Promise.resolve()).then(task);
+        const tail = run.catch(() => {});
+        segmentChains.set(key, tail);
+        tail.then(() => {
+            if (segmentChains.get(key) === tail) segmentChains.delete(key);
+        });
+        return run;
+    }
+
+    // Appends one chunk at offset; rejects a bad checksum (422) or an
+    // offset other than the stored size (409) with the offset to resume from
+    static appendChunk(deviceId, segment, offset, total, checksum, chunk) {
+        return this.serialize(deviceId, segment,
+            () => this.writeChunk(deviceId, segment, offset, total, checksum, chunk));
+    }
+
+    static async writeChunk(deviceId, segment, offset, total, checksum, chunk) {
+        const current = await this.getOffset(deviceId, segment);
+        if (crc32(chunk) !== checksum) {
+            throw statusError('Chunk checksum mismatch', 422, current.offset);
+        }
+        if (current.complete || offset !== current.offset || offset + chunk.length > total) {
+            throw statusError('Unexpected chunk offset', 409, current.offset);
+        }
+
+        const partPath = this.segmentPath(deviceId, segment, true);
+        await fs.promises.mkdir(path.dirname(partPath), { recursive: true });
+        await fs.promises.appendFile(partPath, chunk);
+
+        const end = offset + chunk.length;
+        if (end === total) {
+            await fs.promises.rename(partPath, this.segmentPath(deviceId, segment, false));
+            logger.info(`Segment ${segment} from ${deviceId} complete: ${total} bytes`);
+        }
+        return { offset: end, complete: end === total };
+    }
+}
+
+module.exports = UploadService;
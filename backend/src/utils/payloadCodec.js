@@ -0,0 +1,130 @@
+// Decoding for MQTT payloads from the logger (layout in
+// firmware/include/types.h, UPLINK PAYLOADS). A payload is either bare
+// JSON or an 8-byte header - magic 0xC5, codec, content, reserved,
+// raw length (u32 LE) - followed by the body, LZ4 block compressed when
+// codec is 1. Only vehicle/data/batch uses the header; JSON topics are
+// always bare. The backend has no MQTT ingest yet, so nothing requires this
+// module; it is the decoder for whatever subscriber is added.
+
+const PAYLOAD_MAGIC = 0xC5;
+const HEADER_SIZE = 8;
+
+const Codec = { NONE: 0, LZ4: 1 };
+const Content = { JSON: 1, FRAME_BATCH: 2 };
+
+// FrameBatchHeader, then JournalCanRecords each followed by dlc data bytes
+const BATCH_HEADER_SIZE = 16;
+const CAN_RECORD_SIZE = 12;
+
+function payloadError(message) {
+    const error = new Error(message);
+    error.statusCode = 400;
+    return error;
+}
+
+// LZ4 block format (no frame); rawLength is the exact decoded size
+function lz4DecompressBlock(input, rawLength) {
+    const output = Buffer.alloc(rawLength);
+    let ip = 0;
+    let op = 0;
+
+    const readLength = (length) => {
+        if (length !== 15) return length;
+        let byte;
+        do {
+            if (ip >= input.length) throw payloadError('Truncated LZ4 block');
+            byte = input[ip++];
+            length += byte;
+        } while (byte === 255);
+        return length;
+    };
+
+    while (ip < input.length) {
+        const token = input[ip++];
+        const literals = readLength(token >> 4);
+        if (ip + literals > input.length || op + literals > rawLength) {
+            throw payloadError('LZ4 literals overrun');
+        }
+        input.copy(output, op, ip, ip + literals);
+        ip += literals;
+        op += literals;
+        if (ip === input.length) break;
+
+        if (ip + 2 > input.length) throw payloadError('Truncated LZ4 block');
+        const offset = input[ip] | (input[ip + 1] << 8);
+        ip += 2;
+        if (offset === 0 || offset > op) throw payloadError('Bad LZ4 match offset');
+        const matchLength = readLength(token & 0x0F) + 4;
+        if (op + matchLength > rawLength) throw payloadError('LZ4 match overrun');
+        // Byte by byte: the match may overlap what it is copying
+        for (let i = 0; i < matchLength; i++, op++) {
+            output[op] = output[op - offset];
+        }
+    }
+    if (op !== rawLength) throw payloadError('LZ4 block shorter than its raw length');
+    return output;
+}
+
+// { content, body } with body a Buffer; bare JSON comes back as Content.JSON
+function decodePayload(payload) {
+    if (payload.length === 0 || payload[0] !== PAYLOAD_MAGIC) {
+        return { content: Content.JSON, body: payload };
+    }
+    if (payload.length < HEADER_SIZE) throw payloadError('Truncated payload header');
+
+    const codec = payload[1];
+    const content = payload[2];
+    const rawLength = payload.readUInt32LE(4);
+    const body = payload.subarray(HEADER_SIZE);
+    if (codec === Codec.NONE) {
+        if (body.length !== rawLength) throw payloadError('Payload length mismatch');
+        return { content, body };
+    }
+    if (codec === Codec.LZ4) {
+        return { content, body: lz4DecompressBlock(body, rawLength) };
+    }
+    throw payloadError(`Unknown payload codec ${codec}`);
+}
+
+// CANLog documents from a vehicle/data/batch body
+function frameBatchToLogs(body, deviceId) {
+    if (body.length < BATCH_HEADER_SIZE) throw payloadError('Truncated frame batch');
+    const count = body.readUInt16LE(0);
+    const firstTimestamp = body.readUInt32LE(4);
+    const firstUtc = Number(body.readBigUInt64LE(8));
+
+    const logs = [];
+    let offset = BATCH_HEADER_SIZE;
+    for (let i = 0; i < count; i++) {
+        if (offset + CAN_RECORD_SIZE > body.length) throw payloadError('Truncated frame batch');
+        const timestamp = body.readUInt32LE(offset);
+        const canId = body.readUInt32LE(offset + 4);
+        const channel = body[offset + 8];
+        const dlc = Math.min(body[offset + 9], 8);
+        const suppressed = body.readUInt16LE(offset + 10);
+        offset += CAN_RECORD_SIZE;
+        if (offset + dlc > body.length) throw payloadError('Truncated frame batch');
+
+        // Device uptime is mapped onto UTC from the batch's first frame when synced
+        const elapsed = (timestamp - firstTimestamp) | 0;
+        logs.push({
+            timestamp: firstUtc ? firstUtc + elapsed : timestamp,
+            canId: `0x${canId.toString(16)}`,
+            dlc,
+            data: Array.from(body.subarray(offset, offset + dlc)),
+            channel,
+            suppressed,
+            deviceId
+        });
+        offset += dlc;
+    }
+    return logs;
+}
+
+module.exports = {
+    Codec,
+    Content,
+    decodePayload,
+    frameBatchToLogs,
+    lz4DecompressBlock
+};
@@ -2,58 +2,42 @@
 #define ANOMALY_DETECTOR_H
 
 #include <Arduino.h>
+#include "config.h"
 #include "types.h"
+#include "anomaly_rules.h"
 
 class AnomalyDetector {
 public:
+    // Evaluation order; the first rule to fire on a frame is reported
+    typedef RulePipeline<RpmSpikeRule, SpeedThresholdRule, CanFrequencyRule,
+                         EngineInconsistencyRule, StatisticalDeviationRule> Rules;
+
+    static const uint8_t RULE_COUNT = Rules::COUNT;
+
     AnomalyDetector();
     ~AnomalyDetector();
 
     void init();
-    void update(const CanFrame& frame, const VehicleState& state);
+    // signals: VehicleStateManager::getDecodedSignals() for this frame
+    void update(const CanFrame& frame, const VehicleState& state, uint8_t signals);
     bool hasAnomaly();
     Anomaly getLatestAnomaly();
 
-private:
-    static const uint8_t MAX_HISTORY = 32;
+    // RULE_COUNT entries since the previous call; returns the frames seen
+    uint32_t takeRuleReport(RuleReport* reports);
 
+#if ANOMALY_STATS_BENCHMARK
+    // Cycles per frame of the deviation check against the double version it replaced
+    static void runStatsBenchmark(uint16_t iterations);
+#endif
+
+private:
     Anomaly _latest_anomaly;
+    Anomaly _scratch;           // Hits after the first on a frame
     bool _anomaly_flagged;
+    uint32_t _frames;
 
-    // Rule-based detection
-    bool checkRPMSpike(const VehicleState& state);
-    bool checkSpeedThreshold(const VehicleState& state);
-    bool checkCANFrequency(const CanFrame& frame);
-    bool checkEngineInconsistency(const VehicleState& state);
-
-    // Statistical detection
-    bool checkStatisticalDeviation(const VehicleState& state);
-
-    // State history for statistical analysis
-    struct History {
-        uint16_t rpm;
-        uint16_t speed;
-        uint32_t timestamp;
-    } _history[MAX_HISTORY];
-    uint8_t _history_index;
-
-    // Previous state for spike detection
-    VehicleState _prev_state;
-    uint32_t _last_check_time;
-
-    // Message frequency tracking
-    struct MessageTrack {
-        uint32_t can_id;
-        uint32_t last_seen;
-        uint32_t frequency;
-    } _message_track[16];
-    uint8_t _tracked_messages;
-
-    // Helper functions
-    double calculateMean(uint16_t* values, uint8_t count);
-    double calculateVariance(uint16_t* values, uint8_t count, double mean);
-    void recordHistory(const VehicleState& state);
-    void createAnomaly(uint8_t type, const char* description, uint8_t severity, uint16_t can_id);
+    Rules _rules;
 };
 
 #endif // ANOMALY_DETECTOR_H
@@ -0,0 +1,184 @@
+#ifndef ANOMALY_RULES_H
+#define ANOMALY_RULES_H
+
+#include <Arduino.h>
+#include "types.h"
+
+// Anomaly rules as types, composed into a RulePipeline at compile time.
+// A rule holds its own state and provides:
+//
+//   static const uint8_t INPUTS;      // (1 << SignalId/StatusSignal) bits it
+//                                     // reads, or RULE_EVERY_FRAME
+//   static const char* name();
+//   bool evaluate(const RuleContext& context, Anomaly& anomaly);
+//
+// evaluate() runs only for frames that decoded one of its INPUTS. When it
+// fires it fills in type, severity, can_id and description; the detector
+// sets the rest.
+
+// Past the decoded-signal bits: rules that look at the frame itself
+#define RULE_EVERY_FRAME 0x80
+
+static_assert(SIGNAL_FAULT_STATUS < 7, "Decoded-signal bits overlap RULE_EVERY_FRAME");
+
+struct RuleContext {
+    const CanFrame& frame;
+    const VehicleState& state;
+    uint32_t now;             // millis()
+};
+
+// Since the last takeReport()
+struct RuleReport {
+    const char* name;
+    uint8_t inputs;
+    uint32_t evaluations;     // Frames that touched its inputs
+    uint32_t hits;            // Including those masked by an earlier rule on the same frame
+    uint32_t avg_cycles;
+    uint32_t max_cycles;
+};
+
+class RpmSpikeRule {
+public:
+    static const uint8_t INPUTS = 1 << SIGNAL_RPM;
+    static const char* name() { return "rpm_spike"; }
+
+    RpmSpikeRule() : _prev_rpm(0) {}
+    bool evaluate(const RuleContext& context, Anomaly& anomaly);
+
+private:
+    uint16_t _prev_rpm;       // 0 until the first RPM frame
+};
+
+class SpeedThresholdRule {
+public:
+    static const uint8_t INPUTS = 1 << SIGNAL_SPEED;
+    static const char* name() { return "speed_threshold"; }
+
+    bool evaluate(const RuleContext& context, Anomaly& anomaly);
+};
+
+class CanFrequencyRule {
+public:
+    static const uint8_t INPUTS = RULE_EVERY_FRAME;
+    static const char* name() { return "can_frequency"; }
+
+    CanFrequencyRule();
+    bool evaluate(const RuleContext& context, Anomaly& anomaly);
+
+private:
+    static const uint8_t MAX_TRACKED = 16;
+
+    struct MessageTrack {
+        uint32_t can_id;
+        uint32_t last_seen;
+        uint32_t frequency;
+    } _message_track[MAX_TRACKED];
+    uint8_t _tracked_messages;
+};
+
+class EngineInconsistencyRule {
+public:
+    static const uint8_t INPUTS = (1 << SIGNAL_ENGINE_STATUS) | (1 << SIGNAL_RPM);
+    static const char* name() { return "engine_inconsistency"; }
+
+    bool evaluate(const RuleContext& context, Anomaly& anomaly);
+};
+
+// RPM 3-sigma outliers against the last MAX_HISTORY RPM readings
+class StatisticalDeviationRule {
+public:
+    static const uint8_t INPUTS = 1 << SIGNAL_RPM;
+    static const char* name() { return "statistical_deviation"; }
+    static const uint8_t MAX_HISTORY = 32;
+
+    StatisticalDeviationRule();
+    bool evaluate(const RuleContext& context, Anomaly& anomaly);
+
+    static bool exceedsThreeSigma(uint16_t value, uint32_t count, uint32_t sum, uint64_t sum_sq);
+
+private:
+    uint16_t _history[MAX_HISTORY];
+    uint8_t _history_index;     // Next slot to overwrite
+    uint8_t _history_count;
+    // Running sums over the history, kept exact in integers so the
+    // 3-sigma test needs no mean, variance or square root
+    uint32_t _rpm_sum;
+    uint64_t _rpm_sum_sq;
+
+    void record(uint16_t rpm);
+};
+
+// Rules run in declaration order, each only when the frame's inputs
+// intersect its INPUTS; the test is against a constant, inlined per rule,
+// with no table or virtual call. The first rule to fire is the one
+// reported; later hits on the same frame are only counted.
+template <typename... Rules>
+class RulePipeline;
+
+template <>
+class RulePipeline<> {
+public:
+    static const uint8_t COUNT = 0;
+
+    bool run(uint8_t, const RuleContext&, Anomaly&, Anomaly&, bool found) { return found; }
+    void takeReport(RuleReport*) {}
+};
+
+template <typename Rule, typename... Rest>
+class RulePipeline<Rule, Rest...> {
+public:
+    static_assert(Rule::INPUTS != 0, "A rule must depend on at least one input");
+
+    static const uint8_t COUNT = 1 + RulePipeline<Rest...>::COUNT;
+
+    RulePipeline() { resetCost(); }
+
+    // True if any rule fired; anomaly holds the first, scratch takes the rest
+    bool run(uint8_t inputs, const RuleContext& context, Anomaly& anomaly, Anomaly& scratch,
+             bool found = false) {
+        if (inputs & Rule::INPUTS) {
+            uint32_t start = ESP.getCycleCount();
+            bool hit = _rule.evaluate(context, found ? scratch : anomaly);
+            uint32_t cycles = ESP.getCycleCount() - start;
+
+            _evaluations++;
+            _total_cycles += cycles;
+            if (cycles > _max_cycles) _max_cycles = cycles;
+            if (hit) {
+                _hits++;
+                found = true;
+            }
+        }
+        return _rest.run(inputs, context, anomaly, scratch, found);
+    }
+
+    // COUNT entries, in pipeline order; clears the counters
+    void takeReport(RuleReport* reports) {
+        RuleReport& r = reports[0];
+        r.name = Rule::name();
+        r.inputs = Rule::INPUTS;
+        r.evaluations = _evaluations;
+        r.hits = _hits;
+        r.avg_cycles = _evaluations ? (uint32_t)(_total_cycles / _evaluations) : 0;
+        r.max_cycles = _max_cycles;
+        resetCost();
+        _rest.takeReport(reports + 1);
+    }
+
+private:
+    Rule _rule;
+    uint32_t _evaluations;
+    uint32_t _hits;
+    uint64_t _total_cycles;
+    uint32_t _max_cycles;
+    RulePipeline<Rest...> _rest;
+
+    void resetCost() {
+        _evaluations = 0;
+        _hits = 0;
+        _total_cycles = 0;
+        _max_cycles = 0;
+    }
+};
+
+#endif // ANOMALY_RULES_H
@@ -0,0 +1,19 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <cstdint>
+#include <cstddef>
+
+// RFC 4648 base64 for embedding binary blobs in CSV and JSON.
+// Host-buildable; shared with the tools/ utilities.
+class Base64 {
+public:
+    static size_t encodedLength(size_t length) { return ((length + 2) / 3) * 4; }
+
+    // NUL-terminates; returns characters written, 0 if out is too small
+    static size_t encode(const uint8_t* in, size_t length, char* out, size_t size);
+    // Returns bytes written, 0 on malformed input or a short buffer
+    static size_t decode(const char* in, size_t length, uint8_t* out, size_t size);
+};
+
+#endif // BASE64_H
@@ -0,0 +1,62 @@
+#ifndef CAN_RECEIVER_H
+#define CAN_RECEIVER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#include "mcp2515_driver.h"
+
+// Owns the RX task that services every MCP2515 on the shared SPI bus. Each
+// controller's INT wakes the task, which takes one frame per channel per
+// pass until all are empty, so a saturated bus cannot starve the other.
+// loop() drains the per-channel rings with readFrame(), also round-robin.
+// Transmit queues are serviced after each RX drain, so a TX completion or a
+// writeFrame() notification is handled on the same task.
+class CanReceiver {
+public:
+    struct ChannelReport {
+        uint8_t channel;
+        uint32_t frames;
+        uint32_t frames_per_sec;   // Over the window since the previous report
+        uint32_t overflows;
+        uint32_t ring_dropped;
+        uint16_t ring_high_water;
+        uint32_t tx_sent;
+        uint32_t tx_per_sec;
+        uint32_t tx_arbitration_lost;
+        uint32_t tx_failed;        // Aborted on timeout or bus error
+        uint32_t bitrate;
+        uint32_t bitrate_lock_ms;  // Autobaud time-to-lock, 0 if fixed or not locked
+    };
+
+    CanReceiver();
+    ~CanReceiver();
+
+    bool addChannel(MCP2515Driver& driver);
+    bool start();
+
+    bool readFrame(CanFrame& frame);
+
+    uint8_t getChannelCount() const { return _count; }
+    MCP2515Driver& getChannel(uint8_t index) { return *_channels[index]; }
+    uint32_t getLastRxTime() const;
+    // esp_timer time of the first frame taken off any controller, 0 before
+    uint32_t getFirstFrameUs() const { return _first_frame_us; }
+
+    // Fills one report per channel; returns the number filled
+    uint8_t takeReport(ChannelReport* reports, uint32_t now);
+
+private:
+    MCP2515Driver* _channels[CAN_MAX_CHANNELS];
+    uint8_t _count;
+    uint8_t _next;                 // Channel readFrame() tries first
+    TaskHandle_t _task;
+    volatile uint32_t _first_frame_us;
+    uint32_t _report_frames[CAN_MAX_CHANNELS];
+    uint32_t _report_tx[CAN_MAX_CHANNELS];
+    uint32_t _report_time;
+
+    static void rxTask(void* arg);
+};
+
+#endif // CAN_RECEIVER_H
@@ -0,0 +1,94 @@
+#ifndef CHANGE_FILTER_H
+#define CHANGE_FILTER_H
+
+#include <cstdint>
+#include "config.h"
+#include "types.h"
+
+// Per-ID change detection for 11-bit CAN IDs. Each ID gets an entry out of
+// CHANGE_FILTER_MAX_IDS the first time it is seen or configured; IDs beyond
+// that, and extended IDs, are passed through unfiltered. A frame whose DLC
+// and payload match the previous frame of the same ID is suppressed; the
+// next emitted frame for that ID carries the number of suppressed repeats,
+// and a heartbeat is emitted at least every CHANGE_FILTER_HEARTBEAT_MS. The host restores the full stream by
+// inserting `suppressed` copies of the previous payload before each record.
+// Repeat counts and heartbeats are kept per sink and only reset once the
+// sink confirm()s it wrote the frame, so a sink that skips or drops a
+// frame still reports every repeat it has not written; after a lost
+// payload change the sink re-sends the ID's next frame in full.
+// The table is shared by all channels; an ID seen on two buses is passed
+// through unfiltered from then on. Each sink starts from its
+// CHANGE_FILTER_*_DEFAULT mode and init() applies CHANGE_FILTER_OVERRIDES.
+// No Arduino dependencies, so tools/change_filter_check builds it on the
+// host.
+class ChangeFilter {
+public:
+    enum Sink { SINK_SD = 0, SINK_MQTT = 1, SINK_COUNT = 2 };
+    enum Mode { MODE_ALL = 0, MODE_ON_CHANGE = 1, MODE_OFF = 2 };
+
+    struct Result {
+        bool emit[SINK_COUNT];
+        uint16_t suppressed[SINK_COUNT];  // Repeats elided before this frame
+    };
+
+    struct Stats {
+        uint32_t frames;
+        uint32_t emitted[SINK_COUNT];   // Confirmed written
+        uint16_t shared_ids;            // Seen on two channels, now unfiltered
+        uint32_t overflow;              // Frames of IDs with no free entry, unfiltered
+    };
+
+    ChangeFilter();
+    ~ChangeFilter();
+
+    void init();
+    // 11-bit IDs only, and false once every entry is taken; other IDs use
+    // the defaults. Repeats still pending for the sink are dropped and its
+    // next frame goes out in full.
+    bool setMode(Sink sink, uint32_t can_id, Mode mode);
+    Mode getMode(Sink sink, uint32_t can_id) const;
+
+    void process(const CanFrame& frame, Result& result);
+    // Required for every sink process() set emit for: whether the sink
+    // stored the frame
+    void confirm(Sink sink, const CanFrame& frame, bool written);
+    // The sink lost frames it had confirmed (a dropped MQTT batch); every
+    // ID re-sends its next frame in full
+    void resync(Sink sink);
+
+    const Stats& getStats() const { return _stats; }
+    // Fraction of frames not written to the sink, 0.0 - 1.0
+    float getReduction(Sink sink) const;
+
+private:
+    static const uint16_t TABLE_SIZE = MAX_CAN_ID + 1;
+    static const uint16_t NO_ENTRY = 0xFFFF;
+
+    struct Entry {
+        uint8_t data[8];
+        uint8_t dlc;          // 0xFF until the ID has been seen
+        uint8_t modes;        // Two bits per sink, owning channel, SHARED_FLAG
+        uint8_t resync;       // Bit per sink: it missed the current payload
+        uint16_t suppressed[SINK_COUNT];
+        uint32_t last_emit[SINK_COUNT];
+    };
+
+    static const uint8_t CHANNEL_SHIFT = 4;
+    static const uint8_t CHANNEL_MASK = 0x30;
+    static const uint8_t SHARED_FLAG = 0x80;
+    static const uint8_t DEFAULT_MODES = (CHANGE_FILTER_SD_DEFAULT << (SINK_SD * 2)) |
+                                         (CHANGE_FILTER_MQTT_DEFAULT << (SINK_MQTT * 2));
+
+    uint16_t _index[TABLE_SIZE];   // Entry per 11-bit ID, NO_ENTRY until seen
+    Entry _entries[CHANGE_FILTER_MAX_IDS];
+    uint16_t _used;
+    Stats _stats;
+    bool _changed;            // The frame in process() changed its ID's payload
+
+    uint16_t indexOf(uint32_t can_id) const;
+    Entry* allocate(uint32_t can_id);
+    bool claim(Entry& entry, const CanFrame& frame);
+    void passThrough(Result& result, uint8_t modes);
+};
+
+#endif // CHANGE_FILTER_H
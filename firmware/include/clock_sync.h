@@ -0,0 +1,69 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// GPS-disciplined model of UTC over the local microsecond timer.
+// Records keep their cheap millis() stamp; toUtcMs() maps it onto UTC at
+// serialization time using a phase/frequency-corrected linear model.
+// Each sample steers phase; frequency is measured between raw samples
+// CLOCK_FREQ_BASELINE_MS apart, where arrival jitter is a few ppm. With a
+// PPS pin only PPS-aligned samples measure frequency, and NMEA samples
+// steer phase only while no PPS edge has done so recently.
+class ClockSync {
+public:
+    enum State {
+        UNSYNCED = 0,  // No GPS time seen since boot
+        LOCKED = 1,    // Disciplined within CLOCK_HOLDOVER_MS
+        HOLDOVER = 2   // GPS lost; free-running on the last offset and drift
+    };
+
+    struct Stats {
+        uint8_t state;
+        bool pps;                 // Last sample was aligned to a PPS edge
+        uint32_t samples;
+        uint32_t steps;           // Hard re-alignments (first fix, large error)
+        int64_t offset_us;        // UTC minus local timer at the last sample
+        int32_t last_error_us;    // Model prediction error at the last sample
+        uint32_t jitter_us;       // Smoothed absolute prediction error
+        float drift_ppm;          // Local oscillator frequency error
+        uint32_t since_sync_ms;
+    };
+
+    static void init(int8_t pps_pin = -1);
+
+    // Feed a GPS time observation. local_us is esp_timer time at which the
+    // message carrying utc_ms finished arriving.
+    static void onGpsTime(uint64_t utc_ms, int64_t local_us);
+
+    static uint64_t toUtcMs(uint32_t local_ms);  // 0 while UNSYNCED
+    static uint64_t nowUtcMs();
+    static State getState();
+    static Stats getStats();
+
+    // Civil UTC to Unix epoch milliseconds
+    static uint64_t epochMs(uint16_t year, uint8_t month, uint8_t day, uint32_t ms_of_day);
+
+private:
+    static portMUX_TYPE _lock;
+    static bool _synced;
+    static int64_t _ref_local_us;
+    static int64_t _ref_utc_us;
+    static float _drift_ppm;
+    static Stats _stats;
+    static bool _pps_enabled;
+    static volatile int64_t _pps_us;     // Written by the ISR, read under _lock
+    static int64_t _last_pps_sample_us;
+    // Start of the current frequency baseline, 0 if none
+    static int64_t _freq_local_us;
+    static int64_t _freq_utc_us;
+    static bool _freq_valid;             // _drift_ppm holds a measurement
+
+    static void IRAM_ATTR onPps();
+    static int64_t predictLocked(int64_t local_us);
+    static void measureFrequencyLocked(int64_t utc_us, int64_t local_us);
+    static State stateLocked(int64_t now_us);
+};
+
+#endif // CLOCK_SYNC_H
@@ -2,23 +2,83 @@
 #define CONFIG_H
 
 // ===== CAN BUS CONFIGURATION =====
-#define CAN_BITRATE 500000  // 500 kbps
+#define CAN_BITRATE 500000  // 500 kbps; used when autobaud finds no traffic and nothing is cached
 #define CAN_CS_PIN 5        // GPIO5 for MCP2515 chip select
 #define CAN_INT_PIN 4       // GPIO4 for interrupt
+#define CAN_CHANNELS 2      // 1 leaves the second controller unpopulated
+#define CAN1_BITRATE 500000 // Channel 1 (body bus)
+#define CAN1_CS_PIN 26
+#define CAN1_INT_PIN 27
+#define CAN_MAX_CHANNELS 2
+#define CAN_RX_RING_SIZE 256    // Frames per channel between the RX task and loop(), power of two
+#define CAN_RX_TASK_PRIORITY 5  // Above loop() so INT is serviced promptly
+#define CAN_RX_TASK_CORE 1      // Away from WiFi, MQTT and logging on core 0; preempts loop() on INT
+#define CAN_RX_POLL_MS 10       // Fallback poll in case an INT edge is missed
+#define CAN_LOOP_BATCH 64       // Frames handled per loop() pass
+#define CAN_LISTEN_ONLY 1       // 0 lets channel 0 ACK and transmit (active diagnostics)
+#define CAN1_LISTEN_ONLY 1
+#define CAN_TX_QUEUE_SIZE 16    // Frames waiting for one of the three TX buffers
+#define CAN_TX_TIMEOUT_MS 100   // Abort a loaded frame that has not won the bus by then
+#define MCP2515_CRYSTAL_HZ 8000000      // Oscillator on the MCP2515 modules (8 or 16 MHz)
+#define CAN_AUTOBAUD 1                  // Probe candidate rates listen-only at init; 0 trusts the configured rate
+#define CAN_AUTOBAUD_DWELL_MS 150       // Longest wait per candidate on a quiet bus
+#define CAN_AUTOBAUD_MAX_ERRORS 2       // Receive errors that reject a candidate early
+#define CAN_AUTOBAUD_TIMEOUT_MS 3000    // Sweep limit before falling back to the cached/configured rate
+
+// ===== OBD-II POLLING =====
+#define OBD_ENABLED 0                 // Poll Mode 01 PIDs on channel 0; needs CAN_LISTEN_ONLY 0
+#define OBD_MAX_ECUS 8                // Responders 0x7E8-0x7EF
+#define OBD_PIDS_PER_REQUEST 6        // ISO 15765-4 limit for one Mode 01 request
+#define OBD_RESPONSE_TIMEOUT_MS 100   // P2 is 50 ms; NRC 0x78 restarts the wait
+#define OBD_DISCOVERY_RETRY_MS 5000   // Re-broadcast PID 0x00 while no ECU answers
+#define OBD_MAX_TIMEOUTS 5            // Consecutive misses before an ECU is rediscovered
+#define OBD_ISOTP_MAX 64              // Reassembly buffer per ECU; 6 PIDs need at most 31 bytes
+#define OBD_RPM_INTERVAL_MS 50
+#define OBD_SPEED_INTERVAL_MS 100
+#define OBD_THROTTLE_INTERVAL_MS 100
+#define OBD_STATUS_INTERVAL_MS 1000
 
 // ===== GPS CONFIGURATION =====
 #define GPS_RX_PIN 16       // GPIO16 UART2 RX
 #define GPS_TX_PIN 17       // GPIO17 UART2 TX
-#define GPS_BAUDRATE 9600
+#define GPS_BAUDRATE 9600           // Receiver power-on default
+#define GPS_RUN_BAUDRATE 115200     // Switched to during init; 0 keeps GPS_BAUDRATE
+#define GPS_BAUD_PROBE_MS 1500      // Listen time per candidate rate at init; NMEA defaults to 1 Hz
+#define GPS_UPDATE_RATE_HZ 5        // Navigation rate; NEO-6M tops out at 5, u-blox 7 and later take 10
+#define GPS_USE_UBX 0               // 1: binary UBX-NAV-PVT (u-blox 7 or later), 0: NMEA
+#define GPS_RX_BUFFER_SIZE 2048     // UART RX ring, ~180 ms at 115200 baud
+#define GPS_PPS_PIN -1              // Timepulse input for clock discipline, -1 disables
+#define GPS_PARSER_BENCHMARK 0      // Run the NMEA corpus benchmark at boot
+
+// ===== TIME SYNCHRONIZATION =====
+#define CLOCK_HOLDOVER_MS 600000       // Keep LOCKED this long after the last GPS time
+#define CLOCK_STEP_THRESHOLD_US 500000 // Re-align instead of slewing beyond this error
+#define CLOCK_MAX_DRIFT_PPM 200        // Clamp for the frequency estimate
+#define CLOCK_FREQ_BASELINE_MS 300000  // Frequency is measured over this much GPS time
 
 // ===== SD CARD CONFIGURATION =====
 #define SD_CS_PIN 2         // GPIO2 for SD card chip select
 #define SD_LOG_INTERVAL 5000 // Log interval in ms
+#define SD_BOOT_BACKLOG_FRAMES 2048 // Frames held in RAM (24 bytes each) while the card mounts at boot
+
+// ===== LOG JOURNAL =====
+#define JOURNAL_SEGMENT_BLOCKS 2048   // 512-byte blocks per segment file (1 MiB), preallocated at creation
+#define JOURNAL_QUEUE_BLOCKS 16       // Sealed blocks waiting for the card (8 KiB)
+#define JOURNAL_SEGMENT_MAX_MS 600000 // Rotate a segment after 10 minutes even if not full
+#define JOURNAL_TIME_INDEX_STRIDE 16  // Data blocks per time index entry (8 KiB of log)
+#define JOURNAL_INDEX_MAX_IDS 256     // CAN IDs tracked per segment; beyond this the segment is marked unindexed
+#define JOURNAL_MIN_FREE_MB 64        // Oldest segments are deleted at rotation to keep this much free
+
+// ===== SPI ARBITRATION =====
+#define SD_WRITE_CHUNK 512        // Bytes per SD write; one sector bounds how long CAN waits
+#define SD_CHUNKS_PER_PASS 4      // Chunks (journal blocks) written per loop() pass
+#define SD_FLUSH_INTERVAL 1000    // Partial journal block seal plus card sync cadence
+#define SPI_YIELD_MAX_US 2000     // Longest an SD writer defers to pending CAN service
 
 // ===== WIFI CONFIGURATION =====
 #define WIFI_SSID "your-ssid"
 #define WIFI_PASSWORD "your-password"
-#define WIFI_CONNECT_TIMEOUT 10000
+#define WIFI_CONNECT_TIMEOUT 10000   // Warn if WiFi is not up by then; connecting continues in the background
 
 // ===== MQTT CONFIGURATION =====
 #define MQTT_BROKER "your-broker-ip"
@@ -26,20 +86,94 @@
 #define MQTT_USER "mqtt-user"
 #define MQTT_PASS "mqtt-password"
 #define MQTT_PUBLISH_INTERVAL 10000
+#define MQTT_MAX_PACKET_SIZE 8192     // Largest payload (heap); batched data runs to several KB
+#define MQTT_QUEUE_BYTES 16384        // Outbound ring (power of two, heap); QoS 1 messages stay until acked
+#define MQTT_INFLIGHT_WINDOW 8        // QoS 1 publishes awaiting PUBACK
+#define MQTT_QUEUE_HIGH_WATER 75      // Ring % at which producers are told to back off...
+#define MQTT_QUEUE_LOW_WATER 50       // ...until it drains below this
+#define MQTT_ACK_TIMEOUT_MS 10000     // Reconnect and resend if the oldest PUBACK is this late
+#define MQTT_KEEPALIVE_S 30
+#define MQTT_RECONNECT_MS 5000
+#define MQTT_TASK_PRIORITY 1
+#define MQTT_TASK_CORE 0              // With the WiFi stack, off the loop() core
+#define MQTT_BATCH_FRAMES 64          // Raw frames per vehicle/data/batch message; 0 sends each as JSON on vehicle/data
+#define MQTT_BATCH_MS 1000            // Send a partial batch after this long
+#define MQTT_COMPRESS_ENABLED 1       // LZ4-compress vehicle/data/batch payloads; JSON topics always go bare
+#define MQTT_COMPRESS_MIN_BYTES 128   // Smaller batches go as they are
+
+// ===== LOG QUERY SERVER =====
+#define QUERY_SERVER_ENABLED 1
+#define QUERY_SERVER_PORT 80
+#define QUERY_BLOCKS_PER_PASS 4       // Journal blocks read and streamed per loop() pass
+#define QUERY_REQUEST_TIMEOUT_MS 2000 // Drop a client that has not sent its request line and headers by then
+#define QUERY_WRITE_TIMEOUT_MS 5000   // Drop a client that has not taken any response bytes for this long
+#define QUERY_MAX_IDS 16              // CAN IDs per query
+#define QUERY_TOKEN "your-query-token" // Required as ?token= or "Authorization: Bearer"; URL-safe, empty refuses all
+
+// ===== SEGMENT UPLOAD =====
+#define UPLOAD_ENABLED 1
+#define UPLOAD_HOST "your-backend-ip"
+#define UPLOAD_PORT 3000
+#define UPLOAD_PATH "/api/uploads"
+#define UPLOAD_DEVICE_ID "ESP32-CANLogger"
+#define UPLOAD_USE_TLS 0                // 1: HTTPS, verified against UPLOAD_CA_CERT
+#define UPLOAD_CA_CERT ""               // PEM of the backend's CA when UPLOAD_USE_TLS
+#define UPLOAD_CHUNK_SIZE 4096          // Bytes per PUT, multiple of JOURNAL_BLOCK_SIZE; held in RAM
+#define UPLOAD_MAX_KBPS 64              // Upload ceiling so live MQTT keeps its share of the link
+#define UPLOAD_CONNECT_TIMEOUT_MS 5000  // DNS, TCP and any TLS handshake, on the connect task
+#define UPLOAD_TASK_PRIORITY 1
+#define UPLOAD_TASK_CORE 0              // With the WiFi stack, off the loop() core
+#define UPLOAD_SEND_TIMEOUT_MS 5000     // Give up on a request the socket has not taken any of for this long
+#define UPLOAD_RESPONSE_TIMEOUT_MS 5000
+#define UPLOAD_RETRY_MS 30000           // Back-off after a failed connection or request
+#define UPLOAD_MAX_CHUNK_RETRIES 3      // Checksum rejections of one chunk before backing off
 
 // ===== ANOMALY DETECTION =====
 #define RPM_SPIKE_THRESHOLD 500       // RPM change threshold
 #define SPEED_MAX_THRESHOLD 200       // Max speed km/h
 #define CAN_MSG_TIMEOUT 5000          // ms
+#define ANOMALY_STATS_BENCHMARK 0     // Time the 3-sigma check against double math at boot
+
+// ===== CHANGE-ONLY LOGGING =====
+#define CHANGE_FILTER_HEARTBEAT_MS 1000   // Unchanged IDs are still emitted this often
+#define CHANGE_FILTER_SD_DEFAULT 1        // Per-ID default, 0: every frame, 1: on change, 2: off
+#define CHANGE_FILTER_MQTT_DEFAULT 2
+#define CHANGE_FILTER_MAX_IDS 256         // 11-bit IDs tracked, 24 bytes each; later ones pass through
+// Per-ID exceptions, {first_id, last_id, sd_mode, mqtt_mode} over 11-bit IDs
+#define CHANGE_FILTER_OVERRIDES { {0x7E8, 0x7EF, 0, 2} }  // OBD-II replies keep their own timestamps
+
+// ===== SIGNAL DISTRIBUTIONS =====
+#define DIST_WINDOW_MS 300000             // Sketch window published to MQTT and SD
+#define DIST_MAX_HOLD_MS 1000             // Longest a value is credited once its signal goes quiet
+
+// ===== FLIGHT RECORDER =====
+#define FLIGHT_RECORDER_FRAMES 2048         // Raw frame ring (20 bytes each); must hold PRE_MS of traffic
+#define FLIGHT_RECORDER_STATES 256          // Sampled VehicleState ring
+#define FLIGHT_RECORDER_STATE_INTERVAL 100  // ms between state samples
+#define FLIGHT_RECORDER_PRE_MS 1000         // Captured before the trigger
+#define FLIGHT_RECORDER_POST_MS 1000        // Captured after the trigger
+#define FLIGHT_RECORDER_CHUNK 64            // Frames per SD write while draining
 
 // ===== POWER MANAGEMENT =====
-#define DEEP_SLEEP_ENABLED 0
+#define DEEP_SLEEP_ENABLED 0          // Reboots on wake-up; takes precedence over light sleep
 #define DEEP_SLEEP_DURATION 60000000  // 60 seconds in microseconds
+#define LIGHT_SLEEP_ENABLED 1         // RAM and CAN config retained, wakes in ~1 ms
+#define BUS_IDLE_TIMEOUT 30000        // ms without frames before sleeping
 
 // ===== LOGGING =====
-#define LOG_BUFFER_SIZE 256
+#define LOG_BUFFER_SIZE 256   // Formatted line, drain task only
 #define LOG_ENABLE 1
 #define LOG_LEVEL 2  // 0: ERROR, 1: WARN, 2: INFO, 3: DEBUG
+#define LOG_QUEUE_DEPTH 64    // Pending messages, power of two
+#define LOG_MAX_ARGS 8
+#define LOG_STRING_BYTES 96   // Copied %s text per message
+#define LOG_TASK_PRIORITY 1
+#define LOG_TASK_CORE 0
+
+// ===== INSTRUMENTATION =====
+#define PERF_ENABLED 1
+#define PERF_CPU_MHZ 240              // Cycle counter to microseconds
+#define PERF_REPORT_INTERVAL 60000    // Health snapshot period in ms
 
 // ===== DATA STRUCTURES =====
 #define MAX_CAN_ID 0x7FF
@@ -0,0 +1,15 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <cstdint>
+#include <cstddef>
+
+// CRC-32 (IEEE 802.3, reflected 0xEDB88320) for journal blocks.
+// Host-buildable; shared with the tools/ utilities.
+class Crc32 {
+public:
+    // Chain calls by passing the previous result; start with 0
+    static uint32_t update(uint32_t crc, const void* data, size_t length);
+};
+
+#endif // CRC32_H
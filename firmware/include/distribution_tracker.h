@@ -0,0 +1,43 @@
+#ifndef DISTRIBUTION_TRACKER_H
+#define DISTRIBUTION_TRACKER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#include "quantile_sketch.h"
+
+// Time-weighted distributions of speed, RPM and throttle. Each decoded value
+// is credited with the milliseconds it was held (capped at DIST_MAX_HOLD_MS
+// so bus silence is not counted), which makes bucket weights time-in-band
+// and quantiles time-based regardless of frame rate. Windows are closed
+// every DIST_WINDOW_MS and merged per trip on the host.
+class DistributionTracker {
+public:
+    static const uint8_t SIGNALS = SIGNAL_THROTTLE + 1;  // SignalIds tracked
+    static const size_t MAX_BLOB_SIZE = 768;              // Serialized sketch cap
+    static const size_t MAX_ENCODED_SIZE = ((MAX_BLOB_SIZE + 2) / 3) * 4 + 1;
+
+    DistributionTracker();
+
+    void update(const VehicleState& state, uint8_t signals, uint32_t now);
+    // Credits held values up to now; the sketches then cover [start, now]
+    void closeWindow(uint32_t now);
+    void reset(uint32_t now);
+
+    const QuantileSketch& getSketch(SignalId signal) const { return _sketches[signal]; }
+    uint32_t getWindowStart() const { return _window_start; }
+
+    // Serialized sketch as base64 for CSV/JSON; 0 if over MAX_BLOB_SIZE
+    static size_t encode(const QuantileSketch& sketch, char* out, size_t size);
+
+private:
+    QuantileSketch _sketches[SIGNALS];
+    uint16_t _held_value[SIGNALS];
+    uint32_t _held_since[SIGNALS];
+    uint8_t _held;  // Bitmask of signals with a value
+    uint32_t _window_start;
+
+    void credit(uint8_t signal, uint32_t now);
+};
+
+#endif // DISTRIBUTION_TRACKER_H
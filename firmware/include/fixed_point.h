@@ -0,0 +1,33 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Integer parsing and formatting for values that would otherwise go
+// through atof() and software-emulated double (the ESP32 FPU is single
+// precision only). Host-buildable; shared with the tools/ utilities.
+//
+// Error bounds:
+//   parseDecimal         rounded half away from zero at the last kept
+//                        digit: within 0.5 unit of that digit
+//   parseNmeaCoordinate  within 0.6 microdegree (about 7 cm) of the exact
+//                        ddmm.mmmmm value: 0.5 from rounding minutes/60,
+//                        plus at most 0.09 when more than five minute
+//                        decimals are rounded away (receivers send 4-5);
+//                        tools/fixed_point_check measures 0.583 at worst
+class FixedPoint {
+public:
+    static const int32_t MICRODEGREES_PER_DEGREE = 1000000;
+
+    // "-12.345" with decimals 2 -> -1235. Stops at the first character that
+    // is not part of the number; empty text is 0. The scaled value must fit
+    // in 32 bits.
+    static int32_t parseDecimal(const char* text, uint8_t decimals);
+    // NMEA (d)ddmm.mmmmm and N/S/E/W hemisphere to signed microdegrees
+    static int32_t parseNmeaCoordinate(const char* coord, const char* hemisphere);
+    // "-48.117300"; returns the length written, excluding the terminator
+    static size_t formatMicrodegrees(int32_t microdegrees, char* out, size_t size);
+};
+
+#endif // FIXED_POINT_H
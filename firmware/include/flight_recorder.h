@@ -0,0 +1,72 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#include "sd_logger.h"
+
+// Fixed-memory circular capture of raw frames and sampled vehicle state;
+// init() allocates both rings, and the recorder stays off without them.
+// trigger() marks a window of FLIGHT_RECORDER_PRE_MS before and
+// FLIGHT_RECORDER_POST_MS after an anomaly; update() streams that window
+// to SD in bounded chunks while capture continues.
+class FlightRecorder {
+public:
+    enum Phase { IDLE = 0, POST_TRIGGER = 1, WRITING = 2 };
+
+    struct Stats {
+        uint32_t snapshots;
+        uint32_t coalesced;       // Triggers folded into an open snapshot
+        uint32_t rejected;        // Triggers while a snapshot was being written
+        uint32_t frames_lost;     // Overwritten before reaching the card
+    };
+
+    FlightRecorder(SDLogger& sd_logger);
+    ~FlightRecorder();
+
+    void init();
+
+    // Hot path: a 20-byte copy and an index increment
+    void record(const CanFrame& frame) {
+        if (!_frames) return;
+        _frames[_frame_head % FLIGHT_RECORDER_FRAMES] = frame;
+        _frame_head++;
+    }
+    void recordState(const VehicleState& state);
+
+    // Returns the snapshot id that will contain this anomaly, or 0
+    uint32_t trigger(const Anomaly& anomaly);
+    void update();
+
+    Phase getPhase() const { return _phase; }
+    const Stats& getStats() const { return _stats; }
+
+private:
+    SDLogger& _sd_logger;
+    Phase _phase;
+    Stats _stats;
+
+    CanFrame* _frames;            // FLIGHT_RECORDER_FRAMES, from init()
+    VehicleState* _states;        // FLIGHT_RECORDER_STATES
+    uint32_t _frame_head;         // Monotonic sequence of the next frame slot
+    uint32_t _state_head;
+    uint32_t _last_state_time;
+
+    // Active snapshot
+    SnapshotHeader _header;
+    uint32_t _snapshot_id;
+    uint32_t _frame_next;         // Next frame sequence to write
+    uint32_t _frame_end;
+    uint32_t _state_next;
+    uint32_t _state_end;
+    bool _write_failed;
+
+    uint32_t findFrameStart(uint32_t cutoff);
+    uint32_t findStateStart(uint32_t cutoff);
+    bool writeFrames();
+    bool writeStates();
+    void finish();
+};
+
+#endif // FLIGHT_RECORDER_H
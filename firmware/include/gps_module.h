@@ -2,32 +2,57 @@
 #define GPS_MODULE_H
 
 #include <Arduino.h>
+#include "config.h"
 #include "types.h"
+#include "nmea_parser.h"
+#include "ubx_parser.h"
 
 class GPSModule {
 public:
     GPSModule(uint8_t rx_pin, uint8_t tx_pin, uint32_t baudrate = 9600);
     ~GPSModule();
 
+    // Configures the receiver and registers a UART receive event; after this
+    // bytes are consumed as they arrive and loop() never needs to poll
     void init();
     void update();
     bool hasValidFix();
     GpsData getLatestData();
+    uint32_t getFixCount() const { return _fix_count; }
+    const NmeaParser::Stats& getParserStats() const { return _parser.getStats(); }
+    const UbxParser::Stats& getUbxStats() const { return _ubx_parser.getStats(); }
+
+#if GPS_PARSER_BENCHMARK
+    void runParserBenchmark(uint16_t iterations);
+#endif
 
 private:
     uint8_t _rx_pin;
     uint8_t _tx_pin;
     uint32_t _baudrate;
-    GpsData _latest_data;
+    GpsData _fix;            // Working copy, only touched by the UART reader
+    GpsData _latest_data;    // Published copy, guarded by _data_lock
+    portMUX_TYPE _data_lock;
+    volatile uint32_t _fix_count;
+    NmeaParser _parser;
+    UbxParser _ubx_parser;
 
-    bool parseNMEA(const char* sentence);
-    bool parseGPGGA(const char* fields[]);
-    bool parseGPRMC(const char* fields[]);
-    double parseCoordinate(const char* coord, const char* dir);
+    // Receiver configuration
+    void configureReceiver();
+    uint32_t probeBaudrate(const uint32_t* candidates, uint8_t count);  // 0 if none decodes
+    void sendPortConfig(uint32_t baud);
+    void sendUbx(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len);
+    void setMessageRate(uint8_t msg_class, uint8_t msg_id, uint8_t rate);
 
-    static const size_t NMEA_BUFFER_SIZE = 128;
-    char _nmea_buffer[NMEA_BUFFER_SIZE];
-    uint16_t _buffer_index;
+    void publishFix();
+    bool handleSentence(const NmeaParser& nmea, NmeaParser::SentenceType type);
+    bool handleUbx(const UbxParser& ubx);
+    bool parseGGA(const NmeaParser& nmea);
+    bool parseRMC(const NmeaParser& nmea);
+    bool parseVTG(const NmeaParser& nmea);
+    bool parseGSA(const NmeaParser& nmea);
+    bool parseNavPvt(const UbxParser& ubx);
+    uint64_t parseUtc(const char* time, const char* date);
 };
 
 #endif // GPS_MODULE_H
@@ -0,0 +1,27 @@
+#ifndef JOURNAL_INDEX_H
+#define JOURNAL_INDEX_H
+
+#include <cstdint>
+#include "types.h"
+
+// Searches over /journal/index.bin, one JournalIndexEntry per closed
+// segment in segment order. Entries are read through a callback, so the
+// same search runs against the card and in tools/journal_index_check.
+// Host-buildable.
+class JournalIndex {
+public:
+    // False if the entry cannot be read or fails its CRC
+    typedef bool (*Reader)(void* context, uint32_t position, JournalIndexEntry& entry);
+
+    // First entry at or after position that reads back intact, and with
+    // synced set, that has a UTC range. A probe that lands on a corrupt
+    // entry or one closed before the clock synced takes its key from the next.
+    static bool probe(Reader read, void* context, uint32_t position, uint32_t count, bool synced,
+                      JournalIndexEntry& entry);
+    // First segment from first_seq on whose range reaches utc_ms. Segments
+    // closed before a clock sync have no UTC and only match utc_ms 0.
+    static bool findTime(Reader read, void* context, uint32_t count, uint32_t first_seq, uint64_t utc_ms,
+                         JournalIndexEntry& entry);
+};
+
+#endif // JOURNAL_INDEX_H
@@ -0,0 +1,142 @@
+#ifndef LOG_JOURNAL_H
+#define LOG_JOURNAL_H
+
+#include <Arduino.h>
+#include <SD.h>
+#include "config.h"
+#include "types.h"
+
+// Crash-safe CAN, GPS and anomaly log: records are packed into CRC-protected
+// blocks (layout in types.h) that are written in place into preallocated
+// segment files, so a power cut tears at most the block being written and
+// never touches FAT metadata mid-segment.
+//
+// Segments rotate when full, after JOURNAL_SEGMENT_MAX_MS, at every boot and
+// on close(). Closing writes a trailer with a sparse time index (one entry
+// per JOURNAL_TIME_INDEX_STRIDE blocks) and a sorted per-ID table of first
+// and last block, and appends a summary to /journal/index.bin, so time and
+// ID lookups binary-search the summaries and trailers and then read only
+// the blocks they name. The open segment's index lives in RAM.
+//
+// open() finds the newest segment by galloping and binary search over
+// segment numbers from the /journal/head hint. If the previous run did not
+// close it, the last valid block is found by binary search and the trailer
+// is rebuilt from the surviving blocks.
+//
+// Not thread-safe: everything runs from loop() via SDLogger; open() runs
+// once before the rest.
+class LogJournal {
+public:
+    struct Stats {
+        uint32_t segment_seq;       // Segment currently written
+        uint32_t block_seq;         // Next block sequence number
+        uint32_t blocks_written;
+        uint32_t write_errors;
+        uint32_t rotations;
+        uint32_t segments_deleted;  // Oldest segments removed for space
+        uint32_t recovery_us;       // Locating the end of the log in open()
+        uint32_t index_rebuild_us;  // Re-indexing an unclosed segment in open()
+        uint16_t recovery_reads;    // Block reads and existence probes in open()
+        uint16_t recovered_blocks;  // Data blocks found in an unclosed segment
+    };
+
+    struct Location {
+        uint32_t segment_seq;
+        uint16_t block;
+    };
+
+    static const uint16_t TIME_PER_BLOCK = JOURNAL_PAYLOAD_SIZE / sizeof(JournalTimeEntry);
+    static const uint16_t IDS_PER_BLOCK = JOURNAL_PAYLOAD_SIZE / sizeof(JournalIdEntry);
+    static const uint16_t TIME_INDEX_MAX =
+        (JOURNAL_SEGMENT_BLOCKS + JOURNAL_TIME_INDEX_STRIDE - 1) / JOURNAL_TIME_INDEX_STRIDE;
+    static const uint16_t TRAILER_BLOCKS =
+        (TIME_INDEX_MAX + TIME_PER_BLOCK - 1) / TIME_PER_BLOCK +
+        (JOURNAL_INDEX_MAX_IDS + IDS_PER_BLOCK - 1) / IDS_PER_BLOCK;
+    static const uint16_t DATA_BLOCKS_MAX = JOURNAL_SEGMENT_BLOCKS - 1 - TRAILER_BLOCKS;
+
+    LogJournal();
+    ~LogJournal();
+
+    bool open();
+    bool isOpen() const { return _segment_seq != 0; }
+    // Seals, writes out and indexes the current segment; the next block
+    // written starts a new one
+    bool close();
+
+    // Appends one record; false if it does not fit before the queue drains
+    bool append(uint8_t type, const void* record, uint8_t length, uint32_t timestamp);
+    bool appendCan(const CanFrame& frame, uint16_t suppressed);
+    bool appendGps(const GpsData& gps);
+    bool appendAnomaly(const Anomaly& anomaly);
+    bool hasRoom(size_t length) const;
+
+    // Closes the partially filled block so the next writeBlock() takes it
+    void seal();
+    uint8_t sealedBlocks() const { return _sealed; }
+    // Writes the oldest sealed block; false if none or the card failed
+    bool writeBlock();
+    void sync();
+
+    // First block that can hold records at or after utc_ms; records from
+    // before a clock sync have no UTC and only match utc_ms 0. False if
+    // the log ends before it
+    bool findTime(uint64_t utc_ms, Location& at);
+    // Block range of an ID within a segment. A segment whose ID table
+    // overflowed reports its whole data range.
+    bool findId(uint32_t segment_seq, uint32_t id, JournalIdEntry& entry);
+    // Summary of a closed segment, or of the open one as written so far
+    bool getSegment(uint32_t segment_seq, JournalIndexEntry& entry);
+    bool readSegmentBlock(uint32_t segment_seq, uint16_t index, uint8_t* block);
+    // Oldest segment still on the card
+    uint32_t firstSegment() const { return _first_seq; }
+
+    Stats getStats() const;
+
+    // Checks magic, version, CRC and position; host tools use the same test
+    static bool validateBlock(const uint8_t* block, uint32_t segment_seq, uint16_t block_index);
+    static void segmentPath(uint32_t seq, char* path, size_t size);
+
+private:
+    File _file;
+    File _reader;              // Closed segment last read by a lookup
+    uint32_t _reader_seq;
+    uint8_t _queue[JOURNAL_QUEUE_BLOCKS][JOURNAL_BLOCK_SIZE];
+    uint8_t _head;             // Oldest sealed block
+    uint8_t _sealed;           // Sealed blocks waiting
+    uint16_t _fill;            // Bytes used in the open block, 0 if none
+    uint32_t _segment_seq;
+    uint16_t _next_index;      // Block index the next write goes to
+    uint32_t _block_seq;
+    uint32_t _first_seq;       // Oldest segment still on the card
+    Stats _stats;
+
+    // Index of the open segment, written out as its trailer
+    JournalIndexEntry _current;
+    JournalTimeEntry _time_index[TIME_INDEX_MAX];
+    JournalIdEntry _id_index[JOURNAL_INDEX_MAX_IDS];
+
+    uint8_t* openBlock();
+    bool createSegment(uint32_t seq);
+    bool recoverSegment(uint32_t seq);
+    bool writeTrailer();
+    void indexBlock(const uint8_t* block, uint16_t index);
+    void indexId(uint32_t id, uint16_t index);
+    void freeSpace();
+    bool readBlock(uint16_t index, uint8_t* block);
+    bool writeRaw(uint16_t index, const uint8_t* block);
+    bool writeHead();
+    bool readHead(JournalHead& head);
+    uint32_t indexCount();
+    bool readIndex(uint32_t position, JournalIndexEntry& entry);
+    static bool readIndexEntry(void* context, uint32_t position, JournalIndexEntry& entry);
+    bool appendIndex(JournalIndexEntry& entry);
+    int32_t searchTrailer(uint32_t segment_seq, uint16_t first_block, uint16_t count,
+                          uint16_t per_block, size_t entry_size, uint64_t (*key)(const uint8_t*),
+                          uint64_t target, void* out);
+    bool segmentExists(uint32_t seq);
+    uint32_t findLastSegment(uint32_t hint);
+    uint32_t scanSegments(uint32_t& first);
+    void finishBlock(uint8_t* block, uint8_t kind, uint16_t index);
+};
+
+#endif // LOG_JOURNAL_H
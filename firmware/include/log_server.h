@@ -0,0 +1,112 @@
+#ifndef LOG_SERVER_H
+#define LOG_SERVER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "config.h"
+#include "types.h"
+#include "sd_logger.h"
+
+// HTTP access to the journal on the card, so a parked vehicle can be read
+// over depot WiFi without pulling the SD card:
+//
+//   GET /log?from=UTC_MS&to=UTC_MS&id=0x1A0,0x2B0
+//       CAN frames in the CSV column order of the journal tool's _can.csv,
+//       streamed with chunked transfer encoding. from/to default to the
+//       whole log; id defaults to every ID.
+//   GET /stats
+//       Query count and the last query's size, duration and throughput.
+//
+// Both need QUERY_TOKEN, as a token= parameter or an "Authorization:
+// Bearer" header; without it the answer is 401.
+//
+// The journal's time index and per-ID tables pick the blocks to read, so
+// a query touches only the segments and block ranges that can match. One
+// client at a time (others wait in the accept backlog), served from loop()
+// a few blocks per pass with one block and one chunk of RAM. A pass writes
+// only what the socket takes without waiting and keeps the rest for the
+// next, so a slow client never stalls CAN logging.
+class LogServer {
+public:
+    struct Stats {
+        uint32_t queries;
+        uint32_t rejected;          // Malformed, unknown path or timed out
+        uint32_t unauthorized;      // Missing or wrong QUERY_TOKEN
+        uint32_t last_bytes;        // Body bytes of the last completed query
+        uint32_t last_ms;
+        uint32_t last_kbps;         // last_bytes over last_ms, kB/s
+        uint32_t last_records;      // Frames sent
+        uint32_t last_blocks;       // Journal blocks read
+        uint32_t last_segments_skipped;  // Segments the ID tables ruled out
+        uint64_t total_bytes;
+    };
+
+    LogServer(SDLogger& sd_logger);
+    ~LogServer();
+
+    bool init();
+    void update();
+    const Stats& getStats() const { return _stats; }
+
+private:
+    enum State { STATE_IDLE, STATE_REQUEST, STATE_STREAMING, STATE_CLOSING };
+
+    static const size_t REQUEST_MAX = 512;
+    static const size_t HEADER_MAX = 128;   // Longer header lines are cut; only Authorization is read
+    static const size_t CHUNK_MAX = 3072;   // Every line from one block, worst case
+    static const size_t CHUNK_HEAD = 8;     // Room for the chunk-size line ahead of the lines
+
+    SDLogger& _sd_logger;
+    WiFiServer _server;
+    WiFiClient _client;
+    State _state;
+    uint32_t _started;
+
+    char _request[REQUEST_MAX];     // Request line
+    size_t _request_length;
+    bool _line_done;
+    char _header[HEADER_MAX];       // Header line being read
+    size_t _header_length;
+    bool _authorized;               // A header carried QUERY_TOKEN
+    uint32_t _tail;                 // Last four bytes read, to spot the blank line
+
+    // Query in progress
+    uint64_t _from;
+    uint64_t _to;
+    uint32_t _ids[QUERY_MAX_IDS];
+    uint8_t _id_count;
+    uint32_t _segment;
+    uint16_t _block;
+    uint16_t _end_block;
+    uint32_t _bytes;
+    uint32_t _records;
+    uint32_t _blocks;
+    uint32_t _skipped;
+    Stats _stats;
+
+    uint8_t _block_buffer[JOURNAL_BLOCK_SIZE];
+    // Lines are formatted at CHUNK_HEAD and framed in place; bytes from
+    // _out_start to _out_end are still to be written
+    char _chunk[CHUNK_HEAD + CHUNK_MAX + 2];
+    size_t _out_start;
+    size_t _out_end;
+    uint32_t _last_write;
+
+    void readRequest();
+    void handleRequest();
+    void checkHeader();
+    bool parseQuery(const char* query);
+    void beginQuery();
+    bool enterSegment(uint32_t segment, uint16_t from_block);
+    void streamBlocks();
+    size_t formatBlock(const uint8_t* block);
+    bool wantsId(uint32_t id) const;
+    void queueChunk(size_t length);
+    bool flush();
+    void sendResponse(uint16_t code, const char* reason, const char* type, const char* body,
+                      const char* headers = "");
+    void finishQuery();
+    void closeClient();
+};
+
+#endif // LOG_SERVER_H
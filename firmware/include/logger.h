@@ -2,27 +2,122 @@
 #define LOGGER_H
 
 #include <Arduino.h>
+#include <atomic>
+#include <type_traits>
 #include "config.h"
 
+// Deferred logger. The calling thread only copies the format pointer and
+// raw argument words into a lock-free ring; a low-priority task does the
+// printf-style formatting and the UART write. Format strings must be
+// literals (they are kept by pointer); %s arguments are copied.
+// Supported conversions: d i u x X o c s p f e g E G with flags, width,
+// precision and h/l/ll/z length modifiers. '*' widths are not supported.
+// Safe from any task on either core, but not from ISRs.
 class Logger {
 public:
     enum Level { ERROR = 0, WARN = 1, INFO = 2, DEBUG = 3 };
 
+    struct Stats {
+        uint32_t written;     // Messages queued
+        uint32_t dropped;     // Messages lost to a full ring
+        uint32_t high_water;  // Peak ring occupancy
+    };
+
     static void init();
-    static void log(Level level, const char* tag, const char* format, ...);
-    static void logError(const char* tag, const char* format, ...);
-    static void logWarn(const char* tag, const char* format, ...);
-    static void logInfo(const char* tag, const char* format, ...);
-    static void logDebug(const char* tag, const char* format, ...);
+
+    template <typename... Args>
+    static void log(Level level, const char* tag, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+        uint32_t pos;
+        Entry* entry = reserve(pos);
+        if (!entry) return;
+
+        entry->timestamp = millis();
+        entry->level = level;
+        entry->tag = tag;
+        entry->format = format;
+        entry->arg_count = 0;
+        entry->string_bytes = 0;
+        int expand[] = {0, (packArg(*entry, args), 0)...};
+        (void)expand;
+
+        commit(entry, pos);
+    }
+
+    static Stats getStats();
 
 private:
-    static void vlog(Level level, const char* tag, const char* format, va_list args);
-    static const char* levelToString(Level level);
+    // Flag marking an argument word as an offset into Entry::strings
+    static const uint64_t STRING_ARG = 1ULL << 63;
+
+    struct Entry {
+        std::atomic<uint32_t> sequence;
+        uint32_t timestamp;
+        const char* tag;
+        const char* format;
+        uint8_t level;
+        uint8_t arg_count;
+        uint8_t string_bytes;
+        uint64_t args[LOG_MAX_ARGS];
+        char strings[LOG_STRING_BYTES];
+    };
+
+    static Entry _ring[LOG_QUEUE_DEPTH];
+    static std::atomic<uint32_t> _enqueue_pos;
+    static uint32_t _dequeue_pos;
+    static std::atomic<uint32_t> _written;
+    static std::atomic<uint32_t> _dropped;
+    static uint32_t _high_water;
+    static TaskHandle_t _drain_task;
+
+    static Entry* reserve(uint32_t& pos);
+    static void commit(Entry* entry, uint32_t pos);
+    static void drainTask(void* arg);
+    static bool drainOne(char* line, size_t size);
+    static size_t format(const Entry& entry, char* out, size_t size);
+    static const char* levelToString(uint8_t level);
+
+    static void packArg(Entry& entry, const char* value);
+    static void packArg(Entry& entry, char* value) { packArg(entry, (const char*)value); }
+    static void packArg(Entry& entry, const void* value) { pushArg(entry, (uint64_t)(uintptr_t)value); }
+    static void packArg(Entry& entry, double value);
+    static void packArg(Entry& entry, float value) { packArg(entry, (double)value); }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    packArg(Entry& entry, T value) {
+        // Sign-extended; the conversion spec picks the width when formatting
+        pushArg(entry, (uint64_t)(int64_t)value);
+    }
+
+    static void pushArg(Entry& entry, uint64_t word) {
+        if (entry.arg_count < LOG_MAX_ARGS) entry.args[entry.arg_count++] = word;
+    }
 };
 
-#define LOG_E(tag, fmt, ...) Logger::logError(tag, fmt, ##__VA_ARGS__)
-#define LOG_W(tag, fmt, ...) Logger::logWarn(tag, fmt, ##__VA_ARGS__)
-#define LOG_I(tag, fmt, ...) Logger::logInfo(tag, fmt, ##__VA_ARGS__)
-#define LOG_D(tag, fmt, ...) Logger::logDebug(tag, fmt, ##__VA_ARGS__)
+// Levels above LOG_LEVEL compile to nothing, arguments included
+#if LOG_ENABLE && LOG_LEVEL >= 0
+#define LOG_E(tag, fmt, ...) Logger::log(Logger::ERROR, tag, fmt, ##__VA_ARGS__)
+#else
+#define LOG_E(tag, fmt, ...) do {} while (0)
+#endif
+
+#if LOG_ENABLE && LOG_LEVEL >= 1
+#define LOG_W(tag, fmt, ...) Logger::log(Logger::WARN, tag, fmt, ##__VA_ARGS__)
+#else
+#define LOG_W(tag, fmt, ...) do {} while (0)
+#endif
+
+#if LOG_ENABLE && LOG_LEVEL >= 2
+#define LOG_I(tag, fmt, ...) Logger::log(Logger::INFO, tag, fmt, ##__VA_ARGS__)
+#else
+#define LOG_I(tag, fmt, ...) do {} while (0)
+#endif
+
+#if LOG_ENABLE && LOG_LEVEL >= 3
+#define LOG_D(tag, fmt, ...) Logger::log(Logger::DEBUG, tag, fmt, ##__VA_ARGS__)
+#else
+#define LOG_D(tag, fmt, ...) do {} while (0)
+#endif
 
 #endif // LOGGER_H
@@ -0,0 +1,28 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstdint>
+#include <cstddef>
+
+// LZ4 block-format compressor for uplink payloads: greedy matching through
+// a 2 KiB hash table held in the object, no allocation, no window beyond
+// the input itself. Output decodes with any LZ4 block decoder
+// (LZ4_decompress_safe, lz4.block in Python) given the raw length.
+// Host-buildable; shared with the tools/ utilities.
+class LzCodec {
+public:
+    static const size_t MAX_BLOCK = 65535;     // Match offsets are 16-bit
+
+    // Bytes written to out, or 0 if the input is too long or the result
+    // would not fit in capacity (send it uncompressed)
+    size_t compress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity);
+    // Bytes written to out, or 0 if the block is malformed or longer than capacity
+    static size_t decompress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity);
+
+private:
+    static const uint8_t HASH_BITS = 10;
+
+    uint16_t _table[1 << HASH_BITS];           // Last input position per 4-byte hash
+};
+
+#endif // LZ_CODEC_H
@@ -3,6 +3,8 @@
 
 #include <Arduino.h>
 #include <SPI.h>
+#include <atomic>
+#include "config.h"
 #include "types.h"
 
 class MCP2515Driver {
@@ -15,41 +17,158 @@ public:
         ERROR_NOMSG = 4
     };
 
-    MCP2515Driver(uint8_t cs_pin, uint32_t bitrate = 500000);
+    struct Stats {
+        uint32_t frames;          // Moved from the controller into the ring
+        uint32_t overflows;       // MCP2515 RX buffer overrun events
+        uint32_t ring_dropped;    // Frames lost to a full ring
+        uint16_t ring_high_water;
+        uint32_t tx_queued;
+        uint32_t tx_sent;
+        uint32_t tx_aborted;      // Timed out after CAN_TX_TIMEOUT_MS
+        uint32_t tx_errors;       // TXERR reported by the controller
+        uint32_t tx_arbitration_lost;  // Frames that lost arbitration at least once
+        uint32_t tx_queue_full;
+        uint32_t bitrate_lock_ms;   // Autobaud start to first valid frame, 0 if not locked
+        uint8_t bitrate_probes;     // Candidates tried before locking
+    };
+
+    enum TxStatus { TX_SENT = 0, TX_ABORTED = 1, TX_ERROR = 2 };
+
+    struct TxResult {
+        uint32_t id;
+        uint32_t tag;             // Caller's value from writeFrame()
+        uint32_t latency_us;      // writeFrame() to completion
+        uint8_t status;           // TxStatus
+        uint8_t channel;
+    };
+
+    // Runs in the RX task; keep it short and do not call back into the driver
+    typedef void (*TxCallback)(const TxResult& result, void* context);
+
+    MCP2515Driver(uint8_t cs_pin, uint8_t int_pin, uint32_t bitrate = 500000, uint8_t channel = 0);
     ~MCP2515Driver();
 
-    // Initialization
-    ErrorCode init();
+    // Initialization. Ends in listen-only or normal mode as asked once the
+    // rate is locked (or configured, without CAN_AUTOBAUD); returns
+    // ERROR_NOMSG, listen-only on the fallback rate, when nothing locked
+    ErrorCode init(bool listen_only);
     ErrorCode setBitrate(uint32_t bitrate);
+    // Listen-only sweep over the cached rate and common candidates; locks on
+    // the first rate that receives a valid frame and caches it in NVS.
+    // Falls back to the cached/configured rate and returns ERROR_NOMSG if
+    // the bus stays silent. Must be called in configuration mode.
+    ErrorCode detectBitrate(uint32_t timeout_ms);
+    uint32_t getBitrate() const { return _bitrate; }
+    // CNF1-3 for any rate the crystal can reach within 0.5%: the sample
+    // point nearest 87.5% (75% above 800 kbit/s), then the most time quanta
+    static bool computeTiming(uint32_t bitrate, uint32_t crystal_hz, uint8_t cnf[3]);
+    // Fails to leave listen-only while the rate is not locked
     ErrorCode setListenOnly(bool enable);
 
-    // Frame operations
+    // Power management: sleep() arms wake-on-bus-activity, wake() restores
+    // the previous operating mode and RX interrupts
+    ErrorCode sleep();
+    ErrorCode wake();
+
+    // Frame operations. service() runs in the RX task and moves up to
+    // max_frames from the controller into the ring; readFrame() pops the
+    // ring from the consumer side. One producer and one consumer only.
+    uint8_t service(uint8_t max_frames);
     ErrorCode readFrame(CanFrame& frame);
-    ErrorCode writeFrame(const CanFrame& frame);
+
+    // Non-blocking: queues the frame and wakes the RX task, which loads it
+    // into a free TX buffer. Higher priority (0-3) is sent first, both in
+    // the queue and among loaded buffers (TXP). Fails in listen-only mode
+    // and with ERROR_ALLTXBUSY when the queue is full.
+    ErrorCode writeFrame(const CanFrame& frame, uint8_t priority = 1, uint32_t tag = 0);
+    // RX task: reaps completed buffers and refills them from the queue
+    void serviceTx();
+    void setTxCallback(TxCallback callback, void* context) { _tx_callback = callback; _tx_context = context; }
+    bool isListenOnly() const { return _listen_only; }
 
     // Status
     uint8_t getStatus();
+    uint8_t checkOverflow();
+    uint8_t getChannel() const { return _channel; }
+    uint8_t getIntPin() const { return _int_pin; }
+    const Stats& getStats() const { return _stats; }
+    uint32_t getLastRxTime() const { return _last_rx_time; }
+
+    // INT falling edges notify rx_task; enableInterrupt() reuses the last task
+    void setRxTask(TaskHandle_t rx_task) { _rx_task = rx_task; }
     void enableInterrupt();
     void disableInterrupt();
 
 private:
+    static_assert((CAN_RX_RING_SIZE & (CAN_RX_RING_SIZE - 1)) == 0, "CAN_RX_RING_SIZE must be a power of two");
+
     uint8_t _cs_pin;
+    uint8_t _int_pin;
+    uint8_t _channel;
     uint32_t _bitrate;
     SPISettings _spi_settings;
+    Stats _stats;
+    uint32_t _last_rx_time;
+    bool _listen_only;
+    bool _rate_locked;        // The rate received a valid frame or was configured
+    TaskHandle_t _rx_task;
+
+    struct TxEntry {
+        CanFrame frame;
+        uint32_t tag;
+        uint32_t queued_us;
+        uint8_t priority;
+    };
+
+    struct TxSlot {
+        TxEntry entry;
+        uint32_t loaded_ms;
+        bool busy;
+        bool arbitration_lost;
+    };
+
+    static const uint8_t TX_BUFFERS = 3;
+
+    TxEntry _tx_queue[CAN_TX_QUEUE_SIZE];   // Sorted by priority, FIFO within one
+    uint8_t _tx_count;
+    TxSlot _tx_slots[TX_BUFFERS];
+    portMUX_TYPE _tx_mux;
+    TxCallback _tx_callback;
+    void* _tx_context;
+
+    CanFrame _ring[CAN_RX_RING_SIZE];
+    std::atomic<uint16_t> _ring_head;   // Written by service()
+    std::atomic<uint16_t> _ring_tail;   // Written by readFrame()
+
+    static void IRAM_ATTR onInterrupt(void* arg);
+
+    // SPI transaction plus chip select; the transaction lock is what keeps
+    // the controllers and the SD card from interleaving on the shared bus
+    void select() { SPI.beginTransaction(_spi_settings); digitalWrite(_cs_pin, LOW); }
+    void deselect() { digitalWrite(_cs_pin, HIGH); SPI.endTransaction(); }
 
     // Register operations
     uint8_t readRegister(uint8_t address);
     void writeRegister(uint8_t address, uint8_t value);
     void modifyRegister(uint8_t address, uint8_t mask, uint8_t data);
 
+    ErrorCode setMode(uint8_t mode);
+
     // Bitrate setup
+    // PROBE_FAILED: the controller did not change mode, so no rate will do
+    enum ProbeResult { PROBE_LOCKED, PROBE_ERRORS, PROBE_SILENT, PROBE_UNSUPPORTED, PROBE_FAILED };
+
     ErrorCode setBitrateCfg(uint32_t bitrate);
+    ProbeResult probeBitrate(uint32_t bitrate);
+    uint32_t loadCachedBitrate();
+    void storeCachedBitrate(uint32_t bitrate);
 
     // SPI commands
     uint8_t sendCommand(uint8_t cmd);
     uint8_t readStatus();
-    void readFrame(uint8_t buffer_addr, CanFrame& frame);
-    void writeFrame(uint8_t buffer_addr, const CanFrame& frame);
+    void readRxBuffer(uint8_t command, CanFrame& frame);
+    void writeFrame(uint8_t buffer, const CanFrame& frame);
+    void completeTx(uint8_t buffer, TxStatus status);
 };
 
 #endif // MCP2515_DRIVER_H
@@ -3,36 +3,89 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
 #include "types.h"
+#include "mqtt_transport.h"
+#include "lz_codec.h"
+#include "clock_sync.h"
+#include "perf_counters.h"
+#include "quantile_sketch.h"
+#include "can_receiver.h"
+#include "spi_arbiter.h"
+#include "obd_poller.h"
+#include "segment_uploader.h"
+#include "anomaly_rules.h"
 
 class MQTTClient {
 public:
+    // Since the last takePayloadStats()
+    struct PayloadStats {
+        uint32_t messages;
+        uint32_t compressed;        // Batches sent LZ4-coded; the rest did not shrink or were too small
+        uint32_t batches;           // vehicle/data/batch messages
+        uint32_t batch_frames;
+        uint32_t raw_bytes;         // Payload bytes before compression
+        uint32_t sent_bytes;        // Queued for the broker, headers included
+        uint32_t compress_us;       // CPU time in the compressor
+        uint32_t compress_input;    // Bytes it was given
+    };
+
     MQTTClient();
     ~MQTTClient();
 
     bool init(const char* ssid, const char* password, const char* broker, uint16_t port);
     void disconnect();
     bool isConnected();
+    // Outbound queue past its high-water mark; skip optional publishes
+    bool isCongested() { return _transport.isCongested(); }
+    MqttTransport::Stats takeTransportStats() { return _transport.takeStats(); }
+    PayloadStats takePayloadStats();
 
-    bool publishCANData(const CanFrame& frame);
-    bool publishVehicleState(const VehicleState& state);
+    // Batched unless MQTT_BATCH_FRAMES is 0; update() sends partial batches.
+    // True once the frame is batched; takeBatchLost() reports a batch that
+    // then failed to go out.
+    bool publishCANData(const CanFrame& frame, uint16_t suppressed = 0);
+    bool takeBatchLost();
+    bool publishVehicleState(const VehicleState& state, const SignalWindow& window);
     bool publishAnomaly(const Anomaly& anomaly);
     bool publishGPSData(const GpsData& gps);
+    bool publishClockStats(const ClockSync::Stats& stats);
+    bool publishDistribution(SignalId signal, const QuantileSketch& sketch, uint32_t start, uint32_t end);
+    bool publishHealth(const PerfCounters::Snapshot& snapshot, const SpiArbiter::Stats& spi);
+    bool publishCanStats(const CanReceiver::ChannelReport* reports, uint8_t count);
+    bool publishBoot(const BootTimes& boot);
+    bool publishObdStats(const ObdPoller::PidReport* reports, uint8_t count, const ObdPoller::Stats& stats);
+    bool publishUploadStats(const SegmentUploader::Stats& stats, uint32_t pending);
+    bool publishRuleStats(const RuleReport* reports, uint8_t count, uint32_t frames);
+    bool publishMqttStats(const MqttTransport::Stats& stats, const PayloadStats& payload);
 
     void update();
 
 private:
-    WiFiClient _wifi_client;
-    PubSubClient _mqtt_client;
+    MqttTransport _transport;
+
+    bool _wifi_up;
+    bool _wifi_warned;
+    uint32_t _wifi_start;
 
-    bool _connected;
-    uint32_t _last_reconnect;
+    LzCodec _codec;
+    PayloadStats _payload_stats;
+    // MQTT_MAX_PACKET_SIZE from init(): header and compressed (or copied)
+    // body, or the text of a large JSON message, which goes out bare
+    uint8_t* _packed;
+#if MQTT_BATCH_FRAMES
+    static const size_t BATCH_MAX = sizeof(FrameBatchHeader) +
+                                    MQTT_BATCH_FRAMES * (sizeof(JournalCanRecord) + 8);
+    static_assert(BATCH_MAX + sizeof(PayloadHeader) <= MQTT_MAX_PACKET_SIZE, "MQTT_BATCH_FRAMES too large for a packet");
+    uint8_t _batch[BATCH_MAX];
+    size_t _batch_length;
+    uint32_t _batch_started;
+    bool _batch_lost;
 
-    const uint32_t RECONNECT_INTERVAL = 5000;  // 5 seconds
+    bool flushBatch();
+#endif
 
-    void onMessageReceived(char* topic, byte* payload, unsigned int length);
-    void reconnect();
+    bool publish(const char* topic, const char* payload, uint8_t qos = 1);
+    bool publishPayload(const char* topic, const uint8_t* body, size_t length, PayloadContent content, uint8_t qos);
 };
 
 #endif // MQTT_CLIENT_H
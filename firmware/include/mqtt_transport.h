@@ -0,0 +1,137 @@
+#ifndef MQTT_TRANSPORT_H
+#define MQTT_TRANSPORT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <atomic>
+#include "config.h"
+
+// MQTT 3.1.1 client on its own task, so publishing never waits on the
+// network. publish() copies the topic and payload into an outbound ring
+// and returns; the task connects, writes PUBLISH packets straight from the
+// ring and keeps up to MQTT_INFLIGHT_WINDOW QoS 1 messages awaiting PUBACK.
+// Ring space is released in order as messages are acknowledged (QoS 0 as
+// soon as they are written), and anything unacknowledged is resent with
+// DUP set after a reconnect.
+//
+// Producers see backpressure through isCongested() once the ring passes
+// MQTT_QUEUE_HIGH_WATER percent, until it drains below MQTT_QUEUE_LOW_WATER;
+// publish() fails outright only when the message does not fit.
+//
+// publish() and isCongested() are for a single producer task (loop());
+// the rest is safe from any task.
+class MqttTransport {
+public:
+    struct Stats {
+        uint32_t queued;
+        uint32_t sent;              // PUBLISH packets written, resends included
+        uint32_t acked;             // PUBACKs received
+        uint32_t dropped;           // Did not fit in the ring
+        uint32_t resent;            // Unacknowledged at a reconnect and sent again
+        uint32_t reconnects;
+        uint32_t congested;         // Times the ring crossed the high-water mark
+        uint32_t queue_peak;        // Ring bytes
+        uint16_t inflight_peak;
+        // Since the last takeStats()
+        uint32_t publish_avg_us;    // publish() to written on the socket
+        uint32_t publish_max_us;
+        uint32_t ack_avg_us;        // Written to PUBACK
+        uint32_t ack_max_us;
+    };
+
+    MqttTransport();
+
+    // Allocates the ring and starts the task; it connects whenever WiFi is
+    // up. Strings must outlive the transport.
+    bool begin(const char* host, uint16_t port, const char* client_id,
+               const char* user, const char* password, const char* subscribe_topic);
+    // Sends DISCONNECT and stays offline until begin() is called again
+    void disconnect();
+
+    bool publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos);
+    bool isConnected() const { return _connected.load(std::memory_order_relaxed); }
+    bool isCongested();
+    size_t queuedBytes() const;
+
+    // Counters are cumulative; latencies cover the interval since the last call
+    Stats takeStats();
+
+private:
+    enum RecordFlags : uint8_t {
+        REC_SKIP = 0x01,            // Padding to the end of the ring
+        REC_SENT = 0x02,
+        REC_DONE = 0x04             // Acknowledged, or written if QoS 0
+    };
+
+    struct Record {
+        uint32_t length;            // Header, topic and payload, padded to 4 bytes
+        uint32_t payload_length;
+        uint32_t queued_us;
+        uint32_t sent_us;
+        uint16_t topic_length;
+        uint16_t packet_id;
+        uint8_t qos;
+        uint8_t flags;
+        uint8_t reserved[2];
+    };
+
+    struct Inflight {
+        uint16_t packet_id;
+        uint32_t position;
+    };
+
+    static const uint32_t RX_MAX = 128;     // Larger incoming packets are skipped
+
+    WiFiClient _client;
+    const char* _host;
+    uint16_t _port;
+    const char* _client_id;
+    const char* _user;
+    const char* _password;
+    const char* _subscribe_topic;
+    TaskHandle_t _task;
+    std::atomic<bool> _connected;
+    std::atomic<bool> _enabled;
+
+    // Outbound ring of MQTT_QUEUE_BYTES, allocated by the first begin();
+    // positions count bytes and wrap at 2^32
+    uint8_t* _ring;
+    std::atomic<uint32_t> _head;    // Producer: end of the newest record
+    std::atomic<uint32_t> _tail;    // Task: oldest record not yet released
+    uint32_t _send;                 // Task: next record to write
+    bool _congested;
+
+    // Task state
+    Inflight _inflight[MQTT_INFLIGHT_WINDOW];
+    uint8_t _inflight_count;
+    uint16_t _next_packet_id;
+    uint32_t _last_attempt;
+    uint32_t _last_tx;
+    uint32_t _last_rx;
+    bool _ping_pending;
+    uint8_t _rx[RX_MAX];
+
+    portMUX_TYPE _lock;             // Guards _stats and the latency sums
+    Stats _stats;
+    uint64_t _publish_sum_us;
+    uint32_t _publish_count;
+    uint64_t _ack_sum_us;
+    uint32_t _ack_count;
+
+    static void taskEntry(void* arg);
+    void run();
+    bool connect();
+    void dropConnection(const char* reason);
+    bool sendNext();
+    bool writePublish(Record* record);
+    void release();
+    bool readPacket();
+    void onPuback(uint16_t packet_id);
+    bool readExact(uint8_t* buffer, size_t length, uint32_t timeout_ms);
+    bool writeAll(const uint8_t* data, size_t length);
+    Record* recordAt(uint32_t& position);
+    static size_t encodeLength(uint8_t* out, uint32_t length);
+    static size_t putString(uint8_t* out, const char* str);
+};
+
+#endif // MQTT_TRANSPORT_H
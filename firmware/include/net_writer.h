@@ -0,0 +1,35 @@
+#ifndef NET_WRITER_H
+#define NET_WRITER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Socket writes from loop() that never wait on the peer. lwIP reports a
+// socket writable only while more than half its send buffer is free, so
+// a slice of one TCP segment written after a writable poll is taken
+// whole. Callers keep whatever was not taken and offer it again on a
+// later pass.
+class NetWriter {
+public:
+    static const size_t SLICE = 1436;   // One TCP segment (CONFIG_LWIP_TCP_MSS)
+
+    // Bytes taken now, 0 while the send buffer is full, -1 if the
+    // connection is gone
+    template <typename Client>
+    static int write(Client& client, const uint8_t* data, size_t length) {
+        if (!client.connected()) return -1;
+        size_t total = 0;
+        while (total < length && writable(client.fd())) {
+            size_t slice = length - total < SLICE ? length - total : SLICE;
+            size_t written = client.write(data + total, slice);
+            if (!written) return -1;    // The client stops itself on a socket error
+            total += written;
+        }
+        return (int)total;
+    }
+
+private:
+    static bool writable(int fd);
+};
+
+#endif // NET_WRITER_H
@@ -0,0 +1,58 @@
+#ifndef NMEA_PARSER_H
+#define NMEA_PARSER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Incremental NMEA 0183 tokenizer. Bytes are fed one at a time; fields are
+// NUL-terminated in place inside the sentence buffer, so no per-field copies
+// are made. A sentence is only reported once its *hh checksum has matched.
+class NmeaParser {
+public:
+    enum SentenceType {
+        SENTENCE_NONE = 0,     // No complete sentence yet
+        SENTENCE_GGA = 1,
+        SENTENCE_RMC = 2,
+        SENTENCE_VTG = 3,
+        SENTENCE_GSA = 4,
+        SENTENCE_UNKNOWN = 5   // Valid checksum, unsupported formatter
+    };
+
+    struct Stats {
+        uint32_t sentences;        // Checksum-valid sentences
+        uint32_t checksum_errors;
+        uint32_t framing_errors;   // Overlong sentences, bad hex, missing '*'
+    };
+
+    NmeaParser();
+
+    void reset();
+    SentenceType feed(char ch);
+
+    // Valid until the next call to feed() that starts a new sentence.
+    uint8_t fieldCount() const { return _field_count; }
+    const char* field(uint8_t index) const;
+    const char* talker() const { return _talker; }
+    const Stats& getStats() const { return _stats; }
+
+    static const size_t MAX_SENTENCE_LENGTH = 96;  // NMEA caps at 82 incl. "$" and CRLF
+    static const uint8_t MAX_FIELDS = 24;
+
+private:
+    enum State { STATE_IDLE, STATE_BODY, STATE_CHECKSUM_HI, STATE_CHECKSUM_LO };
+
+    State _state;
+    char _buffer[MAX_SENTENCE_LENGTH];
+    uint8_t _length;
+    uint8_t _field_start[MAX_FIELDS];
+    uint8_t _field_count;
+    uint8_t _checksum;
+    uint8_t _expected_checksum;
+    char _talker[3];
+    Stats _stats;
+
+    SentenceType classify();
+    static int8_t hexValue(char ch);
+};
+
+#endif // NMEA_PARSER_H
@@ -0,0 +1,130 @@
+#ifndef OBD_POLLER_H
+#define OBD_POLLER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#include "mcp2515_driver.h"
+#include "vehicle_state_manager.h"
+
+// Active OBD-II Mode 01 polling for vehicles that do not broadcast the
+// signals VehicleStateManager decodes. A functional PID 0x00 request finds
+// the responding ECUs and their supported PIDs; each PID is then polled
+// from the first ECU that supports it, at its own interval.
+//
+// Throughput comes from pipelining rather than from one PID per round
+// trip: every ECU has its own request in flight, each request carries all
+// of that ECU's due PIDs (up to OBD_PIDS_PER_REQUEST), and the next request
+// goes out on the loop pass after the response. Multi-PID responses arrive
+// as ISO-TP multi-frame messages; the poller answers First Frames with a
+// Flow Control (no block limit, no separation time) and reassembles the
+// Consecutive Frames per ECU.
+class ObdPoller {
+public:
+    struct Stats {
+        uint32_t requests;
+        uint32_t responses;
+        uint32_t timeouts;
+        uint32_t negative;          // 0x7F replies
+        uint32_t isotp_errors;      // Sequence gaps, oversize or stray frames
+        uint32_t flow_controls;
+    };
+
+    struct PidReport {
+        uint8_t pid;
+        uint8_t ecu;                // 0-7 for 0x7E8-0x7EF, 0xFF if unsupported
+        uint16_t interval_ms;       // Requested refresh interval
+        float rate_hz;              // Achieved over the window since the previous report
+        uint16_t latency_avg_ms;    // Request on the wire to complete response
+        uint16_t latency_max_ms;
+        uint32_t responses;
+        uint32_t timeouts;
+    };
+
+    static const uint8_t MAX_REPORTS = 4;
+
+    ObdPoller(MCP2515Driver& driver, VehicleStateManager& vehicle_state);
+    ~ObdPoller();
+
+    bool init();
+    void update(uint32_t now);
+    // true if the frame completed a response that updated the vehicle state
+    bool onFrame(const CanFrame& frame);
+
+    const Stats& getStats() const { return _stats; }
+    // Fills one report per polled PID; returns the number filled
+    uint8_t takeReport(PidReport* reports, uint32_t now);
+
+private:
+    enum State { STATE_OFF, STATE_DISCOVERING, STATE_POLLING };
+    enum TxState { TX_PENDING, TX_DONE, TX_FAILED };
+
+    static const uint32_t FUNCTIONAL_ID = 0x7DF;
+    static const uint32_t REQUEST_BASE = 0x7E0;
+    static const uint32_t RESPONSE_BASE = 0x7E8;
+    static const uint32_t TAG_FLOW_CONTROL = 0x80000000;
+    static const uint32_t TAG_DISCOVERY = 0x40000000;
+    static const uint8_t NO_ECU = 0xFF;
+
+    struct PidConfig {
+        uint8_t pid;
+        uint8_t length;             // Data bytes in the response
+        uint16_t interval_ms;
+    };
+    static const uint8_t PID_COUNT = MAX_REPORTS;
+    static const PidConfig PIDS[PID_COUNT];
+
+    struct Pid {
+        uint8_t ecu;
+        uint32_t next_due;
+        uint32_t responses;
+        uint32_t report_responses;  // responses at the previous report
+        uint32_t timeouts;
+        uint32_t latency_sum;       // Since the previous report
+        uint32_t latency_count;
+        uint16_t latency_max;
+    };
+
+    struct IsoTp {
+        uint8_t data[OBD_ISOTP_MAX];
+        uint16_t expected;
+        uint16_t received;
+        uint8_t next_sn;
+        bool active;
+    };
+
+    struct Ecu {
+        bool present;
+        uint32_t supported;         // PIDs 0x01-0x20, bit 31 = PID 0x01
+        bool in_flight;
+        uint8_t seq;
+        uint8_t pids[OBD_PIDS_PER_REQUEST];  // Indexes into PIDS
+        uint8_t pid_count;
+        uint32_t request_ms;
+        volatile uint8_t tx_state;  // Written by the TX callback on the RX task
+        volatile uint32_t tx_ms;
+        uint8_t timeouts;           // Consecutive
+        IsoTp rx;
+    };
+
+    MCP2515Driver& _driver;
+    VehicleStateManager& _vehicle_state;
+    State _state;
+    Pid _pids[PID_COUNT];
+    Ecu _ecus[OBD_MAX_ECUS];
+    uint32_t _discovery_ms;
+    uint32_t _report_time;
+    Stats _stats;
+
+    void startDiscovery(uint32_t now);
+    void finishDiscovery(uint32_t now);
+    void sendRequest(uint8_t ecu_index, uint32_t now);
+    void sendFlowControl(uint8_t ecu_index);
+    void expire(uint8_t ecu_index, uint32_t now);
+    bool handleResponse(uint8_t ecu_index, const uint8_t* data, uint16_t length, uint32_t timestamp);
+    int8_t findPid(uint8_t pid) const;
+
+    static void onTx(const MCP2515Driver::TxResult& result, void* context);
+};
+
+#endif // OBD_POLLER_H
@@ -0,0 +1,101 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+// Always-on hot-path instrumentation: event counters plus per-stage
+// latency histograms fed from the CPU cycle counter. Recording is a few
+// integer ops. The CAN RX task records beside the loop task, so counters
+// are atomic and stage data is updated under a spinlock.
+class PerfCounters {
+public:
+    enum Counter {
+        FRAMES_RECEIVED = 0,
+        FRAMES_DECODED,
+        FRAMES_LOGGED,
+        FRAMES_PUBLISHED,
+        FRAMES_DROPPED,      // MCP2515 RX overflow events
+        FRAMES_SUPPRESSED,   // Unchanged frames elided from the SD log
+        SD_WRITE_ERRORS,
+        MQTT_PUBLISH_ERRORS,
+        COUNTER_COUNT
+    };
+
+    enum Stage {
+        STAGE_LOOP = 0,
+        STAGE_CAN_READ,
+        STAGE_DECODE,
+        STAGE_ANOMALY,
+        STAGE_SD_WRITE,
+        STAGE_MQTT_PUBLISH,
+        STAGE_COUNT
+    };
+
+    static const uint8_t HISTOGRAM_BUCKETS = 16;  // log2(us): 0, 1, 2-3, ... >= 16 ms
+
+    struct StageSummary {
+        uint32_t count;
+        uint32_t avg_us;
+        uint32_t p50_us;     // Bucket upper bounds, so within 2x
+        uint32_t p99_us;
+        uint32_t max_us;
+    };
+
+    struct Snapshot {
+        uint32_t uptime_ms;
+        uint32_t window_ms;
+        uint32_t counters[COUNTER_COUNT];
+        StageSummary stages[STAGE_COUNT];
+    };
+
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Stage stage) : _stage(stage), _start(ESP.getCycleCount()) {}
+        ~ScopedTimer() { PerfCounters::record(_stage, ESP.getCycleCount() - _start); }
+    private:
+        Stage _stage;
+        uint32_t _start;
+    };
+
+    static void increment(Counter counter, uint32_t amount = 1) {
+        _counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+    static void record(Stage stage, uint32_t cycles);
+
+    // Counters are cumulative; stage histograms cover the window since the
+    // previous snapshot and are cleared by it
+    static Snapshot takeSnapshot();
+    static void logSnapshot(const Snapshot& snapshot);
+
+    static const char* counterName(Counter counter);
+    static const char* stageName(Stage stage);
+
+private:
+    struct StageData {
+        uint32_t count;
+        uint64_t total_us;
+        uint32_t max_us;
+        uint32_t buckets[HISTOGRAM_BUCKETS];
+    };
+
+    static std::atomic<uint32_t> _counters[COUNTER_COUNT];
+    static StageData _stages[STAGE_COUNT];
+    static portMUX_TYPE _lock;          // Guards _stages
+    static uint32_t _window_start;
+
+    static uint32_t percentile(const StageData& data, uint8_t pct);
+};
+
+#if PERF_ENABLED
+#define PERF_CONCAT_INNER(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_INNER(a, b)
+#define PERF_SCOPE(stage) PerfCounters::ScopedTimer PERF_CONCAT(_perf_scope_, __LINE__)(PerfCounters::stage)
+#define PERF_COUNT(counter) PerfCounters::increment(PerfCounters::counter)
+#else
+#define PERF_SCOPE(stage) do {} while (0)
+#define PERF_COUNT(counter) do {} while (0)
+#endif
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,45 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "types.h"
+#include "can_receiver.h"
+#include "sd_logger.h"
+
+// Puts the MCP2515s and the ESP32 to sleep once every bus has been silent
+// for BUS_IDLE_TIMEOUT, and wakes them on the next activity on any channel's
+// INT pin. Deep sleep can only wake on one pin (ext0), channel 0's.
+class PowerManager {
+public:
+    struct Stats {
+        uint32_t sleeps;
+        uint32_t last_sleep_ms;             // Time spent in the last sleep
+        uint32_t last_wake_latency_us;      // Wake-up to first received frame
+        uint32_t max_wake_latency_us;
+        uint8_t last_wake_cause;            // esp_sleep_wakeup_cause_t
+    };
+
+    PowerManager(CanReceiver& can_receiver, SDLogger& sd_logger);
+    ~PowerManager();
+
+    void init();
+    void update();
+    void onFrame(const CanFrame& frame);
+    const Stats& getStats() const { return _stats; }
+
+private:
+    CanReceiver& _can;
+    SDLogger& _sd_logger;
+    Stats _stats;
+    uint32_t _wake_time;         // millis() at the last wake-up, idle reference
+    int64_t _wake_us;
+    bool _awaiting_first_frame;
+
+    bool enterSleep();
+    void wakeChannels(uint8_t count);
+    void lightSleep();
+    void deepSleep();
+};
+
+#endif // POWER_MANAGER_H
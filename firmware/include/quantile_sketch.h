@@ -0,0 +1,46 @@
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Fixed-memory log-linear histogram over uint16 values. Values below 16 get
+// exact buckets; above that each power-of-two octave is split into 16
+// sub-buckets, so a reported quantile is within 1/16 (6.25%) of the true
+// value. Sketches merge by adding counts. No Arduino dependencies, so the
+// host tools build it unchanged.
+class QuantileSketch {
+public:
+    static const uint8_t SUB_BUCKET_BITS = 4;
+    static const uint16_t BUCKET_COUNT = 208;  // 16 exact + 12 octaves x 16
+    static const uint8_t SERIAL_VERSION = 1;
+    // Version, min, max, then (index delta, count) varint pairs
+    static const size_t MAX_SERIALIZED_SIZE = 1 + 3 + 3 + BUCKET_COUNT * (2 + 5);
+
+    QuantileSketch();
+
+    void clear();
+    void add(uint16_t value, uint32_t weight = 1);
+    void merge(const QuantileSketch& other);
+
+    uint64_t total() const;
+    uint16_t min() const { return _min; }
+    uint16_t max() const { return _max; }
+    uint16_t quantile(float q) const;
+    uint64_t weightInRange(uint16_t low, uint16_t high) const;  // Bucket resolution
+
+    // Returns bytes written, 0 if out is too small
+    size_t serialize(uint8_t* out, size_t size) const;
+    bool deserialize(const uint8_t* in, size_t length);
+
+    static uint8_t bucketIndex(uint16_t value);
+    static uint16_t bucketLower(uint8_t index);
+    static uint16_t bucketUpper(uint8_t index);
+
+private:
+    uint32_t _counts[BUCKET_COUNT];
+    uint16_t _min;
+    uint16_t _max;
+};
+
+#endif // QUANTILE_SKETCH_H
@@ -3,34 +3,75 @@
 
 #include <Arduino.h>
 #include <SD.h>
+#include <atomic>
+#include "config.h"
 #include "types.h"
+#include "quantile_sketch.h"
+#include "log_journal.h"
 
 class SDLogger {
 public:
+    struct BacklogStats {
+        uint32_t captured;        // Frames held in RAM before the card was ready
+        uint32_t dropped;         // Lost to a full backlog
+    };
+
     SDLogger(uint8_t cs_pin);
     ~SDLogger();
 
+    // Until init() has finished (it may run on another task), CAN frames are
+    // held in RAM and written in capture order once the card is up. Call
+    // before the CAN receiver starts.
+    bool beginBootCapture();
     bool init();
-    bool logCANFrame(const CanFrame& frame);
-    bool logVehicleState(const VehicleState& state);
+    bool isReady() const { return _ready.load(std::memory_order_acquire); }
+    BacklogStats getBacklogStats() const { return _backlog_stats; }
+    // suppressed: unchanged repeats of this ID elided since its previous record
+    bool logCANFrame(const CanFrame& frame, uint16_t suppressed = 0);
+    bool logVehicleState(const VehicleState& state, const SignalWindow& window);
     bool logAnomaly(const Anomaly& anomaly);
     bool logGPSData(const GpsData& gps);
+    bool logDistribution(SignalId signal, const QuantileSketch& sketch, uint32_t start, uint32_t end);
+
+    // Flight recorder snapshots: /snapshots/snap_NNNNN.bin
+    uint32_t beginSnapshot();
+    bool appendSnapshot(const void* data, size_t length);
+    bool finishSnapshot(const SnapshotHeader& header);
 
+    // Writes sealed journal blocks, one SD_WRITE_CHUNK each; call every loop()
+    void service();
+    // Writes everything out and closes the journal segment with its index
     void flush();
-    uint32_t getFileSize();
+    LogJournal& getJournal() { return _journal; }
+    LogJournal::Stats getJournalStats() const { return _journal.getStats(); }
 
 private:
     uint8_t _cs_pin;
-    File _can_log_file;
-    File _anomaly_log_file;
-    File _gps_log_file;
+    File _snapshot_file;
+    uint32_t _next_snapshot_id;
+    std::atomic<bool> _ready;
+    std::atomic<bool> _mount_failed;
+    LogJournal _journal;
+    uint32_t _last_flush;
+
+    struct BacklogEntry {
+        CanFrame frame;
+        uint16_t suppressed;
+    };
+    BacklogEntry* _backlog;       // Freed once drained
+    uint32_t _backlog_head;       // Next to stage
+    uint32_t _backlog_tail;       // Next free
+    BacklogStats _backlog_stats;
 
-    const char* CAN_LOG_FILE = "/can_log.csv";
-    const char* ANOMALY_LOG_FILE = "/anomaly_log.csv";
-    const char* GPS_LOG_FILE = "/gps_log.csv";
+    const char* STATE_LOG_FILE = "/vehicle_state.csv";
+    const char* DIST_LOG_FILE = "/distributions.csv";
+    const char* SNAPSHOT_DIR = "/snapshots";
 
     bool createFileIfNotExists(const char* filename);
-    char* frameToCSV(const CanFrame& frame);
+    bool stageCanFrame(const CanFrame& frame, uint16_t suppressed);
+    void drainBacklog();
+    void releaseBacklog();
+    void scanSnapshots();
 };
 
 #endif // SD_LOGGER_H
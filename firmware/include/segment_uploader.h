@@ -0,0 +1,123 @@
+#ifndef SEGMENT_UPLOADER_H
+#define SEGMENT_UPLOADER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <atomic>
+#include "config.h"
+#include "types.h"
+#include "sd_logger.h"
+#if UPLOAD_USE_TLS
+#include <WiFiClientSecure.h>
+#endif
+
+// Uploads closed journal segments to the backend whenever WiFi is up, so
+// full-fidelity logs leave the vehicle, not just the MQTT samples:
+//
+//   GET UPLOAD_PATH/<device>/<segment>
+//       -> 200 {"offset":N}  bytes the server already holds
+//   PUT UPLOAD_PATH/<device>/<segment>?offset=N&total=T
+//       X-Chunk-Crc32: CRC-32 of the body (as crc32.h), hex
+//       -> 200 {"offset":N+len}
+//          409 {"offset":M}  offset is not where the server is; resend from M
+//          422 {"offset":N}  checksum mismatch; resend the chunk
+//
+// Every segment starts by asking for the server's offset, so a dropped
+// connection, a timeout or a reboot resumes at the last acknowledged byte.
+// Chunks are paced by a token bucket at UPLOAD_MAX_KBPS. Runs from loop()
+// one step per pass: connecting (DNS, TCP and any TLS handshake) is handed
+// to a small task, each chunk is read from the card a block at a time,
+// behind pending CAN service, requests are written only as fast as the
+// socket takes them, and responses are polled, not waited for.
+// The next segment to send is kept in NVS.
+class SegmentUploader {
+public:
+    struct Stats {
+        uint32_t segments;          // Uploaded completely
+        uint32_t segments_missed;   // Deleted for space before they were sent
+        uint32_t chunks;            // Acknowledged
+        uint32_t chunk_retries;     // Rejected (checksum or offset) and re-sent
+        uint32_t resumes;           // Segments picked up at a non-zero offset
+        uint32_t failures;          // Connect, request or response failures
+        uint64_t bytes_sent;        // Chunk bytes put on the wire
+        uint64_t bytes_acked;       // Chunk bytes the server kept
+        uint64_t bytes_resumed;     // Not re-sent because the server already had them
+        uint32_t last_kbps;         // Last completed segment, kB/s
+    };
+
+    SegmentUploader(SDLogger& sd_logger);
+    ~SegmentUploader();
+
+    bool init();
+    void update();
+    // Closed segments not yet uploaded
+    uint32_t pendingSegments();
+    const Stats& getStats() const { return _stats; }
+
+private:
+    enum State { STATE_IDLE, STATE_CONNECT, STATE_QUERY, STATE_SEND, STATE_WRITE, STATE_ACK };
+    enum ConnectResult : uint8_t { CONNECT_BUSY, CONNECT_OK, CONNECT_FAILED };
+
+    static const size_t REQUEST_MAX = 256;
+    static const size_t RESPONSE_MAX = 512;
+    static_assert(UPLOAD_CHUNK_SIZE % JOURNAL_BLOCK_SIZE == 0, "UPLOAD_CHUNK_SIZE must be whole journal blocks");
+
+    SDLogger& _sd_logger;
+#if UPLOAD_USE_TLS
+    WiFiClientSecure _client;
+#else
+    WiFiClient _client;
+#endif
+    File _file;
+    State _state;
+    TaskHandle_t _task;
+    // Written by the connect task, read by update(); the client belongs to
+    // the task from startConnect() until this leaves CONNECT_BUSY
+    std::atomic<uint8_t> _connect_result;
+    State _connect_next;        // QUERY or SEND once connected
+    uint32_t _retry_at;         // millis() before which IDLE does not reconnect
+    uint8_t _failures_in_row;
+    uint32_t _request_at;
+    uint32_t _tokens;           // Bytes the throttle allows right now
+    uint32_t _last_refill;
+
+    // Segment in progress
+    uint32_t _segment;          // Next to upload; 0 until init()
+    uint32_t _size;
+    uint32_t _offset;           // Acknowledged by the server
+    uint32_t _chunk_length;
+    uint8_t _chunk_retries;
+    uint32_t _resumed_at;       // Offset the server reported at the start
+    uint32_t _segment_started;
+    uint32_t _segment_sent;
+
+    // Request being written: headers, then _body_length bytes of _chunk
+    char _request[REQUEST_MAX];
+    size_t _request_length;
+    size_t _body_length;
+    size_t _written;
+    State _reply_state;         // QUERY or ACK once it is all out
+    uint32_t _last_write;
+
+    char _response[RESPONSE_MAX];
+    size_t _response_length;
+    uint8_t _chunk[UPLOAD_CHUNK_SIZE];
+    Stats _stats;
+
+    static void taskEntry(void* arg);
+    void run();
+    bool openSegment();
+    void startConnect(State next);
+    bool sendQuery();
+    bool sendChunk();
+    void beginWrite(size_t body_length, State reply_state);
+    void writeRequest();
+    int readResponse(uint32_t& offset);
+    void handleQuery(int status, uint32_t offset);
+    void handleAck(int status, uint32_t offset);
+    void finishSegment();
+    void advance();
+    void fail(const char* reason);
+};
+
+#endif // SEGMENT_UPLOADER_H
@@ -0,0 +1,27 @@
+#ifndef SIGNAL_AGGREGATOR_H
+#define SIGNAL_AGGREGATOR_H
+
+#include <Arduino.h>
+#include "types.h"
+
+// Running min/max/sum/last per decoded signal over one reporting window.
+// Each consumer (MQTT, SD) owns an instance and closes its window with
+// takeWindow() on its own schedule.
+class SignalAggregator {
+public:
+    SignalAggregator();
+
+    // signals: bitmask of (1 << SignalId) decoded from the current frame
+    void update(const VehicleState& state, uint8_t signals);
+    SignalWindow takeWindow(uint32_t now);
+
+    static uint16_t mean(const SignalStats& stats);
+    static const char* signalName(SignalId signal);
+
+private:
+    SignalWindow _window;
+
+    void reset(uint32_t now);
+};
+
+#endif // SIGNAL_AGGREGATOR_H
@@ -0,0 +1,54 @@
+#ifndef SPI_ARBITER_H
+#define SPI_ARBITER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+// Gives CAN servicing priority over SD on the shared SPI bus. Bus access
+// itself is serialized by the SPI transaction lock; this class makes SD
+// writers step aside between bounded chunks while a CAN interrupt is
+// outstanding, and measures how long CAN waited for the bus.
+class SpiArbiter {
+public:
+    struct Stats {
+        uint32_t can_services;           // INT edges serviced
+        uint32_t can_latency_max_us;     // INT edge to first frame read, this window
+        uint32_t can_latency_sd_max_us;  // Same, for edges that arrived during an SD write
+        uint32_t sd_chunks;
+        uint32_t sd_chunk_max_us;        // Longest single SD write
+        uint32_t sd_yields;              // Chunks deferred for a pending CAN interrupt
+    };
+
+    // Marks SD as holding the bus for its lifetime and times the write
+    class SdScope {
+    public:
+        SdScope() : _start(micros()) { _sd_busy.store(true, std::memory_order_relaxed); }
+        ~SdScope() { SpiArbiter::endSdWrite(micros() - _start); }
+    private:
+        uint32_t _start;
+    };
+
+    // ISR side: first edge of a burst starts the latency clock
+    static void IRAM_ATTR onCanInterrupt();
+    // RX task: call once the first frame after a wake-up has been read
+    static void onCanServiced();
+
+    static bool canPending() { return _can_pending.load(std::memory_order_acquire); }
+    // Waits, bounded by SPI_YIELD_MAX_US, for outstanding CAN service
+    static void yieldToCan();
+
+    // Window maxima are cleared by takeStats(); counts are cumulative
+    static Stats takeStats();
+
+private:
+    static std::atomic<bool> _can_pending;
+    static std::atomic<bool> _sd_busy;
+    static volatile uint32_t _edge_us;
+    static volatile bool _edge_during_sd;
+    static Stats _stats;
+
+    static void endSdWrite(uint32_t elapsed_us);
+};
+
+#endif // SPI_ARBITER_H
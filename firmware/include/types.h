@@ -8,18 +8,25 @@
 typedef struct {
     uint32_t id;
     uint8_t dlc;
+    uint8_t channel;      // Index of the controller that received it
     uint8_t data[8];
     uint32_t timestamp;
 } CanFrame;
 
 // ===== GPS DATA =====
+// Coordinates are fixed-point microdegrees (about 0.11 m of latitude); the
+// rest is single precision, which the FPU handles. See fixed_point.h.
 typedef struct {
-    double latitude;
-    double longitude;
-    double speed;
-    double altitude;
+    int32_t latitude_udeg;
+    int32_t longitude_udeg;
+    float speed;          // km/h
+    float altitude;       // m above mean sea level
+    float course;         // Degrees true, from RMC/VTG
+    float hdop;
+    uint64_t utc_ms;      // Unix epoch ms of the fix, 0 until the receiver reports a date
     uint32_t timestamp;
     uint8_t fix_quality;
+    uint8_t fix_type;     // GSA: 1 = none, 2 = 2D, 3 = 3D
     uint8_t satellites;
 } GpsData;
 
@@ -34,15 +41,240 @@ typedef struct {
     uint32_t timestamp;
 } VehicleState;
 
+// ===== SIGNAL WINDOWS =====
+enum SignalId {
+    SIGNAL_SPEED = 0,
+    SIGNAL_RPM,
+    SIGNAL_THROTTLE,
+    SIGNAL_GEAR,
+    SIGNAL_COUNT
+};
+
+// Decoded-signal bits past the windowed signals: status that is not
+// aggregated, but that anomaly rules react to
+enum StatusSignal {
+    SIGNAL_ENGINE_STATUS = SIGNAL_COUNT,
+    SIGNAL_FAULT_STATUS
+};
+
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint16_t last;        // Carried over from the previous window if count is 0
+    uint32_t count;
+    uint64_t sum;
+} SignalStats;
+
+typedef struct {
+    uint32_t start;       // millis() when the window opened
+    uint32_t end;
+    SignalStats signals[SIGNAL_COUNT];
+} SignalWindow;
+
+// ===== BOOT TIMING =====
+// Microseconds since app start (esp_timer), 0 until the stage completes
+typedef struct {
+    uint32_t can_ready_us;      // Receiver running
+    uint32_t first_frame_us;    // First frame moved off a controller
+    uint32_t gps_ready_us;
+    uint32_t sd_ready_us;
+    uint32_t network_ready_us;  // First MQTT connection
+    uint32_t backlog_frames;    // Held in RAM until the card was up
+    uint32_t backlog_dropped;
+    uint32_t journal_recovery_us;  // Locating the CAN journal's last valid block
+} BootTimes;
+
 // ===== ANOMALY DETECTION =====
 typedef struct {
     uint8_t type;
     char description[128];
     uint32_t timestamp;
-    uint16_t can_id;
+    uint32_t can_id;
     uint8_t severity; // 1: LOW, 2: MEDIUM, 3: HIGH
+    uint32_t snapshot_id; // Flight recorder snapshot, 0 if none
 } Anomaly;
 
+// ===== FLIGHT RECORDER SNAPSHOT =====
+// File layout: SnapshotHeader, frame_count CanFrames, state_count VehicleStates
+#define SNAPSHOT_MAGIC 0x4E534346  // "FCSN" little-endian
+#define SNAPSHOT_VERSION 3  // 2: CanFrame gained channel, 3: 29-bit anomaly can_id
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t trigger_time;     // millis() at the anomaly
+    uint64_t trigger_utc_ms;   // 0 if the clock was unsynced
+    uint32_t pre_trigger_ms;
+    uint32_t post_trigger_ms;
+    uint32_t frame_count;
+    uint32_t state_count;
+    uint32_t frames_lost;      // Overwritten before they could be written out
+    Anomaly anomaly;
+} SnapshotHeader;
+
+// ===== LOG JOURNAL =====
+// The CAN, GPS and anomaly log is a numbered series of fixed-size segment
+// files (/journal/seg_NNNNNNNN.bin), each JOURNAL_SEGMENT_BLOCKS blocks of
+// JOURNAL_BLOCK_SIZE bytes. Block 0 is the segment header; data blocks
+// 1..data_blocks hold records of [type, length, payload]; a closed segment
+// ends with a trailer of time index blocks then ID index blocks, whose
+// payloads are arrays of entries that never straddle a block. A block is
+// valid when its magic, CRC, segment_seq and block_index all match, so a
+// torn write or stale data from an earlier file fails the check. All fields
+// are little-endian.
+#define JOURNAL_MAGIC 0x424A4C43   // "CLJB" little-endian
+#define JOURNAL_VERSION 2          // 2: 29-bit anomaly can_id
+#define JOURNAL_BLOCK_SIZE 512
+#define JOURNAL_HEAD_MAGIC 0x444A4C43   // "CLJD"
+
+enum JournalBlockKind {
+    JOURNAL_BLOCK_SEGMENT = 1,
+    JOURNAL_BLOCK_DATA = 2,
+    JOURNAL_BLOCK_TIME_INDEX = 3,   // JournalTimeEntry[]
+    JOURNAL_BLOCK_ID_INDEX = 4      // JournalIdEntry[]
+};
+
+enum JournalRecordType {
+    JOURNAL_REC_CAN = 1,      // JournalCanRecord + dlc data bytes
+    JOURNAL_REC_GPS = 2,      // JournalGpsRecord
+    JOURNAL_REC_ANOMALY = 3   // JournalAnomalyRecord + description bytes, unterminated
+};
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t kind;              // JournalBlockKind
+    uint16_t block_index;      // Within the segment
+    uint32_t segment_seq;
+    uint32_t block_seq;        // Across all segments, never reused
+    uint16_t payload_length;
+    uint16_t record_count;
+    uint32_t first_timestamp;  // millis() of the first record
+    uint32_t last_timestamp;
+    uint64_t first_utc_ms;     // UTC of first_timestamp, 0 if the clock was unsynced
+    uint32_t crc;              // CRC-32 of the whole block with this field zero
+} JournalBlockHeader;
+
+#define JOURNAL_PAYLOAD_SIZE (JOURNAL_BLOCK_SIZE - sizeof(JournalBlockHeader))
+
+// Payload of block 0
+typedef struct __attribute__((packed)) {
+    uint16_t block_size;
+    uint16_t segment_blocks;
+    uint32_t created_ms;
+    uint64_t created_utc_ms;
+} JournalSegmentInfo;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;              // JournalRecordType
+    uint8_t length;            // Payload bytes that follow
+} JournalRecordHeader;
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp;
+    uint32_t id;
+    uint8_t channel;
+    uint8_t dlc;
+    uint16_t suppressed;       // Repeats elided by the change filter
+} JournalCanRecord;
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp;
+    double latitude;
+    double longitude;
+    float altitude;
+    float speed;
+    float course;
+    float hdop;
+    uint64_t utc_ms;           // Receiver time of the fix
+    uint8_t fix_quality;
+    uint8_t fix_type;
+    uint8_t satellites;
+} JournalGpsRecord;
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp;
+    uint32_t snapshot_id;
+    uint32_t can_id;
+    uint8_t type;
+    uint8_t severity;
+} JournalAnomalyRecord;
+
+// Trailer entries. Time entries sample every JOURNAL_TIME_INDEX_STRIDE data
+// blocks in block order; ID entries are sorted by id.
+typedef struct __attribute__((packed)) {
+    uint16_t block;
+    uint32_t first_timestamp;
+    uint64_t first_utc_ms;
+} JournalTimeEntry;
+
+typedef struct __attribute__((packed)) {
+    uint32_t id;
+    uint16_t first_block;      // First and last data block holding the ID
+    uint16_t last_block;
+    uint32_t frames;
+} JournalIdEntry;
+
+#define JOURNAL_INDEX_IDS_COMPLETE 0x01   // Clear if the ID table overflowed; scan the segment
+
+// /journal/index.bin: one entry per closed segment, appended in order
+typedef struct __attribute__((packed)) {
+    uint32_t segment_seq;
+    uint32_t first_block_seq;
+    uint16_t block_count;      // Header, data and trailer blocks
+    uint16_t data_blocks;
+    uint16_t time_count;
+    uint16_t id_count;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t first_timestamp;  // millis() of the segment's first and last record
+    uint32_t last_timestamp;
+    uint64_t first_utc_ms;     // 0 if the clock was unsynced
+    uint64_t last_utc_ms;
+    uint32_t crc;              // CRC-32 of the preceding fields
+} JournalIndexEntry;
+
+// /journal/head: rewritten on rotation, so it can lag the newest segment
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t first_seq;
+    uint32_t last_seq;
+    uint32_t crc;              // CRC-32 of the preceding fields
+} JournalHead;
+
+// ===== UPLINK PAYLOADS =====
+// An MQTT payload is either bare JSON text (first byte '{') or a
+// PayloadHeader followed by the body, LZ4-block compressed when codec says
+// so. raw_length is the body size before compression. Little-endian. JSON
+// topics are always sent bare, so plain MQTT consumers can read them.
+#define PAYLOAD_MAGIC 0xC5   // Never starts JSON text
+
+enum PayloadCodec {
+    PAYLOAD_CODEC_NONE = 0,
+    PAYLOAD_CODEC_LZ4 = 1    // LZ4 block format, no frame
+};
+
+enum PayloadContent {
+    PAYLOAD_JSON = 1,
+    PAYLOAD_FRAME_BATCH = 2  // FrameBatchHeader, then count JournalCanRecords each with dlc data bytes
+};
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t codec;           // PayloadCodec
+    uint8_t content;         // PayloadContent
+    uint8_t reserved;
+    uint32_t raw_length;
+} PayloadHeader;
+
+typedef struct __attribute__((packed)) {
+    uint16_t count;
+    uint16_t reserved;
+    uint32_t first_timestamp; // millis() of the first frame
+    uint64_t first_utc_ms;    // UTC of first_timestamp, 0 if the clock was unsynced
+} FrameBatchHeader;
+
 // ===== SENSOR READING =====
 typedef struct {
     uint32_t timestamp;
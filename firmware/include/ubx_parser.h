@@ -0,0 +1,72 @@
+#ifndef UBX_PARSER_H
+#define UBX_PARSER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Incremental u-blox UBX binary frame decoder. Frames are
+// 0xB5 0x62 <class> <id> <len16 LE> <payload> <ck_a> <ck_b>, with an
+// 8-bit Fletcher checksum over class..payload.
+class UbxParser {
+public:
+    struct Stats {
+        uint32_t frames;           // Checksum-valid frames
+        uint32_t checksum_errors;
+        uint32_t oversize_frames;  // Payload larger than MAX_PAYLOAD, skipped
+    };
+
+    UbxParser();
+
+    void reset();
+    bool feed(uint8_t byte);  // true when a valid frame has completed
+
+    uint8_t msgClass() const { return _class; }
+    uint8_t msgId() const { return _id; }
+    uint16_t payloadLength() const { return _payload_length; }
+    const uint8_t* payload() const { return _payload; }
+    const Stats& getStats() const { return _stats; }
+
+    // Little-endian field readers for payload offsets
+    uint8_t u1(uint16_t offset) const { return _payload[offset]; }
+    uint16_t u2(uint16_t offset) const;
+    uint32_t u4(uint16_t offset) const;
+    int32_t i4(uint16_t offset) const { return (int32_t)u4(offset); }
+
+    // Serialize a frame into out (needs payload_len + 8 bytes); returns frame length
+    static size_t buildFrame(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload,
+                             uint16_t payload_len, uint8_t* out);
+
+    static const uint8_t SYNC_1 = 0xB5;
+    static const uint8_t SYNC_2 = 0x62;
+    static const uint16_t MAX_PAYLOAD = 100;  // NAV-PVT is 92 bytes
+
+    // Message classes / IDs used by the logger
+    static const uint8_t CLASS_NAV = 0x01;
+    static const uint8_t CLASS_ACK = 0x05;
+    static const uint8_t CLASS_CFG = 0x06;
+    static const uint8_t ID_NAV_PVT = 0x07;
+    static const uint8_t ID_CFG_PRT = 0x00;
+    static const uint8_t ID_CFG_MSG = 0x01;
+    static const uint8_t ID_CFG_RATE = 0x08;
+
+private:
+    enum State {
+        STATE_SYNC_1, STATE_SYNC_2, STATE_CLASS, STATE_ID,
+        STATE_LENGTH_LO, STATE_LENGTH_HI, STATE_PAYLOAD, STATE_CK_A, STATE_CK_B
+    };
+
+    State _state;
+    uint8_t _class;
+    uint8_t _id;
+    uint16_t _payload_length;
+    uint16_t _payload_index;
+    uint8_t _ck_a;
+    uint8_t _ck_b;
+    uint8_t _rx_ck_a;
+    uint8_t _payload[MAX_PAYLOAD];
+    Stats _stats;
+
+    void checksum(uint8_t byte);
+};
+
+#endif // UBX_PARSER_H
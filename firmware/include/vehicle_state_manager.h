@@ -10,13 +10,18 @@ public:
     ~VehicleStateManager();
 
     void init();
-    void update(const CanFrame& frame);
+    bool update(const CanFrame& frame);  // true if the frame carried a decoded signal
+    // Mode 01 PID reply data from ObdPoller; adds to getDecodedSignals()
+    // of the update() for the frame that completed the response
+    bool updateObd(uint8_t pid, const uint8_t* data, uint8_t length);
     VehicleState getState();
+    uint8_t getDecodedSignals() const { return _decoded_signals; }  // (1 << SignalId/StatusSignal) from the last update()
     void reset();
 
 private:
     VehicleState _current_state;
     uint32_t _last_update;
+    uint8_t _decoded_signals;
 
     // Decoding functions for common CAN message IDs
     void decodeSpeed(const CanFrame& frame);
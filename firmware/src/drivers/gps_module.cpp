@@ -1,104 +1,398 @@
 #include "gps_module.h"
 #include "logger.h"
+#include "clock_sync.h"
+#include "fixed_point.h"
+#include <esp_timer.h>
 #include <cstring>
 #include <cstdlib>
+#include <cmath>
 
 GPSModule::GPSModule(uint8_t rx_pin, uint8_t tx_pin, uint32_t baudrate)
-    : _rx_pin(rx_pin), _tx_pin(tx_pin), _baudrate(baudrate), _buffer_index(0) {
+    : _rx_pin(rx_pin), _tx_pin(tx_pin), _baudrate(baudrate), _fix_count(0) {
+    memset(&_fix, 0, sizeof(GpsData));
     memset(&_latest_data, 0, sizeof(GpsData));
+    _data_lock = portMUX_INITIALIZER_UNLOCKED;
 }
 
 GPSModule::~GPSModule() {}
 
 void GPSModule::init() {
+    // Must be sized before begin(); the default 256-byte ring holds barely
+    // one 10 Hz NMEA epoch
+    Serial2.setRxBufferSize(GPS_RX_BUFFER_SIZE);
     Serial2.begin(_baudrate, SERIAL_8N1, _rx_pin, _tx_pin);
-    LOG_I("GPS", "GPS module initialized at %lu baud", _baudrate);
+    configureReceiver();
+
+    // Runs in the UART driver's event task on FIFO-full or RX idle timeout
+    Serial2.onReceive([this]() { update(); });
+
+    LOG_I("GPS", "GPS module initialized at %lu baud, %u Hz, %s", _baudrate,
+          GPS_UPDATE_RATE_HZ, GPS_USE_UBX ? "UBX" : "NMEA");
 }
 
-void GPSModule::update() {
-    while (Serial2.available()) {
-        char ch = Serial2.read();
-
-        if (ch == '\n') {
-            _nmea_buffer[_buffer_index] = '\0';
-            parseNMEA(_nmea_buffer);
-            _buffer_index = 0;
-        } else if (ch != '\r' && _buffer_index < NMEA_BUFFER_SIZE - 1) {
-            _nmea_buffer[_buffer_index++] = ch;
+void GPSModule::configureReceiver() {
+    uint32_t baud = GPS_RUN_BAUDRATE ? GPS_RUN_BAUDRATE : _baudrate;
+    // An ESP32 reset does not reset the receiver, which may still be at the
+    // run rate from the previous boot
+    uint32_t candidates[2] = {baud, _baudrate};
+    uint8_t count = (baud != _baudrate) ? 2 : 1;
+    uint32_t found = probeBaudrate(candidates, count);
+
+    if (found == 0) {
+        LOG_W("GPS", "No data at %lu or %lu baud, configuring at both",
+              candidates[0], candidates[count - 1]);
+        for (uint8_t i = 0; i < count; i++) {
+            Serial2.updateBaudRate(candidates[i]);
+            sendPortConfig(baud);
         }
+    } else if (found != baud || GPS_USE_UBX) {
+        // CFG-PRT also picks the output protocol, so UBX mode sends it even
+        // at an unchanged baud rate to turn NMEA off
+        Serial2.updateBaudRate(found);
+        sendPortConfig(baud);
     }
-}
+    Serial2.updateBaudRate(baud);
+    _baudrate = baud;
 
-bool GPSModule::parseNMEA(const char* sentence) {
-    if (sentence[0] != '$') return false;
+    if (found == 0 && probeBaudrate(&baud, 1) == 0) {
+        LOG_E("GPS", "Receiver silent at %lu baud, check wiring and power", baud);
+    }
 
-    char fields[20][32];
-    int field_count = 0;
-    size_t i = 1;
+    // UBX-CFG-RATE: measurement period, one solution per measurement, GPS time
+    uint16_t meas_rate = 1000 / GPS_UPDATE_RATE_HZ;
+    uint8_t rate[6] = {
+        (uint8_t)(meas_rate & 0xFF), (uint8_t)(meas_rate >> 8),
+        0x01, 0x00,
+        0x01, 0x00
+    };
+    sendUbx(UbxParser::CLASS_CFG, UbxParser::ID_CFG_RATE, rate, sizeof(rate));
 
-    while (i < strlen(sentence) && field_count < 20) {
-        size_t start = i;
-        while (i < strlen(sentence) && sentence[i] != ',') i++;
+#if GPS_USE_UBX
+    setMessageRate(UbxParser::CLASS_NAV, UbxParser::ID_NAV_PVT, 1);
+#else
+    // Drop the sentences we do not decode so 10 Hz fits the link
+    setMessageRate(0xF0, 0x01, 0);  // GLL
+    setMessageRate(0xF0, 0x03, 0);  // GSV
+#endif
+}
 
-        size_t len = i - start;
-        if (len > 31) len = 31;
-        strncpy(fields[field_count], sentence + start, len);
-        fields[field_count][len] = '\0';
+uint32_t GPSModule::probeBaudrate(const uint32_t* candidates, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        Serial2.updateBaudRate(candidates[i]);
+        while (Serial2.available()) Serial2.read();
 
-        field_count++;
-        i++;
+        // Local parsers keep the framing errors of a wrong rate out of the
+        // reported stats; either protocol counts, whichever the receiver
+        // was last left emitting
+        NmeaParser nmea;
+        UbxParser ubx;
+        uint32_t start = millis();
+        while (millis() - start < GPS_BAUD_PROBE_MS) {
+            while (Serial2.available()) {
+                uint8_t byte = (uint8_t)Serial2.read();
+                if (nmea.feed((char)byte) != NmeaParser::SENTENCE_NONE || ubx.feed(byte)) {
+                    LOG_I("GPS", "Receiver found at %lu baud", candidates[i]);
+                    return candidates[i];
+                }
+            }
+            delay(10);
+        }
     }
+    return 0;
+}
 
-    if (strncmp(sentence, "$GPGGA", 6) == 0) {
-        return parseGPGGA(fields);
-    } else if (strncmp(sentence, "$GPRMC", 6) == 0) {
-        return parseGPRMC(fields);
+void GPSModule::sendPortConfig(uint32_t baud) {
+    // UBX-CFG-PRT: UART1, 8N1, baud rate, protocols
+    uint8_t prt[20] = {0};
+    uint32_t mode = 0x000008D0;
+    uint16_t in_proto = 0x0003;                       // UBX + NMEA
+    uint16_t out_proto = GPS_USE_UBX ? 0x0001 : 0x0002;
+    prt[0] = 1;
+    memcpy(&prt[4], &mode, 4);
+    memcpy(&prt[8], &baud, 4);
+    memcpy(&prt[12], &in_proto, 2);
+    memcpy(&prt[14], &out_proto, 2);
+    sendUbx(UbxParser::CLASS_CFG, UbxParser::ID_CFG_PRT, prt, sizeof(prt));
+
+    // The receiver switches after the frame has left; no ACK arrives at the
+    // old rate
+    Serial2.flush();
+    delay(50);
+}
+
+void GPSModule::sendUbx(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload, uint16_t len) {
+    uint8_t frame[UbxParser::MAX_PAYLOAD + 8];
+    if (len > UbxParser::MAX_PAYLOAD) return;
+    size_t frame_len = UbxParser::buildFrame(msg_class, msg_id, payload, len, frame);
+    Serial2.write(frame, frame_len);
+}
+
+void GPSModule::setMessageRate(uint8_t msg_class, uint8_t msg_id, uint8_t rate) {
+    uint8_t msg[3] = {msg_class, msg_id, rate};
+    sendUbx(UbxParser::CLASS_CFG, UbxParser::ID_CFG_MSG, msg, sizeof(msg));
+}
+
+void GPSModule::update() {
+    while (Serial2.available()) {
+        uint8_t byte = (uint8_t)Serial2.read();
+#if GPS_USE_UBX
+        if (_ubx_parser.feed(byte) && handleUbx(_ubx_parser)) {
+            if (_fix.utc_ms != 0) ClockSync::onGpsTime(_fix.utc_ms, esp_timer_get_time());
+            publishFix();
+        }
+#else
+        NmeaParser::SentenceType type = _parser.feed((char)byte);
+        if (type != NmeaParser::SENTENCE_NONE && handleSentence(_parser, type)) {
+            // RMC is the only sentence carrying the date
+            if (type == NmeaParser::SENTENCE_RMC && _fix.utc_ms != 0) {
+                ClockSync::onGpsTime(_fix.utc_ms, esp_timer_get_time());
+            }
+            publishFix();
+        }
+#endif
     }
+}
 
-    return false;
+void GPSModule::publishFix() {
+    portENTER_CRITICAL(&_data_lock);
+    _latest_data = _fix;
+    portEXIT_CRITICAL(&_data_lock);
+    _fix_count++;
 }
 
-bool GPSModule::parseGPGGA(const char* fields[]) {
-    _latest_data.fix_quality = atoi(fields[6]);
-    _latest_data.satellites = atoi(fields[7]);
+bool GPSModule::handleSentence(const NmeaParser& nmea, NmeaParser::SentenceType type) {
+    switch (type) {
+        case NmeaParser::SENTENCE_GGA: return parseGGA(nmea);
+        case NmeaParser::SENTENCE_RMC: return parseRMC(nmea);
+        case NmeaParser::SENTENCE_VTG: return parseVTG(nmea);
+        case NmeaParser::SENTENCE_GSA: return parseGSA(nmea);
+        default: return false;
+    }
+}
+
+bool GPSModule::parseGGA(const NmeaParser& nmea) {
+    _fix.fix_quality = atoi(nmea.field(6));
+    _fix.satellites = atoi(nmea.field(7));
 
-    if (_latest_data.fix_quality > 0) {
-        _latest_data.latitude = parseCoordinate(fields[2], fields[3]);
-        _latest_data.longitude = parseCoordinate(fields[4], fields[5]);
-        _latest_data.altitude = atof(fields[9]);
-        _latest_data.timestamp = millis();
+    if (_fix.fix_quality > 0) {
+        _fix.latitude_udeg = FixedPoint::parseNmeaCoordinate(nmea.field(2), nmea.field(3));
+        _fix.longitude_udeg = FixedPoint::parseNmeaCoordinate(nmea.field(4), nmea.field(5));
+        _fix.hdop = FixedPoint::parseDecimal(nmea.field(8), 2) * 0.01f;
+        _fix.altitude = FixedPoint::parseDecimal(nmea.field(9), 1) * 0.1f;
+        _fix.timestamp = millis();
         return true;
     }
 
     return false;
 }
 
-bool GPSModule::parseGPRMC(const char* fields[]) {
-    if (fields[2][0] == 'A') {  // Active (valid fix)
-        _latest_data.speed = atof(fields[7]) * 1.852;  // Convert knots to km/h
-        _latest_data.timestamp = millis();
+bool GPSModule::parseRMC(const NmeaParser& nmea) {
+    if (nmea.field(2)[0] == 'A') {  // Active (valid fix)
+        _fix.speed = FixedPoint::parseDecimal(nmea.field(7), 3) * 0.001852f;  // Knots to km/h
+        _fix.course = FixedPoint::parseDecimal(nmea.field(8), 2) * 0.01f;
+        _fix.utc_ms = parseUtc(nmea.field(1), nmea.field(9));
+        _fix.timestamp = millis();
         return true;
     }
     return false;
 }
 
-double GPSModule::parseCoordinate(const char* coord, const char* dir) {
-    double value = atof(coord);
-    int degrees = (int)(value / 100.0);
-    double minutes = value - (degrees * 100.0);
-    double decimal = degrees + minutes / 60.0;
+bool GPSModule::parseVTG(const NmeaParser& nmea) {
+    // Mode indicator 'N' means data not valid (NMEA 2.3+)
+    if (nmea.field(9)[0] == 'N') return false;
+    if (nmea.field(7)[0] == '\0') return false;
+
+    _fix.speed = FixedPoint::parseDecimal(nmea.field(7), 3) * 0.001f;  // Already in km/h
+    if (nmea.field(1)[0] != '\0') {
+        _fix.course = FixedPoint::parseDecimal(nmea.field(1), 2) * 0.01f;
+    }
+    _fix.timestamp = millis();
+    return true;
+}
+
+bool GPSModule::parseGSA(const NmeaParser& nmea) {
+    _fix.fix_type = atoi(nmea.field(2));
+    if (nmea.field(16)[0] != '\0') {
+        _fix.hdop = FixedPoint::parseDecimal(nmea.field(16), 2) * 0.01f;
+    }
+    return _fix.fix_type > 1;
+}
+
+bool GPSModule::handleUbx(const UbxParser& ubx) {
+    if (ubx.msgClass() == UbxParser::CLASS_NAV && ubx.msgId() == UbxParser::ID_NAV_PVT) {
+        return parseNavPvt(ubx);
+    }
+    return false;  // ACK/NAK and anything else we did not ask for
+}
 
-    if (dir[0] == 'S' || dir[0] == 'W') {
-        decimal = -decimal;
+// 1e-7 degrees to microdegrees, rounded half away from zero
+static int32_t roundDiv10(int32_t value) {
+    return (value >= 0 ? value + 5 : value - 5) / 10;
+}
+
+bool GPSModule::parseNavPvt(const UbxParser& ubx) {
+    if (ubx.payloadLength() < 92) return false;
+
+    uint8_t fix_type = ubx.u1(20);    // 0 none, 1 DR, 2 2D, 3 3D, 4 GNSS+DR, 5 time only
+    bool fix_ok = ubx.u1(21) & 0x01;  // gnssFixOK
+
+    _fix.fix_quality = fix_ok ? 1 : 0;
+    _fix.fix_type = (fix_type == 2 || fix_type == 3) ? fix_type : (fix_type == 4 ? 3 : 1);
+    _fix.satellites = ubx.u1(23);
+    if (!fix_ok) return false;
+
+    // validDate | validTime | fullyResolved
+    if ((ubx.u1(11) & 0x07) == 0x07) {
+        uint32_t ms_of_day = (ubx.u1(8) * 3600UL + ubx.u1(9) * 60UL + ubx.u1(10)) * 1000UL;
+        int64_t utc_ms = (int64_t)ClockSync::epochMs(ubx.u2(4), ubx.u1(6), ubx.u1(7), ms_of_day);
+        _fix.utc_ms = (uint64_t)(utc_ms + ubx.i4(16) / 1000000);  // nano may be negative
+    } else {
+        _fix.utc_ms = 0;
     }
 
-    return decimal;
+    _fix.longitude_udeg = roundDiv10(ubx.i4(24));   // 1e-7 deg
+    _fix.latitude_udeg = roundDiv10(ubx.i4(28));
+    _fix.altitude = ubx.i4(36) * 0.001f;       // hMSL, mm
+    _fix.speed = ubx.i4(60) * 0.0036f;         // gSpeed, mm/s -> km/h
+    _fix.course = ubx.i4(64) * 1e-5f;          // headMot
+    _fix.hdop = ubx.u2(76) / 100.0f;           // pDOP; NAV-PVT carries no HDOP
+    _fix.timestamp = millis();
+    return true;
+}
+
+uint64_t GPSModule::parseUtc(const char* time, const char* date) {
+    // time: hhmmss[.sss], date: ddmmyy
+    if (strlen(time) < 6 || strlen(date) != 6) return 0;
+
+    uint32_t hh = (time[0] - '0') * 10 + (time[1] - '0');
+    uint32_t mm = (time[2] - '0') * 10 + (time[3] - '0');
+    uint32_t ss = (time[4] - '0') * 10 + (time[5] - '0');
+    uint32_t frac_ms = 0;
+    if (time[6] == '.') {
+        uint32_t scale = 100;
+        for (const char* p = time + 7; *p >= '0' && *p <= '9' && scale > 0; p++) {
+            frac_ms += (*p - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    uint8_t day = (date[0] - '0') * 10 + (date[1] - '0');
+    uint8_t month = (date[2] - '0') * 10 + (date[3] - '0');
+    uint16_t year = 2000 + (date[4] - '0') * 10 + (date[5] - '0');
+    if (month < 1 || month > 12 || day < 1 || day > 31) return 0;
+
+    return ClockSync::epochMs(year, month, day, (hh * 3600 + mm * 60 + ss) * 1000 + frac_ms);
 }
 
 bool GPSModule::hasValidFix() {
-    return _latest_data.fix_quality > 0 && _latest_data.satellites >= 4;
+    GpsData data = getLatestData();
+    return data.fix_quality > 0 && data.satellites >= 4;
 }
 
 GpsData GPSModule::getLatestData() {
-    return _latest_data;
+    portENTER_CRITICAL(&_data_lock);
+    GpsData data = _latest_data;
+    portEXIT_CRITICAL(&_data_lock);
+    return data;
+}
+
+#if GPS_PARSER_BENCHMARK
+// Mixed-talker corpus: every supported formatter, an unsupported one, a
+// corrupted checksum and a truncated line
+static const char* const NMEA_CORPUS[] = {
+    "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n",
+    "$GNGGA,092725.00,4717.11399,N,00833.91590,E,1,08,1.01,499.6,M,48.0,M,,*45\r\n",
+    "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A\r\n",
+    "$GNRMC,092725.00,A,4717.11437,N,00833.91522,E,0.004,77.52,091202,,,A*40\r\n",
+    "$GPVTG,054.7,T,034.4,M,005.5,N,010.2,K,A*25\r\n",
+    "$GNGSA,A,3,23,29,07,08,09,18,26,28,,,,,1.94,1.18,1.54,1*0E\r\n",
+    "$GLGSV,2,1,08,65,38,321,27,66,41,045,31,67,18,093,,74,14,258,21*6D\r\n",
+    "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*48\r\n",
+    "$GNRMC,092725.00,A,4717.1\r\n",
+};
+static const size_t NMEA_CORPUS_COUNT = sizeof(NMEA_CORPUS) / sizeof(NMEA_CORPUS[0]);
+
+// Coordinate fields as receivers send them: 3 to 5 minute decimals
+static const char* const COORD_CORPUS[][2] = {
+    {"4807.038", "N"}, {"01131.000", "E"}, {"4717.11399", "N"}, {"00833.91590", "E"},
+    {"3356.4821", "S"}, {"15112.9873", "E"}, {"4044.60124", "N"}, {"07359.83516", "W"},
+};
+static const size_t COORD_CORPUS_COUNT = sizeof(COORD_CORPUS) / sizeof(COORD_CORPUS[0]);
+
+// The atof/double conversion the parser used before FixedPoint
+static double parseCoordinateDouble(const char* coord, const char* dir) {
+    double value = atof(coord);
+    int degrees = (int)(value / 100.0);
+    double decimal = degrees + (value - degrees * 100.0) / 60.0;
+    return (dir[0] == 'S' || dir[0] == 'W') ? -decimal : decimal;
+}
+
+static void runCoordinateBenchmark(uint16_t iterations) {
+    volatile double double_sink = 0;
+    volatile int32_t fixed_sink = 0;
+
+    uint32_t start = ESP.getCycleCount();
+    for (uint16_t it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < COORD_CORPUS_COUNT; i++) {
+            double_sink = parseCoordinateDouble(COORD_CORPUS[i][0], COORD_CORPUS[i][1]);
+        }
+    }
+    uint32_t double_cycles = ESP.getCycleCount() - start;
+
+    start = ESP.getCycleCount();
+    for (uint16_t it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < COORD_CORPUS_COUNT; i++) {
+            fixed_sink = FixedPoint::parseNmeaCoordinate(COORD_CORPUS[i][0], COORD_CORPUS[i][1]);
+        }
+    }
+    uint32_t fixed_cycles = ESP.getCycleCount() - start;
+
+    // Worst disagreement, in hundredths of a microdegree
+    uint32_t max_error = 0;
+    for (size_t i = 0; i < COORD_CORPUS_COUNT; i++) {
+        double reference = parseCoordinateDouble(COORD_CORPUS[i][0], COORD_CORPUS[i][1]) * 1e6;
+        double error = fabs(FixedPoint::parseNmeaCoordinate(COORD_CORPUS[i][0], COORD_CORPUS[i][1]) - reference);
+        if ((uint32_t)(error * 100) > max_error) max_error = (uint32_t)(error * 100);
+    }
+    (void)double_sink;
+    (void)fixed_sink;
+
+    uint32_t parses = (uint32_t)iterations * COORD_CORPUS_COUNT;
+    if (parses == 0) parses = 1;
+    LOG_I("GPS", "Coordinate benchmark: double %lu cycles, fixed-point %lu cycles, max error %lu.%02lu udeg",
+          double_cycles / parses, fixed_cycles / parses, max_error / 100, max_error % 100);
+}
+
+void GPSModule::runParserBenchmark(uint16_t iterations) {
+    NmeaParser parser;
+    GpsData saved = _fix;
+    uint32_t bytes = 0;
+    uint32_t decoded = 0;
+
+    uint32_t start = ESP.getCycleCount();
+    for (uint16_t it = 0; it < iterations; it++) {
+        for (size_t s = 0; s < NMEA_CORPUS_COUNT; s++) {
+            for (const char* p = NMEA_CORPUS[s]; *p; p++) {
+                NmeaParser::SentenceType type = parser.feed(*p);
+                if (type != NmeaParser::SENTENCE_NONE) {
+                    handleSentence(parser, type);
+                    decoded++;
+                }
+                bytes++;
+            }
+        }
+    }
+    uint32_t cycles = ESP.getCycleCount() - start;
+
+    // Benchmark fixes must not leak into live data
+    _fix = saved;
+
+    const NmeaParser::Stats& stats = parser.getStats();
+    LOG_I("GPS", "NMEA benchmark: %lu bytes, %lu sentences, %lu cycles/byte, %lu cycles/sentence",
+          bytes, decoded, cycles / (bytes ? bytes : 1), cycles / (decoded ? decoded : 1));
+    LOG_I("GPS", "NMEA benchmark: ok=%lu checksum_err=%lu framing_err=%lu",
+          stats.sentences, stats.checksum_errors, stats.framing_errors);
+
+    runCoordinateBenchmark(iterations);
 }
+#endif
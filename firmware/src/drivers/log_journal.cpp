@@ -0,0 +1,732 @@
+#include "log_journal.h"
+#include "logger.h"
+#include "clock_sync.h"
+#include "crc32.h"
+#include "journal_index.h"
+#include "perf_counters.h"
+#include "spi_arbiter.h"
+#include <stddef.h>
+
+static const char* JOURNAL_DIR = "/journal";
+static const char* JOURNAL_HEAD_FILE = "/journal/head";
+static const char* JOURNAL_INDEX_FILE = "/journal/index.bin";
+
+static uint64_t timeKey(const uint8_t* entry) {
+    return ((const JournalTimeEntry*)entry)->first_utc_ms;
+}
+
+static uint64_t idKey(const uint8_t* entry) {
+    return ((const JournalIdEntry*)entry)->id;
+}
+
+LogJournal::LogJournal()
+    : _reader_seq(0), _head(0), _sealed(0), _fill(0), _segment_seq(0), _next_index(0),
+      _block_seq(0), _first_seq(0) {
+    memset(&_stats, 0, sizeof(Stats));
+    memset(&_current, 0, sizeof(_current));
+}
+
+LogJournal::~LogJournal() {
+    if (_file) _file.close();
+    if (_reader) _reader.close();
+}
+
+bool LogJournal::open() {
+    uint32_t start = micros();
+    if (!SD.exists(JOURNAL_DIR)) SD.mkdir(JOURNAL_DIR);
+
+    JournalHead head;
+    uint32_t last;
+    if (readHead(head)) {
+        _first_seq = head.first_seq;
+        last = findLastSegment(head.last_seq);
+    } else {
+        last = scanSegments(_first_seq);
+    }
+
+    bool ok;
+    if (last == 0) {
+        _first_seq = 1;
+        _stats.recovery_us = micros() - start;
+        ok = createSegment(1);
+    } else {
+        // A clean close leaves the segment's summary as the last index entry
+        JournalIndexEntry tail;
+        uint32_t count = indexCount();
+        bool have_tail = count && readIndex(count - 1, tail);
+        if (have_tail) _block_seq = tail.first_block_seq + tail.block_count;
+
+        if (have_tail && tail.segment_seq == last) {
+            _stats.recovery_us = micros() - start;
+        } else if (recoverSegment(last)) {
+            _stats.recovery_us = micros() - start;
+            uint32_t rebuild_start = micros();
+            uint8_t* block = _queue[0];
+            for (uint16_t i = 1; i < _next_index; i++) {
+                if (readBlock(i, block)) indexBlock(block, i);
+            }
+            writeTrailer();
+            _stats.index_rebuild_us = micros() - rebuild_start;
+            LOG_I("JOURNAL", "Re-indexed %u blocks of segment %lu in %lu us",
+                  _stats.recovered_blocks, last, _stats.index_rebuild_us);
+        } else {
+            _stats.recovery_us = micros() - start;
+            LOG_W("JOURNAL", "Segment %lu unreadable, starting a new one", last);
+        }
+        // Each boot starts a fresh segment so millis() stamps within one
+        // segment never go backwards
+        _segment_seq = last;
+        ok = createSegment(last + 1);
+    }
+
+    if (!ok) {
+        LOG_E("JOURNAL", "Failed to open the journal");
+        _segment_seq = 0;
+        return false;
+    }
+    LOG_I("JOURNAL", "Segment %lu, end of log found in %lu us (%u reads)",
+          _segment_seq, _stats.recovery_us, _stats.recovery_reads);
+    return true;
+}
+
+bool LogJournal::close() {
+    if (!_file) return true;
+    seal();
+    while (_sealed && writeBlock()) {}
+    // An empty segment stays open for whatever comes next
+    if (!_current.data_blocks) {
+        sync();
+        return !_sealed;
+    }
+    return writeTrailer() && !_sealed;
+}
+
+bool LogJournal::readHead(JournalHead& head) {
+    File f = SD.open(JOURNAL_HEAD_FILE, FILE_READ);
+    if (!f) return false;
+    bool ok = f.read((uint8_t*)&head, sizeof(head)) == sizeof(head);
+    f.close();
+    _stats.recovery_reads++;
+    return ok && head.magic == JOURNAL_HEAD_MAGIC &&
+           head.crc == Crc32::update(0, &head, offsetof(JournalHead, crc)) &&
+           head.first_seq && head.first_seq <= head.last_seq;
+}
+
+bool LogJournal::writeHead() {
+    JournalHead head;
+    head.magic = JOURNAL_HEAD_MAGIC;
+    head.first_seq = _first_seq;
+    head.last_seq = _segment_seq;
+    head.crc = Crc32::update(0, &head, offsetof(JournalHead, crc));
+
+    File f = SD.open(JOURNAL_HEAD_FILE, FILE_WRITE);
+    if (!f) return false;
+    bool ok = f.write((const uint8_t*)&head, sizeof(head)) == sizeof(head);
+    f.close();
+    return ok;
+}
+
+bool LogJournal::segmentExists(uint32_t seq) {
+    char path[40];
+    segmentPath(seq, path, sizeof(path));
+    _stats.recovery_reads++;
+    return SD.exists(path);
+}
+
+uint32_t LogJournal::findLastSegment(uint32_t hint) {
+    uint32_t first;
+    if (!segmentExists(hint)) return scanSegments(first);
+
+    // The head is only rewritten on rotation, so a crash can leave it behind
+    // the newest segment. Segment numbers are contiguous: gallop forward from
+    // the hint, then binary search the gap.
+    uint32_t lo = hint;
+    uint32_t step = 1;
+    while (segmentExists(lo + step)) {
+        lo += step;
+        step *= 2;
+    }
+    uint32_t hi = lo + step;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (segmentExists(mid)) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+uint32_t LogJournal::scanSegments(uint32_t& first) {
+    uint32_t last = 0;
+    first = 0;
+    File dir = SD.open(JOURNAL_DIR);
+    if (!dir) return 0;
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+        const char* name = strrchr(entry.name(), '/');
+        name = name ? name + 1 : entry.name();
+        unsigned long seq = 0;
+        if (sscanf(name, "seg_%lu.bin", &seq) == 1 && seq) {
+            if (!first || seq < first) first = seq;
+            if (seq > last) last = seq;
+        }
+        entry.close();
+        _stats.recovery_reads++;
+    }
+    dir.close();
+    return last;
+}
+
+bool LogJournal::recoverSegment(uint32_t seq) {
+    char path[40];
+    segmentPath(seq, path, sizeof(path));
+    _file = SD.open(path, "r+");
+    if (!_file) return false;
+    _segment_seq = seq;
+
+    // The queue is empty until open() returns; borrow a slot to read into
+    uint8_t* block = _queue[0];
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    _stats.recovery_reads++;
+    if (!readBlock(0, block) || !validateBlock(block, seq, 0) || header->kind != JOURNAL_BLOCK_SEGMENT) {
+        _file.close();
+        return false;
+    }
+    memset(&_current, 0, sizeof(_current));
+    _current.segment_seq = seq;
+    _current.first_block_seq = header->block_seq;
+    _current.flags = JOURNAL_INDEX_IDS_COMPLETE;
+    uint32_t last_seq = header->block_seq;
+
+    // Data blocks are written strictly in order, so the valid ones form a
+    // prefix; anything after it is a torn write or preallocated garbage
+    uint16_t lo = 0;
+    uint16_t hi = DATA_BLOCKS_MAX + 1;
+    while (hi - lo > 1) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        _stats.recovery_reads++;
+        if (readBlock(mid, block) && validateBlock(block, seq, mid) && header->kind == JOURNAL_BLOCK_DATA) {
+            lo = mid;
+            last_seq = header->block_seq;
+        } else {
+            hi = mid;
+        }
+    }
+
+    _next_index = lo + 1;
+    _block_seq = last_seq + 1;
+    _stats.recovered_blocks = lo;
+    return true;
+}
+
+bool LogJournal::readBlock(uint16_t index, uint8_t* block) {
+    SpiArbiter::yieldToCan();
+    SpiArbiter::SdScope sd_busy;
+    return _file.seek((uint32_t)index * JOURNAL_BLOCK_SIZE) &&
+           _file.read(block, JOURNAL_BLOCK_SIZE) == JOURNAL_BLOCK_SIZE;
+}
+
+bool LogJournal::writeRaw(uint16_t index, const uint8_t* block) {
+    SpiArbiter::yieldToCan();
+    PERF_SCOPE(STAGE_SD_WRITE);
+    SpiArbiter::SdScope sd_busy;
+    return _file.seek((uint32_t)index * JOURNAL_BLOCK_SIZE) &&
+           _file.write(block, JOURNAL_BLOCK_SIZE) == JOURNAL_BLOCK_SIZE;
+}
+
+bool LogJournal::createSegment(uint32_t seq) {
+    if (_file) _file.close();
+    freeSpace();
+
+    char path[40];
+    segmentPath(seq, path, sizeof(path));
+    _file = SD.open(path, "w+");     // Read back by lookups while open
+    if (!_file) {
+        LOG_E("JOURNAL", "Failed to create %s", path);
+        return false;
+    }
+
+    // Allocate every cluster now so block writes never touch the FAT, then
+    // commit the directory entry before any data goes in
+    uint8_t block[JOURNAL_BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+    bool ok;
+    {
+        SpiArbiter::yieldToCan();
+        SpiArbiter::SdScope sd_busy;
+        ok = _file.seek((uint32_t)JOURNAL_SEGMENT_BLOCKS * JOURNAL_BLOCK_SIZE - 1) &&
+             _file.write(block, 1) == 1;
+        _file.flush();
+    }
+
+    _segment_seq = seq;
+    memset(&_current, 0, sizeof(_current));
+    _current.segment_seq = seq;
+    _current.first_block_seq = _block_seq;
+    _current.flags = JOURNAL_INDEX_IDS_COMPLETE;
+
+    JournalSegmentInfo* info = (JournalSegmentInfo*)(block + sizeof(JournalBlockHeader));
+    info->block_size = JOURNAL_BLOCK_SIZE;
+    info->segment_blocks = JOURNAL_SEGMENT_BLOCKS;
+    info->created_ms = millis();
+    info->created_utc_ms = ClockSync::toUtcMs(info->created_ms);
+    ((JournalBlockHeader*)block)->payload_length = sizeof(JournalSegmentInfo);
+    finishBlock(block, JOURNAL_BLOCK_SEGMENT, 0);
+
+    ok = ok && writeRaw(0, block);
+    sync();
+    if (!ok) {
+        LOG_E("JOURNAL", "Failed to preallocate %s", path);
+        _stats.write_errors++;
+        _file.close();
+        return false;
+    }
+
+    _next_index = 1;
+    _block_seq++;
+    _stats.rotations++;
+    if (!writeHead()) LOG_W("JOURNAL", "Failed to update the journal head");
+    return true;
+}
+
+void LogJournal::freeSpace() {
+    // Oldest first; the segment just closed is always kept
+    const uint64_t min_free = (uint64_t)JOURNAL_MIN_FREE_MB << 20;
+    while (_first_seq && _first_seq < _segment_seq && SD.usedBytes() + min_free > SD.totalBytes()) {
+        char path[40];
+        segmentPath(_first_seq, path, sizeof(path));
+        if (_reader && _reader_seq == _first_seq) _reader.close();
+        if (!SD.remove(path) && SD.exists(path)) {
+            LOG_W("JOURNAL", "Failed to delete %s", path);
+            break;
+        }
+        _first_seq++;
+        _stats.segments_deleted++;
+    }
+}
+
+bool LogJournal::writeTrailer() {
+    if (!_file) return false;
+
+    uint8_t block[JOURNAL_BLOCK_SIZE];
+    JournalBlockHeader* header = (JournalBlockHeader*)block;
+    uint16_t index = _current.data_blocks + 1;
+    bool ok = true;
+
+    for (uint16_t i = 0; ok && i < _current.time_count; i += TIME_PER_BLOCK) {
+        uint16_t count = _current.time_count - i < TIME_PER_BLOCK ? _current.time_count - i : TIME_PER_BLOCK;
+        memset(block, 0, sizeof(block));
+        header->record_count = count;
+        header->payload_length = count * sizeof(JournalTimeEntry);
+        memcpy(block + sizeof(JournalBlockHeader), &_time_index[i], header->payload_length);
+        finishBlock(block, JOURNAL_BLOCK_TIME_INDEX, index);
+        ok = writeRaw(index++, block);
+        _block_seq++;
+    }
+    for (uint16_t i = 0; ok && i < _current.id_count; i += IDS_PER_BLOCK) {
+        uint16_t count = _current.id_count - i < IDS_PER_BLOCK ? _current.id_count - i : IDS_PER_BLOCK;
+        memset(block, 0, sizeof(block));
+        header->record_count = count;
+        header->payload_length = count * sizeof(JournalIdEntry);
+        memcpy(block + sizeof(JournalBlockHeader), &_id_index[i], header->payload_length);
+        finishBlock(block, JOURNAL_BLOCK_ID_INDEX, index);
+        ok = writeRaw(index++, block);
+        _block_seq++;
+    }
+
+    sync();
+    _file.close();
+    _current.block_count = index;
+    if (!ok) {
+        // The data blocks stay readable; only lookups lose this segment
+        _stats.write_errors++;
+        LOG_W("JOURNAL", "Failed to write the index of segment %lu", _segment_seq);
+        return false;
+    }
+    return appendIndex(_current);
+}
+
+void LogJournal::indexBlock(const uint8_t* block, uint16_t index) {
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    if (!_current.data_blocks) _current.first_timestamp = header->first_timestamp;
+    if (!_current.first_utc_ms) _current.first_utc_ms = header->first_utc_ms;
+    if ((index - 1) % JOURNAL_TIME_INDEX_STRIDE == 0 && _current.time_count < TIME_INDEX_MAX) {
+        JournalTimeEntry& entry = _time_index[_current.time_count++];
+        entry.block = index;
+        entry.first_timestamp = header->first_timestamp;
+        entry.first_utc_ms = header->first_utc_ms;
+    }
+    _current.last_timestamp = header->last_timestamp;
+    if (header->first_utc_ms) {
+        _current.last_utc_ms = header->first_utc_ms + (header->last_timestamp - header->first_timestamp);
+    }
+    _current.data_blocks = index;
+
+    size_t offset = sizeof(JournalBlockHeader);
+    size_t end = offset + header->payload_length;
+    while (offset + sizeof(JournalRecordHeader) <= end) {
+        const JournalRecordHeader* rec = (const JournalRecordHeader*)(block + offset);
+        offset += sizeof(JournalRecordHeader);
+        if (offset + rec->length > end) break;
+        if (rec->type == JOURNAL_REC_CAN && rec->length >= sizeof(JournalCanRecord)) {
+            indexId(((const JournalCanRecord*)(block + offset))->id, index);
+        }
+        offset += rec->length;
+    }
+}
+
+void LogJournal::indexId(uint32_t id, uint16_t index) {
+    uint16_t lo = 0;
+    uint16_t hi = _current.id_count;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (_id_index[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < _current.id_count && _id_index[lo].id == id) {
+        _id_index[lo].last_block = index;
+        _id_index[lo].frames++;
+        return;
+    }
+    if (_current.id_count >= JOURNAL_INDEX_MAX_IDS) {
+        _current.flags &= ~JOURNAL_INDEX_IDS_COMPLETE;
+        return;
+    }
+    memmove(&_id_index[lo + 1], &_id_index[lo], (_current.id_count - lo) * sizeof(JournalIdEntry));
+    _id_index[lo].id = id;
+    _id_index[lo].first_block = index;
+    _id_index[lo].last_block = index;
+    _id_index[lo].frames = 1;
+    _current.id_count++;
+}
+
+uint32_t LogJournal::indexCount() {
+    File f = SD.open(JOURNAL_INDEX_FILE, FILE_READ);
+    if (!f) return 0;
+    uint32_t count = f.size() / sizeof(JournalIndexEntry);
+    f.close();
+    return count;
+}
+
+bool LogJournal::readIndex(uint32_t position, JournalIndexEntry& entry) {
+    File f = SD.open(JOURNAL_INDEX_FILE, FILE_READ);
+    if (!f) return false;
+    bool ok = f.seek(position * sizeof(JournalIndexEntry)) &&
+              f.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    f.close();
+    return ok && entry.crc == Crc32::update(0, &entry, offsetof(JournalIndexEntry, crc));
+}
+
+bool LogJournal::appendIndex(JournalIndexEntry& entry) {
+    entry.crc = Crc32::update(0, &entry, offsetof(JournalIndexEntry, crc));
+
+    // Written at the last whole entry, so a torn append is overwritten
+    // rather than shifting every entry after it
+    uint32_t position = indexCount();
+    File f = SD.open(JOURNAL_INDEX_FILE, position ? "r+" : FILE_WRITE);
+    if (!f) return false;
+    bool ok = f.seek(position * sizeof(JournalIndexEntry)) &&
+              f.write((const uint8_t*)&entry, sizeof(entry)) == sizeof(entry);
+    f.close();
+    if (!ok) LOG_W("JOURNAL", "Failed to index segment %lu", entry.segment_seq);
+    return ok;
+}
+
+bool LogJournal::getSegment(uint32_t segment_seq, JournalIndexEntry& entry) {
+    if (segment_seq == _segment_seq && _file) {
+        entry = _current;
+        entry.block_count = _next_index;
+        return true;
+    }
+    if (segment_seq < _first_seq) return false;
+
+    // Entries are appended in segment order
+    uint32_t lo = 0;
+    uint32_t hi = indexCount();
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (!readIndex(mid, entry)) return false;
+        if (entry.segment_seq == segment_seq) return true;
+        if (entry.segment_seq < segment_seq) lo = mid + 1;
+        else hi = mid;
+    }
+    return false;
+}
+
+bool LogJournal::readSegmentBlock(uint32_t segment_seq, uint16_t index, uint8_t* block) {
+    bool ok;
+    if (segment_seq == _segment_seq && _file) {
+        ok = readBlock(index, block);
+    } else {
+        if (!_reader || _reader_seq != segment_seq) {
+            if (_reader) _reader.close();
+            char path[40];
+            segmentPath(segment_seq, path, sizeof(path));
+            _reader = SD.open(path, FILE_READ);
+            _reader_seq = segment_seq;
+            if (!_reader) return false;
+        }
+        SpiArbiter::yieldToCan();
+        SpiArbiter::SdScope sd_busy;
+        ok = _reader.seek((uint32_t)index * JOURNAL_BLOCK_SIZE) &&
+             _reader.read(block, JOURNAL_BLOCK_SIZE) == JOURNAL_BLOCK_SIZE;
+    }
+    return ok && validateBlock(block, segment_seq, index);
+}
+
+int32_t LogJournal::searchTrailer(uint32_t segment_seq, uint16_t first_block, uint16_t count,
+                                  uint16_t per_block, size_t entry_size, uint64_t (*key)(const uint8_t*),
+                                  uint64_t target, void* out) {
+    // Last entry with key <= target; each probe reads at most one block
+    uint8_t block[JOURNAL_BLOCK_SIZE];
+    int32_t cached = -1;
+    auto fetch = [&](uint16_t k) -> const uint8_t* {
+        int32_t b = k / per_block;
+        if (b != cached) {
+            if (!readSegmentBlock(segment_seq, first_block + b, block)) return nullptr;
+            cached = b;
+        }
+        return block + sizeof(JournalBlockHeader) + (k % per_block) * entry_size;
+    };
+
+    uint16_t lo = 0;
+    uint16_t hi = count;
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        const uint8_t* entry = fetch(mid);
+        if (!entry) return -1;
+        if (key(entry) <= target) lo = mid + 1;
+        else hi = mid;
+    }
+    const uint8_t* entry = lo ? fetch(lo - 1) : nullptr;
+    if (!entry) return -1;
+    memcpy(out, entry, entry_size);
+    return lo - 1;
+}
+
+bool LogJournal::readIndexEntry(void* context, uint32_t position, JournalIndexEntry& entry) {
+    return ((LogJournal*)context)->readIndex(position, entry);
+}
+
+bool LogJournal::findTime(uint64_t utc_ms, Location& at) {
+    // Closed segments through index.bin, then the open one
+    JournalIndexEntry entry;
+    if (JournalIndex::findTime(readIndexEntry, this, indexCount(), _first_seq, utc_ms, entry)) {
+        JournalTimeEntry time;
+        at.segment_seq = entry.segment_seq;
+        at.block = searchTrailer(entry.segment_seq, entry.data_blocks + 1, entry.time_count,
+                                 TIME_PER_BLOCK, sizeof(JournalTimeEntry), timeKey, utc_ms, &time) >= 0
+                   ? time.block : 1;
+        return true;
+    }
+
+    if (_file && _current.data_blocks && _current.last_utc_ms >= utc_ms) {
+        uint16_t k = 0;
+        while (k < _current.time_count && _time_index[k].first_utc_ms <= utc_ms) k++;
+        at.segment_seq = _segment_seq;
+        at.block = k ? _time_index[k - 1].block : 1;
+        return true;
+    }
+    return false;
+}
+
+bool LogJournal::findId(uint32_t segment_seq, uint32_t id, JournalIdEntry& entry) {
+    JournalIndexEntry segment;
+    if (!getSegment(segment_seq, segment)) return false;
+
+    bool found;
+    if (segment_seq == _segment_seq && _file) {
+        uint16_t lo = 0;
+        uint16_t hi = _current.id_count;
+        while (lo < hi) {
+            uint16_t mid = (lo + hi) / 2;
+            if (_id_index[mid].id < id) lo = mid + 1;
+            else hi = mid;
+        }
+        found = lo < _current.id_count && _id_index[lo].id == id;
+        if (found) entry = _id_index[lo];
+    } else {
+        uint16_t time_blocks = (segment.time_count + TIME_PER_BLOCK - 1) / TIME_PER_BLOCK;
+        found = searchTrailer(segment_seq, segment.data_blocks + 1 + time_blocks, segment.id_count,
+                              IDS_PER_BLOCK, sizeof(JournalIdEntry), idKey, id, &entry) >= 0 &&
+                entry.id == id;
+    }
+    if (found) return true;
+
+    if (!(segment.flags & JOURNAL_INDEX_IDS_COMPLETE) && segment.data_blocks) {
+        entry.id = id;
+        entry.first_block = 1;
+        entry.last_block = segment.data_blocks;
+        entry.frames = 0;
+        return true;
+    }
+    return false;
+}
+
+void LogJournal::finishBlock(uint8_t* block, uint8_t kind, uint16_t index) {
+    JournalBlockHeader* header = (JournalBlockHeader*)block;
+    header->magic = JOURNAL_MAGIC;
+    header->version = JOURNAL_VERSION;
+    header->kind = kind;
+    header->block_index = index;
+    header->segment_seq = _segment_seq;
+    header->block_seq = _block_seq;
+    header->crc = 0;
+    header->crc = Crc32::update(0, block, JOURNAL_BLOCK_SIZE);
+}
+
+bool LogJournal::validateBlock(const uint8_t* block, uint32_t segment_seq, uint16_t block_index) {
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION ||
+        header->segment_seq != segment_seq || header->block_index != block_index ||
+        header->payload_length > JOURNAL_PAYLOAD_SIZE) {
+        return false;
+    }
+
+    static const uint8_t zero[sizeof(header->crc)] = {0};
+    const size_t crc_at = offsetof(JournalBlockHeader, crc);
+    const size_t after = crc_at + sizeof(header->crc);
+    uint32_t crc = Crc32::update(0, block, crc_at);
+    crc = Crc32::update(crc, zero, sizeof(zero));
+    crc = Crc32::update(crc, block + after, JOURNAL_BLOCK_SIZE - after);
+    return crc == header->crc;
+}
+
+void LogJournal::segmentPath(uint32_t seq, char* path, size_t size) {
+    snprintf(path, size, "%s/seg_%08lu.bin", JOURNAL_DIR, (unsigned long)seq);
+}
+
+uint8_t* LogJournal::openBlock() {
+    uint8_t* block = _queue[(_head + _sealed) % JOURNAL_QUEUE_BLOCKS];
+    if (_fill) return block;
+    if (_sealed >= JOURNAL_QUEUE_BLOCKS) return nullptr;
+
+    // Zeroed so the unused tail is deterministic under the CRC
+    memset(block, 0, JOURNAL_BLOCK_SIZE);
+    _fill = sizeof(JournalBlockHeader);
+    return block;
+}
+
+bool LogJournal::hasRoom(size_t length) const {
+    size_t need = sizeof(JournalRecordHeader) + length;
+    if (_fill) return _fill + need <= JOURNAL_BLOCK_SIZE || _sealed + 1 < JOURNAL_QUEUE_BLOCKS;
+    return _sealed < JOURNAL_QUEUE_BLOCKS;
+}
+
+bool LogJournal::append(uint8_t type, const void* record, uint8_t length, uint32_t timestamp) {
+    size_t need = sizeof(JournalRecordHeader) + length;
+    if (!hasRoom(length)) return false;
+    if (_fill && _fill + need > JOURNAL_BLOCK_SIZE) seal();
+
+    uint8_t* block = openBlock();
+    JournalBlockHeader* header = (JournalBlockHeader*)block;
+    if (header->record_count == 0) {
+        header->first_timestamp = timestamp;
+        header->last_timestamp = timestamp;
+        header->first_utc_ms = ClockSync::toUtcMs(timestamp);
+    } else if ((int32_t)(timestamp - header->last_timestamp) > 0) {
+        // GPS and anomaly records can carry a slightly older stamp
+        header->last_timestamp = timestamp;
+    }
+    header->record_count++;
+
+    JournalRecordHeader rec = {type, length};
+    memcpy(block + _fill, &rec, sizeof(rec));
+    memcpy(block + _fill + sizeof(rec), record, length);
+    _fill += need;
+    header->payload_length = _fill - sizeof(JournalBlockHeader);
+    return true;
+}
+
+bool LogJournal::appendCan(const CanFrame& frame, uint16_t suppressed) {
+    uint8_t record[sizeof(JournalCanRecord) + 8];
+    JournalCanRecord* can = (JournalCanRecord*)record;
+    uint8_t dlc = frame.dlc <= 8 ? frame.dlc : 8;
+    can->timestamp = frame.timestamp;
+    can->id = frame.id;
+    can->channel = frame.channel;
+    can->dlc = dlc;
+    can->suppressed = suppressed;
+    memcpy(record + sizeof(JournalCanRecord), frame.data, dlc);
+    return append(JOURNAL_REC_CAN, record, sizeof(JournalCanRecord) + dlc, frame.timestamp);
+}
+
+bool LogJournal::appendGps(const GpsData& gps) {
+    JournalGpsRecord rec;
+    rec.timestamp = gps.timestamp;
+    // The record keeps degrees as doubles; one conversion per fix
+    rec.latitude = gps.latitude_udeg * 1e-6;
+    rec.longitude = gps.longitude_udeg * 1e-6;
+    rec.altitude = gps.altitude;
+    rec.speed = gps.speed;
+    rec.course = gps.course;
+    rec.hdop = gps.hdop;
+    rec.utc_ms = gps.utc_ms;
+    rec.fix_quality = gps.fix_quality;
+    rec.fix_type = gps.fix_type;
+    rec.satellites = gps.satellites;
+    return append(JOURNAL_REC_GPS, &rec, sizeof(rec), gps.timestamp);
+}
+
+bool LogJournal::appendAnomaly(const Anomaly& anomaly) {
+    uint8_t record[sizeof(JournalAnomalyRecord) + sizeof(anomaly.description)];
+    JournalAnomalyRecord* rec = (JournalAnomalyRecord*)record;
+    rec->timestamp = anomaly.timestamp;
+    rec->snapshot_id = anomaly.snapshot_id;
+    rec->can_id = anomaly.can_id;
+    rec->type = anomaly.type;
+    rec->severity = anomaly.severity;
+    size_t text = strnlen(anomaly.description, sizeof(anomaly.description));
+    memcpy(record + sizeof(JournalAnomalyRecord), anomaly.description, text);
+    return append(JOURNAL_REC_ANOMALY, record, sizeof(JournalAnomalyRecord) + text, anomaly.timestamp);
+}
+
+void LogJournal::seal() {
+    if (!_fill) return;
+    _sealed++;
+    _fill = 0;
+}
+
+bool LogJournal::writeBlock() {
+    if (!_sealed || !_segment_seq) return false;
+
+    uint8_t* block = _queue[_head];
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    if (_file && (_next_index > DATA_BLOCKS_MAX ||
+                  (_current.data_blocks &&
+                   header->first_timestamp - _current.first_timestamp >= JOURNAL_SEGMENT_MAX_MS))) {
+        writeTrailer();
+    }
+    if (!_file && !createSegment(_segment_seq + 1)) {
+        PERF_COUNT(SD_WRITE_ERRORS);
+        return false;
+    }
+
+    finishBlock(block, JOURNAL_BLOCK_DATA, _next_index);
+    if (!writeRaw(_next_index, block)) {
+        // Keep the block; the next pass rewrites it at the same index
+        _stats.write_errors++;
+        PERF_COUNT(SD_WRITE_ERRORS);
+        return false;
+    }
+    indexBlock(block, _next_index);
+
+    _head = (_head + 1) % JOURNAL_QUEUE_BLOCKS;
+    _sealed--;
+    _next_index++;
+    _block_seq++;
+    _stats.blocks_written++;
+    return true;
+}
+
+void LogJournal::sync() {
+    if (!_file) return;
+    SpiArbiter::yieldToCan();
+    SpiArbiter::SdScope sd_busy;
+    _file.flush();
+}
+
+LogJournal::Stats LogJournal::getStats() const {
+    Stats stats = _stats;
+    stats.segment_seq = _segment_seq;
+    stats.block_seq = _block_seq;
+    return stats;
+}
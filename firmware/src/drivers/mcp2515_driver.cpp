@@ -1,5 +1,8 @@
 #include "mcp2515_driver.h"
 #include "logger.h"
+#include "perf_counters.h"
+#include "spi_arbiter.h"
+#include <Preferences.h>
 
 // MCP2515 Command definitions
 #define MCP_WRITE       0x02
@@ -26,10 +29,23 @@
 #define CANINTE    0x2B
 #define CANINTF    0x2C
 #define EFLG       0x2D
-#define TXB0CTRL   0x30
+#define TXB0CTRL   0x30    // TXB1CTRL/TXB2CTRL follow at +0x10 steps
 #define RXB0CTRL   0x60
 #define RXB1CTRL   0x70
 
+// TXBnCTRL bits
+#define TXB_ABTF   0x40
+#define TXB_MLOA   0x20
+#define TXB_TXERR  0x10
+#define TXB_TXREQ  0x08
+
+// RX0, RX1 and the three TX buffer interrupts
+#define CANINTE_RX_TX 0x1F
+
+// CANINTF bits
+#define CANINTF_RX  0x03    // RX0IF | RX1IF
+#define CANINTF_MERRF 0x80
+
 // Mode definitions
 #define REQOP_NORMAL   0x00
 #define REQOP_SLEEP    0x20
@@ -37,31 +53,37 @@
 #define REQOP_LISTEN   0x60
 #define REQOP_CONFIG   0x80
 
-MCP2515Driver::MCP2515Driver(uint8_t cs_pin, uint32_t bitrate)
-    : _cs_pin(cs_pin), _bitrate(bitrate), _spi_settings(10000000, MSBFIRST, SPI_MODE0) {
+MCP2515Driver::MCP2515Driver(uint8_t cs_pin, uint8_t int_pin, uint32_t bitrate, uint8_t channel)
+    : _cs_pin(cs_pin), _int_pin(int_pin), _channel(channel), _bitrate(bitrate),
+      _spi_settings(10000000, MSBFIRST, SPI_MODE0), _last_rx_time(0), _listen_only(true), _rate_locked(false),
+      _rx_task(nullptr), _tx_count(0), _tx_mux(portMUX_INITIALIZER_UNLOCKED),
+      _tx_callback(nullptr), _tx_context(nullptr), _ring_head(0), _ring_tail(0) {
+    memset(&_stats, 0, sizeof(Stats));
+    memset(_tx_slots, 0, sizeof(_tx_slots));
     pinMode(_cs_pin, OUTPUT);
     digitalWrite(_cs_pin, HIGH);
 }
 
 MCP2515Driver::~MCP2515Driver() {}
 
-MCP2515Driver::ErrorCode MCP2515Driver::init() {
-    LOG_I("MCP2515", "Initializing CAN controller");
+MCP2515Driver::ErrorCode MCP2515Driver::init(bool listen_only) {
+    LOG_I("MCP2515", "Initializing CAN controller %u", _channel);
+    _listen_only = listen_only;
+    _rate_locked = false;
     SPI.begin();
+    pinMode(_int_pin, INPUT_PULLUP);
 
     // Reset the device
-    digitalWrite(_cs_pin, LOW);
+    select();
     SPI.transfer(0xC0);  // RESET command
-    digitalWrite(_cs_pin, HIGH);
-    delay(10);
-
-    // Set configuration mode
-    modifyRegister(CANCTRL, 0xE0, REQOP_CONFIG);
+    deselect();
     delay(10);
 
-    // Set bitrate
-    if (setBitrate(_bitrate) != ERROR_OK) {
-        LOG_E("MCP2515", "Failed to set bitrate");
+    // Reset leaves the controller in configuration mode. A missing or
+    // unpowered chip reads back 0x00 or 0xFF (floating MISO) instead
+    uint8_t canstat = readRegister(CANSTAT);
+    if ((canstat & 0xE0) != REQOP_CONFIG) {
+        LOG_E("MCP2515", "Channel %u: no controller response (CANSTAT 0x%02X)", _channel, canstat);
         return ERROR_FAIL;
     }
 
@@ -70,14 +92,28 @@ MCP2515Driver::ErrorCode MCP2515Driver::init() {
     writeRegister(RXB1CTRL, 0x60);
 
     // Enable interrupts for RX
-    writeRegister(CANINTE, 0x03);  // Enable RX0 and RX1 interrupts
+    writeRegister(CANINTE, CANINTE_RX_TX);
+
+    // Set bitrate. Probing happens listen-only, so a wrong candidate never
+    // puts error frames on the vehicle bus
+#if CAN_AUTOBAUD
+    ErrorCode rate_result = detectBitrate(CAN_AUTOBAUD_TIMEOUT_MS);
+#else
+    ErrorCode rate_result = setBitrate(_bitrate);
+#endif
+    if (rate_result == ERROR_FAIL) {
+        LOG_E("MCP2515", "Channel %u: failed to set bitrate", _channel);
+        return ERROR_FAIL;
+    }
 
-    // Set normal mode
-    modifyRegister(CANCTRL, 0xE0, REQOP_NORMAL);
-    delay(10);
+    // A fallback rate may be wrong; only listen on it, or the controller
+    // would ACK and send error frames onto the vehicle bus
+    _rate_locked = rate_result == ERROR_OK;
+    if (!_rate_locked) _listen_only = true;
+    if (setMode(_listen_only ? REQOP_LISTEN : REQOP_NORMAL) != ERROR_OK) return ERROR_FAIL;
 
-    LOG_I("MCP2515", "CAN controller initialized successfully");
-    return ERROR_OK;
+    LOG_I("MCP2515", "CAN controller %u initialized (%s)", _channel, _listen_only ? "listen-only" : "normal");
+    return rate_result;
 }
 
 MCP2515Driver::ErrorCode MCP2515Driver::setBitrate(uint32_t bitrate) {
@@ -86,123 +122,490 @@ MCP2515Driver::ErrorCode MCP2515Driver::setBitrate(uint32_t bitrate) {
 }
 
 MCP2515Driver::ErrorCode MCP2515Driver::setBitrateCfg(uint32_t bitrate) {
-    uint8_t cnf1, cnf2, cnf3;
-
-    switch (bitrate) {
-        case 500000:
-            cnf1 = 0x00;
-            cnf2 = 0x90;
-            cnf3 = 0x82;
-            break;
-        case 250000:
-            cnf1 = 0x04;
-            cnf2 = 0x90;
-            cnf3 = 0x82;
-            break;
-        case 125000:
-            cnf1 = 0x09;
-            cnf2 = 0x90;
-            cnf3 = 0x82;
-            break;
-        default:
-            LOG_E("MCP2515", "Unsupported bitrate: %lu", bitrate);
-            return ERROR_FAIL;
+    uint8_t cnf[3];
+    if (!computeTiming(bitrate, MCP2515_CRYSTAL_HZ, cnf)) {
+        LOG_E("MCP2515", "Unsupported bitrate: %lu", bitrate);
+        return ERROR_FAIL;
     }
 
-    writeRegister(CNF1, cnf1);
-    writeRegister(CNF2, cnf2);
-    writeRegister(CNF3, cnf3);
+    writeRegister(CNF1, cnf[0]);
+    writeRegister(CNF2, cnf[1]);
+    writeRegister(CNF3, cnf[2]);
 
     return ERROR_OK;
 }
 
+bool MCP2515Driver::computeTiming(uint32_t bitrate, uint32_t crystal_hz, uint8_t cnf[3]) {
+    if (bitrate == 0) return false;
+
+    // Bit time is N quanta of 2 * BRP / Fosc. Candidates rank by rate error,
+    // then sample point error; BRP ascends, so N descends and the first of
+    // equals has the finest resolution.
+    uint16_t target = bitrate > 800000 ? 750 : 875;    // Sample point, 0.1 % units
+    bool found = false;
+    uint32_t best_error = 0;
+    uint16_t best_offset = 0;
+    uint8_t best_brp = 0, best_prop = 0, best_ps1 = 0, best_ps2 = 0;
+    for (uint8_t brp = 1; brp <= 64; brp++) {
+        uint32_t n = (crystal_hz / (2 * brp) + bitrate / 2) / bitrate;
+        if (n < 8) break;
+        if (n > 25) continue;
+
+        uint64_t ideal = (uint64_t)bitrate * 2 * brp * n;
+        uint64_t diff = ideal > crystal_hz ? ideal - crystal_hz : crystal_hz - ideal;
+        uint32_t error = (uint32_t)(diff * 10000 / crystal_hz);   // 0.01 % units
+        if (error > 50) continue;
+
+        // Quanta up to the sample point, sync segment included
+        uint8_t sample = bitrate > 800000 ? (n * 3 + 2) / 4 : (n * 7 + 4) / 8;
+        uint8_t ps2 = n - sample;
+        if (ps2 < 2) ps2 = 2;               // Information processing time
+        if (n - 1 - ps2 > 16) ps2 = n - 17; // PROP + PS1 cap at 16; the rest goes to PS2
+        if (ps2 > 8) continue;
+        uint8_t tseg1 = n - 1 - ps2;        // PROP + PS1
+        uint8_t ps1 = tseg1 / 2;
+        uint8_t prop = tseg1 - ps1;
+        if (prop > 8) {
+            prop = 8;
+            ps1 = tseg1 - 8;
+        }
+        if (ps1 < 1 || prop < 1) continue;
+
+        uint16_t point = (uint32_t)(n - ps2) * 1000 / n;
+        uint16_t offset = point > target ? point - target : target - point;
+        if (!found || error < best_error || (error == best_error && offset < best_offset)) {
+            found = true;
+            best_error = error;
+            best_offset = offset;
+            best_brp = brp;
+            best_prop = prop;
+            best_ps1 = ps1;
+            best_ps2 = ps2;
+        }
+    }
+    if (!found) return false;
+
+    uint8_t sjw = best_ps2 - 1 < 4 ? best_ps2 - 1 : 4;    // PS2 > SJW
+    if (best_ps1 < sjw) sjw = best_ps1;
+    cnf[0] = ((sjw - 1) << 6) | (best_brp - 1);
+    cnf[1] = 0x80 | ((best_ps1 - 1) << 3) | (best_prop - 1);   // BTLMODE: PS2 from CNF3
+    cnf[2] = 0x80 | (best_ps2 - 1);                            // SOF signal on CLKOUT
+    return true;
+}
+
+// Tried after the cached rate, most common first
+static const uint32_t AUTOBAUD_RATES[] = {500000, 250000, 125000, 1000000, 100000, 83333, 50000, 33333};
+
+MCP2515Driver::ErrorCode MCP2515Driver::detectBitrate(uint32_t timeout_ms) {
+    uint32_t start = millis();
+    uint8_t cnf[3];
+    uint32_t cached = loadCachedBitrate();
+    uint32_t first = cached && computeTiming(cached, MCP2515_CRYSTAL_HZ, cnf) ? cached : _bitrate;
+    _stats.bitrate_probes = 0;
+    _stats.bitrate_lock_ms = 0;
+
+    // A locked rate is known after the first valid frame; a bus that stays
+    // silent at every rate gives nothing to lock onto, so stop after one sweep
+    bool activity = true;
+    while (activity && millis() - start < timeout_ms) {
+        activity = false;
+        for (int8_t i = -1; i < (int8_t)(sizeof(AUTOBAUD_RATES) / sizeof(AUTOBAUD_RATES[0])); i++) {
+            uint32_t rate = i < 0 ? first : AUTOBAUD_RATES[i];
+            if (i >= 0 && rate == first) continue;
+
+            ProbeResult result = probeBitrate(rate);
+            if (result == PROBE_FAILED) return ERROR_FAIL;
+            if (result == PROBE_UNSUPPORTED) continue;
+            _stats.bitrate_probes++;
+
+            if (result == PROBE_LOCKED) {
+                _stats.bitrate_lock_ms = millis() - start;
+                LOG_I("MCP2515", "Channel %u locked at %lu bit/s in %lu ms (%u probes)",
+                      _channel, rate, _stats.bitrate_lock_ms, _stats.bitrate_probes);
+                if (rate != cached) storeCachedBitrate(rate);
+                return ERROR_OK;
+            }
+            if (result == PROBE_ERRORS) activity = true;
+            // A quiet bus at the cached rate is most likely ignition-on before
+            // the ECUs talk; capture on it rather than sweep
+            if (i < 0 && result == PROBE_SILENT && first == cached) break;
+            if (millis() - start >= timeout_ms) break;
+        }
+    }
+
+    LOG_W("MCP2515", "Channel %u: no bitrate lock (%s), using %lu bit/s",
+          _channel, activity ? "timeout" : "bus silent", first);
+    if (setMode(REQOP_CONFIG) != ERROR_OK || setBitrate(first) != ERROR_OK) return ERROR_FAIL;
+    return ERROR_NOMSG;
+}
+
+MCP2515Driver::ProbeResult MCP2515Driver::probeBitrate(uint32_t bitrate) {
+    if (setMode(REQOP_CONFIG) != ERROR_OK) return PROBE_FAILED;
+    if (setBitrateCfg(bitrate) != ERROR_OK) return PROBE_UNSUPPORTED;
+    _bitrate = bitrate;
+    modifyRegister(CANINTF, 0xFF, 0x00);
+    if (setMode(REQOP_LISTEN) != ERROR_OK) return PROBE_FAILED;
+
+    // Listen-only stores only frames that passed CRC, so one is proof; a
+    // wrong rate shows up as MERRF from stuff/form/CRC errors
+    uint32_t start = millis();
+    uint8_t errors = 0;
+    while (millis() - start < CAN_AUTOBAUD_DWELL_MS) {
+        uint8_t flags = readRegister(CANINTF);
+        if (flags & CANINTF_RX) return PROBE_LOCKED;
+        if (flags & CANINTF_MERRF) {
+            modifyRegister(CANINTF, CANINTF_MERRF, 0x00);
+            if (++errors >= CAN_AUTOBAUD_MAX_ERRORS) return PROBE_ERRORS;
+        }
+        delay(1);
+    }
+    return errors ? PROBE_ERRORS : PROBE_SILENT;
+}
+
+uint32_t MCP2515Driver::loadCachedBitrate() {
+    Preferences prefs;
+    char key[8];
+    snprintf(key, sizeof(key), "rate%u", _channel);
+    prefs.begin("can", true);
+    uint32_t bitrate = prefs.getUInt(key, 0);
+    prefs.end();
+    return bitrate;
+}
+
+void MCP2515Driver::storeCachedBitrate(uint32_t bitrate) {
+    Preferences prefs;
+    char key[8];
+    snprintf(key, sizeof(key), "rate%u", _channel);
+    prefs.begin("can", false);
+    prefs.putUInt(key, bitrate);
+    prefs.end();
+}
+
 MCP2515Driver::ErrorCode MCP2515Driver::setListenOnly(bool enable) {
-    uint8_t mode = enable ? REQOP_LISTEN : REQOP_NORMAL;
+    if (!enable && !_rate_locked) return ERROR_FAIL;
+    _listen_only = enable;
+    return setMode(enable ? REQOP_LISTEN : REQOP_NORMAL);
+}
+
+MCP2515Driver::ErrorCode MCP2515Driver::setMode(uint8_t mode) {
     modifyRegister(CANCTRL, 0xE0, mode);
-    delay(10);
+
+    // Mode changes complete within a few bit times; poll OPMOD rather
+    // than sleeping a fixed 10 ms
+    uint32_t start = micros();
+    while ((readRegister(CANSTAT) & 0xE0) != mode) {
+        if (micros() - start > 10000) {
+            LOG_E("MCP2515", "Mode change to 0x%02X timed out", mode);
+            return ERROR_FAIL;
+        }
+    }
     return ERROR_OK;
 }
 
-MCP2515Driver::ErrorCode MCP2515Driver::readFrame(CanFrame& frame) {
-    uint8_t status = getStatus();
+MCP2515Driver::ErrorCode MCP2515Driver::sleep() {
+    // INT must be released before sleeping or the host wakes immediately
+    writeRegister(CANINTE, 0x40);           // WAKIE only
+    modifyRegister(CANINTF, 0xFF, 0x00);
+    return setMode(REQOP_SLEEP);
+}
 
-    if (status & 0x01) {  // RXB0 has message
-        readFrame(0x61, frame);
-        modifyRegister(CANINTF, 0x01, 0x00);  // Clear RXB0IF
-        return ERROR_OK;
-    }
+MCP2515Driver::ErrorCode MCP2515Driver::wake() {
+    // Bus activity wakes the controller into listen-only mode; the frame
+    // that caused the wake-up is not received
+    modifyRegister(CANINTF, 0x40, 0x00);    // Clear WAKIF
+    writeRegister(CANINTE, CANINTE_RX_TX);
+    return setMode(_listen_only ? REQOP_LISTEN : REQOP_NORMAL);
+}
 
-    if (status & 0x02) {  // RXB1 has message
-        readFrame(0x71, frame);
-        modifyRegister(CANINTF, 0x02, 0x00);  // Clear RXB1IF
-        return ERROR_OK;
+uint8_t MCP2515Driver::service(uint8_t max_frames) {
+    uint8_t moved = 0;
+
+    while (moved < max_frames) {
+        uint8_t status = getStatus();
+        uint8_t command;
+        if (status & 0x01) {          // RXB0 has message
+            command = MCP_READ_RX0;
+        } else if (status & 0x02) {   // RXB1 has message
+            command = MCP_READ_RX1;
+        } else {
+            checkOverflow();
+            break;
+        }
+
+        CanFrame frame;
+        {
+            PERF_SCOPE(STAGE_CAN_READ);
+            readRxBuffer(command, frame);
+        }
+        moved++;
+        _stats.frames++;
+        _last_rx_time = frame.timestamp;
+        PERF_COUNT(FRAMES_RECEIVED);
+
+        uint16_t head = _ring_head.load(std::memory_order_relaxed);
+        uint16_t used = head - _ring_tail.load(std::memory_order_acquire);
+        if (used >= CAN_RX_RING_SIZE) {
+            _stats.ring_dropped++;
+            PERF_COUNT(FRAMES_DROPPED);
+            continue;
+        }
+        _ring[head & (CAN_RX_RING_SIZE - 1)] = frame;
+        _ring_head.store(head + 1, std::memory_order_release);
+        if (used + 1 > _stats.ring_high_water) _stats.ring_high_water = used + 1;
     }
 
-    return ERROR_NOMSG;
+    return moved;
 }
 
-void MCP2515Driver::readFrame(uint8_t buffer_addr, CanFrame& frame) {
-    digitalWrite(_cs_pin, LOW);
-    SPI.transfer(MCP_READ);
-    SPI.transfer(buffer_addr);
+MCP2515Driver::ErrorCode MCP2515Driver::readFrame(CanFrame& frame) {
+    uint16_t tail = _ring_tail.load(std::memory_order_relaxed);
+    if (tail == _ring_head.load(std::memory_order_acquire)) return ERROR_NOMSG;
+
+    frame = _ring[tail & (CAN_RX_RING_SIZE - 1)];
+    _ring_tail.store(tail + 1, std::memory_order_release);
+    return ERROR_OK;
+}
+
+uint8_t MCP2515Driver::checkOverflow() {
+    // RX0OVR/RX1OVR are sticky: one count per overflow event, not per lost frame
+    uint8_t eflg = readRegister(EFLG);
+    uint8_t overflows = ((eflg >> 6) & 0x01) + ((eflg >> 7) & 0x01);
+    if (overflows) {
+        modifyRegister(EFLG, 0xC0, 0x00);
+        _stats.overflows += overflows;
+        PerfCounters::increment(PerfCounters::FRAMES_DROPPED, overflows);
+    }
+    return overflows;
+}
+
+void MCP2515Driver::readRxBuffer(uint8_t command, CanFrame& frame) {
+    // READ RX BUFFER starts at RXBnSIDH and clears RXnIF when CS rises,
+    // saving the separate BIT MODIFY transaction
+    select();
+    SPI.transfer(command);
+
+    uint8_t sidh = SPI.transfer(0x00);
+    uint8_t sidl = SPI.transfer(0x00);
+    uint8_t eid8 = SPI.transfer(0x00);
+    uint8_t eid0 = SPI.transfer(0x00);
 
-    frame.id = (uint32_t)SPI.transfer(0x00) << 3;
-    frame.id |= (uint32_t)SPI.transfer(0x00) >> 5;
+    frame.id = ((uint32_t)sidh << 3) | (sidl >> 5);
+    if (sidl & 0x08) {  // IDE: 29-bit identifier
+        frame.id = (frame.id << 18) | ((uint32_t)(sidl & 0x03) << 16) | ((uint32_t)eid8 << 8) | eid0;
+    }
 
-    SPI.transfer(0x00);  // Skip EXIDE, SRTR, IDE
     frame.dlc = SPI.transfer(0x00) & 0x0F;
+    if (frame.dlc > 8) frame.dlc = 8;
 
     for (int i = 0; i < frame.dlc; i++) {
         frame.data[i] = SPI.transfer(0x00);
     }
 
-    digitalWrite(_cs_pin, HIGH);
+    deselect();
+    frame.channel = _channel;
     frame.timestamp = millis();
 }
 
-MCP2515Driver::ErrorCode MCP2515Driver::writeFrame(const CanFrame& frame) {
-    LOG_D("MCP2515", "Writing CAN frame: ID=0x%03X DLC=%d", frame.id, frame.dlc);
+MCP2515Driver::ErrorCode MCP2515Driver::writeFrame(const CanFrame& frame, uint8_t priority, uint32_t tag) {
+    if (_listen_only) return ERROR_FAIL;
+
+    TxEntry entry;
+    entry.frame = frame;
+    entry.tag = tag;
+    entry.queued_us = micros();
+    entry.priority = priority > 3 ? 3 : priority;
+
+    portENTER_CRITICAL(&_tx_mux);
+    if (_tx_count >= CAN_TX_QUEUE_SIZE) {
+        portEXIT_CRITICAL(&_tx_mux);
+        _stats.tx_queue_full++;
+        return ERROR_ALLTXBUSY;
+    }
+    uint8_t pos = _tx_count;
+    while (pos > 0 && _tx_queue[pos - 1].priority < entry.priority) {
+        _tx_queue[pos] = _tx_queue[pos - 1];
+        pos--;
+    }
+    _tx_queue[pos] = entry;
+    _tx_count++;
+    portEXIT_CRITICAL(&_tx_mux);
+
+    _stats.tx_queued++;
+    LOG_D("MCP2515", "TX queued: ID=0x%03X DLC=%d prio=%u", frame.id, frame.dlc, entry.priority);
+    if (_rx_task) xTaskNotifyGive(_rx_task);
     return ERROR_OK;
 }
 
+void MCP2515Driver::serviceTx() {
+    bool busy = false;
+    for (uint8_t b = 0; b < TX_BUFFERS; b++) busy |= _tx_slots[b].busy;
+    if (!busy && _tx_count == 0) return;
+
+    // READ STATUS: TXnREQ at bit 2+2n, TXnIF at bit 3+2n
+    uint8_t status = getStatus();
+    uint32_t now = millis();
+
+    for (uint8_t b = 0; b < TX_BUFFERS; b++) {
+        TxSlot& slot = _tx_slots[b];
+        if (!slot.busy) continue;
+
+        if (status & (0x08 << (b * 2))) {
+            modifyRegister(CANINTF, 0x04 << b, 0x00);
+            completeTx(b, TX_SENT);
+            continue;
+        }
+
+        uint8_t ctrl_addr = TXB0CTRL + b * 0x10;
+        uint8_t ctrl = readRegister(ctrl_addr);
+        if (ctrl & TXB_MLOA) slot.arbitration_lost = true;
+
+        if (!(status & (0x04 << (b * 2)))) {
+            // TXREQ dropped without TXnIF: our abort took effect
+            completeTx(b, (ctrl & TXB_TXERR) ? TX_ERROR : TX_ABORTED);
+        } else if (now - slot.loaded_ms > CAN_TX_TIMEOUT_MS && !(ctrl & TXB_ABTF)) {
+            // A frame already on the wire still completes; the next pass
+            // reports whichever happened
+            modifyRegister(ctrl_addr, TXB_TXREQ, 0x00);
+        }
+    }
+
+    // Refill free buffers. Only one frame per priority level is loaded at a
+    // time: the controller breaks TXP ties by buffer number, which would
+    // reorder frames queued at the same level.
+    for (uint8_t b = 0; b < TX_BUFFERS; b++) {
+        if (_tx_slots[b].busy) continue;
+
+        uint8_t levels = 0;
+        for (uint8_t i = 0; i < TX_BUFFERS; i++) {
+            if (_tx_slots[i].busy) levels |= 1 << _tx_slots[i].entry.priority;
+        }
+
+        bool found = false;
+        TxEntry entry;
+        portENTER_CRITICAL(&_tx_mux);
+        for (uint8_t i = 0; i < _tx_count; i++) {
+            if (levels & (1 << _tx_queue[i].priority)) continue;
+            entry = _tx_queue[i];
+            memmove(&_tx_queue[i], &_tx_queue[i + 1], (_tx_count - i - 1) * sizeof(TxEntry));
+            _tx_count--;
+            found = true;
+            break;
+        }
+        portEXIT_CRITICAL(&_tx_mux);
+        if (!found) break;
+
+        TxSlot& slot = _tx_slots[b];
+        slot.entry = entry;
+        slot.loaded_ms = now;
+        slot.arbitration_lost = false;
+        slot.busy = true;
+        writeRegister(TXB0CTRL + b * 0x10, entry.priority);
+        writeFrame(b, entry.frame);
+    }
+}
+
+void MCP2515Driver::writeFrame(uint8_t buffer, const CanFrame& frame) {
+    uint8_t dlc = frame.dlc > 8 ? 8 : frame.dlc;
+
+    // LOAD TX BUFFER starts at TXBnSIDH
+    select();
+    SPI.transfer(MCP_LOAD_TX0 + buffer * 2);
+    if (frame.id > 0x7FF) {
+        SPI.transfer(frame.id >> 21);
+        SPI.transfer(((frame.id >> 13) & 0xE0) | 0x08 | ((frame.id >> 16) & 0x03));
+        SPI.transfer(frame.id >> 8);
+        SPI.transfer(frame.id);
+    } else {
+        SPI.transfer(frame.id >> 3);
+        SPI.transfer((frame.id & 0x07) << 5);
+        SPI.transfer(0x00);
+        SPI.transfer(0x00);
+    }
+    SPI.transfer(dlc);
+    for (uint8_t i = 0; i < dlc; i++) {
+        SPI.transfer(frame.data[i]);
+    }
+    deselect();
+
+    // RTS TXBn is 0x81/0x82/0x84
+    sendCommand(0x80 | (1 << buffer));
+}
+
+void MCP2515Driver::completeTx(uint8_t buffer, TxStatus status) {
+    TxSlot& slot = _tx_slots[buffer];
+    slot.busy = false;
+
+    switch (status) {
+        case TX_SENT:    _stats.tx_sent++; break;
+        case TX_ABORTED: _stats.tx_aborted++; break;
+        case TX_ERROR:   _stats.tx_errors++; break;
+    }
+    if (slot.arbitration_lost) _stats.tx_arbitration_lost++;
+
+    if (_tx_callback) {
+        TxResult result;
+        result.id = slot.entry.frame.id;
+        result.tag = slot.entry.tag;
+        result.latency_us = micros() - slot.entry.queued_us;
+        result.status = status;
+        result.channel = _channel;
+        _tx_callback(result, _tx_context);
+    }
+}
+
 uint8_t MCP2515Driver::getStatus() {
-    digitalWrite(_cs_pin, LOW);
+    select();
     SPI.transfer(MCP_READ_STATUS);
     uint8_t status = SPI.transfer(0x00);
-    digitalWrite(_cs_pin, HIGH);
+    deselect();
     return status;
 }
 
+uint8_t MCP2515Driver::sendCommand(uint8_t cmd) {
+    select();
+    uint8_t result = SPI.transfer(cmd);
+    deselect();
+    return result;
+}
+
 uint8_t MCP2515Driver::readRegister(uint8_t address) {
-    digitalWrite(_cs_pin, LOW);
+    select();
     SPI.transfer(MCP_READ);
     SPI.transfer(address);
     uint8_t value = SPI.transfer(0x00);
-    digitalWrite(_cs_pin, HIGH);
+    deselect();
     return value;
 }
 
 void MCP2515Driver::writeRegister(uint8_t address, uint8_t value) {
-    digitalWrite(_cs_pin, LOW);
+    select();
     SPI.transfer(MCP_WRITE);
     SPI.transfer(address);
     SPI.transfer(value);
-    digitalWrite(_cs_pin, HIGH);
+    deselect();
 }
 
 void MCP2515Driver::modifyRegister(uint8_t address, uint8_t mask, uint8_t data) {
-    digitalWrite(_cs_pin, LOW);
+    select();
     SPI.transfer(MCP_BITMOD);
     SPI.transfer(address);
     SPI.transfer(mask);
     SPI.transfer(data);
-    digitalWrite(_cs_pin, HIGH);
+    deselect();
+}
+
+void IRAM_ATTR MCP2515Driver::onInterrupt(void* arg) {
+    MCP2515Driver* driver = static_cast<MCP2515Driver*>(arg);
+    BaseType_t woken = pdFALSE;
+    SpiArbiter::onCanInterrupt();
+    if (driver->_rx_task) vTaskNotifyGiveFromISR(driver->_rx_task, &woken);
+    portYIELD_FROM_ISR(woken);
 }
 
 void MCP2515Driver::enableInterrupt() {
-    attachInterrupt(digitalPinToInterrupt(CAN_INT_PIN), [](){}, FALLING);
+    attachInterruptArg(digitalPinToInterrupt(_int_pin), onInterrupt, this, FALLING);
 }
 
 void MCP2515Driver::disableInterrupt() {
-    detachInterrupt(digitalPinToInterrupt(CAN_INT_PIN));
+    detachInterrupt(digitalPinToInterrupt(_int_pin));
 }
@@ -0,0 +1,498 @@
+#include "mqtt_transport.h"
+#include "logger.h"
+
+static_assert((MQTT_QUEUE_BYTES & (MQTT_QUEUE_BYTES - 1)) == 0, "MQTT_QUEUE_BYTES must be a power of two");
+static_assert(MQTT_QUEUE_BYTES >= 2 * MQTT_MAX_PACKET_SIZE, "MQTT_QUEUE_BYTES must hold a full-size message");
+
+// MQTT 3.1.1 control packet types (high nibble of the fixed header)
+enum : uint8_t {
+    PKT_CONNECT = 0x10,
+    PKT_CONNACK = 0x20,
+    PKT_PUBLISH = 0x30,
+    PKT_PUBACK = 0x40,
+    PKT_SUBSCRIBE = 0x82,
+    PKT_SUBACK = 0x90,
+    PKT_PINGREQ = 0xC0,
+    PKT_PINGRESP = 0xD0,
+    PKT_DISCONNECT = 0xE0
+};
+
+static const size_t TOPIC_MAX = 112;          // Keeps a PUBLISH header in one small buffer
+static const uint32_t CONNACK_TIMEOUT_MS = 5000;
+static const uint32_t READ_TIMEOUT_MS = 1000;  // Rest of a packet once its first byte is in
+
+MqttTransport::MqttTransport()
+    : _host(nullptr), _port(0), _client_id(nullptr), _user(nullptr), _password(nullptr),
+      _subscribe_topic(nullptr), _task(nullptr), _connected(false), _enabled(false), _ring(nullptr),
+      _head(0), _tail(0), _send(0), _congested(false), _inflight_count(0), _next_packet_id(1),
+      _last_attempt(0), _last_tx(0), _last_rx(0), _ping_pending(false), _lock(portMUX_INITIALIZER_UNLOCKED),
+      _publish_sum_us(0), _publish_count(0), _ack_sum_us(0), _ack_count(0) {
+    memset(&_stats, 0, sizeof(Stats));
+}
+
+bool MqttTransport::begin(const char* host, uint16_t port, const char* client_id,
+                          const char* user, const char* password, const char* subscribe_topic) {
+    _host = host;
+    _port = port;
+    _client_id = client_id;
+    _user = user;
+    _password = password;
+    _subscribe_topic = subscribe_topic;
+    if (!_ring) {
+        _ring = (uint8_t*)malloc(MQTT_QUEUE_BYTES);
+        if (!_ring) {
+            LOG_E("MQTT", "No memory for the %u-byte outbound ring", MQTT_QUEUE_BYTES);
+            return false;
+        }
+    }
+    _enabled.store(true);
+    if (!_task) {
+        xTaskCreatePinnedToCore(taskEntry, "mqtt", 4096, this, MQTT_TASK_PRIORITY, &_task, MQTT_TASK_CORE);
+    } else {
+        xTaskNotifyGive(_task);
+    }
+    return _task != nullptr;
+}
+
+void MqttTransport::disconnect() {
+    _enabled.store(false);
+    if (_task) xTaskNotifyGive(_task);
+}
+
+bool MqttTransport::publish(const char* topic, const uint8_t* payload, size_t length, uint8_t qos) {
+    if (!_ring) return false;
+    size_t topic_length = strlen(topic);
+    uint32_t need = (sizeof(Record) + topic_length + length + 3) & ~3u;
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+
+    // Records are contiguous: one that would straddle the end starts over at 0
+    uint32_t offset = head % MQTT_QUEUE_BYTES;
+    uint32_t pad = MQTT_QUEUE_BYTES - offset < need ? MQTT_QUEUE_BYTES - offset : 0;
+    if (topic_length > TOPIC_MAX || length > MQTT_MAX_PACKET_SIZE ||
+        head + pad + need - tail > MQTT_QUEUE_BYTES) {
+        portENTER_CRITICAL(&_lock);
+        _stats.dropped++;
+        portEXIT_CRITICAL(&_lock);
+        return false;
+    }
+    if (pad >= sizeof(Record)) {
+        Record* skip = (Record*)&_ring[offset];
+        skip->length = pad;
+        skip->flags = REC_SKIP;
+    }
+
+    Record* record = (Record*)&_ring[(head + pad) % MQTT_QUEUE_BYTES];
+    record->length = need;
+    record->payload_length = length;
+    record->queued_us = micros();
+    record->sent_us = 0;
+    record->topic_length = topic_length;
+    record->packet_id = 0;
+    record->qos = qos ? 1 : 0;
+    record->flags = 0;
+    uint8_t* data = (uint8_t*)(record + 1);
+    memcpy(data, topic, topic_length);
+    memcpy(data + topic_length, payload, length);
+
+    head += pad + need;
+    _head.store(head, std::memory_order_release);
+    portENTER_CRITICAL(&_lock);
+    _stats.queued++;
+    if (head - tail > _stats.queue_peak) _stats.queue_peak = head - tail;
+    portEXIT_CRITICAL(&_lock);
+
+    if (_task) xTaskNotifyGive(_task);
+    return true;
+}
+
+bool MqttTransport::isCongested() {
+    size_t used = queuedBytes();
+    if (_congested) {
+        if (used < (size_t)MQTT_QUEUE_BYTES * MQTT_QUEUE_LOW_WATER / 100) _congested = false;
+    } else if (used > (size_t)MQTT_QUEUE_BYTES * MQTT_QUEUE_HIGH_WATER / 100) {
+        _congested = true;
+        portENTER_CRITICAL(&_lock);
+        _stats.congested++;
+        portEXIT_CRITICAL(&_lock);
+    }
+    return _congested;
+}
+
+size_t MqttTransport::queuedBytes() const {
+    return _head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_relaxed);
+}
+
+MqttTransport::Stats MqttTransport::takeStats() {
+    portENTER_CRITICAL(&_lock);
+    Stats stats = _stats;
+    stats.publish_avg_us = _publish_count ? _publish_sum_us / _publish_count : 0;
+    stats.ack_avg_us = _ack_count ? _ack_sum_us / _ack_count : 0;
+    _publish_sum_us = 0;
+    _publish_count = 0;
+    _ack_sum_us = 0;
+    _ack_count = 0;
+    _stats.publish_max_us = 0;
+    _stats.ack_max_us = 0;
+    portEXIT_CRITICAL(&_lock);
+    return stats;
+}
+
+void MqttTransport::taskEntry(void* arg) {
+    static_cast<MqttTransport*>(arg)->run();
+}
+
+void MqttTransport::run() {
+    for (;;) {
+        if (!_enabled.load()) {
+            if (_connected.load()) {
+                const uint8_t packet[] = {PKT_DISCONNECT, 0};
+                writeAll(packet, sizeof(packet));
+                dropConnection(nullptr);
+            }
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            continue;
+        }
+        if (WiFi.status() != WL_CONNECTED) {
+            if (_connected.load()) dropConnection("WiFi down");
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            continue;
+        }
+        if (!_connected.load()) {
+            if (_last_attempt && millis() - _last_attempt < MQTT_RECONNECT_MS) {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+                continue;
+            }
+            // Blocks this task only; publishers keep queueing
+            _last_attempt = millis();
+            connect();
+            continue;
+        }
+        if (!_client.connected()) {
+            dropConnection("connection closed");
+            continue;
+        }
+
+        while (_connected.load() && _client.available() && readPacket()) {}
+        while (_connected.load() && sendNext()) {}
+        if (!_connected.load()) continue;
+
+        uint32_t now = millis();
+        if (_inflight_count) {
+            uint32_t position = _inflight[0].position;
+            if (micros() - recordAt(position)->sent_us > (uint32_t)MQTT_ACK_TIMEOUT_MS * 1000) {
+                dropConnection("PUBACK timed out");
+                continue;
+            }
+        }
+        if (now - _last_rx > MQTT_KEEPALIVE_S * 1500UL) {
+            dropConnection("broker silent past keepalive");
+            continue;
+        }
+        if (!_ping_pending && (now - _last_tx > MQTT_KEEPALIVE_S * 500UL || now - _last_rx > MQTT_KEEPALIVE_S * 500UL)) {
+            const uint8_t packet[] = {PKT_PINGREQ, 0};
+            if (!writeAll(packet, sizeof(packet))) {
+                dropConnection("write failed");
+                continue;
+            }
+            _ping_pending = true;
+        }
+
+        // Woken early by publish()
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    }
+}
+
+bool MqttTransport::connect() {
+    _client.stop();
+    if (!_client.connect(_host, _port)) {
+        LOG_W("MQTT", "Broker %s:%u unreachable", _host, _port);
+        return false;
+    }
+    _client.setNoDelay(true);
+
+    uint8_t body[192];
+    size_t n = 0;
+    n += putString(body + n, "MQTT");
+    body[n++] = 4;                          // Protocol level 3.1.1
+    body[n++] = 0x02 | (_user ? 0x80 : 0) | (_password ? 0x40 : 0);  // Clean session
+    body[n++] = MQTT_KEEPALIVE_S >> 8;
+    body[n++] = MQTT_KEEPALIVE_S & 0xFF;
+    n += putString(body + n, _client_id);
+    if (_user) n += putString(body + n, _user);
+    if (_password) n += putString(body + n, _password);
+
+    uint8_t header[5];
+    header[0] = PKT_CONNECT;
+    size_t header_length = 1 + encodeLength(header + 1, n);
+    uint8_t connack[4];
+    if (!writeAll(header, header_length) || !writeAll(body, n) ||
+        !readExact(connack, sizeof(connack), CONNACK_TIMEOUT_MS) || connack[0] != PKT_CONNACK) {
+        LOG_W("MQTT", "No CONNACK from %s:%u", _host, _port);
+        _client.stop();
+        return false;
+    }
+    if (connack[3] != 0) {
+        LOG_W("MQTT", "Broker refused connection, rc=%u", connack[3]);
+        _client.stop();
+        return false;
+    }
+
+    if (_subscribe_topic) {
+        n = 0;
+        body[n++] = _next_packet_id >> 8;
+        body[n++] = _next_packet_id & 0xFF;
+        if (++_next_packet_id == 0) _next_packet_id = 1;
+        n += putString(body + n, _subscribe_topic);
+        body[n++] = 0;                      // QoS 0
+        header[0] = PKT_SUBSCRIBE;
+        header_length = 1 + encodeLength(header + 1, n);
+        if (!writeAll(header, header_length) || !writeAll(body, n)) {
+            _client.stop();
+            return false;
+        }
+    }
+
+    // Clean session: the broker kept nothing, so everything not yet
+    // acknowledged goes again from the oldest
+    uint32_t resend = 0;
+    for (uint32_t position = _tail.load(std::memory_order_relaxed); position != _send;) {
+        Record* record = recordAt(position);
+        if (!(record->flags & (REC_SKIP | REC_DONE)) && (record->flags & REC_SENT)) resend++;
+        position += record->length;
+    }
+    _send = _tail.load(std::memory_order_relaxed);
+    _inflight_count = 0;
+    _ping_pending = false;
+    _last_rx = millis();
+
+    portENTER_CRITICAL(&_lock);
+    _stats.reconnects++;
+    _stats.resent += resend;
+    portEXIT_CRITICAL(&_lock);
+    _connected.store(true);
+    LOG_I("MQTT", "Connected to %s:%u, %lu unacknowledged to resend, %u bytes queued",
+          _host, _port, resend, (uint32_t)queuedBytes());
+    return true;
+}
+
+void MqttTransport::dropConnection(const char* reason) {
+    if (reason) LOG_W("MQTT", "Disconnected: %s", reason);
+    _client.stop();
+    _connected.store(false);
+    _inflight_count = 0;
+    _last_attempt = millis();
+}
+
+bool MqttTransport::sendNext() {
+    if (_send == _head.load(std::memory_order_acquire)) return false;
+
+    uint32_t position = _send;
+    Record* record = recordAt(position);
+    if (record->flags & (REC_SKIP | REC_DONE)) {
+        // Padding, or QoS 0 already written before a reconnect
+        _send = position + record->length;
+        return true;
+    }
+    if (record->qos && _inflight_count >= MQTT_INFLIGHT_WINDOW) return false;
+
+    bool first = !(record->flags & REC_SENT);
+    if (!writePublish(record)) {
+        dropConnection("write failed");
+        return false;
+    }
+
+    if (record->qos) {
+        _inflight[_inflight_count].packet_id = record->packet_id;
+        _inflight[_inflight_count].position = position;
+        _inflight_count++;
+    } else {
+        record->flags |= REC_DONE;
+    }
+
+    uint32_t waited = record->sent_us - record->queued_us;
+    portENTER_CRITICAL(&_lock);
+    _stats.sent++;
+    if (_inflight_count > _stats.inflight_peak) _stats.inflight_peak = _inflight_count;
+    if (first) {
+        _publish_sum_us += waited;
+        _publish_count++;
+        if (waited > _stats.publish_max_us) _stats.publish_max_us = waited;
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    _send = position + record->length;
+    release();
+    return true;
+}
+
+bool MqttTransport::writePublish(Record* record) {
+    const uint8_t* topic = (const uint8_t*)(record + 1);
+    bool dup = record->flags & REC_SENT;
+    if (record->qos) {
+        record->packet_id = _next_packet_id;
+        if (++_next_packet_id == 0) _next_packet_id = 1;
+    }
+
+    // Fixed header, topic and packet ID in one write, then the payload from the ring
+    uint8_t header[5 + 2 + TOPIC_MAX + 2];
+    header[0] = PKT_PUBLISH | (dup && record->qos ? 0x08 : 0) | (record->qos << 1);
+    size_t n = 1 + encodeLength(header + 1, 2 + record->topic_length + (record->qos ? 2 : 0) +
+                                                record->payload_length);
+    header[n++] = record->topic_length >> 8;
+    header[n++] = record->topic_length & 0xFF;
+    memcpy(header + n, topic, record->topic_length);
+    n += record->topic_length;
+    if (record->qos) {
+        header[n++] = record->packet_id >> 8;
+        header[n++] = record->packet_id & 0xFF;
+    }
+    if (!writeAll(header, n) || !writeAll(topic + record->topic_length, record->payload_length)) return false;
+
+    record->flags |= REC_SENT;
+    record->sent_us = micros();
+    return true;
+}
+
+void MqttTransport::release() {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    while (tail != _send) {
+        uint32_t position = tail;
+        Record* record = recordAt(position);
+        if (!(record->flags & (REC_SKIP | REC_DONE))) break;
+        tail = position + record->length;
+    }
+    _tail.store(tail, std::memory_order_release);
+}
+
+bool MqttTransport::readPacket() {
+    uint8_t type;
+    if (!readExact(&type, 1, READ_TIMEOUT_MS)) {
+        dropConnection("read failed");
+        return false;
+    }
+    uint32_t length = 0;
+    for (uint8_t shift = 0;; shift += 7) {
+        uint8_t byte;
+        if (shift > 21 || !readExact(&byte, 1, READ_TIMEOUT_MS)) {
+            dropConnection("malformed packet");
+            return false;
+        }
+        length |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+
+    // Keep the start of the packet; skip whatever does not fit
+    uint32_t kept = length < RX_MAX ? length : RX_MAX;
+    if (!readExact(_rx, kept, READ_TIMEOUT_MS)) {
+        dropConnection("read failed");
+        return false;
+    }
+    for (uint32_t left = length - kept; left;) {
+        uint8_t scratch[64];
+        uint32_t chunk = left < sizeof(scratch) ? left : sizeof(scratch);
+        if (!readExact(scratch, chunk, READ_TIMEOUT_MS)) {
+            dropConnection("read failed");
+            return false;
+        }
+        left -= chunk;
+    }
+    _last_rx = millis();
+
+    switch (type & 0xF0) {
+        case PKT_PUBACK:
+            if (kept >= 2) onPuback((_rx[0] << 8) | _rx[1]);
+            break;
+        case PKT_PINGRESP:
+            _ping_pending = false;
+            break;
+        case PKT_SUBACK:
+            if (kept >= 3 && _rx[2] == 0x80) LOG_W("MQTT", "Subscription to %s refused", _subscribe_topic);
+            break;
+        case PKT_PUBLISH: {
+            // Commands are not acted on yet; acknowledge so QoS 1 ones stop
+            uint16_t topic_length = (_rx[0] << 8) | _rx[1];
+            if (((type >> 1) & 0x03) == 1 && kept >= 4u + topic_length) {
+                uint8_t puback[] = {PKT_PUBACK, 2, _rx[2 + topic_length], _rx[3 + topic_length]};
+                writeAll(puback, sizeof(puback));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return true;
+}
+
+void MqttTransport::onPuback(uint16_t packet_id) {
+    // Brokers acknowledge in order, so this is almost always entry 0
+    for (uint8_t i = 0; i < _inflight_count; i++) {
+        if (_inflight[i].packet_id != packet_id) continue;
+
+        uint32_t position = _inflight[i].position;
+        Record* record = recordAt(position);
+        record->flags |= REC_DONE;
+        uint32_t waited = micros() - record->sent_us;
+        memmove(&_inflight[i], &_inflight[i + 1], (_inflight_count - i - 1) * sizeof(Inflight));
+        _inflight_count--;
+
+        portENTER_CRITICAL(&_lock);
+        _stats.acked++;
+        _ack_sum_us += waited;
+        _ack_count++;
+        if (waited > _stats.ack_max_us) _stats.ack_max_us = waited;
+        portEXIT_CRITICAL(&_lock);
+        release();
+        return;
+    }
+    // From before a reconnect; that message has been queued again
+}
+
+bool MqttTransport::readExact(uint8_t* buffer, size_t length, uint32_t timeout_ms) {
+    uint32_t start = millis();
+    size_t got = 0;
+    while (got < length) {
+        if (_client.available()) {
+            int n = _client.read(buffer + got, length - got);
+            if (n > 0) got += n;
+            continue;
+        }
+        if (!_client.connected() || millis() - start > timeout_ms) return false;
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+bool MqttTransport::writeAll(const uint8_t* data, size_t length) {
+    if (_client.write(data, length) != length) return false;
+    _last_tx = millis();
+    return true;
+}
+
+MqttTransport::Record* MqttTransport::recordAt(uint32_t& position) {
+    // Too little room for a header before the end: the record starts at 0
+    uint32_t offset = position % MQTT_QUEUE_BYTES;
+    if (MQTT_QUEUE_BYTES - offset < sizeof(Record)) {
+        position += MQTT_QUEUE_BYTES - offset;
+        offset = 0;
+    }
+    return (Record*)&_ring[offset];
+}
+
+size_t MqttTransport::encodeLength(uint8_t* out, uint32_t length) {
+    size_t n = 0;
+    do {
+        uint8_t byte = length & 0x7F;
+        length >>= 7;
+        out[n++] = byte | (length ? 0x80 : 0);
+    } while (length);
+    return n;
+}
+
+size_t MqttTransport::putString(uint8_t* out, const char* str) {
+    size_t length = strlen(str);
+    out[0] = length >> 8;
+    out[1] = length & 0xFF;
+    memcpy(out + 2, str, length);
+    return length + 2;
+}
@@ -0,0 +1,123 @@
+#include "nmea_parser.h"
+#include <cstring>
+
+NmeaParser::NmeaParser() {
+    memset(&_stats, 0, sizeof(Stats));
+    reset();
+}
+
+void NmeaParser::reset() {
+    _state = STATE_IDLE;
+    _length = 0;
+    _field_count = 0;
+    _checksum = 0;
+    _expected_checksum = 0;
+    _buffer[0] = '\0';
+    _talker[0] = '\0';
+}
+
+NmeaParser::SentenceType NmeaParser::feed(char ch) {
+    // '$' always starts a new sentence, which also resynchronises after
+    // a truncated line
+    if (ch == '$') {
+        reset();
+        _field_start[0] = 0;
+        _field_count = 1;
+        _state = STATE_BODY;
+        return SENTENCE_NONE;
+    }
+
+    switch (_state) {
+        case STATE_IDLE:
+            return SENTENCE_NONE;
+
+        case STATE_BODY:
+            if (_length >= MAX_SENTENCE_LENGTH - 1) {
+                _stats.framing_errors++;
+                _state = STATE_IDLE;
+                return SENTENCE_NONE;
+            }
+            if (ch == '*') {
+                _buffer[_length++] = '\0';
+                _state = STATE_CHECKSUM_HI;
+            } else if (ch == ',') {
+                _checksum ^= ch;
+                _buffer[_length++] = '\0';
+                if (_field_count >= MAX_FIELDS) {
+                    _stats.framing_errors++;
+                    _state = STATE_IDLE;
+                    return SENTENCE_NONE;
+                }
+                _field_start[_field_count++] = _length;
+            } else if (ch == '\r' || ch == '\n') {
+                // Line ended without a checksum
+                _stats.framing_errors++;
+                _state = STATE_IDLE;
+            } else {
+                _checksum ^= ch;
+                _buffer[_length++] = ch;
+            }
+            return SENTENCE_NONE;
+
+        case STATE_CHECKSUM_HI: {
+            int8_t hi = hexValue(ch);
+            if (hi < 0) {
+                _stats.framing_errors++;
+                _state = STATE_IDLE;
+                return SENTENCE_NONE;
+            }
+            _expected_checksum = (uint8_t)hi << 4;
+            _state = STATE_CHECKSUM_LO;
+            return SENTENCE_NONE;
+        }
+
+        case STATE_CHECKSUM_LO: {
+            int8_t lo = hexValue(ch);
+            _state = STATE_IDLE;
+            if (lo < 0) {
+                _stats.framing_errors++;
+                return SENTENCE_NONE;
+            }
+            _expected_checksum |= (uint8_t)lo;
+            if (_expected_checksum != _checksum) {
+                _stats.checksum_errors++;
+                return SENTENCE_NONE;
+            }
+            _stats.sentences++;
+            return classify();
+        }
+    }
+
+    return SENTENCE_NONE;
+}
+
+const char* NmeaParser::field(uint8_t index) const {
+    // Missing trailing fields read as empty rather than out of bounds
+    if (index >= _field_count) return "";
+    return &_buffer[_field_start[index]];
+}
+
+NmeaParser::SentenceType NmeaParser::classify() {
+    // Address field is a two-character talker (GP, GN, GL, GA, BD, ...)
+    // followed by a three-character formatter
+    const char* address = _buffer;
+    if (strlen(address) != 5 || address[0] == 'P') return SENTENCE_UNKNOWN;
+
+    _talker[0] = address[0];
+    _talker[1] = address[1];
+    _talker[2] = '\0';
+
+    const char* formatter = address + 2;
+    if (memcmp(formatter, "GGA", 3) == 0) return SENTENCE_GGA;
+    if (memcmp(formatter, "RMC", 3) == 0) return SENTENCE_RMC;
+    if (memcmp(formatter, "VTG", 3) == 0) return SENTENCE_VTG;
+    if (memcmp(formatter, "GSA", 3) == 0) return SENTENCE_GSA;
+    return SENTENCE_UNKNOWN;
+}
+
+int8_t NmeaParser::hexValue(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
@@ -1,125 +1,303 @@
 #include "sd_logger.h"
 #include "logger.h"
+#include "clock_sync.h"
+#include "perf_counters.h"
+#include "signal_aggregator.h"
+#include "distribution_tracker.h"
+#include "spi_arbiter.h"
 
-SDLogger::SDLogger(uint8_t cs_pin) : _cs_pin(cs_pin) {}
+SDLogger::SDLogger(uint8_t cs_pin)
+    : _cs_pin(cs_pin), _next_snapshot_id(1), _ready(false), _mount_failed(false), _last_flush(0),
+      _backlog(nullptr), _backlog_head(0), _backlog_tail(0) {
+    memset(&_backlog_stats, 0, sizeof(BacklogStats));
+}
 
 SDLogger::~SDLogger() {
-    if (_can_log_file) _can_log_file.close();
-    if (_anomaly_log_file) _anomaly_log_file.close();
-    if (_gps_log_file) _gps_log_file.close();
+    if (_snapshot_file) _snapshot_file.close();
+    free(_backlog);
+}
+
+bool SDLogger::beginBootCapture() {
+    _backlog = (BacklogEntry*)malloc(SD_BOOT_BACKLOG_FRAMES * sizeof(BacklogEntry));
+    if (!_backlog) {
+        LOG_W("SDLOG", "No RAM for the boot backlog, frames before SD init are lost");
+        return false;
+    }
+    return true;
 }
 
 bool SDLogger::init() {
     if (!SD.begin(_cs_pin)) {
         LOG_E("SDLOG", "SD card initialization failed");
+        _mount_failed.store(true, std::memory_order_release);
         return false;
     }
 
     LOG_I("SDLOG", "SD card initialized");
 
     // Create CSV headers if files don't exist
-    if (!createFileIfNotExists(CAN_LOG_FILE)) {
-        _can_log_file = SD.open(CAN_LOG_FILE, FILE_WRITE);
-        if (_can_log_file) {
-            _can_log_file.println("timestamp,can_id,dlc,data0,data1,data2,data3,data4,data5,data6,data7");
-            _can_log_file.close();
+    if (!createFileIfNotExists(STATE_LOG_FILE)) {
+        File state_file = SD.open(STATE_LOG_FILE, FILE_WRITE);
+        if (state_file) {
+            // Followed by <signal>_min,_mean,_max,_count for each SignalId
+            state_file.print("timestamp,speed,rpm,throttle,gear,engine_status,fault_status,utc_ms,window_ms");
+            for (uint8_t i = 0; i < SIGNAL_COUNT; i++) {
+                const char* name = SignalAggregator::signalName((SignalId)i);
+                state_file.printf(",%s_min,%s_mean,%s_max,%s_count", name, name, name, name);
+            }
+            state_file.println();
+            state_file.close();
         }
     }
 
-    if (!createFileIfNotExists(ANOMALY_LOG_FILE)) {
-        _anomaly_log_file = SD.open(ANOMALY_LOG_FILE, FILE_WRITE);
-        if (_anomaly_log_file) {
-            _anomaly_log_file.println("timestamp,type,severity,can_id,description");
-            _anomaly_log_file.close();
+    if (!createFileIfNotExists(DIST_LOG_FILE)) {
+        File dist_file = SD.open(DIST_LOG_FILE, FILE_WRITE);
+        if (dist_file) {
+            dist_file.println("start,end,utc_ms,signal,weight_ms,p50,p95,p99,sketch");
+            dist_file.close();
         }
     }
 
-    if (!createFileIfNotExists(GPS_LOG_FILE)) {
-        _gps_log_file = SD.open(GPS_LOG_FILE, FILE_WRITE);
-        if (_gps_log_file) {
-            _gps_log_file.println("timestamp,latitude,longitude,altitude,speed,fix_quality,satellites");
-            _gps_log_file.close();
+    scanSnapshots();
+
+    // Finds where the previous run stopped; the segment stays open from here
+    if (!_journal.open()) {
+        return false;
+    }
+    _last_flush = millis();
+    // Publishes the journal and snapshot state set up above to the tasks
+    // that log, serve queries and upload
+    _ready.store(true, std::memory_order_release);
+    return true;
+}
+
+bool SDLogger::logCANFrame(const CanFrame& frame, uint16_t suppressed) {
+    // While a backlog exists, new frames queue behind it so the file stays
+    // in capture order
+    if (_backlog) {
+        if (_backlog_tail - _backlog_head >= SD_BOOT_BACKLOG_FRAMES) {
+            _backlog_stats.dropped++;
+            PERF_COUNT(SD_WRITE_ERRORS);
+            return false;
         }
+        BacklogEntry& entry = _backlog[_backlog_tail % SD_BOOT_BACKLOG_FRAMES];
+        entry.frame = frame;
+        entry.suppressed = suppressed;
+        _backlog_tail++;
+        _backlog_stats.captured++;
+        return true;
     }
+    return stageCanFrame(frame, suppressed);
+}
 
+bool SDLogger::stageCanFrame(const CanFrame& frame, uint16_t suppressed) {
+    // Staged in RAM only; service() moves sealed blocks to the card
+    if (!isReady() || !_journal.appendCan(frame, suppressed)) {
+        PERF_COUNT(SD_WRITE_ERRORS);
+        return false;
+    }
+    PERF_COUNT(FRAMES_LOGGED);
     return true;
 }
 
-bool SDLogger::logCANFrame(const CanFrame& frame) {
-    _can_log_file = SD.open(CAN_LOG_FILE, FILE_APPEND);
-    if (!_can_log_file) {
-        LOG_E("SDLOG", "Failed to open CAN log file");
-        return false;
+void SDLogger::drainBacklog() {
+    // Only as much as the journal queue takes; service() writes it out
+    while (_backlog_head != _backlog_tail && _journal.hasRoom(sizeof(JournalCanRecord) + 8)) {
+        const BacklogEntry& entry = _backlog[_backlog_head % SD_BOOT_BACKLOG_FRAMES];
+        stageCanFrame(entry.frame, entry.suppressed);
+        _backlog_head++;
     }
+    if (_backlog_head == _backlog_tail) {
+        LOG_I("SDLOG", "Boot backlog written (%lu frames, %lu dropped)",
+              _backlog_stats.captured, _backlog_stats.dropped);
+        releaseBacklog();
+    }
+}
+
+void SDLogger::releaseBacklog() {
+    free(_backlog);
+    _backlog = nullptr;
+    _backlog_head = _backlog_tail = 0;
+}
 
-    _can_log_file.printf("%lu,%03X,%d", frame.timestamp, frame.id, frame.dlc);
-    for (int i = 0; i < 8; i++) {
-        _can_log_file.printf(",%02X", i < frame.dlc ? frame.data[i] : 0x00);
+void SDLogger::service() {
+    if (!isReady()) {
+        if (_mount_failed.load(std::memory_order_acquire) && _backlog) {
+            LOG_W("SDLOG", "No card, discarding %lu boot frames", _backlog_tail - _backlog_head);
+            releaseBacklog();
+        }
+        return;
     }
-    _can_log_file.println();
+    if (_backlog) drainBacklog();
 
-    _can_log_file.close();
-    return true;
+    uint8_t chunks = 0;
+    while (_journal.sealedBlocks() && chunks < SD_CHUNKS_PER_PASS) {
+        if (!_journal.writeBlock()) return;
+        chunks++;
+    }
+
+    // A partial block is sealed and written as-is, bounding what a power
+    // cut can lose to one flush interval
+    if (millis() - _last_flush > SD_FLUSH_INTERVAL && chunks < SD_CHUNKS_PER_PASS) {
+        _journal.seal();
+        if (_journal.sealedBlocks() && !_journal.writeBlock()) return;
+        _journal.sync();
+        _last_flush = millis();
+    }
 }
 
-bool SDLogger::logVehicleState(const VehicleState& state) {
-    File state_file = SD.open("/vehicle_state.csv", FILE_APPEND);
-    if (!state_file) return false;
+bool SDLogger::logVehicleState(const VehicleState& state, const SignalWindow& window) {
+    if (!isReady()) return false;
+    PERF_SCOPE(STAGE_SD_WRITE);
+    SpiArbiter::yieldToCan();
+    SpiArbiter::SdScope sd_busy;
+    File state_file = SD.open(STATE_LOG_FILE, FILE_APPEND);
+    if (!state_file) {
+        PERF_COUNT(SD_WRITE_ERRORS);
+        return false;
+    }
 
-    state_file.printf("%lu,%u,%u,%u,%u,%u,%u\n",
+    state_file.printf("%lu,%u,%u,%u,%u,%u,%u,%llu,%lu",
         state.timestamp, state.speed, state.rpm, state.throttle,
-        state.gear, state.engine_status, state.fault_status);
+        state.gear, state.engine_status, state.fault_status,
+        ClockSync::toUtcMs(state.timestamp), window.end - window.start);
+    for (uint8_t i = 0; i < SIGNAL_COUNT; i++) {
+        const SignalStats& s = window.signals[i];
+        state_file.printf(",%u,%u,%u,%lu", s.min, SignalAggregator::mean(s), s.max, s.count);
+    }
+    state_file.println();
 
     state_file.close();
     return true;
 }
 
 bool SDLogger::logAnomaly(const Anomaly& anomaly) {
-    _anomaly_log_file = SD.open(ANOMALY_LOG_FILE, FILE_APPEND);
-    if (!_anomaly_log_file) {
-        LOG_E("SDLOG", "Failed to open anomaly log file");
+    // Journaled alongside the CAN frames so time lookups find both
+    if (!isReady() || !_journal.appendAnomaly(anomaly)) {
+        PERF_COUNT(SD_WRITE_ERRORS);
         return false;
     }
-
-    _anomaly_log_file.printf("%lu,%u,%u,%03X,%s\n",
-        anomaly.timestamp, anomaly.type, anomaly.severity,
-        anomaly.can_id, anomaly.description);
-
-    _anomaly_log_file.close();
     return true;
 }
 
 bool SDLogger::logGPSData(const GpsData& gps) {
-    _gps_log_file = SD.open(GPS_LOG_FILE, FILE_APPEND);
-    if (!_gps_log_file) {
-        LOG_E("SDLOG", "Failed to open GPS log file");
+    if (!isReady() || !_journal.appendGps(gps)) {
+        PERF_COUNT(SD_WRITE_ERRORS);
         return false;
     }
+    return true;
+}
 
-    _gps_log_file.printf("%lu,%.6f,%.6f,%.2f,%.2f,%u,%u\n",
-        gps.timestamp, gps.latitude, gps.longitude,
-        gps.altitude, gps.speed, gps.fix_quality, gps.satellites);
+bool SDLogger::logDistribution(SignalId signal, const QuantileSketch& sketch, uint32_t start, uint32_t end) {
+    if (!isReady()) return false;
+    PERF_SCOPE(STAGE_SD_WRITE);
+    static char encoded[DistributionTracker::MAX_ENCODED_SIZE];
+    if (!DistributionTracker::encode(sketch, encoded, sizeof(encoded))) {
+        LOG_W("SDLOG", "Sketch for %s too large to log", SignalAggregator::signalName(signal));
+        return false;
+    }
+
+    SpiArbiter::yieldToCan();
+    SpiArbiter::SdScope sd_busy;
+    File dist_file = SD.open(DIST_LOG_FILE, FILE_APPEND);
+    if (!dist_file) {
+        PERF_COUNT(SD_WRITE_ERRORS);
+        return false;
+    }
+
+    dist_file.printf("%lu,%lu,%llu,%s,%llu,%u,%u,%u,%s\n",
+        start, end, ClockSync::toUtcMs(start), SignalAggregator::signalName(signal),
+        sketch.total(), sketch.quantile(0.50f), sketch.quantile(0.95f), sketch.quantile(0.99f),
+        encoded);
 
-    _gps_log_file.close();
+    dist_file.close();
     return true;
 }
 
+uint32_t SDLogger::beginSnapshot() {
+    if (!isReady() || _snapshot_file) return 0;
+
+    char path[40];
+    uint32_t id = _next_snapshot_id;
+    snprintf(path, sizeof(path), "%s/snap_%05lu.bin", SNAPSHOT_DIR, id);
+    _snapshot_file = SD.open(path, FILE_WRITE);
+    if (!_snapshot_file) {
+        PERF_COUNT(SD_WRITE_ERRORS);
+        LOG_E("SDLOG", "Failed to create snapshot %s", path);
+        return 0;
+    }
+
+    // Placeholder, rewritten with final counts by finishSnapshot()
+    SnapshotHeader blank;
+    memset(&blank, 0, sizeof(blank));
+    _snapshot_file.write((const uint8_t*)&blank, sizeof(blank));
+
+    _next_snapshot_id++;
+    return id;
+}
+
+bool SDLogger::appendSnapshot(const void* data, size_t length) {
+    if (!_snapshot_file) return false;
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (length) {
+        size_t chunk = length < SD_WRITE_CHUNK ? length : SD_WRITE_CHUNK;
+        SpiArbiter::yieldToCan();
+
+        PERF_SCOPE(STAGE_SD_WRITE);
+        SpiArbiter::SdScope sd_busy;
+        if (_snapshot_file.write(bytes, chunk) != chunk) {
+            PERF_COUNT(SD_WRITE_ERRORS);
+            return false;
+        }
+        bytes += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool SDLogger::finishSnapshot(const SnapshotHeader& header) {
+    if (!_snapshot_file) return false;
+
+    bool ok = _snapshot_file.seek(0) &&
+              _snapshot_file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+    _snapshot_file.close();
+    if (!ok) PERF_COUNT(SD_WRITE_ERRORS);
+    return ok;
+}
+
+void SDLogger::scanSnapshots() {
+    if (!SD.exists(SNAPSHOT_DIR)) {
+        SD.mkdir(SNAPSHOT_DIR);
+        return;
+    }
+
+    // Continue numbering after the highest id already on the card
+    File dir = SD.open(SNAPSHOT_DIR);
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+        const char* name = strrchr(entry.name(), '/');
+        name = name ? name + 1 : entry.name();
+        unsigned long id = 0;
+        if (sscanf(name, "snap_%lu.bin", &id) == 1 && id >= _next_snapshot_id) {
+            _next_snapshot_id = id + 1;
+        }
+        entry.close();
+    }
+    dir.close();
+}
+
 bool SDLogger::createFileIfNotExists(const char* filename) {
     return SD.exists(filename);
 }
 
 void SDLogger::flush() {
-    if (_can_log_file) _can_log_file.flush();
-    if (_anomaly_log_file) _anomaly_log_file.flush();
-    if (_gps_log_file) _gps_log_file.flush();
-}
-
-uint32_t SDLogger::getFileSize() {
-    if (SD.exists(CAN_LOG_FILE)) {
-        File f = SD.open(CAN_LOG_FILE);
-        uint32_t size = f.size();
-        f.close();
-        return size;
+    if (!isReady()) return;
+    for (;;) {
+        if (_backlog) drainBacklog();
+        _journal.seal();
+        while (_journal.sealedBlocks() && _journal.writeBlock()) {}
+        if (!_backlog || _journal.sealedBlocks()) break;   // Done, or the card stopped taking data
     }
-    return 0;
+    _journal.close();
 }
+
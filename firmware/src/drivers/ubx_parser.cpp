@@ -0,0 +1,125 @@
+#include "ubx_parser.h"
+#include <cstring>
+
+UbxParser::UbxParser() {
+    memset(&_stats, 0, sizeof(Stats));
+    reset();
+}
+
+void UbxParser::reset() {
+    _state = STATE_SYNC_1;
+    _class = 0;
+    _id = 0;
+    _payload_length = 0;
+    _payload_index = 0;
+    _ck_a = 0;
+    _ck_b = 0;
+    _rx_ck_a = 0;
+}
+
+bool UbxParser::feed(uint8_t byte) {
+    switch (_state) {
+        case STATE_SYNC_1:
+            if (byte == SYNC_1) _state = STATE_SYNC_2;
+            return false;
+
+        case STATE_SYNC_2:
+            if (byte == SYNC_2) {
+                _ck_a = 0;
+                _ck_b = 0;
+                _state = STATE_CLASS;
+            } else {
+                _state = (byte == SYNC_1) ? STATE_SYNC_2 : STATE_SYNC_1;
+            }
+            return false;
+
+        case STATE_CLASS:
+            _class = byte;
+            checksum(byte);
+            _state = STATE_ID;
+            return false;
+
+        case STATE_ID:
+            _id = byte;
+            checksum(byte);
+            _state = STATE_LENGTH_LO;
+            return false;
+
+        case STATE_LENGTH_LO:
+            _payload_length = byte;
+            checksum(byte);
+            _state = STATE_LENGTH_HI;
+            return false;
+
+        case STATE_LENGTH_HI:
+            _payload_length |= (uint16_t)byte << 8;
+            checksum(byte);
+            if (_payload_length > MAX_PAYLOAD) {
+                // Nothing we decode is this large; resync on the next header
+                _stats.oversize_frames++;
+                _state = STATE_SYNC_1;
+                return false;
+            }
+            _payload_index = 0;
+            _state = (_payload_length > 0) ? STATE_PAYLOAD : STATE_CK_A;
+            return false;
+
+        case STATE_PAYLOAD:
+            _payload[_payload_index++] = byte;
+            checksum(byte);
+            if (_payload_index >= _payload_length) _state = STATE_CK_A;
+            return false;
+
+        case STATE_CK_A:
+            _rx_ck_a = byte;
+            _state = STATE_CK_B;
+            return false;
+
+        case STATE_CK_B:
+            _state = STATE_SYNC_1;
+            if (_rx_ck_a != _ck_a || byte != _ck_b) {
+                _stats.checksum_errors++;
+                return false;
+            }
+            _stats.frames++;
+            return true;
+    }
+
+    return false;
+}
+
+uint16_t UbxParser::u2(uint16_t offset) const {
+    return (uint16_t)_payload[offset] | ((uint16_t)_payload[offset + 1] << 8);
+}
+
+uint32_t UbxParser::u4(uint16_t offset) const {
+    return (uint32_t)_payload[offset] |
+           ((uint32_t)_payload[offset + 1] << 8) |
+           ((uint32_t)_payload[offset + 2] << 16) |
+           ((uint32_t)_payload[offset + 3] << 24);
+}
+
+size_t UbxParser::buildFrame(uint8_t msg_class, uint8_t msg_id, const uint8_t* payload,
+                             uint16_t payload_len, uint8_t* out) {
+    out[0] = SYNC_1;
+    out[1] = SYNC_2;
+    out[2] = msg_class;
+    out[3] = msg_id;
+    out[4] = payload_len & 0xFF;
+    out[5] = payload_len >> 8;
+    if (payload_len > 0) memcpy(&out[6], payload, payload_len);
+
+    uint8_t ck_a = 0, ck_b = 0;
+    for (size_t i = 2; i < (size_t)payload_len + 6; i++) {
+        ck_a += out[i];
+        ck_b += ck_a;
+    }
+    out[payload_len + 6] = ck_a;
+    out[payload_len + 7] = ck_b;
+    return payload_len + 8;
+}
+
+void UbxParser::checksum(uint8_t byte) {
+    _ck_a += byte;
+    _ck_b += _ck_a;
+}
@@ -1,128 +1,379 @@
 #include <Arduino.h>
 #include "config.h"
 #include "logger.h"
+#include "clock_sync.h"
+#include "perf_counters.h"
 #include "types.h"
 #include "mcp2515_driver.h"
+#include "can_receiver.h"
 #include "gps_module.h"
 #include "sd_logger.h"
 #include "vehicle_state_manager.h"
 #include "anomaly_detector.h"
 #include "mqtt_client.h"
+#include "power_manager.h"
+#include "flight_recorder.h"
+#include "change_filter.h"
+#include "signal_aggregator.h"
+#include "distribution_tracker.h"
+#include "spi_arbiter.h"
+#include "obd_poller.h"
+#include "log_server.h"
+#include "segment_uploader.h"
+#include <esp_timer.h>
 
 // Global objects
-MCP2515Driver can_driver(CAN_CS_PIN, CAN_BITRATE);
+MCP2515Driver can_driver(CAN_CS_PIN, CAN_INT_PIN, CAN_BITRATE, 0);
+#if CAN_CHANNELS > 1
+MCP2515Driver can_driver1(CAN1_CS_PIN, CAN1_INT_PIN, CAN1_BITRATE, 1);
+#endif
+CanReceiver can_receiver;
 GPSModule gps_module(GPS_RX_PIN, GPS_TX_PIN, GPS_BAUDRATE);
 SDLogger sd_logger(SD_CS_PIN);
 VehicleStateManager vehicle_state;
 AnomalyDetector anomaly_detector;
 MQTTClient mqtt_client;
+PowerManager power_manager(can_receiver, sd_logger);
+FlightRecorder flight_recorder(sd_logger);
+ChangeFilter change_filter;
+SignalAggregator mqtt_window;
+SignalAggregator sd_window;
+DistributionTracker distributions;
+ObdPoller obd_poller(can_driver, vehicle_state);  // The OBD port is wired to channel 0
+LogServer log_server(sd_logger);
+SegmentUploader uploader(sd_logger);
 
 // Timing variables
 uint32_t last_log_time = 0;
 uint32_t last_mqtt_time = 0;
-uint32_t last_gps_time = 0;
+uint32_t last_perf_time = 0;
+uint32_t last_dist_time = 0;
+BootTimes boot_times;
+
+// SD mount, header creation and GPS configuration take hundreds of ms;
+// they run here while loop() is already draining CAN. Frames logged before
+// the card is up are held in the SD logger's boot backlog.
+void bringUpTask(void* arg) {
+    LOG_I("MAIN", "Initializing GPS...");
+#if GPS_PARSER_BENCHMARK
+    // Before init() so the UART reader is not yet touching the fix
+    gps_module.runParserBenchmark(100);
+#endif
+    gps_module.init();
+    boot_times.gps_ready_us = (uint32_t)esp_timer_get_time();
+
+    LOG_I("MAIN", "Initializing SD card...");
+    if (sd_logger.init()) {
+        boot_times.sd_ready_us = (uint32_t)esp_timer_get_time();
+    } else {
+        LOG_W("MAIN", "SD card initialization failed!");
+    }
+
+    LOG_I("MAIN", "Background bring-up done: GPS %lu ms, SD %lu ms after start",
+          boot_times.gps_ready_us / 1000, boot_times.sd_ready_us / 1000);
+    vTaskDelete(nullptr);
+}
 
 void setup() {
-    // Initialize logger first
+    // Capture first: only what CAN reception needs runs before the RX task
+    // starts; storage and network come up behind it
     Logger::init();
     LOG_I("MAIN", "=== CAN Bus Data Logger Starting ===");
+    ClockSync::init(GPS_PPS_PIN);
+    sd_logger.beginBootCapture();
 
     // Initialize CAN bus
     LOG_I("MAIN", "Initializing CAN bus...");
-    if (can_driver.init() != MCP2515Driver::ERROR_OK) {
+    // No bitrate lock (ignition off) still captures, listen-only on the
+    // cached or configured rate
+    MCP2515Driver::ErrorCode can_result = can_driver.init(CAN_LISTEN_ONLY);
+    if (can_result != MCP2515Driver::ERROR_OK && can_result != MCP2515Driver::ERROR_NOMSG) {
         LOG_E("MAIN", "CAN initialization failed!");
         while (1) { delay(1000); }
     }
-    can_driver.setListenOnly(true);
-    can_driver.enableInterrupt();
+    can_receiver.addChannel(can_driver);
 
-    // Initialize GPS
-    LOG_I("MAIN", "Initializing GPS...");
-    gps_module.init();
+#if CAN_CHANNELS > 1
+    // The second bus is optional; run single-channel if it is absent
+    can_result = can_driver1.init(CAN1_LISTEN_ONLY);
+    if (can_result == MCP2515Driver::ERROR_OK || can_result == MCP2515Driver::ERROR_NOMSG) {
+        can_receiver.addChannel(can_driver1);
+    } else {
+        LOG_W("MAIN", "CAN channel 1 initialization failed, continuing without it");
+    }
+#endif
 
-    // Initialize SD card
-    LOG_I("MAIN", "Initializing SD card...");
-    if (!sd_logger.init()) {
-        LOG_W("MAIN", "SD card initialization failed!");
+    if (!can_receiver.start()) {
+        LOG_E("MAIN", "CAN receiver failed to start!");
+        while (1) { delay(1000); }
     }
+    boot_times.can_ready_us = (uint32_t)esp_timer_get_time();
+
+    flight_recorder.init();
+    change_filter.init();
+    LOG_I("FILTER", "Change filter initialized (heartbeat %u ms)", CHANGE_FILTER_HEARTBEAT_MS);
 
     // Initialize vehicle state manager
     vehicle_state.init();
 
+#if OBD_ENABLED
+    if (!obd_poller.init()) {
+        LOG_W("MAIN", "OBD-II polling unavailable");
+    }
+#endif
+
     // Initialize anomaly detector
     anomaly_detector.init();
+#if ANOMALY_STATS_BENCHMARK
+    AnomalyDetector::runStatsBenchmark(1000);
+#endif
 
-    // Initialize MQTT
-    LOG_I("MAIN", "Initializing MQTT...");
-    if (!mqtt_client.init(WIFI_SSID, WIFI_PASSWORD, MQTT_BROKER, MQTT_PORT)) {
-        LOG_W("MAIN", "MQTT initialization failed, will retry in loop");
-    }
+    // Starts WiFi only; loop() connects to the broker once it is up
+    mqtt_client.init(WIFI_SSID, WIFI_PASSWORD, MQTT_BROKER, MQTT_PORT);
 
-    LOG_I("MAIN", "Setup complete!");
-}
+#if QUERY_SERVER_ENABLED
+    // After WiFi so the network stack is up; answers 503 until the card is
+    log_server.init();
+#endif
+#if UPLOAD_ENABLED
+    uploader.init();
+#endif
 
-void loop() {
-    uint32_t current_time = millis();
+    power_manager.init();
 
-    // ===== CAN BUS HANDLING =====
-    CanFrame frame;
-    if (can_driver.readFrame(frame) == MCP2515Driver::ERROR_OK) {
-        LOG_D("MAIN", "CAN RX: ID=0x%03X DLC=%d", frame.id, frame.dlc);
+    // Core 0, below loop() and the CAN RX task
+    xTaskCreatePinnedToCore(bringUpTask, "bringup", 8192, nullptr, 1, nullptr, 0);
 
-        // Update vehicle state
-        vehicle_state.update(frame);
-        VehicleState state = vehicle_state.getState();
+    LOG_I("MAIN", "Setup complete, capturing %lu ms after start", boot_times.can_ready_us / 1000);
+}
 
-        // Anomaly detection
-        anomaly_detector.update(frame, state);
+void handleFrame(const CanFrame& frame, uint32_t current_time) {
+    LOG_D("MAIN", "CAN RX: ID=0x%03X DLC=%d", frame.id, frame.dlc);
+    power_manager.onFrame(frame);
+    flight_recorder.record(frame);
 
-        // Log to SD card
-        if (current_time - last_log_time > SD_LOG_INTERVAL) {
-            sd_logger.logCANFrame(frame);
-            sd_logger.logVehicleState(state);
+    // Update vehicle state
+    VehicleState state;
+    uint8_t signals;
+    {
+        PERF_SCOPE(STAGE_DECODE);
+        bool decoded = vehicle_state.update(frame);
+        if (obd_poller.onFrame(frame)) decoded = true;
+        if (decoded) PERF_COUNT(FRAMES_DECODED);
+        state = vehicle_state.getState();
+        signals = vehicle_state.getDecodedSignals();
+        mqtt_window.update(state, signals);
+        sd_window.update(state, signals);
+        distributions.update(state, signals, frame.timestamp);
+    }
+    flight_recorder.recordState(state);
 
-            if (gps_module.hasValidFix()) {
-                GpsData gps = gps_module.getLatestData();
-                sd_logger.logGPSData(gps);
-            }
+    // Anomaly detection
+    {
+        PERF_SCOPE(STAGE_ANOMALY);
+        anomaly_detector.update(frame, state, signals);
+    }
+
+    // Raw frames go out at full rate, minus unchanged repeats. Each sink
+    // confirms what it wrote so skipped frames keep their repeat counts.
+    if (mqtt_client.takeBatchLost()) {
+        change_filter.resync(ChangeFilter::SINK_MQTT);
+        LOG_W("FILTER", "MQTT lost a batch, re-sending every ID in full");
+    }
+    ChangeFilter::Result filtered;
+    change_filter.process(frame, filtered);
+    if (filtered.emit[ChangeFilter::SINK_SD]) {
+        bool written = sd_logger.logCANFrame(frame, filtered.suppressed[ChangeFilter::SINK_SD]);
+        change_filter.confirm(ChangeFilter::SINK_SD, frame, written);
+    } else if (change_filter.getMode(ChangeFilter::SINK_SD, frame.id) == ChangeFilter::MODE_ON_CHANGE) {
+        PERF_COUNT(FRAMES_SUPPRESSED);
+    }
+    if (filtered.emit[ChangeFilter::SINK_MQTT]) {
+        bool written = mqtt_client.publishCANData(frame, filtered.suppressed[ChangeFilter::SINK_MQTT]);
+        change_filter.confirm(ChangeFilter::SINK_MQTT, frame, written);
+    }
 
-            last_log_time = current_time;
+    // Log to SD card
+    if (current_time - last_log_time > SD_LOG_INTERVAL) {
+        sd_logger.logVehicleState(state, sd_window.takeWindow(current_time));
+
+        if (gps_module.hasValidFix()) {
+            GpsData gps = gps_module.getLatestData();
+            sd_logger.logGPSData(gps);
         }
 
-        // Check for anomalies
-        if (anomaly_detector.hasAnomaly()) {
-            Anomaly anom = anomaly_detector.getLatestAnomaly();
-            LOG_W("MAIN", "ANOMALY DETECTED: %s", anom.description);
-            sd_logger.logAnomaly(anom);
+        last_log_time = current_time;
+    }
 
-            // Publish anomaly via MQTT
-            if (mqtt_client.isConnected()) {
-                mqtt_client.publishAnomaly(anom);
-            }
+    // Check for anomalies
+    if (anomaly_detector.hasAnomaly()) {
+        Anomaly anom = anomaly_detector.getLatestAnomaly();
+        LOG_W("MAIN", "ANOMALY DETECTED: %s", anom.description);
+        anom.snapshot_id = flight_recorder.trigger(anom);
+        sd_logger.logAnomaly(anom);
+
+        // Publish anomaly via MQTT
+        if (mqtt_client.isConnected()) {
+            mqtt_client.publishAnomaly(anom);
         }
     }
+}
+
+void loop() {
+    uint32_t current_time = millis();
+#if PERF_ENABLED
+    uint32_t loop_start = ESP.getCycleCount();
+#endif
+
+    // ===== CAN BUS HANDLING =====
+    // Drain the per-channel rings filled by the RX task
+    CanFrame frame;
+    for (uint16_t n = 0; n < CAN_LOOP_BATCH && can_receiver.readFrame(frame); n++) {
+        handleFrame(frame, current_time);
+    }
 
-    // ===== GPS HANDLING =====
-    if (current_time - last_gps_time > 1000) {
-        gps_module.update();
-        last_gps_time = current_time;
+    if (!boot_times.first_frame_us && can_receiver.getFirstFrameUs()) {
+        boot_times.first_frame_us = can_receiver.getFirstFrameUs();
+        LOG_I("MAIN", "First frame captured %lu ms after start", boot_times.first_frame_us / 1000);
     }
 
+    // ===== OBD-II POLLING =====
+    // After the drain so a completed response is followed by the next request
+    obd_poller.update(current_time);
+
+    // ===== SD WRITE-BEHIND =====
+    sd_logger.service();
+
+    // ===== FLIGHT RECORDER =====
+    flight_recorder.update();
+
+#if QUERY_SERVER_ENABLED
+    // ===== LOG QUERIES =====
+    log_server.update();
+#endif
+
+#if UPLOAD_ENABLED
+    // ===== SEGMENT UPLOAD =====
+    uploader.update();
+#endif
+
     // ===== MQTT PUBLISHING =====
     mqtt_client.update();
 
+    if (!boot_times.network_ready_us && mqtt_client.isConnected()) {
+        boot_times.network_ready_us = (uint32_t)esp_timer_get_time();
+        SDLogger::BacklogStats backlog = sd_logger.getBacklogStats();
+        boot_times.backlog_frames = backlog.captured;
+        boot_times.backlog_dropped = backlog.dropped;
+        boot_times.journal_recovery_us = sd_logger.getJournalStats().recovery_us;
+        mqtt_client.publishBoot(boot_times);
+    }
+
     if (mqtt_client.isConnected() && current_time - last_mqtt_time > MQTT_PUBLISH_INTERVAL) {
         VehicleState state = vehicle_state.getState();
-        mqtt_client.publishVehicleState(state);
+        mqtt_client.publishVehicleState(state, mqtt_window.takeWindow(current_time));
 
         if (gps_module.hasValidFix()) {
             GpsData gps = gps_module.getLatestData();
             mqtt_client.publishGPSData(gps);
         }
 
+        mqtt_client.publishClockStats(ClockSync::getStats());
+
         last_mqtt_time = current_time;
     }
 
-    // Brief delay to prevent watchdog triggers
-    delay(10);
+    // ===== SIGNAL DISTRIBUTIONS =====
+    if (current_time - last_dist_time > DIST_WINDOW_MS) {
+        distributions.closeWindow(current_time);
+        uint32_t start = distributions.getWindowStart();
+        for (uint8_t i = 0; i < DistributionTracker::SIGNALS; i++) {
+            const QuantileSketch& sketch = distributions.getSketch((SignalId)i);
+            if (sketch.total() == 0) continue;
+            sd_logger.logDistribution((SignalId)i, sketch, start, current_time);
+            mqtt_client.publishDistribution((SignalId)i, sketch, start, current_time);
+        }
+        distributions.reset(current_time);
+        last_dist_time = current_time;
+    }
+
+    // ===== HEALTH SNAPSHOT =====
+    if (current_time - last_perf_time > PERF_REPORT_INTERVAL) {
+        PerfCounters::Snapshot snapshot = PerfCounters::takeSnapshot();
+        PerfCounters::logSnapshot(snapshot);
+        SpiArbiter::Stats spi = SpiArbiter::takeStats();
+        LOG_I("SPI", "CAN wait max=%luus (during SD %luus) | SD chunks=%lu max=%luus yields=%lu",
+              spi.can_latency_max_us, spi.can_latency_sd_max_us, spi.sd_chunks,
+              spi.sd_chunk_max_us, spi.sd_yields);
+        mqtt_client.publishHealth(snapshot, spi);
+
+        CanReceiver::ChannelReport reports[CAN_MAX_CHANNELS];
+        uint8_t channels = can_receiver.takeReport(reports, current_time);
+        for (uint8_t i = 0; i < channels; i++) {
+            LOG_I("CANRX", "ch%u frames=%lu (%lu/s) overflow=%lu ring_drop=%lu ring_peak=%u",
+                  reports[i].channel, reports[i].frames, reports[i].frames_per_sec,
+                  reports[i].overflows, reports[i].ring_dropped, reports[i].ring_high_water);
+            if (reports[i].tx_sent || reports[i].tx_failed) {
+                LOG_I("CANTX", "ch%u sent=%lu (%lu/s) arb_lost=%lu failed=%lu",
+                      reports[i].channel, reports[i].tx_sent, reports[i].tx_per_sec,
+                      reports[i].tx_arbitration_lost, reports[i].tx_failed);
+            }
+        }
+        mqtt_client.publishCanStats(reports, channels);
+
+        ObdPoller::PidReport pids[ObdPoller::MAX_REPORTS];
+        uint8_t pid_count = obd_poller.takeReport(pids, current_time);
+        for (uint8_t i = 0; i < pid_count; i++) {
+            LOG_I("OBD", "PID 0x%02X %.1f Hz (target %u ms) latency avg=%ums max=%ums timeouts=%lu",
+                  pids[i].pid, pids[i].rate_hz, pids[i].interval_ms,
+                  pids[i].latency_avg_ms, pids[i].latency_max_ms, pids[i].timeouts);
+        }
+        if (pid_count) mqtt_client.publishObdStats(pids, pid_count, obd_poller.getStats());
+
+        RuleReport rules[AnomalyDetector::RULE_COUNT];
+        uint32_t rule_frames = anomaly_detector.takeRuleReport(rules);
+        for (uint8_t i = 0; i < AnomalyDetector::RULE_COUNT; i++) {
+            LOG_I("ANOMALY", "%s: ran on %lu/%lu frames, hits=%lu, cycles avg=%lu max=%lu",
+                  rules[i].name, rules[i].evaluations, rule_frames, rules[i].hits,
+                  rules[i].avg_cycles, rules[i].max_cycles);
+        }
+        mqtt_client.publishRuleStats(rules, AnomalyDetector::RULE_COUNT, rule_frames);
+
+        MqttTransport::Stats mqtt = mqtt_client.takeTransportStats();
+        LOG_I("MQTT", "queued=%lu sent=%lu acked=%lu resent=%lu dropped=%lu congested=%lu peak=%lu B inflight=%u",
+              mqtt.queued, mqtt.sent, mqtt.acked, mqtt.resent, mqtt.dropped, mqtt.congested,
+              mqtt.queue_peak, mqtt.inflight_peak);
+        LOG_I("MQTT", "publish->wire avg=%luus max=%luus | ack avg=%luus max=%luus reconnects=%lu",
+              mqtt.publish_avg_us, mqtt.publish_max_us, mqtt.ack_avg_us, mqtt.ack_max_us, mqtt.reconnects);
+        MQTTClient::PayloadStats payload = mqtt_client.takePayloadStats();
+        LOG_I("MQTT", "payloads=%lu compressed=%lu batches=%lu (%lu frames) bytes %lu -> %lu, %lu us in compressor",
+              payload.messages, payload.compressed, payload.batches, payload.batch_frames,
+              payload.raw_bytes, payload.sent_bytes, payload.compress_us);
+        mqtt_client.publishMqttStats(mqtt, payload);
+#if UPLOAD_ENABLED
+        const SegmentUploader::Stats& upload = uploader.getStats();
+        uint32_t pending = uploader.pendingSegments();
+        LOG_I("UPLOAD", "segments=%lu pending=%lu missed=%lu resumes=%lu retries=%lu failures=%lu sent=%lu kB acked=%lu kB",
+              upload.segments, pending, upload.segments_missed, upload.resumes, upload.chunk_retries,
+              upload.failures, (uint32_t)(upload.bytes_sent / 1000), (uint32_t)(upload.bytes_acked / 1000));
+        mqtt_client.publishUploadStats(upload, pending);
+#endif
+        const ChangeFilter::Stats& filter = change_filter.getStats();
+        LOG_I("FILTER", "Change-only reduction: sd %.1f%% mqtt %.1f%%, unfiltered: %u shared IDs, %lu frames with no entry",
+              change_filter.getReduction(ChangeFilter::SINK_SD) * 100.0f,
+              change_filter.getReduction(ChangeFilter::SINK_MQTT) * 100.0f,
+              filter.shared_ids, filter.overflow);
+        last_perf_time = current_time;
+    }
+
+#if PERF_ENABLED
+    // Work time only, excluding the delay below
+    PerfCounters::record(PerfCounters::STAGE_LOOP, ESP.getCycleCount() - loop_start);
+#endif
+
+    // ===== POWER MANAGEMENT =====
+    power_manager.update();
+
+    // Brief delay to prevent watchdog triggers; the rings absorb the gap
+    delay(1);
 }
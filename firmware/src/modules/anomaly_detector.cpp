@@ -3,195 +3,98 @@
 #include <cmath>
 #include <cstring>
 
-AnomalyDetector::AnomalyDetector()
-    : _anomaly_flagged(false), _history_index(0), _last_check_time(0), _tracked_messages(0) {
+AnomalyDetector::AnomalyDetector() : _anomaly_flagged(false), _frames(0) {
     memset(&_latest_anomaly, 0, sizeof(Anomaly));
-    memset(&_prev_state, 0, sizeof(VehicleState));
-    memset(_history, 0, sizeof(_history));
-    memset(_message_track, 0, sizeof(_message_track));
+    memset(&_scratch, 0, sizeof(Anomaly));
 }
 
 AnomalyDetector::~AnomalyDetector() {}
 
 void AnomalyDetector::init() {
-    LOG_I("ANOMALY", "Anomaly Detector initialized");
+    LOG_I("ANOMALY", "Anomaly Detector initialized, %u rules", RULE_COUNT);
 }
 
-void AnomalyDetector::update(const CanFrame& frame, const VehicleState& state) {
-    _anomaly_flagged = false;
+void AnomalyDetector::update(const CanFrame& frame, const VehicleState& state, uint8_t signals) {
+    _frames++;
+    RuleContext context = {frame, state, millis()};
+    _anomaly_flagged = _rules.run(signals | RULE_EVERY_FRAME, context, _latest_anomaly, _scratch);
+    if (!_anomaly_flagged) return;
 
-    // Run detections
-    if (checkRPMSpike(state)) {
-        _anomaly_flagged = true;
-        return;
-    }
-
-    if (checkSpeedThreshold(state)) {
-        _anomaly_flagged = true;
-        return;
-    }
-
-    if (checkCANFrequency(frame)) {
-        _anomaly_flagged = true;
-        return;
-    }
-
-    if (checkEngineInconsistency(state)) {
-        _anomaly_flagged = true;
-        return;
-    }
-
-    if (checkStatisticalDeviation(state)) {
-        _anomaly_flagged = true;
-        return;
-    }
-
-    recordHistory(state);
-    _prev_state = state;
-}
-
-bool AnomalyDetector::checkRPMSpike(const VehicleState& state) {
-    if (_prev_state.rpm == 0) {
-        _prev_state.rpm = state.rpm;
-        return false;
-    }
-
-    uint16_t rpm_delta = abs((int32_t)state.rpm - (int32_t)_prev_state.rpm);
-
-    if (rpm_delta > RPM_SPIKE_THRESHOLD) {
-        char desc[128];
-        snprintf(desc, sizeof(desc), "RPM spike detected: %u RPM -> %u RPM (delta: %u)",
-                 _prev_state.rpm, state.rpm, rpm_delta);
-        createAnomaly(ANOMALY_RPM_SPIKE, desc, 2, 0x101);
-        return true;
-    }
-
-    return false;
+    _latest_anomaly.timestamp = context.now;
+    _latest_anomaly.snapshot_id = 0;
+    LOG_W("ANOMALY", "[%u] %s", _latest_anomaly.type, _latest_anomaly.description);
 }
 
-bool AnomalyDetector::checkSpeedThreshold(const VehicleState& state) {
-    if (state.speed > SPEED_MAX_THRESHOLD) {
-        char desc[128];
-        snprintf(desc, sizeof(desc), "Speed threshold exceeded: %u km/h (max: %u)",
-                 state.speed, SPEED_MAX_THRESHOLD);
-        createAnomaly(ANOMALY_SPEED_EXCEED, desc, 2, 0x100);
-        return true;
-    }
-
-    return false;
+bool AnomalyDetector::hasAnomaly() {
+    return _anomaly_flagged;
 }
 
-bool AnomalyDetector::checkCANFrequency(const CanFrame& frame) {
-    uint32_t current_time = millis();
-
-    for (uint8_t i = 0; i < _tracked_messages; i++) {
-        if (_message_track[i].can_id == frame.id) {
-            uint32_t time_delta = current_time - _message_track[i].last_seen;
-
-            if (time_delta > CAN_MSG_TIMEOUT && _message_track[i].last_seen > 0) {
-                char desc[128];
-                snprintf(desc, sizeof(desc), "CAN message frequency anomaly: ID=0x%03X, last seen %lu ms ago",
-                         frame.id, time_delta);
-                createAnomaly(ANOMALY_CAN_FREQUENCY, desc, 1, frame.id);
-                return true;
-            }
-
-            _message_track[i].last_seen = current_time;
-            _message_track[i].frequency++;
-            return false;
-        }
-    }
-
-    // Add new message ID
-    if (_tracked_messages < 16) {
-        _message_track[_tracked_messages].can_id = frame.id;
-        _message_track[_tracked_messages].last_seen = current_time;
-        _message_track[_tracked_messages].frequency = 1;
-        _tracked_messages++;
-    }
-
-    return false;
+Anomaly AnomalyDetector::getLatestAnomaly() {
+    return _latest_anomaly;
 }
 
-bool AnomalyDetector::checkEngineInconsistency(const VehicleState& state) {
-    // Engine OFF but RPM > 0
-    if (state.engine_status == 0 && state.rpm > 0) {
-        char desc[128];
-        snprintf(desc, sizeof(desc), "Engine inconsistency: Engine OFF but RPM = %u", state.rpm);
-        createAnomaly(ANOMALY_ENGINE_INCONSISTENCY, desc, 3, 0x103);
-        return true;
-    }
-
-    return false;
+uint32_t AnomalyDetector::takeRuleReport(RuleReport* reports) {
+    _rules.takeReport(reports);
+    uint32_t frames = _frames;
+    _frames = 0;
+    return frames;
 }
 
-bool AnomalyDetector::checkStatisticalDeviation(const VehicleState& state) {
-    if (_history_index < 10) return false;  // Need enough history
-
-    // Calculate statistics for RPM
-    uint16_t rpm_values[MAX_HISTORY];
-    for (uint8_t i = 0; i < _history_index; i++) {
-        rpm_values[i] = _history[i].rpm;
-    }
-
-    double mean = calculateMean(rpm_values, _history_index);
-    double variance = calculateVariance(rpm_values, _history_index, mean);
-    double std_dev = sqrt(variance);
-
-    // Check 3-sigma rule
-    double deviation = abs((double)state.rpm - mean);
-    if (deviation > 3 * std_dev && std_dev > 0) {
-        char desc[128];
-        snprintf(desc, sizeof(desc), "Statistical deviation detected: RPM=%u (mean=%.0f, 3σ=%.0f)",
-                 state.rpm, mean, 3 * std_dev);
-        createAnomaly(ANOMALY_STATISTICAL_DEVIATION, desc, 1, 0x101);
-        return true;
-    }
+#if ANOMALY_STATS_BENCHMARK
+void AnomalyDetector::runStatsBenchmark(uint16_t iterations) {
+    const uint8_t history_size = StatisticalDeviationRule::MAX_HISTORY;
 
-    return false;
-}
-
-double AnomalyDetector::calculateMean(uint16_t* values, uint8_t count) {
-    if (count == 0) return 0;
+    // Idle-to-cruise RPM with a periodic excursion, so both paths see hits
+    uint16_t history[history_size];
     uint32_t sum = 0;
-    for (uint8_t i = 0; i < count; i++) {
-        sum += values[i];
+    uint64_t sum_sq = 0;
+    for (uint8_t i = 0; i < history_size; i++) {
+        history[i] = 1800 + (i * 37) % 200;
+        sum += history[i];
+        sum_sq += (uint32_t)history[i] * history[i];
     }
-    return (double)sum / count;
-}
-
-double AnomalyDetector::calculateVariance(uint16_t* values, uint8_t count, double mean) {
-    if (count == 0) return 0;
-    double sum = 0;
-    for (uint8_t i = 0; i < count; i++) {
-        double diff = values[i] - mean;
-        sum += diff * diff;
+    uint16_t reference[history_size];
+    memcpy(reference, history, sizeof(history));
+
+    // What this check cost before: copy, mean, variance and sqrt in double
+    uint32_t double_hits = 0;
+    uint32_t start = ESP.getCycleCount();
+    for (uint16_t it = 0; it < iterations; it++) {
+        uint16_t rpm = (it % 50 == 0) ? 3500 : 1800 + (it * 53) % 200;
+        uint16_t values[history_size];
+        memcpy(values, reference, sizeof(values));
+        double mean = 0;
+        for (uint8_t i = 0; i < history_size; i++) mean += values[i];
+        mean /= history_size;
+        double variance = 0;
+        for (uint8_t i = 0; i < history_size; i++) {
+            double diff = values[i] - mean;
+            variance += diff * diff;
+        }
+        double std_dev = sqrt(variance / history_size);
+        if (fabs(rpm - mean) > 3 * std_dev && std_dev > 0) double_hits++;
+        reference[it % history_size] = rpm;
     }
-    return sum / count;
-}
-
-void AnomalyDetector::recordHistory(const VehicleState& state) {
-    _history[_history_index % MAX_HISTORY].rpm = state.rpm;
-    _history[_history_index % MAX_HISTORY].speed = state.speed;
-    _history[_history_index % MAX_HISTORY].timestamp = state.timestamp;
-    _history_index++;
-}
-
-void AnomalyDetector::createAnomaly(uint8_t type, const char* description, uint8_t severity, uint16_t can_id) {
-    _latest_anomaly.type = type;
-    _latest_anomaly.severity = severity;
-    _latest_anomaly.can_id = can_id;
-    _latest_anomaly.timestamp = millis();
-    strncpy(_latest_anomaly.description, description, sizeof(_latest_anomaly.description) - 1);
-    _latest_anomaly.description[sizeof(_latest_anomaly.description) - 1] = '\0';
-
-    LOG_W("ANOMALY", "[%u] %s", type, description);
-}
-
-bool AnomalyDetector::hasAnomaly() {
-    return _anomaly_flagged;
-}
+    uint32_t double_cycles = ESP.getCycleCount() - start;
+
+    // Running sums, including the per-frame ring update
+    uint32_t integer_hits = 0;
+    start = ESP.getCycleCount();
+    for (uint16_t it = 0; it < iterations; it++) {
+        uint16_t rpm = (it % 50 == 0) ? 3500 : 1800 + (it * 53) % 200;
+        if (StatisticalDeviationRule::exceedsThreeSigma(rpm, history_size, sum, sum_sq)) integer_hits++;
+        uint16_t& old = history[it % history_size];
+        sum += rpm - old;
+        sum_sq -= (uint32_t)old * old;
+        sum_sq += (uint32_t)rpm * rpm;
+        old = rpm;
+    }
+    uint32_t integer_cycles = ESP.getCycleCount() - start;
 
-Anomaly AnomalyDetector::getLatestAnomaly() {
-    return _latest_anomaly;
+    if (iterations == 0) iterations = 1;
+    LOG_I("ANOMALY", "3-sigma benchmark: double %lu cycles/frame, integer %lu cycles/frame",
+          double_cycles / iterations, integer_cycles / iterations);
+    LOG_I("ANOMALY", "3-sigma benchmark: %lu hits double, %lu hits integer",
+          double_hits, integer_hits);
 }
+#endif
@@ -0,0 +1,143 @@
+#include "anomaly_rules.h"
+#include "config.h"
+#include <cmath>
+#include <cstring>
+
+// The anomaly is sourced from the frame that carried the triggering signal
+static void setAnomaly(Anomaly& anomaly, uint8_t type, uint8_t severity, const CanFrame& frame) {
+    anomaly.type = type;
+    anomaly.severity = severity;
+    anomaly.can_id = frame.id;
+}
+
+bool RpmSpikeRule::evaluate(const RuleContext& context, Anomaly& anomaly) {
+    uint16_t prev = _prev_rpm;
+    uint16_t rpm = context.state.rpm;
+    _prev_rpm = rpm;
+    if (prev == 0) return false;
+
+    uint16_t rpm_delta = abs((int32_t)rpm - (int32_t)prev);
+    if (rpm_delta > RPM_SPIKE_THRESHOLD) {
+        setAnomaly(anomaly, ANOMALY_RPM_SPIKE, 2, context.frame);
+        snprintf(anomaly.description, sizeof(anomaly.description),
+                 "RPM spike detected: %u RPM -> %u RPM (delta: %u)", prev, rpm, rpm_delta);
+        return true;
+    }
+
+    return false;
+}
+
+bool SpeedThresholdRule::evaluate(const RuleContext& context, Anomaly& anomaly) {
+    if (context.state.speed > SPEED_MAX_THRESHOLD) {
+        setAnomaly(anomaly, ANOMALY_SPEED_EXCEED, 2, context.frame);
+        snprintf(anomaly.description, sizeof(anomaly.description),
+                 "Speed threshold exceeded: %u km/h (max: %u)", context.state.speed, SPEED_MAX_THRESHOLD);
+        return true;
+    }
+
+    return false;
+}
+
+CanFrequencyRule::CanFrequencyRule() : _tracked_messages(0) {
+    memset(_message_track, 0, sizeof(_message_track));
+}
+
+bool CanFrequencyRule::evaluate(const RuleContext& context, Anomaly& anomaly) {
+    const CanFrame& frame = context.frame;
+
+    for (uint8_t i = 0; i < _tracked_messages; i++) {
+        if (_message_track[i].can_id == frame.id) {
+            uint32_t time_delta = context.now - _message_track[i].last_seen;
+            bool late = time_delta > CAN_MSG_TIMEOUT && _message_track[i].last_seen > 0;
+
+            // Updated on a hit too, or every later frame of the ID would
+            // measure from the same stale time and fire again
+            _message_track[i].last_seen = context.now;
+            _message_track[i].frequency++;
+
+            if (late) {
+                setAnomaly(anomaly, ANOMALY_CAN_FREQUENCY, 1, frame);
+                snprintf(anomaly.description, sizeof(anomaly.description),
+                         "CAN message frequency anomaly: ID=0x%03X, last seen %lu ms ago",
+                         frame.id, time_delta);
+                return true;
+            }
+            return false;
+        }
+    }
+
+    // Add new message ID
+    if (_tracked_messages < MAX_TRACKED) {
+        _message_track[_tracked_messages].can_id = frame.id;
+        _message_track[_tracked_messages].last_seen = context.now;
+        _message_track[_tracked_messages].frequency = 1;
+        _tracked_messages++;
+    }
+
+    return false;
+}
+
+bool EngineInconsistencyRule::evaluate(const RuleContext& context, Anomaly& anomaly) {
+    // Engine OFF but RPM > 0
+    if (context.state.engine_status == 0 && context.state.rpm > 0) {
+        setAnomaly(anomaly, ANOMALY_ENGINE_INCONSISTENCY, 3, context.frame);
+        snprintf(anomaly.description, sizeof(anomaly.description),
+                 "Engine inconsistency: Engine OFF but RPM = %u", context.state.rpm);
+        return true;
+    }
+
+    return false;
+}
+
+StatisticalDeviationRule::StatisticalDeviationRule()
+    : _history_index(0), _history_count(0), _rpm_sum(0), _rpm_sum_sq(0) {
+    memset(_history, 0, sizeof(_history));
+}
+
+bool StatisticalDeviationRule::evaluate(const RuleContext& context, Anomaly& anomaly) {
+    uint16_t rpm = context.state.rpm;
+
+    // Need enough history; outliers are kept out of it
+    if (_history_count < 10 || !exceedsThreeSigma(rpm, _history_count, _rpm_sum, _rpm_sum_sq)) {
+        record(rpm);
+        return false;
+    }
+
+    // Only a hit pays for the float figures in the description
+    uint64_t spread = (uint64_t)_history_count * _rpm_sum_sq - (uint64_t)_rpm_sum * _rpm_sum;
+    float mean = (float)_rpm_sum / _history_count;
+    float three_sigma = 3.0f * sqrtf((float)spread) / _history_count;
+
+    setAnomaly(anomaly, ANOMALY_STATISTICAL_DEVIATION, 1, context.frame);
+    snprintf(anomaly.description, sizeof(anomaly.description),
+             "Statistical deviation detected: RPM=%u (mean=%.0f, 3σ=%.0f)", rpm, mean, three_sigma);
+    return true;
+}
+
+// |x - S/n| > 3 * sqrt(Q/n - (S/n)^2), multiplied through by n and squared:
+// (n*x - S)^2 > 9 * (n*Q - S^2). Exact in 64 bits for n <= MAX_HISTORY
+// 16-bit samples, where the double version rounded twice and took a root.
+bool StatisticalDeviationRule::exceedsThreeSigma(uint16_t value, uint32_t count, uint32_t sum, uint64_t sum_sq) {
+    uint64_t spread = (uint64_t)count * sum_sq - (uint64_t)sum * sum;   // n^2 * variance
+    if (spread == 0) return false;   // Flat history: no sigma to compare against
+
+    int64_t deviation = (int64_t)count * value - (int64_t)sum;
+    uint64_t magnitude = deviation < 0 ? (uint64_t)-deviation : (uint64_t)deviation;
+    return magnitude * magnitude > 9 * spread;
+}
+
+void StatisticalDeviationRule::record(uint16_t rpm) {
+    uint16_t& slot = _history[_history_index];
+    if (_history_count == MAX_HISTORY) {
+        // Drop the sample being overwritten from the running sums
+        _rpm_sum -= slot;
+        _rpm_sum_sq -= (uint32_t)slot * slot;
+    } else {
+        _history_count++;
+    }
+
+    slot = rpm;
+    _rpm_sum += rpm;
+    _rpm_sum_sq += (uint32_t)rpm * rpm;
+    _history_index = (_history_index + 1) % MAX_HISTORY;
+}
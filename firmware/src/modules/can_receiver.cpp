@@ -0,0 +1,112 @@
+#include "can_receiver.h"
+#include "logger.h"
+#include "spi_arbiter.h"
+#include <esp_timer.h>
+
+CanReceiver::CanReceiver() : _count(0), _next(0), _task(nullptr), _first_frame_us(0), _report_time(0) {
+    memset(_channels, 0, sizeof(_channels));
+    memset(_report_frames, 0, sizeof(_report_frames));
+    memset(_report_tx, 0, sizeof(_report_tx));
+}
+
+CanReceiver::~CanReceiver() {
+    if (_task) vTaskDelete(_task);
+}
+
+bool CanReceiver::addChannel(MCP2515Driver& driver) {
+    if (_count >= CAN_MAX_CHANNELS) {
+        LOG_E("CANRX", "Channel limit %u reached", CAN_MAX_CHANNELS);
+        return false;
+    }
+    _channels[_count++] = &driver;
+    return true;
+}
+
+bool CanReceiver::start() {
+    if (xTaskCreatePinnedToCore(rxTask, "can_rx", 4096, this, CAN_RX_TASK_PRIORITY,
+                                &_task, CAN_RX_TASK_CORE) != pdPASS) {
+        LOG_E("CANRX", "Failed to start RX task");
+        return false;
+    }
+
+    for (uint8_t i = 0; i < _count; i++) {
+        _channels[i]->setRxTask(_task);
+        _channels[i]->enableInterrupt();
+    }
+    _report_time = millis();
+
+    LOG_I("CANRX", "Receiving on %u channel(s)", _count);
+    return true;
+}
+
+void CanReceiver::rxTask(void* arg) {
+    CanReceiver* self = static_cast<CanReceiver*>(arg);
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CAN_RX_POLL_MS));
+
+        bool pending = true;
+        bool first_pass = true;
+        while (pending) {
+            pending = false;
+            for (uint8_t i = 0; i < self->_count; i++) {
+                if (self->_channels[i]->service(1)) pending = true;
+            }
+            if (pending && !self->_first_frame_us) {
+                self->_first_frame_us = (uint32_t)esp_timer_get_time();
+            }
+            if (first_pass) {
+                SpiArbiter::onCanServiced();
+                first_pass = false;
+            }
+        }
+
+        for (uint8_t i = 0; i < self->_count; i++) {
+            self->_channels[i]->serviceTx();
+        }
+    }
+}
+
+bool CanReceiver::readFrame(CanFrame& frame) {
+    for (uint8_t n = 0; n < _count; n++) {
+        uint8_t index = (_next + n) % _count;
+        if (_channels[index]->readFrame(frame) == MCP2515Driver::ERROR_OK) {
+            _next = (index + 1) % _count;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t CanReceiver::getLastRxTime() const {
+    uint32_t latest = 0;
+    for (uint8_t i = 0; i < _count; i++) {
+        uint32_t t = _channels[i]->getLastRxTime();
+        if (i == 0 || (int32_t)(t - latest) > 0) latest = t;
+    }
+    return latest;
+}
+
+uint8_t CanReceiver::takeReport(ChannelReport* reports, uint32_t now) {
+    uint32_t window = now - _report_time;
+    for (uint8_t i = 0; i < _count; i++) {
+        const MCP2515Driver::Stats& stats = _channels[i]->getStats();
+        ChannelReport& r = reports[i];
+        r.channel = _channels[i]->getChannel();
+        r.frames = stats.frames;
+        r.frames_per_sec = window ? (uint32_t)((uint64_t)(stats.frames - _report_frames[i]) * 1000 / window) : 0;
+        r.overflows = stats.overflows;
+        r.ring_dropped = stats.ring_dropped;
+        r.ring_high_water = stats.ring_high_water;
+        r.bitrate = _channels[i]->getBitrate();
+        r.bitrate_lock_ms = stats.bitrate_lock_ms;
+        r.tx_sent = stats.tx_sent;
+        r.tx_per_sec = window ? (uint32_t)((uint64_t)(stats.tx_sent - _report_tx[i]) * 1000 / window) : 0;
+        r.tx_arbitration_lost = stats.tx_arbitration_lost;
+        r.tx_failed = stats.tx_aborted + stats.tx_errors;
+        _report_frames[i] = stats.frames;
+        _report_tx[i] = stats.tx_sent;
+    }
+    _report_time = now;
+    return _count;
+}
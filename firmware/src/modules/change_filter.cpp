@@ -0,0 +1,173 @@
+#include "change_filter.h"
+#include <cstring>
+
+namespace {
+
+struct ModeOverride {
+    uint16_t first_id;
+    uint16_t last_id;
+    uint8_t sd_mode;
+    uint8_t mqtt_mode;
+};
+
+const ModeOverride MODE_OVERRIDES[] = CHANGE_FILTER_OVERRIDES;
+
+}  // namespace
+
+ChangeFilter::ChangeFilter() : _used(0), _changed(false) {
+    memset(&_stats, 0, sizeof(Stats));
+    memset(_index, 0xFF, sizeof(_index));
+}
+
+ChangeFilter::~ChangeFilter() {}
+
+void ChangeFilter::init() {
+    memset(_index, 0xFF, sizeof(_index));
+    _used = 0;
+    for (size_t i = 0; i < sizeof(MODE_OVERRIDES) / sizeof(MODE_OVERRIDES[0]); i++) {
+        const ModeOverride& o = MODE_OVERRIDES[i];
+        for (uint32_t id = o.first_id; id <= o.last_id && id < TABLE_SIZE; id++) {
+            setMode(SINK_SD, id, (Mode)o.sd_mode);
+            setMode(SINK_MQTT, id, (Mode)o.mqtt_mode);
+        }
+    }
+}
+
+bool ChangeFilter::setMode(Sink sink, uint32_t can_id, Mode mode) {
+    Entry* entry = allocate(can_id);
+    if (!entry) return false;
+    uint8_t shift = sink * 2;
+    entry->modes = (entry->modes & ~(0x03 << shift)) | ((mode & 0x03) << shift);
+    entry->suppressed[sink] = 0;
+    entry->resync |= 1 << sink;
+    return true;
+}
+
+ChangeFilter::Mode ChangeFilter::getMode(Sink sink, uint32_t can_id) const {
+    uint16_t index = indexOf(can_id);
+    uint8_t modes = index == NO_ENTRY ? DEFAULT_MODES : _entries[index].modes;
+    uint8_t mode = (modes >> (sink * 2)) & 0x03;
+    // IDs without an entry are passed through: anything not off is every frame
+    bool unfiltered = can_id >= TABLE_SIZE || (index == NO_ENTRY && _used >= CHANGE_FILTER_MAX_IDS);
+    if (unfiltered && mode != MODE_OFF) return MODE_ALL;
+    return (Mode)mode;
+}
+
+void ChangeFilter::process(const CanFrame& frame, Result& result) {
+    _stats.frames++;
+
+    // Extended IDs have no entry and are never filtered
+    if (frame.id >= TABLE_SIZE) {
+        passThrough(result, DEFAULT_MODES);
+        return;
+    }
+
+    Entry* slot = allocate(frame.id);
+    if (!slot) {
+        _stats.overflow++;
+        passThrough(result, DEFAULT_MODES);
+        return;
+    }
+    Entry& entry = *slot;
+    if (!claim(entry, frame)) {
+        passThrough(result, entry.modes);
+        return;
+    }
+
+    uint8_t dlc = frame.dlc > 8 ? 8 : frame.dlc;
+    _changed = entry.dlc != dlc || memcmp(entry.data, frame.data, dlc) != 0;
+    if (_changed) {
+        memcpy(entry.data, frame.data, dlc);
+        entry.dlc = dlc;
+    }
+
+    for (uint8_t s = 0; s < SINK_COUNT; s++) {
+        Mode mode = (Mode)((entry.modes >> (s * 2)) & 0x03);
+        result.suppressed[s] = 0;
+        if (mode != MODE_ON_CHANGE) {
+            result.emit[s] = mode == MODE_ALL;
+            continue;
+        }
+        bool heartbeat = frame.timestamp - entry.last_emit[s] >= CHANGE_FILTER_HEARTBEAT_MS;
+        bool saturated = entry.suppressed[s] == 0xFFFF;
+        result.emit[s] = _changed || heartbeat || saturated || (entry.resync & (1 << s));
+        if (result.emit[s]) result.suppressed[s] = entry.suppressed[s];
+        else entry.suppressed[s]++;
+    }
+}
+
+void ChangeFilter::confirm(Sink sink, const CanFrame& frame, bool written) {
+    if (written) _stats.emitted[sink]++;
+    uint16_t index = indexOf(frame.id);
+    if (index == NO_ENTRY) return;
+    Entry& entry = _entries[index];
+    if ((entry.modes & SHARED_FLAG) || getMode(sink, frame.id) != MODE_ON_CHANGE) return;
+
+    uint8_t bit = 1 << sink;
+    if (written) {
+        entry.suppressed[sink] = 0;
+        entry.last_emit[sink] = frame.timestamp;
+        entry.resync &= ~bit;
+    } else if (_changed || (entry.resync & bit)) {
+        // The sink's last payload is no longer the reference; its count
+        // still stands for repeats of what it did write
+        entry.resync |= bit;
+    } else if (entry.suppressed[sink] < 0xFFFF) {
+        // Same payload the sink last wrote: one more repeat
+        entry.suppressed[sink]++;
+    }
+}
+
+void ChangeFilter::resync(Sink sink) {
+    // The lost frames took their repeat counts with them
+    for (uint16_t i = 0; i < _used; i++) {
+        _entries[i].resync |= 1 << sink;
+        _entries[i].suppressed[sink] = 0;
+    }
+}
+
+uint16_t ChangeFilter::indexOf(uint32_t can_id) const {
+    return can_id < TABLE_SIZE ? _index[can_id] : NO_ENTRY;
+}
+
+ChangeFilter::Entry* ChangeFilter::allocate(uint32_t can_id) {
+    uint16_t index = indexOf(can_id);
+    if (index != NO_ENTRY) return &_entries[index];
+    if (can_id >= TABLE_SIZE || _used >= CHANGE_FILTER_MAX_IDS) return nullptr;
+
+    Entry* entry = &_entries[_used];
+    memset(entry, 0, sizeof(Entry));
+    entry->dlc = 0xFF;
+    entry->modes = DEFAULT_MODES;
+    _index[can_id] = _used++;
+    return entry;
+}
+
+bool ChangeFilter::claim(Entry& entry, const CanFrame& frame) {
+    if (entry.modes & SHARED_FLAG) return false;
+
+    uint8_t channel = (frame.channel << CHANNEL_SHIFT) & CHANNEL_MASK;
+    if (entry.dlc == 0xFF) {
+        entry.modes = (entry.modes & ~CHANNEL_MASK) | channel;
+        return true;
+    }
+    if ((entry.modes & CHANNEL_MASK) == channel) return true;
+
+    // The pending count belonged to the other bus and cannot be attributed
+    entry.modes |= SHARED_FLAG;
+    _stats.shared_ids++;
+    memset(entry.suppressed, 0, sizeof(entry.suppressed));
+    return false;
+}
+
+void ChangeFilter::passThrough(Result& result, uint8_t modes) {
+    for (uint8_t s = 0; s < SINK_COUNT; s++) {
+        result.emit[s] = ((modes >> (s * 2)) & 0x03) != MODE_OFF;
+        result.suppressed[s] = 0;
+    }
+}
+
+float ChangeFilter::getReduction(Sink sink) const {
+    if (_stats.frames == 0) return 0.0f;
+    return 1.0f - (float)_stats.emitted[sink] / (float)_stats.frames;
+}
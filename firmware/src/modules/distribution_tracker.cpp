@@ -0,0 +1,50 @@
+#include "distribution_tracker.h"
+#include "base64.h"
+
+DistributionTracker::DistributionTracker() : _held(0), _window_start(0) {
+    memset(_held_value, 0, sizeof(_held_value));
+    memset(_held_since, 0, sizeof(_held_since));
+}
+
+void DistributionTracker::update(const VehicleState& state, uint8_t signals, uint32_t now) {
+    uint16_t values[SIGNALS];
+    values[SIGNAL_SPEED] = state.speed;
+    values[SIGNAL_RPM] = state.rpm;
+    values[SIGNAL_THROTTLE] = state.throttle;
+
+    for (uint8_t i = 0; i < SIGNALS; i++) {
+        if (!(signals & (1 << i))) continue;
+        credit(i, now);
+        _held_value[i] = values[i];
+        _held_since[i] = now;
+        _held |= 1 << i;
+    }
+}
+
+void DistributionTracker::closeWindow(uint32_t now) {
+    for (uint8_t i = 0; i < SIGNALS; i++) {
+        credit(i, now);
+        if ((int32_t)(now - _held_since[i]) > 0) _held_since[i] = now;
+    }
+}
+
+void DistributionTracker::reset(uint32_t now) {
+    for (uint8_t i = 0; i < SIGNALS; i++) _sketches[i].clear();
+    _window_start = now;
+}
+
+void DistributionTracker::credit(uint8_t signal, uint32_t now) {
+    if (!(_held & (1 << signal))) return;
+    // Frame timestamps can run slightly ahead of the loop's clock sample
+    int32_t held = (int32_t)(now - _held_since[signal]);
+    if (held <= 0) return;
+    if (held > DIST_MAX_HOLD_MS) held = DIST_MAX_HOLD_MS;
+    _sketches[signal].add(_held_value[signal], held);
+}
+
+size_t DistributionTracker::encode(const QuantileSketch& sketch, char* out, size_t size) {
+    uint8_t blob[MAX_BLOB_SIZE];
+    size_t length = sketch.serialize(blob, sizeof(blob));
+    if (length == 0) return 0;
+    return Base64::encode(blob, length, out, size);
+}
@@ -0,0 +1,175 @@
+#include "flight_recorder.h"
+#include "logger.h"
+#include "clock_sync.h"
+#include <cstring>
+
+FlightRecorder::FlightRecorder(SDLogger& sd_logger)
+    : _sd_logger(sd_logger), _phase(IDLE), _frames(nullptr), _states(nullptr),
+      _frame_head(0), _state_head(0), _last_state_time(0),
+      _snapshot_id(0), _frame_next(0), _frame_end(0), _state_next(0), _state_end(0),
+      _write_failed(false) {
+    memset(&_stats, 0, sizeof(Stats));
+    memset(&_header, 0, sizeof(SnapshotHeader));
+}
+
+FlightRecorder::~FlightRecorder() {
+    free(_frames);
+    free(_states);
+}
+
+void FlightRecorder::init() {
+    if (!_frames) _frames = (CanFrame*)malloc(FLIGHT_RECORDER_FRAMES * sizeof(CanFrame));
+    if (!_states) _states = (VehicleState*)malloc(FLIGHT_RECORDER_STATES * sizeof(VehicleState));
+    if (!_frames || !_states) {
+        LOG_E("FLIGHTREC", "No memory for the capture rings, flight recorder off");
+        free(_frames);
+        free(_states);
+        _frames = nullptr;
+        _states = nullptr;
+        return;
+    }
+    LOG_I("FLIGHTREC", "Flight recorder initialized (%u frames, %lu ms pre / %lu ms post)",
+          FLIGHT_RECORDER_FRAMES, (uint32_t)FLIGHT_RECORDER_PRE_MS, (uint32_t)FLIGHT_RECORDER_POST_MS);
+}
+
+void FlightRecorder::recordState(const VehicleState& state) {
+    if (!_states) return;
+    if (_state_head != 0 && state.timestamp - _last_state_time < FLIGHT_RECORDER_STATE_INTERVAL) return;
+    _states[_state_head % FLIGHT_RECORDER_STATES] = state;
+    _state_head++;
+    _last_state_time = state.timestamp;
+}
+
+uint32_t FlightRecorder::trigger(const Anomaly& anomaly) {
+    if (_phase == POST_TRIGGER) {
+        // Anomaly falls inside the window already being captured
+        _stats.coalesced++;
+        return _snapshot_id;
+    }
+    if (_phase == WRITING) {
+        _stats.rejected++;
+        return 0;
+    }
+    if (!_frames) return 0;
+
+    _snapshot_id = _sd_logger.beginSnapshot();
+    if (_snapshot_id == 0) return 0;
+
+    uint32_t now = millis();
+    memset(&_header, 0, sizeof(SnapshotHeader));
+    _header.magic = SNAPSHOT_MAGIC;
+    _header.version = SNAPSHOT_VERSION;
+    _header.header_size = sizeof(SnapshotHeader);
+    _header.trigger_time = now;
+    _header.trigger_utc_ms = ClockSync::toUtcMs(now);
+    _header.pre_trigger_ms = FLIGHT_RECORDER_PRE_MS;
+    _header.post_trigger_ms = FLIGHT_RECORDER_POST_MS;
+    _header.anomaly = anomaly;
+    _header.anomaly.snapshot_id = _snapshot_id;
+
+    _write_failed = false;
+    _frame_next = findFrameStart(now - FLIGHT_RECORDER_PRE_MS);
+    _state_next = findStateStart(now - FLIGHT_RECORDER_PRE_MS);
+    _phase = POST_TRIGGER;
+
+    LOG_I("FLIGHTREC", "Snapshot %lu triggered by anomaly type %u", _snapshot_id, anomaly.type);
+    return _snapshot_id;
+}
+
+void FlightRecorder::update() {
+    if (_phase == IDLE) return;
+
+    if (_phase == POST_TRIGGER) {
+        // Drain the pre-trigger history while the post window fills, so the
+        // ring only has to cover the drain lag rather than the whole window
+        _frame_end = _frame_head;
+        if (millis() - _header.trigger_time < FLIGHT_RECORDER_POST_MS) {
+            if (!writeFrames() && _write_failed) finish();
+            return;
+        }
+        _state_end = _state_head;
+        _phase = WRITING;
+    }
+
+    if (!writeFrames() && !writeStates()) {
+        finish();
+    }
+}
+
+uint32_t FlightRecorder::findFrameStart(uint32_t cutoff) {
+    // Walk back from the newest frame while it is still inside the window
+    uint32_t oldest = _frame_head > FLIGHT_RECORDER_FRAMES ? _frame_head - FLIGHT_RECORDER_FRAMES : 0;
+    uint32_t seq = _frame_head;
+    while (seq > oldest && (int32_t)(_frames[(seq - 1) % FLIGHT_RECORDER_FRAMES].timestamp - cutoff) >= 0) {
+        seq--;
+    }
+    return seq;
+}
+
+uint32_t FlightRecorder::findStateStart(uint32_t cutoff) {
+    uint32_t oldest = _state_head > FLIGHT_RECORDER_STATES ? _state_head - FLIGHT_RECORDER_STATES : 0;
+    uint32_t seq = _state_head;
+    while (seq > oldest && (int32_t)(_states[(seq - 1) % FLIGHT_RECORDER_STATES].timestamp - cutoff) >= 0) {
+        seq--;
+    }
+    return seq;
+}
+
+bool FlightRecorder::writeFrames() {
+    if (_write_failed) return false;
+
+    // Capture keeps running while we drain; anything lapped by the write
+    // head is skipped and counted
+    if (_frame_head - _frame_next > FLIGHT_RECORDER_FRAMES) {
+        uint32_t lost = (_frame_head - FLIGHT_RECORDER_FRAMES) - _frame_next;
+        _header.frames_lost += lost;
+        _frame_next += lost;
+    }
+    if (_frame_next >= _frame_end) return false;
+
+    uint32_t slot = _frame_next % FLIGHT_RECORDER_FRAMES;
+    uint32_t count = _frame_end - _frame_next;
+    if (count > FLIGHT_RECORDER_CHUNK) count = FLIGHT_RECORDER_CHUNK;
+    if (count > FLIGHT_RECORDER_FRAMES - slot) count = FLIGHT_RECORDER_FRAMES - slot;
+
+    if (!_sd_logger.appendSnapshot(&_frames[slot], count * sizeof(CanFrame))) {
+        _write_failed = true;
+        return false;
+    }
+    _frame_next += count;
+    _header.frame_count += count;
+    return true;
+}
+
+bool FlightRecorder::writeStates() {
+    if (_write_failed) return false;
+
+    if (_state_head - _state_next > FLIGHT_RECORDER_STATES) {
+        _state_next = _state_head - FLIGHT_RECORDER_STATES;
+    }
+    if (_state_next >= _state_end) return false;
+
+    uint32_t slot = _state_next % FLIGHT_RECORDER_STATES;
+    uint32_t count = _state_end - _state_next;
+    if (count > FLIGHT_RECORDER_STATES - slot) count = FLIGHT_RECORDER_STATES - slot;
+
+    if (!_sd_logger.appendSnapshot(&_states[slot], count * sizeof(VehicleState))) {
+        _write_failed = true;
+        return false;
+    }
+    _state_next += count;
+    _header.state_count += count;
+    return true;
+}
+
+void FlightRecorder::finish() {
+    if (_sd_logger.finishSnapshot(_header) && !_write_failed) {
+        _stats.snapshots++;
+        LOG_I("FLIGHTREC", "Snapshot %lu written: %lu frames, %lu states, %lu lost",
+              _snapshot_id, _header.frame_count, _header.state_count, _header.frames_lost);
+    } else {
+        LOG_E("FLIGHTREC", "Snapshot %lu could not be finalized", _snapshot_id);
+    }
+    _stats.frames_lost += _header.frames_lost;
+    _phase = IDLE;
+}
@@ -0,0 +1,402 @@
+#include "log_server.h"
+#include "logger.h"
+#include "net_writer.h"
+#include <ArduinoJson.h>
+
+LogServer::LogServer(SDLogger& sd_logger)
+    : _sd_logger(sd_logger), _server(QUERY_SERVER_PORT), _state(STATE_IDLE), _started(0),
+      _request_length(0), _line_done(false), _header_length(0), _authorized(false), _tail(0), _from(0), _to(UINT64_MAX), _id_count(0),
+      _segment(0), _block(0), _end_block(0), _bytes(0), _records(0), _blocks(0), _skipped(0),
+      _out_start(0), _out_end(0), _last_write(0) {
+    memset(&_stats, 0, sizeof(Stats));
+}
+
+LogServer::~LogServer() {
+    closeClient();
+}
+
+bool LogServer::init() {
+    // Listening does not need the link up; clients arrive once WiFi is
+    _server.begin();
+    LOG_I("QUERY", "Log query server on port %u", QUERY_SERVER_PORT);
+    if (sizeof(QUERY_TOKEN) == 1) LOG_W("QUERY", "QUERY_TOKEN is empty, every request will be refused");
+    return true;
+}
+
+void LogServer::update() {
+    switch (_state) {
+        case STATE_IDLE: {
+            WiFiClient client = _server.available();
+            if (!client) return;
+            _client = client;
+            _client.setNoDelay(true);
+            _state = STATE_REQUEST;
+            _started = millis();
+            _request_length = 0;
+            _line_done = false;
+            _header_length = 0;
+            _authorized = false;
+            _tail = 0;
+            break;
+        }
+        case STATE_REQUEST:
+            readRequest();
+            break;
+        case STATE_STREAMING:
+            streamBlocks();
+            break;
+        case STATE_CLOSING:
+            if (flush()) closeClient();
+            break;
+    }
+}
+
+void LogServer::readRequest() {
+    while (_client.available()) {
+        char c = _client.read();
+        if (!_line_done) {
+            if (c == '\n') _line_done = true;
+            else if (c != '\r' && _request_length < REQUEST_MAX - 1) _request[_request_length++] = c;
+        } else if (c == '\n') {
+            _header[_header_length] = '\0';
+            checkHeader();
+            _header_length = 0;
+        } else if (c != '\r' && _header_length < HEADER_MAX - 1) {
+            _header[_header_length++] = c;
+        }
+        _tail = (_tail << 8) | (uint8_t)c;
+        if (_tail == 0x0D0A0D0A) {
+            _request[_request_length] = '\0';
+            handleRequest();
+            return;
+        }
+    }
+    if (!_client.connected() || millis() - _started > QUERY_REQUEST_TIMEOUT_MS) {
+        _stats.rejected++;
+        closeClient();
+    }
+}
+
+// Constant time in the token, so response timing does not give away how
+// much of a guess was right
+static bool tokenMatches(const char* value, size_t length) {
+    const size_t expected = sizeof(QUERY_TOKEN) - 1;
+    if (expected == 0 || length != expected) return false;
+    uint8_t diff = 0;
+    for (size_t i = 0; i < expected; i++) diff |= (uint8_t)(value[i] ^ QUERY_TOKEN[i]);
+    return diff == 0;
+}
+
+static bool queryHasToken(const char* query) {
+    for (const char* param = query; param;) {
+        if (strncmp(param, "token=", 6) == 0) {
+            const char* value = param + 6;
+            return tokenMatches(value, strcspn(value, "&"));
+        }
+        param = strchr(param, '&');
+        if (param) param++;
+    }
+    return false;
+}
+
+void LogServer::checkHeader() {
+    if (strncasecmp(_header, "Authorization:", 14) != 0) return;
+    const char* value = _header + 14;
+    while (*value == ' ') value++;
+    if (strncasecmp(value, "Bearer ", 7) != 0) return;
+    value += 7;
+    size_t length = strlen(value);
+    while (length && value[length - 1] == ' ') length--;
+    if (tokenMatches(value, length)) _authorized = true;
+}
+
+void LogServer::handleRequest() {
+    if (strncmp(_request, "GET ", 4) != 0) {
+        _stats.rejected++;
+        sendResponse(405, "Method Not Allowed", "text/plain", "GET only\n");
+        return;
+    }
+    char* path = _request + 4;
+    char* end = strchr(path, ' ');
+    if (end) *end = '\0';
+    char* query = strchr(path, '?');
+    if (query) *query++ = '\0';
+
+    if (!_authorized && !(query && queryHasToken(query))) {
+        _stats.unauthorized++;
+        sendResponse(401, "Unauthorized", "text/plain", "token required\n",
+                     "WWW-Authenticate: Bearer realm=\"canlogger\"\r\n");
+        return;
+    }
+
+    if (strcmp(path, "/log") == 0) {
+        if (!parseQuery(query)) {
+            _stats.rejected++;
+            sendResponse(400, "Bad Request", "text/plain", "usage: /log?from=UTC_MS&to=UTC_MS&id=ID,ID\n");
+        } else if (!_sd_logger.isReady()) {
+            sendResponse(503, "Service Unavailable", "text/plain", "SD card not ready\n");
+        } else {
+            beginQuery();
+        }
+    } else if (strcmp(path, "/stats") == 0) {
+        StaticJsonDocument<256> doc;
+        doc["queries"] = _stats.queries;
+        doc["rejected"] = _stats.rejected;
+        doc["unauthorized"] = _stats.unauthorized;
+        doc["total_bytes"] = _stats.total_bytes;
+        JsonObject last = doc.createNestedObject("last");
+        last["bytes"] = _stats.last_bytes;
+        last["ms"] = _stats.last_ms;
+        last["kbps"] = _stats.last_kbps;
+        last["frames"] = _stats.last_records;
+        last["blocks"] = _stats.last_blocks;
+        last["segments_skipped"] = _stats.last_segments_skipped;
+
+        char buffer[256];
+        serializeJson(doc, buffer);
+        sendResponse(200, "OK", "application/json", buffer);
+    } else {
+        _stats.rejected++;
+        sendResponse(404, "Not Found", "text/plain", "Not found\n");
+    }
+}
+
+bool LogServer::parseQuery(const char* query) {
+    _from = 0;
+    _to = UINT64_MAX;
+    _id_count = 0;
+    if (!query) return true;
+
+    char params[REQUEST_MAX];
+    strncpy(params, query, sizeof(params) - 1);
+    params[sizeof(params) - 1] = '\0';
+
+    char* save = nullptr;
+    for (char* param = strtok_r(params, "&", &save); param; param = strtok_r(nullptr, "&", &save)) {
+        char* value = strchr(param, '=');
+        if (!value) return false;
+        *value++ = '\0';
+        if (strcmp(param, "from") == 0) {
+            _from = strtoull(value, nullptr, 10);
+        } else if (strcmp(param, "to") == 0) {
+            _to = strtoull(value, nullptr, 10);
+        } else if (strcmp(param, "token") == 0) {
+            // Checked in handleRequest()
+        } else if (strcmp(param, "id") == 0) {
+            char* id_save = nullptr;
+            for (char* id = strtok_r(value, ",", &id_save); id; id = strtok_r(nullptr, ",", &id_save)) {
+                if (_id_count >= QUERY_MAX_IDS) return false;
+                _ids[_id_count++] = strtoul(id, nullptr, 0);
+            }
+        } else {
+            return false;
+        }
+    }
+    return _from <= _to;
+}
+
+void LogServer::beginQuery() {
+    _bytes = 0;
+    _records = 0;
+    _blocks = 0;
+    _skipped = 0;
+    _started = millis();
+
+    static const char HEADER[] =
+        "timestamp,can_id,dlc,data0,data1,data2,data3,data4,data5,data6,data7,utc_ms,suppressed,channel\n";
+    _out_start = 0;
+    _out_end = snprintf(_chunk, sizeof(_chunk),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/csv\r\n"
+                        "Transfer-Encoding: chunked\r\n"
+                        "Connection: close\r\n\r\n"
+                        "%x\r\n%s\r\n", (unsigned)(sizeof(HEADER) - 1), HEADER);
+    _last_write = millis();
+    _bytes += sizeof(HEADER) - 1;
+
+    LogJournal::Location at;
+    if (!_sd_logger.getJournal().findTime(_from, at) || !enterSegment(at.segment_seq, at.block)) {
+        finishQuery();
+        return;
+    }
+    _state = STATE_STREAMING;
+}
+
+bool LogServer::enterSegment(uint32_t segment, uint16_t from_block) {
+    LogJournal& journal = _sd_logger.getJournal();
+    uint32_t last = journal.getStats().segment_seq;
+
+    for (; segment <= last; segment++, from_block = 1) {
+        // Segments without a summary were never closed and cannot be planned
+        JournalIndexEntry entry;
+        if (!journal.getSegment(segment, entry)) continue;
+        if (entry.first_utc_ms && entry.first_utc_ms > _to) return false;
+
+        uint16_t first = from_block;
+        uint16_t end = entry.data_blocks;
+        if (_id_count) {
+            // Union of the requested IDs' block ranges
+            uint16_t lo = UINT16_MAX;
+            uint16_t hi = 0;
+            for (uint8_t i = 0; i < _id_count; i++) {
+                JournalIdEntry id;
+                if (!journal.findId(segment, _ids[i], id)) continue;
+                if (id.first_block < lo) lo = id.first_block;
+                if (id.last_block > hi) hi = id.last_block;
+            }
+            if (lo > hi) {
+                _skipped++;
+                continue;
+            }
+            if (lo > first) first = lo;
+            if (hi < end) end = hi;
+        }
+        if (first > end) continue;
+
+        _segment = segment;
+        _block = first;
+        _end_block = end;
+        return true;
+    }
+    return false;
+}
+
+void LogServer::streamBlocks() {
+    LogJournal& journal = _sd_logger.getJournal();
+
+    for (uint8_t n = 0; n < QUERY_BLOCKS_PER_PASS; n++) {
+        // Blocks are formatted into the chunk buffer, so the last one must be out
+        if (!flush()) return;
+        if (!_client.connected()) {
+            LOG_W("QUERY", "Client left after %lu bytes", _bytes);
+            closeClient();
+            return;
+        }
+        if (_block > _end_block && !enterSegment(_segment + 1, 1)) {
+            finishQuery();
+            return;
+        }
+
+        if (journal.readSegmentBlock(_segment, _block, _block_buffer)) {
+            _blocks++;
+            const JournalBlockHeader* header = (const JournalBlockHeader*)_block_buffer;
+            if (header->first_utc_ms > _to) {
+                finishQuery();
+                return;
+            }
+            size_t length = formatBlock(_block_buffer);
+            if (length) queueChunk(length);
+        }
+        _block++;
+    }
+    flush();
+}
+
+size_t LogServer::formatBlock(const uint8_t* block) {
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    size_t length = 0;
+    size_t offset = sizeof(JournalBlockHeader);
+    size_t end = offset + header->payload_length;
+    char* lines = _chunk + CHUNK_HEAD;
+
+    while (offset + sizeof(JournalRecordHeader) <= end) {
+        const JournalRecordHeader* rec = (const JournalRecordHeader*)(block + offset);
+        offset += sizeof(JournalRecordHeader);
+        if (offset + rec->length > end) break;
+        const uint8_t* payload = block + offset;
+        offset += rec->length;
+        if (rec->type != JOURNAL_REC_CAN || rec->length < sizeof(JournalCanRecord)) continue;
+
+        const JournalCanRecord* can = (const JournalCanRecord*)payload;
+        if (!wantsId(can->id)) continue;
+        // UTC of the block's first record, offset by uptime; 0 before the clock synced
+        uint64_t utc = header->first_utc_ms
+            ? header->first_utc_ms + (int32_t)(can->timestamp - header->first_timestamp) : 0;
+        if (utc < _from || utc > _to) continue;
+
+        // A full block of zero-length frames still fits CHUNK_MAX
+        const uint8_t* data = payload + sizeof(JournalCanRecord);
+        length += snprintf(lines + length, CHUNK_MAX - length, "%lu,%03X,%u",
+                           (unsigned long)can->timestamp, (unsigned)can->id, can->dlc);
+        for (uint8_t i = 0; i < 8; i++) {
+            length += snprintf(lines + length, CHUNK_MAX - length, ",%02X", i < can->dlc ? data[i] : 0x00);
+        }
+        length += snprintf(lines + length, CHUNK_MAX - length, ",%llu,%u,%u\n",
+                           utc, can->suppressed, can->channel);
+        _records++;
+    }
+    return length;
+}
+
+bool LogServer::wantsId(uint32_t id) const {
+    if (!_id_count) return true;
+    for (uint8_t i = 0; i < _id_count; i++) {
+        if (_ids[i] == id) return true;
+    }
+    return false;
+}
+
+// Frames the lines formatBlock() left at CHUNK_HEAD as one HTTP chunk
+void LogServer::queueChunk(size_t length) {
+    char size[CHUNK_HEAD];
+    int n = snprintf(size, sizeof(size), "%x\r\n", (unsigned)length);
+    memcpy(_chunk + CHUNK_HEAD - n, size, n);
+    memcpy(_chunk + CHUNK_HEAD + length, "\r\n", 2);
+    _out_start = CHUNK_HEAD - n;
+    _out_end = CHUNK_HEAD + length + 2;
+    _last_write = millis();
+    _bytes += length;
+}
+
+// Writes what the socket takes now; true once nothing is left. Drops the
+// client if it has gone or taken nothing for QUERY_WRITE_TIMEOUT_MS.
+bool LogServer::flush() {
+    if (_out_start < _out_end) {
+        int written = NetWriter::write(_client, (const uint8_t*)_chunk + _out_start, _out_end - _out_start);
+        if (written > 0) {
+            _out_start += written;
+            _last_write = millis();
+        } else if (written < 0 || millis() - _last_write > QUERY_WRITE_TIMEOUT_MS) {
+            LOG_W("QUERY", "Client %s after %lu bytes", written < 0 ? "left" : "stopped reading", _bytes);
+            closeClient();
+            return false;
+        }
+    }
+    return _out_start >= _out_end;
+}
+
+void LogServer::sendResponse(uint16_t code, const char* reason, const char* type, const char* body,
+                             const char* headers) {
+    _out_start = 0;
+    _out_end = snprintf(_chunk, sizeof(_chunk),
+                        "HTTP/1.1 %u %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n%sConnection: close\r\n\r\n%s",
+                        code, reason, type, (unsigned)strlen(body), headers, body);
+    _last_write = millis();
+    _state = STATE_CLOSING;
+}
+
+void LogServer::finishQuery() {
+    // Only ever behind the response header or an empty buffer
+    if (_out_start == _out_end) _out_start = _out_end = 0;
+    memcpy(_chunk + _out_end, "0\r\n\r\n", 5);
+    _out_end += 5;
+
+    uint32_t elapsed = millis() - _started;
+    _stats.queries++;
+    _stats.last_bytes = _bytes;
+    _stats.last_ms = elapsed;
+    _stats.last_kbps = elapsed ? _bytes / elapsed : _bytes;   // bytes/ms is kB/s
+    _stats.last_records = _records;
+    _stats.last_blocks = _blocks;
+    _stats.last_segments_skipped = _skipped;
+    _stats.total_bytes += _bytes;
+    LOG_I("QUERY", "%lu frames, %lu bytes in %lu ms (%lu kB/s), %lu blocks read, %lu segments skipped",
+          _records, _bytes, elapsed, _stats.last_kbps, _blocks, _skipped);
+    _state = STATE_CLOSING;
+}
+
+void LogServer::closeClient() {
+    _client.stop();
+    _out_start = _out_end = 0;
+    _state = STATE_IDLE;
+}
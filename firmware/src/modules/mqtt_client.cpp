@@ -1,57 +1,81 @@
 #include "mqtt_client.h"
 #include "logger.h"
+#include "signal_aggregator.h"
+#include "distribution_tracker.h"
+#include "fixed_point.h"
 #include <ArduinoJson.h>
 
-MQTTClient::MQTTClient() : _mqtt_client(_wifi_client), _connected(false), _last_reconnect(0) {}
+MQTTClient::MQTTClient()
+    : _wifi_up(false), _wifi_warned(false), _wifi_start(0), _packed(nullptr) {
+    memset(&_payload_stats, 0, sizeof(PayloadStats));
+#if MQTT_BATCH_FRAMES
+    memset(_batch, 0, sizeof(FrameBatchHeader));
+    _batch_length = sizeof(FrameBatchHeader);
+    _batch_started = 0;
+    _batch_lost = false;
+#endif
+}
 
 MQTTClient::~MQTTClient() {
     disconnect();
+    free(_packed);
 }
 
 bool MQTTClient::init(const char* ssid, const char* password, const char* broker, uint16_t port) {
-    // Connect to WiFi
+    // Returns at once; the transport task connects to the broker when WiFi
+    // comes up, so boot never waits on the network
+    if (!_packed) {
+        _packed = (uint8_t*)malloc(MQTT_MAX_PACKET_SIZE);
+        if (!_packed) {
+            LOG_E("MQTT", "No memory for the %u-byte packet buffer", MQTT_MAX_PACKET_SIZE);
+            return false;
+        }
+    }
     LOG_I("MQTT", "Connecting to WiFi: %s", ssid);
     WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
     WiFi.begin(ssid, password);
-
-    uint32_t start_time = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - start_time < WIFI_CONNECT_TIMEOUT) {
-        delay(500);
-    }
-
-    if (WiFi.status() != WL_CONNECTED) {
-        LOG_E("MQTT", "WiFi connection failed");
-        return false;
-    }
-
-    LOG_I("MQTT", "WiFi connected. IP: %s", WiFi.localIP().toString().c_str());
-
-    // Connect to MQTT broker
-    _mqtt_client.setServer(broker, port);
-    reconnect();
-
-    return _connected;
+    _wifi_start = millis();
+    return _transport.begin(broker, port, "ESP32-CANLogger", MQTT_USER, MQTT_PASS, "vehicle/commands");
 }
 
 void MQTTClient::disconnect() {
-    if (_mqtt_client.connected()) {
-        _mqtt_client.disconnect();
-    }
+    _transport.disconnect();
     WiFi.disconnect();
-    _connected = false;
 }
 
 bool MQTTClient::isConnected() {
-    return _mqtt_client.connected();
+    return _transport.isConnected();
 }
 
-bool MQTTClient::publishCANData(const CanFrame& frame) {
-    if (!isConnected()) return false;
+bool MQTTClient::publishCANData(const CanFrame& frame, uint16_t suppressed) {
+    // Raw frames are the first thing to shed when the queue backs up
+    if (!isConnected() || isCongested()) return false;
 
+#if MQTT_BATCH_FRAMES
+    FrameBatchHeader* header = (FrameBatchHeader*)_batch;
+    if (!header->count) {
+        header->first_timestamp = frame.timestamp;
+        header->first_utc_ms = ClockSync::toUtcMs(frame.timestamp);
+        _batch_started = millis();
+    }
+    uint8_t dlc = frame.dlc < 8 ? frame.dlc : 8;
+    JournalCanRecord record = {frame.timestamp, frame.id, frame.channel, dlc, suppressed};
+    memcpy(_batch + _batch_length, &record, sizeof(record));
+    memcpy(_batch + _batch_length + sizeof(record), frame.data, dlc);
+    _batch_length += sizeof(record) + dlc;
+    header->count++;
+    PERF_COUNT(FRAMES_PUBLISHED);
+    if (header->count >= MQTT_BATCH_FRAMES) flushBatch();
+    return true;
+#else
     StaticJsonDocument<256> doc;
     doc["timestamp"] = frame.timestamp;
+    doc["utc"] = ClockSync::toUtcMs(frame.timestamp);
     doc["can_id"] = "0x" + String(frame.id, HEX);
     doc["dlc"] = frame.dlc;
+    doc["channel"] = frame.channel;
+    if (suppressed) doc["suppressed"] = suppressed;
 
     JsonArray data = doc.createNestedArray("data");
     for (int i = 0; i < frame.dlc; i++) {
@@ -61,14 +85,43 @@ bool MQTTClient::publishCANData(const CanFrame& frame) {
     char buffer[512];
     serializeJson(doc, buffer);
 
-    return _mqtt_client.publish("vehicle/data", buffer);
+    if (!publish("vehicle/data", buffer, 0)) return false;
+    PERF_COUNT(FRAMES_PUBLISHED);
+    return true;
+#endif
 }
 
-bool MQTTClient::publishVehicleState(const VehicleState& state) {
+#if MQTT_BATCH_FRAMES
+bool MQTTClient::flushBatch() {
+    FrameBatchHeader* header = (FrameBatchHeader*)_batch;
+    if (!header->count) return true;
+
+    _payload_stats.batches++;
+    _payload_stats.batch_frames += header->count;
+    bool ok = publishPayload("vehicle/data/batch", _batch, _batch_length, PAYLOAD_FRAME_BATCH, 0);
+    header->count = 0;
+    _batch_length = sizeof(FrameBatchHeader);
+    if (!ok) _batch_lost = true;
+    return ok;
+}
+#endif
+
+bool MQTTClient::takeBatchLost() {
+#if MQTT_BATCH_FRAMES
+    bool lost = _batch_lost;
+    _batch_lost = false;
+    return lost;
+#else
+    return false;
+#endif
+}
+
+bool MQTTClient::publishVehicleState(const VehicleState& state, const SignalWindow& window) {
     if (!isConnected()) return false;
 
-    StaticJsonDocument<256> doc;
+    StaticJsonDocument<768> doc;
     doc["timestamp"] = state.timestamp;
+    doc["utc"] = ClockSync::toUtcMs(state.timestamp);
     doc["speed"] = state.speed;
     doc["rpm"] = state.rpm;
     doc["throttle"] = state.throttle;
@@ -76,10 +129,23 @@ bool MQTTClient::publishVehicleState(const VehicleState& state) {
     doc["engine_status"] = state.engine_status ? "ON" : "OFF";
     doc["fault"] = state.fault_status ? true : false;
 
-    char buffer[512];
+    // Window summary per signal as [min, mean, max, last, count]
+    JsonObject summary = doc.createNestedObject("window");
+    summary["ms"] = window.end - window.start;
+    for (uint8_t i = 0; i < SIGNAL_COUNT; i++) {
+        const SignalStats& s = window.signals[i];
+        JsonArray entry = summary.createNestedArray(SignalAggregator::signalName((SignalId)i));
+        entry.add(s.min);
+        entry.add(SignalAggregator::mean(s));
+        entry.add(s.max);
+        entry.add(s.last);
+        entry.add(s.count);
+    }
+
+    char buffer[768];
     serializeJson(doc, buffer);
 
-    return _mqtt_client.publish("vehicle/state", buffer);
+    return publish("vehicle/state", buffer);
 }
 
 bool MQTTClient::publishAnomaly(const Anomaly& anomaly) {
@@ -89,13 +155,15 @@ bool MQTTClient::publishAnomaly(const Anomaly& anomaly) {
     doc["type"] = anomaly.type;
     doc["description"] = anomaly.description;
     doc["timestamp"] = anomaly.timestamp;
+    doc["utc"] = ClockSync::toUtcMs(anomaly.timestamp);
     doc["severity"] = anomaly.severity;
     doc["can_id"] = "0x" + String(anomaly.can_id, HEX);
+    if (anomaly.snapshot_id) doc["snapshot"] = anomaly.snapshot_id;
 
     char buffer[512];
     serializeJson(doc, buffer);
 
-    return _mqtt_client.publish("vehicle/anomaly", buffer);
+    return publish("vehicle/anomaly", buffer);
 }
 
 bool MQTTClient::publishGPSData(const GpsData& gps) {
@@ -103,8 +171,12 @@ bool MQTTClient::publishGPSData(const GpsData& gps) {
 
     StaticJsonDocument<256> doc;
     doc["timestamp"] = gps.timestamp;
-    doc["latitude"] = serialized(String(gps.latitude, 6));
-    doc["longitude"] = serialized(String(gps.longitude, 6));
+    doc["utc"] = gps.utc_ms;
+    char latitude[16], longitude[16];
+    FixedPoint::formatMicrodegrees(gps.latitude_udeg, latitude, sizeof(latitude));
+    FixedPoint::formatMicrodegrees(gps.longitude_udeg, longitude, sizeof(longitude));
+    doc["latitude"] = serialized(latitude);
+    doc["longitude"] = serialized(longitude);
     doc["altitude"] = gps.altitude;
     doc["speed"] = gps.speed;
     doc["fix_quality"] = gps.fix_quality;
@@ -113,27 +185,354 @@ bool MQTTClient::publishGPSData(const GpsData& gps) {
     char buffer[512];
     serializeJson(doc, buffer);
 
-    return _mqtt_client.publish("vehicle/location", buffer);
+    return publish("vehicle/location", buffer);
 }
 
-void MQTTClient::update() {
-    if (!_mqtt_client.connected()) {
-        if (millis() - _last_reconnect > RECONNECT_INTERVAL) {
-            reconnect();
-            _last_reconnect = millis();
+bool MQTTClient::publishClockStats(const ClockSync::Stats& stats) {
+    if (!isConnected()) return false;
+
+    StaticJsonDocument<256> doc;
+    doc["timestamp"] = millis();
+    doc["state"] = stats.state;
+    doc["pps"] = stats.pps;
+    doc["samples"] = stats.samples;
+    doc["steps"] = stats.steps;
+    doc["offset_us"] = stats.offset_us;
+    doc["error_us"] = stats.last_error_us;
+    doc["jitter_us"] = stats.jitter_us;
+    doc["drift_ppm"] = stats.drift_ppm;
+    doc["since_sync_ms"] = stats.since_sync_ms;
+
+    char buffer[512];
+    serializeJson(doc, buffer);
+
+    return publish("vehicle/clock", buffer);
+}
+
+bool MQTTClient::publishDistribution(SignalId signal, const QuantileSketch& sketch, uint32_t start, uint32_t end) {
+    if (!isConnected()) return false;
+
+    static char encoded[DistributionTracker::MAX_ENCODED_SIZE];
+    if (!DistributionTracker::encode(sketch, encoded, sizeof(encoded))) return false;
+
+    // Quantiles for dashboards; "sketch" is what the host merges per trip
+    StaticJsonDocument<256> doc;
+    doc["signal"] = SignalAggregator::signalName(signal);
+    doc["start"] = start;
+    doc["end"] = end;
+    doc["utc"] = ClockSync::toUtcMs(start);
+    doc["weight_ms"] = sketch.total();
+    doc["p50"] = sketch.quantile(0.50f);
+    doc["p95"] = sketch.quantile(0.95f);
+    doc["p99"] = sketch.quantile(0.99f);
+    doc["sketch"] = (const char*)encoded;
+
+    // JSON is published bare, so _packed is free to hold the text
+    char* buffer = (char*)_packed;
+    serializeJson(doc, buffer, MQTT_MAX_PACKET_SIZE);
+
+    return publish("vehicle/distribution", buffer);
+}
+
+bool MQTTClient::publishCanStats(const CanReceiver::ChannelReport* reports, uint8_t count) {
+    if (!isConnected()) return false;
+
+    StaticJsonDocument<768> doc;
+    doc["timestamp"] = millis();
+    JsonArray channels = doc.createNestedArray("channels");
+    for (uint8_t i = 0; i < count; i++) {
+        const CanReceiver::ChannelReport& r = reports[i];
+        JsonObject entry = channels.createNestedObject();
+        entry["channel"] = r.channel;
+        entry["frames"] = r.frames;
+        entry["bitrate"] = r.bitrate;
+        entry["lock_ms"] = r.bitrate_lock_ms;
+        entry["fps"] = r.frames_per_sec;
+        entry["overflows"] = r.overflows;
+        entry["ring_dropped"] = r.ring_dropped;
+        entry["ring_high_water"] = r.ring_high_water;
+        entry["tx"] = r.tx_sent;
+        entry["tx_per_sec"] = r.tx_per_sec;
+        entry["tx_arb_lost"] = r.tx_arbitration_lost;
+        entry["tx_failed"] = r.tx_failed;
+    }
+
+    char buffer[768];
+    serializeJson(doc, buffer);
+
+    return publish("vehicle/can", buffer);
+}
+
+bool MQTTClient::publishObdStats(const ObdPoller::PidReport* reports, uint8_t count, const ObdPoller::Stats& stats) {
+    if (!isConnected()) return false;
+
+    // PIDs as [ecu, target_hz, hz, latency_avg_ms, latency_max_ms, timeouts]
+    StaticJsonDocument<768> doc;
+    doc["timestamp"] = millis();
+    doc["requests"] = stats.requests;
+    doc["responses"] = stats.responses;
+    doc["timeouts"] = stats.timeouts;
+    doc["negative"] = stats.negative;
+    doc["isotp_errors"] = stats.isotp_errors;
+
+    JsonObject pids = doc.createNestedObject("pids");
+    for (uint8_t i = 0; i < count; i++) {
+        const ObdPoller::PidReport& r = reports[i];
+        char key[8];
+        snprintf(key, sizeof(key), "0x%02X", r.pid);
+        JsonArray entry = pids.createNestedArray(key);
+        if (r.ecu == 0xFF) entry.add(nullptr);
+        else entry.add(0x7E8 + r.ecu);
+        entry.add(r.interval_ms ? 1000.0f / r.interval_ms : 0.0f);
+        entry.add(serialized(String(r.rate_hz, 1)));
+        entry.add(r.latency_avg_ms);
+        entry.add(r.latency_max_ms);
+        entry.add(r.timeouts);
+    }
+
+    char buffer[768];
+    serializeJson(doc, buffer);
+
+    return publish("vehicle/obd", buffer);
+}
+
+bool MQTTClient::publishRuleStats(const RuleReport* reports, uint8_t count, uint32_t frames) {
+    if (!isConnected()) return false;
+
+    // Rules as [evaluations, hits, avg_cycles, max_cycles]
+    StaticJsonDocument<768> doc;
+    doc["timestamp"] = millis();
+    doc["frames"] = frames;
+
+    JsonObject rules = doc.createNestedObject("rules");
+    for (uint8_t i = 0; i < count; i++) {
+        const RuleReport& r = reports[i];
+        JsonArray entry = rules.createNestedArray(r.name);
+        entry.add(r.evaluations);
+        entry.add(r.hits);
+        entry.add(r.avg_cycles);
+        entry.add(r.max_cycles);
+    }
+
+    char buffer[768];
+    serializeJson(doc, buffer);
+
+    return publish("vehicle/anomaly/rules", buffer);
+}
+
+bool MQTTClient::publishUploadStats(const SegmentUploader::Stats& stats, uint32_t pending) {
+    if (!isConnected()) return false;
+
+    StaticJsonDocument<384> doc;
+    doc["timestamp"] = millis();
+    doc["segments"] = stats.segments;
+    doc["pending"] = pending;
+    doc["missed"] = stats.segments_missed;
+    doc["chunks"] = stats.chunks;
+    doc["chunk_retries"] = stats.chunk_retries;
+    doc["resumes"] = stats.resumes;
+    doc["failures"] = stats.failures;
+    doc["bytes_sent"] = stats.bytes_sent;
+    doc["bytes_acked"] = stats.bytes_acked;
+    doc["bytes_resumed"] = stats.bytes_resumed;
+    // Share of the bytes sent that the server kept
+    doc["efficiency"] = stats.bytes_sent ? (float)stats.bytes_acked / stats.bytes_sent : 1.0f;
+    doc["kbps"] = stats.last_kbps;
+
+    char buffer[384];
+    serializeJson(doc, buffer);
+
+    return publish("vehicle/upload", buffer);
+}
+
+bool MQTTClient::publishBoot(const BootTimes& boot) {
+    if (!isConnected()) return false;
+
+    // Microseconds since start; 0 for a stage that has not completed
+    StaticJsonDocument<384> doc;
+    doc["timestamp"] = millis();
+    doc["can_ready_us"] = boot.can_ready_us;
+    doc["first_frame_us"] = boot.first_frame_us;
+    doc["gps_ready_us"] = boot.gps_ready_us;
+    doc["sd_ready_us"] = boot.sd_ready_us;
+    doc["network_ready_us"] = boot.network_ready_us;
+    doc["backlog_frames"] = boot.backlog_frames;
+    doc["backlog_dropped"] = boot.backlog_dropped;
+    doc["journal_recovery_us"] = boot.journal_recovery_us;
+
+    char buffer[384];
+    serializeJson(doc, buffer);
+
+    return publish("vehicle/boot", buffer);
+}
+
+bool MQTTClient::publishHealth(const PerfCounters::Snapshot& snapshot, const SpiArbiter::Stats& spi) {
+    if (!isConnected()) return false;
+
+    // Stages as [count, avg, p50, p99, max] in microseconds
+    StaticJsonDocument<1536> doc;
+    doc["timestamp"] = snapshot.uptime_ms;
+    doc["window_ms"] = snapshot.window_ms;
+    doc["heap"] = ESP.getFreeHeap();
+
+    JsonObject counters = doc.createNestedObject("counters");
+    for (uint8_t i = 0; i < PerfCounters::COUNTER_COUNT; i++) {
+        counters[PerfCounters::counterName((PerfCounters::Counter)i)] = snapshot.counters[i];
+    }
+
+    JsonObject stages = doc.createNestedObject("stages");
+    for (uint8_t i = 0; i < PerfCounters::STAGE_COUNT; i++) {
+        const PerfCounters::StageSummary& stage = snapshot.stages[i];
+        JsonArray entry = stages.createNestedArray(PerfCounters::stageName((PerfCounters::Stage)i));
+        entry.add(stage.count);
+        entry.add(stage.avg_us);
+        entry.add(stage.p50_us);
+        entry.add(stage.p99_us);
+        entry.add(stage.max_us);
+    }
+
+    Logger::Stats log_stats = Logger::getStats();
+    doc["log_dropped"] = log_stats.dropped;
+
+    JsonObject bus = doc.createNestedObject("spi");
+    bus["can_wait_max_us"] = spi.can_latency_max_us;
+    bus["can_wait_sd_max_us"] = spi.can_latency_sd_max_us;
+    bus["sd_chunk_max_us"] = spi.sd_chunk_max_us;
+    bus["sd_yields"] = spi.sd_yields;
+
+    // At least the document's capacity, so more counters or stages cannot
+    // cut the message short; JSON goes out bare, leaving _packed free
+    char* buffer = (char*)_packed;
+    serializeJson(doc, buffer, MQTT_MAX_PACKET_SIZE);
+
+    return publish("vehicle/health", buffer);
+}
+
+bool MQTTClient::publishMqttStats(const MqttTransport::Stats& stats, const PayloadStats& payload) {
+    if (!isConnected()) return false;
+
+    StaticJsonDocument<512> doc;
+    doc["timestamp"] = millis();
+    doc["queued"] = stats.queued;
+    doc["sent"] = stats.sent;
+    doc["acked"] = stats.acked;
+    doc["dropped"] = stats.dropped;
+    doc["resent"] = stats.resent;
+    doc["reconnects"] = stats.reconnects;
+    doc["congested"] = stats.congested;
+    doc["queue_peak"] = stats.queue_peak;
+    doc["inflight_peak"] = stats.inflight_peak;
+    JsonArray publish_us = doc.createNestedArray("publish_us");
+    publish_us.add(stats.publish_avg_us);
+    publish_us.add(stats.publish_max_us);
+    JsonArray ack_us = doc.createNestedArray("ack_us");
+    ack_us.add(stats.ack_avg_us);
+    ack_us.add(stats.ack_max_us);
+
+    JsonObject coding = doc.createNestedObject("payload");
+    coding["messages"] = payload.messages;
+    coding["compressed"] = payload.compressed;
+    coding["batches"] = payload.batches;
+    coding["batch_frames"] = payload.batch_frames;
+    coding["raw_bytes"] = payload.raw_bytes;
+    coding["sent_bytes"] = payload.sent_bytes;
+    coding["ratio"] = payload.raw_bytes ? (float)payload.sent_bytes / payload.raw_bytes : 1.0f;
+    coding["us_per_kb"] = payload.compress_input ? (uint32_t)((uint64_t)payload.compress_us * 1024 / payload.compress_input) : 0;
+
+    char buffer[512];
+    serializeJson(doc, buffer);
+
+    return publish("vehicle/mqtt", buffer);
+}
+
+MQTTClient::PayloadStats MQTTClient::takePayloadStats() {
+    PayloadStats stats = _payload_stats;
+    memset(&_payload_stats, 0, sizeof(PayloadStats));
+    return stats;
+}
+
+bool MQTTClient::publish(const char* topic, const char* payload, uint8_t qos) {
+    return publishPayload(topic, (const uint8_t*)payload, strlen(payload), PAYLOAD_JSON, qos);
+}
+
+// JSON goes bare; binary content is framed with a PayloadHeader and, for
+// frame batches, LZ4-compressed when that pays. Queues only; the transport
+// task does the network I/O.
+bool MQTTClient::publishPayload(const char* topic, const uint8_t* body, size_t length,
+                                PayloadContent content, uint8_t qos) {
+    PERF_SCOPE(STAGE_MQTT_PUBLISH);
+    uint8_t* packed_body = _packed + sizeof(PayloadHeader);
+    size_t capacity = MQTT_MAX_PACKET_SIZE - sizeof(PayloadHeader);
+    const uint8_t* payload = body;
+    size_t payload_length = length;
+    bool framed = false;
+    uint8_t codec = PAYLOAD_CODEC_NONE;
+
+#if MQTT_COMPRESS_ENABLED
+    if (content == PAYLOAD_FRAME_BATCH && length >= MQTT_COMPRESS_MIN_BYTES) {
+        // Only kept if it saves more than the header costs
+        size_t limit = length - sizeof(PayloadHeader) - 1;
+        uint32_t start = micros();
+        size_t packed = _codec.compress(body, length, packed_body, limit < capacity ? limit : capacity);
+        _payload_stats.compress_us += micros() - start;
+        _payload_stats.compress_input += length;
+        if (packed) {
+            framed = true;
+            codec = PAYLOAD_CODEC_LZ4;
+            payload_length = packed;
+            _payload_stats.compressed++;
+        }
+    }
+#endif
+    if (!framed && content != PAYLOAD_JSON) {
+        if (length > capacity) {
+            PERF_COUNT(MQTT_PUBLISH_ERRORS);
+            return false;
         }
-    } else {
-        _mqtt_client.loop();
+        memcpy(packed_body, body, length);
+        framed = true;
+    }
+    if (framed) {
+        PayloadHeader* header = (PayloadHeader*)_packed;
+        header->magic = PAYLOAD_MAGIC;
+        header->codec = codec;
+        header->content = content;
+        header->reserved = 0;
+        header->raw_length = length;
+        payload = _packed;
+        payload_length += sizeof(PayloadHeader);
     }
+
+    _payload_stats.messages++;
+    _payload_stats.raw_bytes += length;
+    if (!_transport.publish(topic, payload, payload_length, qos)) {
+        PERF_COUNT(MQTT_PUBLISH_ERRORS);
+        return false;
+    }
+    _payload_stats.sent_bytes += payload_length;
+    return true;
 }
 
-void MQTTClient::reconnect() {
-    if (_mqtt_client.connect("ESP32-CANLogger", MQTT_USER, MQTT_PASS)) {
-        LOG_I("MQTT", "Connected to MQTT broker");
-        _connected = true;
-        _mqtt_client.subscribe("vehicle/commands");
-    } else {
-        LOG_W("MQTT", "MQTT connection failed, rc=%d", _mqtt_client.state());
-        _connected = false;
+// Broker connection, keepalive and resends all live in the transport task;
+// this sends partial frame batches and reports WiFi state
+void MQTTClient::update() {
+#if MQTT_BATCH_FRAMES
+    if (((FrameBatchHeader*)_batch)->count && millis() - _batch_started >= MQTT_BATCH_MS) flushBatch();
+#endif
+
+    if (WiFi.status() != WL_CONNECTED) {
+        if (_wifi_up) {
+            LOG_W("MQTT", "WiFi connection lost");
+            _wifi_up = false;
+        } else if (!_wifi_warned && millis() - _wifi_start > WIFI_CONNECT_TIMEOUT) {
+            LOG_W("MQTT", "WiFi not connected after %lu ms, still trying", (uint32_t)WIFI_CONNECT_TIMEOUT);
+            _wifi_warned = true;
+        }
+        return;
+    }
+
+    if (!_wifi_up) {
+        _wifi_up = true;
+        LOG_I("MQTT", "WiFi connected. IP: %s", WiFi.localIP().toString().c_str());
     }
 }
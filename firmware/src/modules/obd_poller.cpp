@@ -0,0 +1,334 @@
+#include "obd_poller.h"
+#include "logger.h"
+
+// Table order is request order when more PIDs are due than fit in one frame
+const ObdPoller::PidConfig ObdPoller::PIDS[PID_COUNT] = {
+    {0x0C, 2, OBD_RPM_INTERVAL_MS},       // Engine RPM, (256A + B) / 4
+    {0x0D, 1, OBD_SPEED_INTERVAL_MS},     // Vehicle speed, km/h
+    {0x11, 1, OBD_THROTTLE_INTERVAL_MS},  // Throttle position, A * 100 / 255
+    {0x01, 4, OBD_STATUS_INTERVAL_MS},    // Monitor status, MIL in A bit 7
+};
+
+ObdPoller::ObdPoller(MCP2515Driver& driver, VehicleStateManager& vehicle_state)
+    : _driver(driver), _vehicle_state(vehicle_state), _state(STATE_OFF),
+      _discovery_ms(0), _report_time(0) {
+    memset(_pids, 0, sizeof(_pids));
+    memset(_ecus, 0, sizeof(_ecus));
+    memset(&_stats, 0, sizeof(Stats));
+}
+
+ObdPoller::~ObdPoller() {}
+
+bool ObdPoller::init() {
+    if (_driver.isListenOnly()) {
+        LOG_E("OBD", "CAN channel %u is listen-only, polling disabled", _driver.getChannel());
+        return false;
+    }
+
+    _driver.setTxCallback(onTx, this);
+    _report_time = millis();
+    startDiscovery(_report_time);
+    LOG_I("OBD", "OBD-II polling on channel %u (%u PIDs)", _driver.getChannel(), PID_COUNT);
+    return true;
+}
+
+void ObdPoller::startDiscovery(uint32_t now) {
+    for (uint8_t i = 0; i < OBD_MAX_ECUS; i++) {
+        _ecus[i].present = false;
+        _ecus[i].in_flight = false;
+        _ecus[i].rx.active = false;
+    }
+
+    CanFrame request;
+    memset(&request, 0, sizeof(CanFrame));
+    request.id = FUNCTIONAL_ID;
+    request.dlc = 8;
+    request.data[0] = 0x02;
+    request.data[1] = 0x01;
+    request.data[2] = 0x00;   // Supported PIDs 0x01-0x20
+
+    _state = STATE_DISCOVERING;
+    _discovery_ms = now;
+    _driver.writeFrame(request, 2, TAG_DISCOVERY);
+}
+
+void ObdPoller::finishDiscovery(uint32_t now) {
+    uint8_t ecus = 0;
+    for (uint8_t i = 0; i < OBD_MAX_ECUS; i++) {
+        if (_ecus[i].present) ecus++;
+    }
+    if (ecus == 0) {
+        if (now - _discovery_ms >= OBD_DISCOVERY_RETRY_MS) startDiscovery(now);
+        return;
+    }
+
+    // Lowest responder first: 0x7E8 is the engine ECU by convention
+    for (uint8_t p = 0; p < PID_COUNT; p++) {
+        Pid& pid = _pids[p];
+        pid.ecu = NO_ECU;
+        pid.next_due = now;
+        for (uint8_t i = 0; i < OBD_MAX_ECUS && pid.ecu == NO_ECU; i++) {
+            if (_ecus[i].present && (_ecus[i].supported & (0x80000000UL >> (PIDS[p].pid - 1)))) {
+                pid.ecu = i;
+            }
+        }
+        if (pid.ecu == NO_ECU) {
+            LOG_W("OBD", "PID 0x%02X not supported by any ECU", PIDS[p].pid);
+        } else {
+            LOG_I("OBD", "PID 0x%02X from ECU 0x%03X every %u ms",
+                  PIDS[p].pid, RESPONSE_BASE + pid.ecu, PIDS[p].interval_ms);
+        }
+    }
+
+    _state = STATE_POLLING;
+    LOG_I("OBD", "%u ECU(s) responded", ecus);
+}
+
+void ObdPoller::update(uint32_t now) {
+    if (_state == STATE_OFF) return;
+
+    if (_state == STATE_DISCOVERING) {
+        if (now - _discovery_ms >= OBD_RESPONSE_TIMEOUT_MS) finishDiscovery(now);
+        return;
+    }
+
+    for (uint8_t i = 0; i < OBD_MAX_ECUS; i++) {
+        Ecu& ecu = _ecus[i];
+        if (!ecu.present) continue;
+
+        if (ecu.in_flight) {
+            bool failed = ecu.tx_state == TX_FAILED;
+            if (failed || now - ecu.request_ms > OBD_RESPONSE_TIMEOUT_MS) expire(i, now);
+            if (_state != STATE_POLLING) return;
+            if (ecu.in_flight) continue;
+        }
+        sendRequest(i, now);
+    }
+}
+
+void ObdPoller::sendRequest(uint8_t ecu_index, uint32_t now) {
+    Ecu& ecu = _ecus[ecu_index];
+
+    CanFrame request;
+    memset(&request, 0, sizeof(CanFrame));
+    request.id = REQUEST_BASE + ecu_index;
+    request.dlc = 8;
+    request.data[1] = 0x01;
+
+    ecu.pid_count = 0;
+    for (uint8_t p = 0; p < PID_COUNT && ecu.pid_count < OBD_PIDS_PER_REQUEST; p++) {
+        Pid& pid = _pids[p];
+        if (pid.ecu != ecu_index || (int32_t)(now - pid.next_due) < 0) continue;
+        request.data[2 + ecu.pid_count] = PIDS[p].pid;
+        ecu.pids[ecu.pid_count++] = p;
+    }
+    if (ecu.pid_count == 0) return;
+    request.data[0] = 1 + ecu.pid_count;
+
+    ecu.seq++;
+    ecu.tx_state = TX_PENDING;
+    uint32_t tag = ((uint32_t)ecu.seq << 8) | ecu_index;
+    if (_driver.writeFrame(request, 1, tag) != MCP2515Driver::ERROR_OK) return;
+
+    // Due times advance from the request, so a slow ECU lowers the achieved
+    // rate instead of building a backlog
+    for (uint8_t n = 0; n < ecu.pid_count; n++) {
+        uint8_t p = ecu.pids[n];
+        _pids[p].next_due = now + PIDS[p].interval_ms;
+    }
+    ecu.in_flight = true;
+    ecu.request_ms = now;
+    _stats.requests++;
+}
+
+void ObdPoller::sendFlowControl(uint8_t ecu_index) {
+    CanFrame fc;
+    memset(&fc, 0, sizeof(CanFrame));
+    fc.id = REQUEST_BASE + ecu_index;
+    fc.dlc = 8;
+    fc.data[0] = 0x30;   // Continue to send
+    fc.data[1] = 0x00;   // Block size: no further Flow Control
+    fc.data[2] = 0x00;   // STmin: back to back
+
+    // Highest priority: the ECU gives up after N_Bs without it
+    if (_driver.writeFrame(fc, 3, TAG_FLOW_CONTROL) == MCP2515Driver::ERROR_OK) {
+        _stats.flow_controls++;
+    }
+}
+
+void ObdPoller::expire(uint8_t ecu_index, uint32_t now) {
+    Ecu& ecu = _ecus[ecu_index];
+    for (uint8_t n = 0; n < ecu.pid_count; n++) {
+        _pids[ecu.pids[n]].timeouts++;
+    }
+    ecu.in_flight = false;
+    ecu.rx.active = false;
+    _stats.timeouts++;
+
+    if (++ecu.timeouts >= OBD_MAX_TIMEOUTS) {
+        LOG_W("OBD", "ECU 0x%03X stopped responding, rediscovering", RESPONSE_BASE + ecu_index);
+        ecu.timeouts = 0;
+        startDiscovery(now);
+    }
+}
+
+bool ObdPoller::onFrame(const CanFrame& frame) {
+    if (_state == STATE_OFF || frame.channel != _driver.getChannel()) return false;
+    if (frame.id < RESPONSE_BASE || frame.id >= RESPONSE_BASE + OBD_MAX_ECUS || frame.dlc < 1) return false;
+
+    uint8_t ecu_index = frame.id - RESPONSE_BASE;
+    IsoTp& rx = _ecus[ecu_index].rx;
+    uint8_t dlc = frame.dlc > 8 ? 8 : frame.dlc;
+
+    switch (frame.data[0] >> 4) {
+        case 0x0: {   // Single Frame
+            uint8_t length = frame.data[0] & 0x0F;
+            rx.active = false;
+            if (length == 0 || length > dlc - 1) break;
+            return handleResponse(ecu_index, &frame.data[1], length, frame.timestamp);
+        }
+        case 0x1: {   // First Frame
+            uint16_t length = ((frame.data[0] & 0x0F) << 8) | frame.data[1];
+            if (dlc < 8 || length < 8 || length > OBD_ISOTP_MAX) {
+                rx.active = false;
+                _stats.isotp_errors++;
+                break;
+            }
+            memcpy(rx.data, &frame.data[2], 6);
+            rx.expected = length;
+            rx.received = 6;
+            rx.next_sn = 1;
+            rx.active = true;
+            sendFlowControl(ecu_index);
+            break;
+        }
+        case 0x2: {   // Consecutive Frame
+            if (!rx.active) {
+                _stats.isotp_errors++;
+                break;
+            }
+            if ((frame.data[0] & 0x0F) != rx.next_sn) {
+                LOG_D("OBD", "ECU 0x%03X CF sequence %u, expected %u",
+                      frame.id, frame.data[0] & 0x0F, rx.next_sn);
+                rx.active = false;
+                _stats.isotp_errors++;
+                break;
+            }
+            uint16_t chunk = rx.expected - rx.received;
+            if (chunk > (uint16_t)(dlc - 1)) chunk = dlc - 1;
+            memcpy(&rx.data[rx.received], &frame.data[1], chunk);
+            rx.received += chunk;
+            rx.next_sn = (rx.next_sn + 1) & 0x0F;
+            if (rx.received >= rx.expected) {
+                rx.active = false;
+                return handleResponse(ecu_index, rx.data, rx.expected, frame.timestamp);
+            }
+            break;
+        }
+        default:      // Flow Control from a responder is not expected
+            break;
+    }
+    return false;
+}
+
+bool ObdPoller::handleResponse(uint8_t ecu_index, const uint8_t* data, uint16_t length, uint32_t timestamp) {
+    Ecu& ecu = _ecus[ecu_index];
+
+    if (data[0] == 0x7F) {
+        if (length >= 3 && data[1] == 0x01 && data[2] == 0x78) {
+            // Response pending: the ECU asked for more time
+            ecu.request_ms = timestamp;
+            return false;
+        }
+        _stats.negative++;
+        LOG_D("OBD", "ECU 0x%03X negative response 0x%02X",
+              RESPONSE_BASE + ecu_index, length >= 3 ? data[2] : 0);
+        if (ecu.in_flight) {
+            ecu.in_flight = false;
+            ecu.timeouts = 0;
+        }
+        return false;
+    }
+    if (data[0] != 0x41 || length < 2) return false;
+
+    if (_state == STATE_DISCOVERING) {
+        if (data[1] == 0x00 && length >= 6) {
+            ecu.present = true;
+            ecu.supported = ((uint32_t)data[2] << 24) | ((uint32_t)data[3] << 16) |
+                            ((uint32_t)data[4] << 8) | data[5];
+        }
+        return false;
+    }
+
+    bool decoded = false;
+    uint16_t offset = 1;
+    while (offset < length) {
+        int8_t p = findPid(data[offset]);
+        if (p < 0 || offset + 1 + PIDS[p].length > length) break;
+        if (_vehicle_state.updateObd(PIDS[p].pid, &data[offset + 1], PIDS[p].length)) decoded = true;
+        _pids[p].responses++;
+        offset += 1 + PIDS[p].length;
+    }
+
+    if (ecu.in_flight) {
+        // Measured from when the request left the controller when known
+        uint32_t sent = ecu.tx_state == TX_DONE ? ecu.tx_ms : ecu.request_ms;
+        uint32_t latency = (int32_t)(timestamp - sent) > 0 ? timestamp - sent : 0;
+        if (latency > 0xFFFF) latency = 0xFFFF;
+        for (uint8_t n = 0; n < ecu.pid_count; n++) {
+            Pid& pid = _pids[ecu.pids[n]];
+            pid.latency_sum += latency;
+            pid.latency_count++;
+            if (latency > pid.latency_max) pid.latency_max = latency;
+        }
+        ecu.in_flight = false;
+        ecu.timeouts = 0;
+        _stats.responses++;
+    }
+    return decoded;
+}
+
+int8_t ObdPoller::findPid(uint8_t pid) const {
+    for (uint8_t p = 0; p < PID_COUNT; p++) {
+        if (PIDS[p].pid == pid) return p;
+    }
+    return -1;
+}
+
+uint8_t ObdPoller::takeReport(PidReport* reports, uint32_t now) {
+    if (_state == STATE_OFF) return 0;
+
+    uint32_t window = now - _report_time;
+    for (uint8_t p = 0; p < PID_COUNT; p++) {
+        Pid& pid = _pids[p];
+        PidReport& r = reports[p];
+        r.pid = PIDS[p].pid;
+        r.ecu = pid.ecu;
+        r.interval_ms = PIDS[p].interval_ms;
+        r.rate_hz = window ? (pid.responses - pid.report_responses) * 1000.0f / window : 0.0f;
+        r.latency_avg_ms = pid.latency_count ? pid.latency_sum / pid.latency_count : 0;
+        r.latency_max_ms = pid.latency_max;
+        r.responses = pid.responses;
+        r.timeouts = pid.timeouts;
+
+        pid.report_responses = pid.responses;
+        pid.latency_sum = 0;
+        pid.latency_count = 0;
+        pid.latency_max = 0;
+    }
+    _report_time = now;
+    return PID_COUNT;
+}
+
+void ObdPoller::onTx(const MCP2515Driver::TxResult& result, void* context) {
+    // Runs on the CAN RX task
+    ObdPoller* self = static_cast<ObdPoller*>(context);
+    if (result.tag & (TAG_FLOW_CONTROL | TAG_DISCOVERY)) return;
+
+    uint8_t ecu_index = result.tag & 0xFF;
+    if (ecu_index >= OBD_MAX_ECUS) return;
+    Ecu& ecu = self->_ecus[ecu_index];
+    if (ecu.seq != ((result.tag >> 8) & 0xFF)) return;
+    ecu.tx_ms = millis();
+    ecu.tx_state = result.status == MCP2515Driver::TX_SENT ? TX_DONE : TX_FAILED;
+}
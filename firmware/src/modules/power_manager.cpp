@@ -0,0 +1,121 @@
+#include "power_manager.h"
+#include "logger.h"
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <cstring>
+
+// Survives deep sleep so the count is not reset by the wake-up reboot
+RTC_DATA_ATTR static uint32_t rtc_sleep_count = 0;
+
+PowerManager::PowerManager(CanReceiver& can_receiver, SDLogger& sd_logger)
+    : _can(can_receiver), _sd_logger(sd_logger), _wake_time(0), _wake_us(0),
+      _awaiting_first_frame(false) {
+    memset(&_stats, 0, sizeof(Stats));
+}
+
+PowerManager::~PowerManager() {}
+
+void PowerManager::init() {
+    _stats.sleeps = rtc_sleep_count;
+    _stats.last_wake_cause = esp_sleep_get_wakeup_cause();
+
+    // After a deep-sleep wake the reboot itself is the wake-up, so latency
+    // to the first frame is measured from reset
+    if (_stats.last_wake_cause == ESP_SLEEP_WAKEUP_EXT0) {
+        _wake_us = 0;
+        _awaiting_first_frame = true;
+    }
+    _wake_time = millis();
+
+    LOG_I("POWER", "Power manager initialized (idle timeout %lu ms, %s)", (uint32_t)BUS_IDLE_TIMEOUT,
+          DEEP_SLEEP_ENABLED ? "deep sleep" : (LIGHT_SLEEP_ENABLED ? "light sleep" : "sleep disabled"));
+}
+
+void PowerManager::onFrame(const CanFrame& frame) {
+    if (!_awaiting_first_frame) return;
+    _awaiting_first_frame = false;
+
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - _wake_us);
+    _stats.last_wake_latency_us = latency;
+    if (latency > _stats.max_wake_latency_us) _stats.max_wake_latency_us = latency;
+    LOG_I("POWER", "First frame 0x%03X %lu us after wake-up", frame.id, latency);
+}
+
+void PowerManager::update() {
+#if DEEP_SLEEP_ENABLED || LIGHT_SLEEP_ENABLED
+    uint32_t now = millis();
+    uint32_t last_activity = _can.getLastRxTime();
+    if ((int32_t)(_wake_time - last_activity) > 0) last_activity = _wake_time;
+
+    if (now - last_activity > BUS_IDLE_TIMEOUT) {
+        enterSleep();
+    }
+#endif
+}
+
+bool PowerManager::enterSleep() {
+    LOG_I("POWER", "Bus idle for %lu ms, sleeping", (uint32_t)BUS_IDLE_TIMEOUT);
+    _sd_logger.flush();
+
+    for (uint8_t i = 0; i < _can.getChannelCount(); i++) {
+        if (_can.getChannel(i).sleep() != MCP2515Driver::ERROR_OK) {
+            // Without wake-on-activity armed the unit could sleep through a trip
+            LOG_E("POWER", "MCP2515 %u refused sleep mode, staying awake", i);
+            wakeChannels(i + 1);
+            _wake_time = millis();
+            return false;
+        }
+    }
+
+    _stats.sleeps = ++rtc_sleep_count;
+
+#if DEEP_SLEEP_ENABLED
+    deepSleep();  // Does not return
+#else
+    lightSleep();
+#endif
+    return true;
+}
+
+void PowerManager::wakeChannels(uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) _can.getChannel(i).wake();
+}
+
+void PowerManager::lightSleep() {
+    uint8_t channels = _can.getChannelCount();
+
+    // Level wake-up on INT replaces the edge ISR while asleep
+    for (uint8_t i = 0; i < channels; i++) {
+        MCP2515Driver& driver = _can.getChannel(i);
+        driver.disableInterrupt();
+        gpio_wakeup_enable((gpio_num_t)driver.getIntPin(), GPIO_INTR_LOW_LEVEL);
+    }
+    esp_sleep_enable_gpio_wakeup();
+
+    uint32_t sleep_start = millis();
+    esp_light_sleep_start();
+    _wake_us = esp_timer_get_time();
+
+    for (uint8_t i = 0; i < channels; i++) {
+        MCP2515Driver& driver = _can.getChannel(i);
+        gpio_wakeup_disable((gpio_num_t)driver.getIntPin());
+        driver.wake();
+        driver.enableInterrupt();
+    }
+
+    _wake_time = millis();
+    _awaiting_first_frame = true;
+    _stats.last_sleep_ms = _wake_time - sleep_start;
+    _stats.last_wake_cause = esp_sleep_get_wakeup_cause();
+    LOG_I("POWER", "Woke after %lu ms (cause %u)", _stats.last_sleep_ms, _stats.last_wake_cause);
+}
+
+void PowerManager::deepSleep() {
+    // CAN activity reboots the unit; the timer bounds how long a missed
+    // wake-up could strand it
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)_can.getChannel(0).getIntPin(), 0);
+    esp_sleep_enable_timer_wakeup(DEEP_SLEEP_DURATION);
+    Serial.flush();
+    esp_deep_sleep_start();
+}
@@ -0,0 +1,333 @@
+#include "segment_uploader.h"
+#include "logger.h"
+#include "crc32.h"
+#include "spi_arbiter.h"
+#include "net_writer.h"
+#include <Preferences.h>
+
+SegmentUploader::SegmentUploader(SDLogger& sd_logger)
+    : _sd_logger(sd_logger), _state(STATE_IDLE), _task(nullptr), _connect_result(CONNECT_BUSY),
+      _connect_next(STATE_QUERY), _retry_at(0), _failures_in_row(0), _request_at(0),
+      _tokens(UPLOAD_CHUNK_SIZE), _last_refill(0), _segment(0), _size(0), _offset(0),
+      _chunk_length(0), _chunk_retries(0), _resumed_at(0), _segment_started(0), _segment_sent(0),
+      _request_length(0), _body_length(0), _written(0), _reply_state(STATE_QUERY), _last_write(0),
+      _response_length(0) {
+    memset(&_stats, 0, sizeof(Stats));
+}
+
+SegmentUploader::~SegmentUploader() {
+    _client.stop();
+    if (_file) _file.close();
+}
+
+bool SegmentUploader::init() {
+#if UPLOAD_USE_TLS
+    _client.setCACert(UPLOAD_CA_CERT);
+#endif
+    Preferences prefs;
+    prefs.begin("upload", true);
+    _segment = prefs.getUInt("next", 0);
+    prefs.end();
+    _last_refill = millis();
+    if (xTaskCreatePinnedToCore(taskEntry, "upload", UPLOAD_USE_TLS ? 8192 : 4096, this,
+                                UPLOAD_TASK_PRIORITY, &_task, UPLOAD_TASK_CORE) != pdPASS) {
+        LOG_E("UPLOAD", "Failed to start the connect task");
+        return false;
+    }
+    LOG_I("UPLOAD", "Segments to %s:%u%s, resuming at %lu", UPLOAD_HOST, UPLOAD_PORT, UPLOAD_PATH, _segment);
+    return true;
+}
+
+uint32_t SegmentUploader::pendingSegments() {
+    LogJournal& journal = _sd_logger.getJournal();
+    uint32_t first = _segment > journal.firstSegment() ? _segment : journal.firstSegment();
+    uint32_t current = journal.getStats().segment_seq;
+    return current > first ? current - first : 0;
+}
+
+void SegmentUploader::update() {
+    uint32_t now = millis();
+    // 1 kB/s is one byte per millisecond; a full bucket holds one chunk
+    uint32_t refill = (now - _last_refill) * UPLOAD_MAX_KBPS;
+    _tokens = refill >= UPLOAD_CHUNK_SIZE - _tokens ? UPLOAD_CHUNK_SIZE : _tokens + refill;
+    _last_refill = now;
+
+    uint32_t offset;
+    int status;
+    switch (_state) {
+        case STATE_IDLE:
+            if ((int32_t)(now - _retry_at) < 0) return;
+            if (WiFi.status() != WL_CONNECTED || !_sd_logger.isReady()) return;
+            if (!openSegment()) return;
+            if (!_client.connected()) startConnect(STATE_QUERY);
+            else sendQuery();
+            break;
+
+        case STATE_CONNECT:
+            switch (_connect_result.load(std::memory_order_acquire)) {
+                case CONNECT_BUSY:
+                    return;
+                case CONNECT_FAILED:
+                    fail("connect failed");
+                    return;
+            }
+            _client.setNoDelay(true);
+            if (_connect_next == STATE_QUERY) sendQuery();
+            else _state = STATE_SEND;
+            break;
+
+        case STATE_SEND:
+            if (!_client.connected()) {
+                startConnect(STATE_SEND);
+                return;
+            }
+            // Sized before the check: the previous chunk may have been a short tail
+            _chunk_length = _size - _offset < UPLOAD_CHUNK_SIZE ? _size - _offset : UPLOAD_CHUNK_SIZE;
+            if (_tokens < _chunk_length) return;
+            sendChunk();
+            break;
+
+        case STATE_WRITE:
+            writeRequest();
+            break;
+
+        case STATE_QUERY:
+        case STATE_ACK:
+            status = readResponse(offset);
+            if (status == 0) {
+                if (!_client.connected()) fail("connection lost");
+                else if (now - _request_at > UPLOAD_RESPONSE_TIMEOUT_MS) fail("response timed out");
+                return;
+            }
+            if (status < 0) {
+                fail("malformed response");
+                return;
+            }
+            if (_state == STATE_QUERY) handleQuery(status, offset);
+            else handleAck(status, offset);
+            break;
+    }
+}
+
+bool SegmentUploader::openSegment() {
+    LogJournal& journal = _sd_logger.getJournal();
+    uint32_t first = journal.firstSegment();
+    if (_segment < first) {
+        if (_segment) {
+            _stats.segments_missed += first - _segment;
+            LOG_W("UPLOAD", "Segments %lu-%lu were deleted before upload", _segment, first - 1);
+        }
+        _segment = first;
+    }
+    // The open segment is still being written
+    if (!_segment || _segment >= journal.getStats().segment_seq) return false;
+
+    char path[40];
+    LogJournal::segmentPath(_segment, path, sizeof(path));
+    if (_file) _file.close();
+    _file = SD.open(path, FILE_READ);
+    if (!_file) {
+        _stats.segments_missed++;
+        advance();
+        return false;
+    }
+
+    // Closed segments end at their trailer; one that lost its index goes whole
+    JournalIndexEntry entry;
+    _size = journal.getSegment(_segment, entry) ? (uint32_t)entry.block_count * JOURNAL_BLOCK_SIZE
+                                                : _file.size();
+    _offset = 0;
+    _chunk_retries = 0;
+    return true;
+}
+
+void SegmentUploader::startConnect(State next) {
+    _connect_next = next;
+    _connect_result.store(CONNECT_BUSY, std::memory_order_relaxed);
+    _state = STATE_CONNECT;
+    xTaskNotifyGive(_task);
+}
+
+void SegmentUploader::taskEntry(void* arg) {
+    static_cast<SegmentUploader*>(arg)->run();
+}
+
+// Connects on request; loop() does not touch the client meanwhile
+void SegmentUploader::run() {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bool ok = _client.connect(UPLOAD_HOST, UPLOAD_PORT, UPLOAD_CONNECT_TIMEOUT_MS);
+        _connect_result.store(ok ? CONNECT_OK : CONNECT_FAILED, std::memory_order_release);
+    }
+}
+
+bool SegmentUploader::sendQuery() {
+    _request_length = snprintf(_request, sizeof(_request),
+                               "GET %s/%s/%lu HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n",
+                               UPLOAD_PATH, UPLOAD_DEVICE_ID, _segment, UPLOAD_HOST);
+    beginWrite(0, STATE_QUERY);
+    return _state != STATE_IDLE;
+}
+
+bool SegmentUploader::sendChunk() {
+    // A block at a time so CAN is serviced between card reads
+    bool ok = _file.seek(_offset);
+    for (uint32_t done = 0; ok && done < _chunk_length; done += JOURNAL_BLOCK_SIZE) {
+        size_t length = _chunk_length - done < JOURNAL_BLOCK_SIZE ? _chunk_length - done : JOURNAL_BLOCK_SIZE;
+        SpiArbiter::yieldToCan();
+        SpiArbiter::SdScope sd_busy;
+        ok = _file.read(_chunk + done, length) == length;
+    }
+    if (!ok) {
+        fail("segment read failed");
+        return false;
+    }
+
+    _request_length = snprintf(_request, sizeof(_request),
+                               "PUT %s/%s/%lu?offset=%lu&total=%lu HTTP/1.1\r\nHost: %s\r\n"
+                               "Content-Type: application/octet-stream\r\nContent-Length: %lu\r\n"
+                               "X-Chunk-Crc32: %08lx\r\nConnection: keep-alive\r\n\r\n",
+                               UPLOAD_PATH, UPLOAD_DEVICE_ID, _segment, _offset, _size, UPLOAD_HOST,
+                               _chunk_length, (unsigned long)Crc32::update(0, _chunk, _chunk_length));
+    _tokens = _tokens > _chunk_length ? _tokens - _chunk_length : 0;
+    beginWrite(_chunk_length, STATE_ACK);
+    return _state != STATE_IDLE;
+}
+
+void SegmentUploader::beginWrite(size_t body_length, State reply_state) {
+    _body_length = body_length;
+    _written = 0;
+    _reply_state = reply_state;
+    _last_write = millis();
+    _state = STATE_WRITE;
+    writeRequest();
+}
+
+// Writes what the socket takes now, resuming where the last pass stopped;
+// once the request is all out, the response is awaited
+void SegmentUploader::writeRequest() {
+    size_t total = _request_length + _body_length;
+    while (_written < total) {
+        int written = _written < _request_length
+            ? NetWriter::write(_client, (const uint8_t*)_request + _written, _request_length - _written)
+            : NetWriter::write(_client, _chunk + (_written - _request_length), total - _written);
+        if (written < 0) {
+            fail("request failed");
+            return;
+        }
+        if (written == 0) {
+            if (millis() - _last_write > UPLOAD_SEND_TIMEOUT_MS) fail("send timed out");
+            return;
+        }
+        _written += written;
+        _last_write = millis();
+    }
+    _segment_sent += _body_length;
+    _stats.bytes_sent += _body_length;
+    _response_length = 0;
+    _request_at = millis();
+    _state = _reply_state;
+}
+
+// HTTP status once the whole response is in, 0 while waiting, -1 if
+// it cannot be parsed. offset is taken from the JSON body.
+int SegmentUploader::readResponse(uint32_t& offset) {
+    while (_client.available() && _response_length < RESPONSE_MAX - 1) {
+        _response[_response_length++] = _client.read();
+    }
+    _response[_response_length] = '\0';
+
+    char* body = strstr(_response, "\r\n\r\n");
+    if (!body) return _response_length >= RESPONSE_MAX - 1 ? -1 : 0;
+    body += 4;
+
+    size_t content_length = 0;
+    bool close = false;
+    for (char* line = strstr(_response, "\r\n"); line && line + 2 < body; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) content_length = strtoul(line + 17, nullptr, 10);
+        else if (strncasecmp(line + 2, "Connection: close", 17) == 0) close = true;
+    }
+    if (strlen(body) < content_length) {
+        return _response_length >= RESPONSE_MAX - 1 ? -1 : 0;
+    }
+    if (strncmp(_response, "HTTP/1.", 7) != 0) return -1;
+
+    const char* field = strstr(body, "\"offset\":");
+    offset = field ? strtoul(field + 9, nullptr, 10) : 0;
+    // Reconnect for the next request rather than write into a closing socket
+    if (close) _client.stop();
+    return atoi(_response + 9);
+}
+
+void SegmentUploader::handleQuery(int status, uint32_t offset) {
+    if (status != 200) {
+        LOG_W("UPLOAD", "Segment %lu: offset query returned %d", _segment, status);
+        fail("offset query rejected");
+        return;
+    }
+    _failures_in_row = 0;
+    _offset = offset < _size ? offset : _size;
+    if (_offset) {
+        _stats.resumes++;
+        _stats.bytes_resumed += _offset;
+    }
+    _resumed_at = _offset;
+    _segment_started = millis();
+    _segment_sent = 0;
+    if (_offset >= _size) finishSegment();
+    else _state = STATE_SEND;
+}
+
+void SegmentUploader::handleAck(int status, uint32_t offset) {
+    if (status == 200) {
+        _failures_in_row = 0;
+        _stats.chunks++;
+        _stats.bytes_acked += _chunk_length;
+        _chunk_retries = 0;
+        _offset = offset;
+        if (_offset >= _size) finishSegment();
+        else _state = STATE_SEND;
+        return;
+    }
+    if ((status == 409 || status == 422) && ++_chunk_retries <= UPLOAD_MAX_CHUNK_RETRIES) {
+        // Resend from wherever the server says it is
+        _stats.chunk_retries++;
+        _offset = offset < _size ? offset : _size;
+        _state = STATE_SEND;
+        return;
+    }
+    LOG_W("UPLOAD", "Segment %lu: chunk at %lu returned %d", _segment, _offset, status);
+    fail("chunk rejected");
+}
+
+void SegmentUploader::finishSegment() {
+    uint32_t elapsed = millis() - _segment_started;
+    _stats.segments++;
+    _stats.last_kbps = elapsed ? _segment_sent / elapsed : _segment_sent;   // bytes/ms is kB/s
+    LOG_I("UPLOAD", "Segment %lu done: %lu bytes sent in %lu ms (%lu kB/s), resumed at %lu",
+          _segment, _segment_sent, elapsed, _stats.last_kbps, _resumed_at);
+    advance();
+    // Straight on to the next segment over the same connection
+    _state = STATE_IDLE;
+}
+
+void SegmentUploader::advance() {
+    if (_file) _file.close();
+    _segment++;
+    Preferences prefs;
+    prefs.begin("upload", false);
+    prefs.putUInt("next", _segment);
+    prefs.end();
+}
+
+void SegmentUploader::fail(const char* reason) {
+    // One dropped connection is resumed at once; a second in a row backs off
+    uint32_t delay_ms = _failures_in_row++ ? UPLOAD_RETRY_MS : 0;
+    LOG_W("UPLOAD", "Segment %lu at %lu/%lu: %s, retrying in %lu s",
+          _segment, _offset, _size, reason, delay_ms / 1000);
+    _stats.failures++;
+    _client.stop();
+    if (_file) _file.close();
+    _state = STATE_IDLE;
+    _retry_at = millis() + delay_ms;
+}
@@ -0,0 +1,66 @@
+#include "signal_aggregator.h"
+
+SignalAggregator::SignalAggregator() {
+    memset(&_window, 0, sizeof(SignalWindow));
+    reset(0);
+}
+
+void SignalAggregator::update(const VehicleState& state, uint8_t signals) {
+    if (!signals) return;
+
+    uint16_t values[SIGNAL_COUNT];
+    values[SIGNAL_SPEED] = state.speed;
+    values[SIGNAL_RPM] = state.rpm;
+    values[SIGNAL_THROTTLE] = state.throttle;
+    values[SIGNAL_GEAR] = state.gear;
+
+    for (uint8_t i = 0; i < SIGNAL_COUNT; i++) {
+        if (!(signals & (1 << i))) continue;
+        SignalStats& s = _window.signals[i];
+        uint16_t v = values[i];
+        if (v < s.min) s.min = v;
+        if (v > s.max) s.max = v;
+        s.last = v;
+        s.sum += v;
+        s.count++;
+    }
+}
+
+SignalWindow SignalAggregator::takeWindow(uint32_t now) {
+    SignalWindow window = _window;
+    window.end = now;
+    for (uint8_t i = 0; i < SIGNAL_COUNT; i++) {
+        SignalStats& s = window.signals[i];
+        // An idle signal reports its last known value rather than the sentinels
+        if (s.count == 0) s.min = s.max = s.last;
+    }
+    reset(now);
+    return window;
+}
+
+uint16_t SignalAggregator::mean(const SignalStats& stats) {
+    if (stats.count == 0) return stats.last;
+    return (uint16_t)((stats.sum + stats.count / 2) / stats.count);
+}
+
+const char* SignalAggregator::signalName(SignalId signal) {
+    switch (signal) {
+        case SIGNAL_SPEED:    return "speed";
+        case SIGNAL_RPM:      return "rpm";
+        case SIGNAL_THROTTLE: return "throttle";
+        case SIGNAL_GEAR:     return "gear";
+        default:              return "?";
+    }
+}
+
+void SignalAggregator::reset(uint32_t now) {
+    _window.start = now;
+    _window.end = now;
+    for (uint8_t i = 0; i < SIGNAL_COUNT; i++) {
+        SignalStats& s = _window.signals[i];
+        s.min = 0xFFFF;
+        s.max = 0;
+        s.count = 0;
+        s.sum = 0;
+    }
+}
@@ -4,6 +4,7 @@
 VehicleStateManager::VehicleStateManager() {
     memset(&_current_state, 0, sizeof(VehicleState));
     _last_update = 0;
+    _decoded_signals = 0;
 }
 
 VehicleStateManager::~VehicleStateManager() {}
@@ -12,8 +13,10 @@ void VehicleStateManager::init() {
     LOG_I("VSTATE", "Vehicle State Manager initialized");
 }
 
-void VehicleStateManager::update(const CanFrame& frame) {
+bool VehicleStateManager::update(const CanFrame& frame) {
     _current_state.timestamp = frame.timestamp;
+    bool decoded = true;
+    _decoded_signals = 0;
 
     // Common OBD-II CAN IDs (vehicle-specific mapping needed)
     switch (frame.id) {
@@ -33,10 +36,39 @@ void VehicleStateManager::update(const CanFrame& frame) {
             decodeFaultStatus(frame);
             break;
         default:
+            decoded = false;
             break;
     }
 
     _last_update = millis();
+    return decoded;
+}
+
+bool VehicleStateManager::updateObd(uint8_t pid, const uint8_t* data, uint8_t length) {
+    switch (pid) {
+        case 0x0C:  // Engine RPM, 0.25 RPM per unit, MSB first
+            if (length < 2) return false;
+            _current_state.rpm = ((data[0] << 8) | data[1]) / 4;
+            _decoded_signals |= 1 << SIGNAL_RPM;
+            return true;
+        case 0x0D:  // Vehicle speed, km/h
+            if (length < 1) return false;
+            _current_state.speed = data[0];
+            _decoded_signals |= 1 << SIGNAL_SPEED;
+            return true;
+        case 0x11:  // Throttle position, 0-255 -> 0-100%
+            if (length < 1) return false;
+            _current_state.throttle = (data[0] * 100) / 255;
+            _decoded_signals |= 1 << SIGNAL_THROTTLE;
+            return true;
+        case 0x01:  // Monitor status, MIL in bit 7 of A
+            if (length < 1) return false;
+            _current_state.fault_status = (data[0] & 0x80) ? 1 : 0;
+            _decoded_signals |= 1 << SIGNAL_FAULT_STATUS;
+            return true;
+        default:
+            return false;
+    }
 }
 
 void VehicleStateManager::decodeSpeed(const CanFrame& frame) {
@@ -44,6 +76,7 @@ void VehicleStateManager::decodeSpeed(const CanFrame& frame) {
     // Example: Speed in bytes 0-1, LSB first, 0.1 km/h per unit
     uint16_t raw = (frame.data[1] << 8) | frame.data[0];
     _current_state.speed = raw / 10;
+    _decoded_signals |= 1 << SIGNAL_SPEED;
 }
 
 void VehicleStateManager::decodeRPM(const CanFrame& frame) {
@@ -51,12 +84,14 @@ void VehicleStateManager::decodeRPM(const CanFrame& frame) {
     // Example: RPM in bytes 0-1, LSB first, 0.25 RPM per unit
     uint16_t raw = (frame.data[1] << 8) | frame.data[0];
     _current_state.rpm = raw / 4;
+    _decoded_signals |= 1 << SIGNAL_RPM;
 }
 
 void VehicleStateManager::decodeThrottle(const CanFrame& frame) {
     if (frame.dlc < 1) return;
     // Example: Throttle position in byte 0, 0-255 -> 0-100%
     _current_state.throttle = (frame.data[0] * 100) / 255;
+    _decoded_signals |= 1 << SIGNAL_THROTTLE;
 }
 
 void VehicleStateManager::decodeEngineStatus(const CanFrame& frame) {
@@ -65,12 +100,14 @@ void VehicleStateManager::decodeEngineStatus(const CanFrame& frame) {
     _current_state.engine_status = (frame.data[0] & 0x01) ? 1 : 0;
     // Gear in bits 1-3
     _current_state.gear = (frame.data[0] >> 1) & 0x07;
+    _decoded_signals |= (1 << SIGNAL_GEAR) | (1 << SIGNAL_ENGINE_STATUS);
 }
 
 void VehicleStateManager::decodeFaultStatus(const CanFrame& frame) {
     if (frame.dlc < 1) return;
     // Example: Fault flag in bit 0
     _current_state.fault_status = (frame.data[0] & 0x01) ? 1 : 0;
+    _decoded_signals |= 1 << SIGNAL_FAULT_STATUS;
 }
 
 VehicleState VehicleStateManager::getState() {
@@ -80,6 +117,7 @@ VehicleState VehicleStateManager::getState() {
 void VehicleStateManager::reset() {
     memset(&_current_state, 0, sizeof(VehicleState));
     _last_update = 0;
+    _decoded_signals = 0;
 }
 
 uint16_t VehicleStateManager::extractBits(const uint8_t* data, uint8_t start_bit, uint8_t length) {
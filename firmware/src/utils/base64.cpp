@@ -0,0 +1,58 @@
+#include "base64.h"
+
+static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int8_t decodeChar(char ch) {
+    if (ch >= 'A' && ch <= 'Z') return ch - 'A';
+    if (ch >= 'a' && ch <= 'z') return ch - 'a' + 26;
+    if (ch >= '0' && ch <= '9') return ch - '0' + 52;
+    if (ch == '+') return 62;
+    if (ch == '/') return 63;
+    return -1;
+}
+
+size_t Base64::encode(const uint8_t* in, size_t length, char* out, size_t size) {
+    size_t needed = encodedLength(length);
+    if (size < needed + 1) return 0;
+
+    size_t pos = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t chunk = (uint32_t)in[i] << 16;
+        if (i + 1 < length) chunk |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < length) chunk |= in[i + 2];
+
+        out[pos++] = ALPHABET[(chunk >> 18) & 0x3F];
+        out[pos++] = ALPHABET[(chunk >> 12) & 0x3F];
+        out[pos++] = (i + 1 < length) ? ALPHABET[(chunk >> 6) & 0x3F] : '=';
+        out[pos++] = (i + 2 < length) ? ALPHABET[chunk & 0x3F] : '=';
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+size_t Base64::decode(const char* in, size_t length, uint8_t* out, size_t size) {
+    if (length % 4 != 0) return 0;
+
+    uint8_t padding = 0;
+    if (length >= 1 && in[length - 1] == '=') padding++;
+    if (length >= 2 && in[length - 2] == '=') padding++;
+
+    size_t pos = 0;
+    for (size_t i = 0; i < length; i += 4) {
+        bool last = (i + 4 == length);
+        uint32_t chunk = 0;
+        for (uint8_t j = 0; j < 4; j++) {
+            char ch = in[i + j];
+            int8_t value = (last && ch == '=' && j >= 4 - padding) ? 0 : decodeChar(ch);
+            if (value < 0) return 0;
+            chunk = (chunk << 6) | value;
+        }
+
+        uint8_t bytes = last ? 3 - padding : 3;
+        if (pos + bytes > size) return 0;
+        out[pos++] = (chunk >> 16) & 0xFF;
+        if (bytes > 1) out[pos++] = (chunk >> 8) & 0xFF;
+        if (bytes > 2) out[pos++] = chunk & 0xFF;
+    }
+    return pos;
+}
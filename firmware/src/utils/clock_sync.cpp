@@ -0,0 +1,176 @@
+#include "clock_sync.h"
+#include "logger.h"
+#include <esp_timer.h>
+#include <cstring>
+
+// PPS edges older than this cannot belong to the message being processed
+#define PPS_MAX_AGE_US 1000000
+// With a PPS pin, NMEA samples leave phase alone for this long after a
+// PPS-aligned one; their arrival latency would pull against it
+#define PPS_STEER_TIMEOUT_US 3000000
+// Loop gains as right shifts: NMEA arrival time jitters by tens of ms,
+// a PPS edge by a few us. Frequency measurements are averaged over
+// 1 << FREQ_SHIFT baselines.
+#define PHASE_SHIFT_NMEA 3
+#define PHASE_SHIFT_PPS 1
+#define FREQ_SHIFT 2
+
+portMUX_TYPE ClockSync::_lock = portMUX_INITIALIZER_UNLOCKED;
+bool ClockSync::_synced = false;
+int64_t ClockSync::_ref_local_us = 0;
+int64_t ClockSync::_ref_utc_us = 0;
+float ClockSync::_drift_ppm = 0.0f;
+ClockSync::Stats ClockSync::_stats = {};
+bool ClockSync::_pps_enabled = false;
+volatile int64_t ClockSync::_pps_us = 0;
+int64_t ClockSync::_last_pps_sample_us = 0;
+int64_t ClockSync::_freq_local_us = 0;
+int64_t ClockSync::_freq_utc_us = 0;
+bool ClockSync::_freq_valid = false;
+
+void ClockSync::init(int8_t pps_pin) {
+    memset(&_stats, 0, sizeof(Stats));
+    _pps_enabled = pps_pin >= 0;
+    if (pps_pin >= 0) {
+        pinMode(pps_pin, INPUT);
+        attachInterrupt(digitalPinToInterrupt(pps_pin), onPps, RISING);
+    }
+    LOG_I("CLOCK", "Clock sync initialized (PPS %s)", pps_pin >= 0 ? "enabled" : "disabled");
+}
+
+void IRAM_ATTR ClockSync::onPps() {
+    // 64-bit: a plain store can be seen half-written from the other core
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&_lock);
+    _pps_us = now;
+    portEXIT_CRITICAL_ISR(&_lock);
+}
+
+void ClockSync::onGpsTime(uint64_t utc_ms, int64_t local_us) {
+    int64_t utc_us = (int64_t)utc_ms * 1000;
+    bool stepped = false;
+
+    portENTER_CRITICAL(&_lock);
+    // Whole-second epochs are marked by the preceding PPS edge
+    bool pps = false;
+    int64_t pps_us = _pps_us;
+    if (pps_us != 0 && utc_ms % 1000 == 0 && local_us - pps_us < PPS_MAX_AGE_US) {
+        local_us = pps_us;
+        pps = true;
+        _last_pps_sample_us = local_us;
+    }
+
+    int64_t error = _synced ? utc_us - predictLocked(local_us) : 0;
+
+    if (!_synced || error > CLOCK_STEP_THRESHOLD_US || error < -CLOCK_STEP_THRESHOLD_US) {
+        _ref_local_us = local_us;
+        _ref_utc_us = utc_us;
+        _synced = true;
+        _stats.steps++;
+        stepped = true;
+        // The oscillator did not change, but the baseline spans the jump
+        _freq_local_us = 0;
+    } else {
+        bool steer = pps || !_pps_enabled || local_us - _last_pps_sample_us > PPS_STEER_TIMEOUT_US;
+        if (steer) {
+            int64_t predicted = utc_us - error;
+            _ref_utc_us = predicted + (error >> (pps ? PHASE_SHIFT_PPS : PHASE_SHIFT_NMEA));
+            _ref_local_us = local_us;
+
+            uint32_t abs_error = (uint32_t)(error < 0 ? -error : error);
+            _stats.jitter_us += ((int32_t)abs_error - (int32_t)_stats.jitter_us) / 8;
+        }
+    }
+    if (pps || !_pps_enabled) measureFrequencyLocked(utc_us, local_us);
+
+    _stats.pps = pps;
+    _stats.samples++;
+    _stats.last_error_us = (int32_t)error;
+    _stats.offset_us = _ref_utc_us - _ref_local_us;
+    _stats.drift_ppm = _drift_ppm;
+    uint32_t steps = _stats.steps;
+    portEXIT_CRITICAL(&_lock);
+
+    if (stepped) {
+        LOG_I("CLOCK", "Clock stepped to GPS time (step #%lu, error %ld us)", steps, (int32_t)error);
+    }
+}
+
+uint64_t ClockSync::toUtcMs(uint32_t local_ms) {
+    // Widen the 32-bit millis() stamp against the 64-bit timer it derives from
+    int64_t now_us = esp_timer_get_time();
+    uint32_t age_ms = (uint32_t)(now_us / 1000) - local_ms;
+    int64_t local_us = now_us - (int64_t)age_ms * 1000;
+
+    portENTER_CRITICAL(&_lock);
+    int64_t utc_us = _synced ? predictLocked(local_us) : 0;
+    portEXIT_CRITICAL(&_lock);
+
+    return utc_us > 0 ? (uint64_t)(utc_us / 1000) : 0;
+}
+
+uint64_t ClockSync::nowUtcMs() {
+    return toUtcMs(millis());
+}
+
+ClockSync::State ClockSync::getState() {
+    int64_t now_us = esp_timer_get_time();
+    portENTER_CRITICAL(&_lock);
+    State state = stateLocked(now_us);
+    portEXIT_CRITICAL(&_lock);
+    return state;
+}
+
+ClockSync::Stats ClockSync::getStats() {
+    int64_t now_us = esp_timer_get_time();
+    portENTER_CRITICAL(&_lock);
+    Stats stats = _stats;
+    stats.state = stateLocked(now_us);
+    stats.since_sync_ms = _synced ? (uint32_t)((now_us - _ref_local_us) / 1000) : 0;
+    portEXIT_CRITICAL(&_lock);
+    return stats;
+}
+
+uint64_t ClockSync::epochMs(uint16_t year, uint8_t month, uint8_t day, uint32_t ms_of_day) {
+    // Days since 1970-01-01 for a proleptic Gregorian date
+    int32_t y = (int32_t)year - (month <= 2 ? 1 : 0);
+    int32_t era = y / 400;
+    uint32_t yoe = (uint32_t)(y - era * 400);
+    uint32_t mp = (month + 9) % 12;
+    uint32_t doy = (153 * mp + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+    return (uint64_t)days * 86400000ULL + ms_of_day;
+}
+
+void ClockSync::measureFrequencyLocked(int64_t utc_us, int64_t local_us) {
+    if (_freq_local_us == 0) {
+        _freq_local_us = local_us;
+        _freq_utc_us = utc_us;
+        return;
+    }
+    int64_t elapsed = local_us - _freq_local_us;
+    if (elapsed < (int64_t)CLOCK_FREQ_BASELINE_MS * 1000) return;
+
+    // UTC advanced by utc_us - _freq_utc_us while the timer advanced by elapsed
+    float measured = (float)(utc_us - _freq_utc_us - elapsed) / (float)elapsed * 1e6f;
+    if (_freq_valid) _drift_ppm += (measured - _drift_ppm) / (1 << FREQ_SHIFT);
+    else _drift_ppm = measured;
+    _freq_valid = true;
+    if (_drift_ppm > CLOCK_MAX_DRIFT_PPM) _drift_ppm = CLOCK_MAX_DRIFT_PPM;
+    if (_drift_ppm < -CLOCK_MAX_DRIFT_PPM) _drift_ppm = -CLOCK_MAX_DRIFT_PPM;
+
+    _freq_local_us = local_us;
+    _freq_utc_us = utc_us;
+}
+
+int64_t ClockSync::predictLocked(int64_t local_us) {
+    int64_t elapsed = local_us - _ref_local_us;
+    return _ref_utc_us + elapsed + (int64_t)((float)elapsed * _drift_ppm * 1e-6f);
+}
+
+ClockSync::State ClockSync::stateLocked(int64_t now_us) {
+    if (!_synced) return UNSYNCED;
+    if (now_us - _ref_local_us > (int64_t)CLOCK_HOLDOVER_MS * 1000) return HOLDOVER;
+    return LOCKED;
+}
@@ -0,0 +1,63 @@
+#include "fixed_point.h"
+#include <cstdio>
+
+// Integer part into whole; returns the fraction scaled to `decimals`
+// digits, rounded on the next one. All 32-bit: no 64-bit multiply per digit.
+static uint32_t parseScaled(const char* text, uint8_t decimals, uint32_t& whole, bool& negative) {
+    const char* p = text;
+    negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+
+    whole = 0;
+    for (; *p >= '0' && *p <= '9'; p++) whole = whole * 10 + (*p - '0');
+
+    uint32_t fraction = 0;
+    uint8_t kept = 0;
+    bool round_up = false;
+    if (*p == '.') {
+        for (p++; *p >= '0' && *p <= '9'; p++) {
+            if (kept < decimals) {
+                fraction = fraction * 10 + (*p - '0');
+                kept++;
+            } else if (kept == decimals) {
+                round_up = *p >= '5';
+                kept++;
+            }
+        }
+    }
+    for (; kept < decimals; kept++) fraction *= 10;
+    return fraction + (round_up ? 1 : 0);
+}
+
+int32_t FixedPoint::parseDecimal(const char* text, uint8_t decimals) {
+    uint32_t whole;
+    bool negative;
+    uint32_t fraction = parseScaled(text, decimals, whole, negative);
+    uint32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) scale *= 10;
+    int32_t value = (int32_t)(whole * scale + fraction);
+    return negative ? -value : value;
+}
+
+int32_t FixedPoint::parseNmeaCoordinate(const char* coord, const char* hemisphere) {
+    // ddmm.mmmmm: whole is ddmm, fraction is minutes in 1e-5
+    uint32_t whole;
+    bool negative;
+    uint32_t minute_fraction = parseScaled(coord, 5, whole, negative);
+    uint32_t degrees = whole / 100;
+    uint32_t minutes_e5 = (whole % 100) * 100000 + minute_fraction;
+
+    // One minute is 1e6 / 60 microdegrees, so minutes_e5 / 6, rounded
+    int32_t value = (int32_t)(degrees * MICRODEGREES_PER_DEGREE + (minutes_e5 + 3) / 6);
+    if (negative || hemisphere[0] == 'S' || hemisphere[0] == 'W') value = -value;
+    return value;
+}
+
+size_t FixedPoint::formatMicrodegrees(int32_t microdegrees, char* out, size_t size) {
+    uint32_t magnitude = microdegrees < 0 ? 0u - (uint32_t)microdegrees : (uint32_t)microdegrees;
+    int n = snprintf(out, size, "%s%lu.%06lu", microdegrees < 0 ? "-" : "",
+                     (unsigned long)(magnitude / MICRODEGREES_PER_DEGREE),
+                     (unsigned long)(magnitude % MICRODEGREES_PER_DEGREE));
+    if (n < 0) return 0;
+    return (size_t)n < size ? (size_t)n : size - 1;
+}
@@ -0,0 +1,34 @@
+#include "journal_index.h"
+
+bool JournalIndex::probe(Reader read, void* context, uint32_t position, uint32_t count, bool synced,
+                         JournalIndexEntry& entry) {
+    for (; position < count; position++) {
+        if (!read(context, position, entry)) continue;
+        if (synced && !entry.last_utc_ms) continue;
+        return true;
+    }
+    return false;
+}
+
+bool JournalIndex::findTime(Reader read, void* context, uint32_t count, uint32_t first_seq, uint64_t utc_ms,
+                            JournalIndexEntry& entry) {
+    // Skip deleted segments, then find the first whose range reaches
+    // utc_ms. Every boot starts unsynced, so entries with last_utc_ms 0 can
+    // sit anywhere; only the synced ones are ordered.
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (!probe(read, context, mid, count, false, entry) || entry.segment_seq >= first_seq) hi = mid;
+        else lo = mid + 1;
+    }
+    bool synced = utc_ms != 0;
+    hi = count;
+    while (synced && lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        // Past the last synced entry counts as reached, to keep the order
+        if (!probe(read, context, mid, count, true, entry) || entry.last_utc_ms >= utc_ms) hi = mid;
+        else lo = mid + 1;
+    }
+    return probe(read, context, lo, count, synced, entry);
+}
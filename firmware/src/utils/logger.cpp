@@ -1,69 +1,220 @@
 #include "logger.h"
-#include <cstdarg>
+#include <cstring>
+
+static_assert((LOG_QUEUE_DEPTH & (LOG_QUEUE_DEPTH - 1)) == 0, "LOG_QUEUE_DEPTH must be a power of two");
+static_assert(LOG_STRING_BYTES <= 255, "String offsets are stored in one byte");
+
+Logger::Entry Logger::_ring[LOG_QUEUE_DEPTH];
+std::atomic<uint32_t> Logger::_enqueue_pos(0);
+uint32_t Logger::_dequeue_pos = 0;
+std::atomic<uint32_t> Logger::_written(0);
+std::atomic<uint32_t> Logger::_dropped(0);
+uint32_t Logger::_high_water = 0;
+TaskHandle_t Logger::_drain_task = nullptr;
 
 void Logger::init() {
+    // No settle delay: lines queue until the drain task prints them, and
+    // boot must reach CAN capture without waiting on the console
     Serial.begin(115200);
-    delay(100);
+
+    for (uint32_t i = 0; i < LOG_QUEUE_DEPTH; i++) {
+        _ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    xTaskCreatePinnedToCore(drainTask, "logger", 4096, nullptr,
+                            LOG_TASK_PRIORITY, &_drain_task, LOG_TASK_CORE);
     LOG_I("LOGGER", "Logger initialized");
 }
 
-void Logger::log(Level level, const char* tag, const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    vlog(level, tag, format, args);
-    va_end(args);
+// Bounded MPMC queue (per-slot sequence numbers): producers on any task or
+// core claim a slot with one CAS and never block
+Logger::Entry* Logger::reserve(uint32_t& pos) {
+    pos = _enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Entry* entry = &_ring[pos & (LOG_QUEUE_DEPTH - 1)];
+        uint32_t seq = entry->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+
+        if (diff == 0) {
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return entry;
+            }
+        } else if (diff < 0) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::commit(Entry* entry, uint32_t pos) {
+    entry->sequence.store(pos + 1, std::memory_order_release);
+    _written.fetch_add(1, std::memory_order_relaxed);
+    if (_drain_task) xTaskNotifyGive(_drain_task);
 }
 
-void Logger::logError(const char* tag, const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    vlog(ERROR, tag, format, args);
-    va_end(args);
+void Logger::packArg(Entry& entry, const char* value) {
+    if (!value) value = "(null)";
+    size_t room = LOG_STRING_BYTES - entry.string_bytes;
+    if (room == 0) {
+        // Area is full; the previous string's terminator reads as ""
+        pushArg(entry, STRING_ARG | (entry.string_bytes - 1));
+        return;
+    }
+
+    size_t len = strnlen(value, room - 1);
+    memcpy(&entry.strings[entry.string_bytes], value, len);
+    entry.strings[entry.string_bytes + len] = '\0';
+    pushArg(entry, STRING_ARG | entry.string_bytes);
+    entry.string_bytes += len + 1;
 }
 
-void Logger::logWarn(const char* tag, const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    vlog(WARN, tag, format, args);
-    va_end(args);
+void Logger::packArg(Entry& entry, double value) {
+    uint64_t word;
+    memcpy(&word, &value, sizeof(word));
+    pushArg(entry, word);
 }
 
-void Logger::logInfo(const char* tag, const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    vlog(INFO, tag, format, args);
-    va_end(args);
+void Logger::drainTask(void* arg) {
+    char line[LOG_BUFFER_SIZE];
+    uint32_t reported_drops = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        while (drainOne(line, sizeof(line))) {}
+
+        uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+        if (dropped != reported_drops) {
+            int len = snprintf(line, sizeof(line), "[%06lu] [WRN] LOGGER: %lu messages dropped (total %lu)\r\n",
+                               (unsigned long)millis(), (unsigned long)(dropped - reported_drops),
+                               (unsigned long)dropped);
+            Serial.write((const uint8_t*)line, len);
+            reported_drops = dropped;
+        }
+    }
 }
 
-void Logger::logDebug(const char* tag, const char* format, ...) {
-    va_list args;
-    va_start(args, format);
-    vlog(DEBUG, tag, format, args);
-    va_end(args);
+bool Logger::drainOne(char* line, size_t size) {
+    Entry* entry = &_ring[_dequeue_pos & (LOG_QUEUE_DEPTH - 1)];
+    uint32_t seq = entry->sequence.load(std::memory_order_acquire);
+    if (seq != _dequeue_pos + 1) return false;
+
+    uint32_t pending = _enqueue_pos.load(std::memory_order_relaxed) - _dequeue_pos;
+    if (pending > _high_water) _high_water = pending;
+
+    int len = snprintf(line, size, "[%06lu] [%s] %s: ", (unsigned long)entry->timestamp,
+                       levelToString(entry->level), entry->tag);
+    if (len < 0) len = 0;
+    if ((size_t)len > size - 3) len = size - 3;
+    len += format(*entry, line + len, size - 2 - len);
+    line[len++] = '\r';
+    line[len++] = '\n';
+
+    // Slot is free for producers again once it is formatted
+    entry->sequence.store(_dequeue_pos + LOG_QUEUE_DEPTH, std::memory_order_release);
+    _dequeue_pos++;
+
+    Serial.write((const uint8_t*)line, len);
+    return true;
+}
+
+size_t Logger::format(const Entry& entry, char* out, size_t size) {
+    size_t n = 0;
+    uint8_t arg = 0;
+    const char* p = entry.format;
+
+    while (*p && n + 1 < size) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Copy one conversion spec, then print it with the stored word
+        char spec[16];
+        size_t spec_len = 0;
+        uint8_t longs = 0;
+        spec[spec_len++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && spec_len < sizeof(spec) - 4) {
+            spec[spec_len++] = *p++;
+        }
+        while (*p == 'l' || *p == 'h' || *p == 'z') {
+            if (*p == 'l') longs++;
+            if (spec_len < sizeof(spec) - 2) spec[spec_len++] = *p;
+            p++;
+        }
+        if (!*p) break;
+        char conv = *p++;
+        spec[spec_len++] = conv;
+        spec[spec_len] = '\0';
+
+        uint64_t word = arg < entry.arg_count ? entry.args[arg] : 0;
+        arg++;
+
+        int written = 0;
+        switch (conv) {
+            case 'd':
+            case 'i':
+                if (longs >= 2) written = snprintf(out + n, size - n, spec, (long long)word);
+                else if (longs == 1) written = snprintf(out + n, size - n, spec, (long)word);
+                else written = snprintf(out + n, size - n, spec, (int)word);
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                if (longs >= 2) written = snprintf(out + n, size - n, spec, (unsigned long long)word);
+                else if (longs == 1) written = snprintf(out + n, size - n, spec, (unsigned long)word);
+                else written = snprintf(out + n, size - n, spec, (unsigned int)word);
+                break;
+            case 'f':
+            case 'e':
+            case 'g':
+            case 'E':
+            case 'G': {
+                double value;
+                memcpy(&value, &word, sizeof(value));
+                written = snprintf(out + n, size - n, spec, value);
+                break;
+            }
+            case 's': {
+                // Only copied strings are safe to dereference here
+                const char* str = (word & STRING_ARG) ? &entry.strings[word & 0xFF] : "(?)";
+                written = snprintf(out + n, size - n, spec, str);
+                break;
+            }
+            case 'p':
+                written = snprintf(out + n, size - n, spec, (void*)(uintptr_t)word);
+                break;
+            default:
+                written = 0;
+                break;
+        }
+
+        if (written > 0) {
+            n += ((size_t)written < size - n) ? (size_t)written : size - n - 1;
+        }
+    }
+
+    out[n] = '\0';
+    return n;
 }
 
-void Logger::vlog(Level level, const char* tag, const char* format, va_list args) {
-#if LOG_ENABLE
-    if (level > LOG_LEVEL) return;
-
-    char timestamp[32];
-    uint32_t ms = millis();
-    snprintf(timestamp, sizeof(timestamp), "[%06lu]", ms);
-
-    Serial.print(timestamp);
-    Serial.print(" [");
-    Serial.print(levelToString(level));
-    Serial.print("] ");
-    Serial.print(tag);
-    Serial.print(": ");
-
-    char buffer[256];
-    vsnprintf(buffer, sizeof(buffer), format, args);
-    Serial.println(buffer);
-#endif
+Logger::Stats Logger::getStats() {
+    Stats stats;
+    stats.written = _written.load(std::memory_order_relaxed);
+    stats.dropped = _dropped.load(std::memory_order_relaxed);
+    stats.high_water = _high_water;
+    return stats;
 }
 
-const char* Logger::levelToString(Level level) {
+const char* Logger::levelToString(uint8_t level) {
     switch (level) {
         case ERROR: return "ERR";
         case WARN:  return "WRN";
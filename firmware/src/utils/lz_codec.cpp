@@ -0,0 +1,131 @@
+#include "lz_codec.h"
+#include <cstring>
+
+// LZ4 block rules: matches are at least 4 bytes, the last match starts at
+// least 12 bytes before the end and the last 5 bytes are always literals
+static const size_t MIN_MATCH = 4;
+static const size_t MATCH_START_LIMIT = 12;
+static const size_t LAST_LITERALS = 5;
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash(uint32_t sequence, uint8_t bits) {
+    return (sequence * 2654435761u) >> (32 - bits);
+}
+
+// Token, literal run and, if match_length is non-zero, offset and match.
+// False if it does not fit.
+static bool emitSequence(const uint8_t* literals, size_t literal_length, uint16_t offset,
+                         size_t match_length, uint8_t*& out, const uint8_t* end) {
+    size_t match_code = match_length ? match_length - MIN_MATCH : 0;
+    size_t need = 1 + literal_length / 255 + 1 + literal_length + (match_length ? 2 + match_code / 255 + 1 : 0);
+    if ((size_t)(end - out) < need) return false;
+
+    uint8_t* token = out++;
+    *token = (literal_length < 15 ? literal_length : 15) << 4;
+    if (literal_length >= 15) {
+        size_t left = literal_length - 15;
+        for (; left >= 255; left -= 255) *out++ = 255;
+        *out++ = left;
+    }
+    if (literal_length) memcpy(out, literals, literal_length);
+    out += literal_length;
+    if (!match_length) return true;
+
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+    *token |= match_code < 15 ? match_code : 15;
+    if (match_code >= 15) {
+        size_t left = match_code - 15;
+        for (; left >= 255; left -= 255) *out++ = 255;
+        *out++ = left;
+    }
+    return true;
+}
+
+size_t LzCodec::compress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity) {
+    if (length > MAX_BLOCK) return 0;
+    memset(_table, 0, sizeof(_table));
+
+    uint8_t* op = out;
+    const uint8_t* end = out + capacity;
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + MATCH_START_LIMIT <= length) {
+        uint32_t sequence = read32(in + pos);
+        uint32_t h = hash(sequence, HASH_BITS);
+        size_t candidate = _table[h];
+        _table[h] = pos;
+        if (candidate >= pos || read32(in + candidate) != sequence) {
+            // Step faster through data that is not matching
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        while (pos > anchor && candidate > 0 && in[pos - 1] == in[candidate - 1]) {
+            pos--;
+            candidate--;
+        }
+        size_t match_end = pos + MIN_MATCH;
+        for (size_t from = candidate + MIN_MATCH; match_end < length - LAST_LITERALS && in[match_end] == in[from];
+             match_end++, from++) {}
+
+        if (!emitSequence(in + anchor, pos - anchor, pos - candidate, match_end - pos, op, end)) return 0;
+        // Index inside the match too, so the next repeat finds it
+        if (match_end - 2 + MIN_MATCH <= length) _table[hash(read32(in + match_end - 2), HASH_BITS)] = match_end - 2;
+        pos = anchor = match_end;
+    }
+
+    if (!emitSequence(in + anchor, length - anchor, 0, 0, op, end)) return 0;
+    return op - out;
+}
+
+size_t LzCodec::decompress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity) {
+    const uint8_t* ip = in;
+    const uint8_t* in_end = in + length;
+    uint8_t* op = out;
+    uint8_t* out_end = out + capacity;
+
+    while (ip < in_end) {
+        uint8_t token = *ip++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            uint8_t byte;
+            do {
+                if (ip >= in_end) return 0;
+                byte = *ip++;
+                literal_length += byte;
+            } while (byte == 255);
+        }
+        if ((size_t)(in_end - ip) < literal_length || (size_t)(out_end - op) < literal_length) return 0;
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == in_end) break;    // Last sequence has no match
+
+        if (in_end - ip < 2) return 0;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out)) return 0;
+        size_t match_length = (token & 0x0F);
+        if (match_length == 15) {
+            uint8_t byte;
+            do {
+                if (ip >= in_end) return 0;
+                byte = *ip++;
+                match_length += byte;
+            } while (byte == 255);
+        }
+        match_length += MIN_MATCH;
+        if ((size_t)(out_end - op) < match_length) return 0;
+        // Byte by byte: the match may overlap what it is copying
+        const uint8_t* from = op - offset;
+        for (size_t i = 0; i < match_length; i++) op[i] = from[i];
+        op += match_length;
+    }
+    return op - out;
+}
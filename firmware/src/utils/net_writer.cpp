@@ -0,0 +1,11 @@
+#include "net_writer.h"
+#include <lwip/sockets.h>
+
+bool NetWriter::writable(int fd) {
+    if (fd < 0) return false;
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    struct timeval timeout = {0, 0};
+    return select(fd + 1, nullptr, &set, nullptr, &timeout) > 0 && FD_ISSET(fd, &set);
+}
@@ -0,0 +1,108 @@
+#include "perf_counters.h"
+#include "logger.h"
+#include <cstring>
+
+std::atomic<uint32_t> PerfCounters::_counters[COUNTER_COUNT];
+PerfCounters::StageData PerfCounters::_stages[STAGE_COUNT] = {};
+portMUX_TYPE PerfCounters::_lock = portMUX_INITIALIZER_UNLOCKED;
+uint32_t PerfCounters::_window_start = 0;
+
+void PerfCounters::record(Stage stage, uint32_t cycles) {
+    uint32_t us = cycles / PERF_CPU_MHZ;
+    uint8_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+
+    portENTER_CRITICAL(&_lock);
+    StageData& data = _stages[stage];
+    data.buckets[bucket]++;
+    data.count++;
+    data.total_us += us;
+    if (us > data.max_us) data.max_us = us;
+    portEXIT_CRITICAL(&_lock);
+}
+
+PerfCounters::Snapshot PerfCounters::takeSnapshot() {
+    Snapshot snapshot;
+    uint32_t now = millis();
+
+    snapshot.uptime_ms = now;
+    snapshot.window_ms = now - _window_start;
+    for (uint8_t i = 0; i < COUNTER_COUNT; i++) {
+        snapshot.counters[i] = _counters[i].load(std::memory_order_relaxed);
+    }
+
+    // Copied and cleared in one step so no record() falls between
+    StageData stages[STAGE_COUNT];
+    portENTER_CRITICAL(&_lock);
+    memcpy(stages, _stages, sizeof(_stages));
+    memset(_stages, 0, sizeof(_stages));
+    portEXIT_CRITICAL(&_lock);
+
+    for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+        const StageData& data = stages[i];
+        StageSummary& summary = snapshot.stages[i];
+        summary.count = data.count;
+        summary.avg_us = data.count ? (uint32_t)(data.total_us / data.count) : 0;
+        summary.p50_us = percentile(data, 50);
+        summary.p99_us = percentile(data, 99);
+        summary.max_us = data.max_us;
+    }
+
+    _window_start = now;
+    return snapshot;
+}
+
+void PerfCounters::logSnapshot(const Snapshot& snapshot) {
+    const uint32_t* c = snapshot.counters;
+    LOG_I("PERF", "frames rx=%lu dec=%lu log=%lu pub=%lu drop=%lu sup=%lu | sd_err=%lu mqtt_err=%lu",
+          c[FRAMES_RECEIVED], c[FRAMES_DECODED], c[FRAMES_LOGGED], c[FRAMES_PUBLISHED],
+          c[FRAMES_DROPPED], c[FRAMES_SUPPRESSED], c[SD_WRITE_ERRORS], c[MQTT_PUBLISH_ERRORS]);
+
+    for (uint8_t i = 0; i < STAGE_COUNT; i++) {
+        const StageSummary& s = snapshot.stages[i];
+        if (s.count == 0) continue;
+        LOG_I("PERF", "%-6s n=%lu avg=%luus p50<%luus p99<%luus max=%luus",
+              stageName((Stage)i), s.count, s.avg_us, s.p50_us, s.p99_us, s.max_us);
+    }
+}
+
+uint32_t PerfCounters::percentile(const StageData& data, uint8_t pct) {
+    if (data.count == 0) return 0;
+
+    uint32_t target = ((uint64_t)data.count * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += data.buckets[b];
+        if (seen >= target) {
+            // Upper bound of bucket b; the last bucket is open-ended
+            return (b == HISTOGRAM_BUCKETS - 1) ? data.max_us : (1UL << b);
+        }
+    }
+    return data.max_us;
+}
+
+const char* PerfCounters::counterName(Counter counter) {
+    switch (counter) {
+        case FRAMES_RECEIVED:     return "rx";
+        case FRAMES_DECODED:      return "decoded";
+        case FRAMES_LOGGED:       return "logged";
+        case FRAMES_PUBLISHED:    return "published";
+        case FRAMES_DROPPED:      return "dropped";
+        case FRAMES_SUPPRESSED:   return "suppressed";
+        case SD_WRITE_ERRORS:     return "sd_err";
+        case MQTT_PUBLISH_ERRORS: return "mqtt_err";
+        default:                  return "?";
+    }
+}
+
+const char* PerfCounters::stageName(Stage stage) {
+    switch (stage) {
+        case STAGE_LOOP:         return "loop";
+        case STAGE_CAN_READ:     return "can";
+        case STAGE_DECODE:       return "decode";
+        case STAGE_ANOMALY:      return "anomaly";
+        case STAGE_SD_WRITE:     return "sd";
+        case STAGE_MQTT_PUBLISH: return "mqtt";
+        default:                 return "?";
+    }
+}
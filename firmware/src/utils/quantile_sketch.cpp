@@ -0,0 +1,155 @@
+#include "quantile_sketch.h"
+#include <cstring>
+
+static size_t putVarint(uint8_t* out, size_t pos, size_t size, uint32_t value) {
+    do {
+        if (pos >= size) return 0;
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[pos++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return pos;
+}
+
+static bool getVarint(const uint8_t* in, size_t length, size_t& pos, uint32_t& value) {
+    value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (pos >= length) return false;
+        uint8_t byte = in[pos++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+QuantileSketch::QuantileSketch() {
+    clear();
+}
+
+void QuantileSketch::clear() {
+    memset(_counts, 0, sizeof(_counts));
+    _min = 0xFFFF;
+    _max = 0;
+}
+
+uint8_t QuantileSketch::bucketIndex(uint16_t value) {
+    const uint16_t linear = 1 << SUB_BUCKET_BITS;
+    if (value < linear) return value;
+
+    uint8_t msb = 15;
+    while (!(value & (1 << msb))) msb--;
+    uint8_t shift = msb - SUB_BUCKET_BITS;
+    uint8_t sub = (value >> shift) & (linear - 1);
+    return linear + shift * linear + sub;
+}
+
+uint16_t QuantileSketch::bucketLower(uint8_t index) {
+    const uint16_t linear = 1 << SUB_BUCKET_BITS;
+    if (index < linear) return index;
+
+    uint8_t shift = (index - linear) / linear;
+    uint8_t sub = (index - linear) % linear;
+    return (linear + sub) << shift;
+}
+
+uint16_t QuantileSketch::bucketUpper(uint8_t index) {
+    const uint16_t linear = 1 << SUB_BUCKET_BITS;
+    if (index < linear) return index;
+
+    uint8_t shift = (index - linear) / linear;
+    return bucketLower(index) + ((1 << shift) - 1);
+}
+
+void QuantileSketch::add(uint16_t value, uint32_t weight) {
+    if (weight == 0) return;
+    uint32_t& count = _counts[bucketIndex(value)];
+    count = (count > 0xFFFFFFFF - weight) ? 0xFFFFFFFF : count + weight;
+    if (value < _min) _min = value;
+    if (value > _max) _max = value;
+}
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+    for (uint16_t i = 0; i < BUCKET_COUNT; i++) {
+        uint32_t add = other._counts[i];
+        _counts[i] = (_counts[i] > 0xFFFFFFFF - add) ? 0xFFFFFFFF : _counts[i] + add;
+    }
+    if (other._min < _min) _min = other._min;
+    if (other._max > _max) _max = other._max;
+}
+
+uint64_t QuantileSketch::total() const {
+    uint64_t sum = 0;
+    for (uint16_t i = 0; i < BUCKET_COUNT; i++) sum += _counts[i];
+    return sum;
+}
+
+uint16_t QuantileSketch::quantile(float q) const {
+    uint64_t sum = total();
+    if (sum == 0) return 0;
+    if (q <= 0.0f) return _min;
+    if (q >= 1.0f) return _max;
+
+    uint64_t target = (uint64_t)(q * (double)sum);
+    uint64_t seen = 0;
+    for (uint16_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += _counts[i];
+        if (seen > target) {
+            // Bucket midpoint, clamped to the exact extremes
+            uint32_t mid = ((uint32_t)bucketLower(i) + bucketUpper(i) + 1) / 2;
+            if (mid < _min) mid = _min;
+            if (mid > _max) mid = _max;
+            return mid;
+        }
+    }
+    return _max;
+}
+
+uint64_t QuantileSketch::weightInRange(uint16_t low, uint16_t high) const {
+    uint64_t sum = 0;
+    for (uint16_t i = bucketIndex(low); i <= bucketIndex(high); i++) sum += _counts[i];
+    return sum;
+}
+
+size_t QuantileSketch::serialize(uint8_t* out, size_t size) const {
+    if (size < 1) return 0;
+    size_t pos = 0;
+    out[pos++] = SERIAL_VERSION;
+    if (!(pos = putVarint(out, pos, size, _min))) return 0;
+    if (!(pos = putVarint(out, pos, size, _max))) return 0;
+
+    uint16_t previous = 0;
+    for (uint16_t i = 0; i < BUCKET_COUNT; i++) {
+        if (_counts[i] == 0) continue;
+        if (!(pos = putVarint(out, pos, size, i - previous))) return 0;
+        if (!(pos = putVarint(out, pos, size, _counts[i]))) return 0;
+        previous = i;
+    }
+    return pos;
+}
+
+bool QuantileSketch::deserialize(const uint8_t* in, size_t length) {
+    clear();
+    if (length < 1 || in[0] != SERIAL_VERSION) return false;
+
+    size_t pos = 1;
+    uint32_t min_value, max_value;
+    if (!getVarint(in, length, pos, min_value) || !getVarint(in, length, pos, max_value)) return false;
+
+    uint32_t index = 0;
+    while (pos < length) {
+        uint32_t delta, count;
+        if (!getVarint(in, length, pos, delta) || !getVarint(in, length, pos, count)) {
+            clear();
+            return false;
+        }
+        index += delta;
+        if (index >= BUCKET_COUNT) {
+            clear();
+            return false;
+        }
+        _counts[index] = count;
+    }
+    _min = min_value;
+    _max = max_value;
+    return true;
+}
@@ -0,0 +1,54 @@
+#include "spi_arbiter.h"
+#include <esp_timer.h>
+#include <cstring>
+
+std::atomic<bool> SpiArbiter::_can_pending(false);
+std::atomic<bool> SpiArbiter::_sd_busy(false);
+volatile uint32_t SpiArbiter::_edge_us = 0;
+volatile bool SpiArbiter::_edge_during_sd = false;
+SpiArbiter::Stats SpiArbiter::_stats = {};
+
+void IRAM_ATTR SpiArbiter::onCanInterrupt() {
+    if (_can_pending.load(std::memory_order_relaxed)) return;
+    _edge_us = (uint32_t)esp_timer_get_time();
+    _edge_during_sd = _sd_busy.load(std::memory_order_relaxed);
+    _can_pending.store(true, std::memory_order_release);
+}
+
+void SpiArbiter::onCanServiced() {
+    if (!_can_pending.load(std::memory_order_acquire)) return;
+
+    uint32_t latency = (uint32_t)esp_timer_get_time() - _edge_us;
+    bool during_sd = _edge_during_sd;
+    _can_pending.store(false, std::memory_order_release);
+
+    _stats.can_services++;
+    if (latency > _stats.can_latency_max_us) _stats.can_latency_max_us = latency;
+    if (during_sd && latency > _stats.can_latency_sd_max_us) _stats.can_latency_sd_max_us = latency;
+}
+
+void SpiArbiter::yieldToCan() {
+    if (!canPending()) return;
+
+    // The RX task outranks SD writers, so this normally clears on the
+    // first yield; the bound covers an RX task stuck elsewhere
+    _stats.sd_yields++;
+    uint32_t start = micros();
+    while (canPending() && micros() - start < SPI_YIELD_MAX_US) {
+        taskYIELD();
+    }
+}
+
+void SpiArbiter::endSdWrite(uint32_t elapsed_us) {
+    _sd_busy.store(false, std::memory_order_relaxed);
+    _stats.sd_chunks++;
+    if (elapsed_us > _stats.sd_chunk_max_us) _stats.sd_chunk_max_us = elapsed_us;
+}
+
+SpiArbiter::Stats SpiArbiter::takeStats() {
+    Stats stats = _stats;
+    _stats.can_latency_max_us = 0;
+    _stats.can_latency_sd_max_us = 0;
+    _stats.sd_chunk_max_us = 0;
+    return stats;
+}
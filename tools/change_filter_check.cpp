@@ -0,0 +1,325 @@
+// Randomised check of the change-only filter (see change_filter.h): feeds
+// generated CAN traffic through ChangeFilter with sinks that fail writes and
+// lose whole MQTT batches, rebuilds each sink's stream the way the host
+// does, and compares it with the input.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Ifirmware/include -o change_filter_check
+//       tools/change_filter_check.cpp firmware/src/modules/change_filter.cpp
+//
+// Usage:
+//   change_filter_check [--seed N] [--rounds N] [--frames N] [--fail PCT]
+//
+// Each round (default 200 of 20000 frames) draws a new ID set, per-ID sink
+// modes set through setMode(), and payload change rates. The SD sink fails
+// --fail percent (default 25) of its writes; the MQTT sink also groups its
+// writes into batches of 8 and loses one batch in 20, as a failed
+// vehicle/data/batch publish does. Rebuilding inserts `suppressed` copies
+// of the ID's previous surviving record before each record. Checked:
+//   - every inserted copy stands for a real input frame with that payload,
+//     so the rebuilt stream is a subsequence of the input
+//   - for MODE_ON_CHANGE IDs, when every frame since the previous record was
+//     a repeat and the sink did not lose a batch meanwhile, no repeat is
+//     missing, written or not (MODE_ALL drops failed writes like any sink)
+//   - with --fail 0 and no batch loss the rebuilt stream is the input
+//   - MODE_ALL emits every frame, MODE_OFF none, and an unchanged ID is
+//     emitted at least every CHANGE_FILTER_HEARTBEAT_MS
+//   - CHANGE_FILTER_OVERRIDES applies, extended IDs never alias the 11-bit
+//     ID in their low bits, and IDs past CHANGE_FILTER_MAX_IDS pass through
+// Exits 1 on the first mismatch.
+
+#include "config.h"
+#include "types.h"
+#include "change_filter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const ChangeFilter::Sink SINKS[] = {ChangeFilter::SINK_SD, ChangeFilter::SINK_MQTT};
+const char* const SINK_NAMES[] = {"sd", "mqtt"};
+const size_t MQTT_BATCH = 8;
+const unsigned BATCH_LOSS_ONE_IN = 20;
+
+struct Record {
+    size_t input;          // Index into the round's frames
+    uint16_t suppressed;
+};
+
+struct SinkState {
+    std::map<uint32_t, std::vector<Record>> records;  // Surviving, per ID
+    std::vector<std::pair<uint32_t, Record>> batch;   // MQTT: not yet published
+    std::vector<size_t> losses;                       // Input index of each resync
+    std::map<uint32_t, uint32_t> last_written;        // Timestamp, per ID
+    uint32_t confirmed = 0;   // Including writes later lost with a batch
+};
+
+bool fail(const char* what, unsigned round, const std::string& detail) {
+    fprintf(stderr, "FAIL round %u: %s: %s\n", round, what, detail.c_str());
+    return false;
+}
+
+std::string describe(const char* sink, uint32_t id, size_t input) {
+    char text[64];
+    snprintf(text, sizeof(text), "%s id 0x%X frame %zu", sink, id, input);
+    return text;
+}
+
+bool checkConfig() {
+    std::unique_ptr<ChangeFilter> filter(new ChangeFilter());
+    filter->init();
+
+    struct Range { uint16_t first_id; uint16_t last_id; uint8_t sd_mode; uint8_t mqtt_mode; };
+    const Range overrides[] = CHANGE_FILTER_OVERRIDES;
+    for (const Range& o : overrides) {
+        for (uint32_t id = o.first_id; id <= o.last_id && id <= MAX_CAN_ID; id++) {
+            if (filter->getMode(ChangeFilter::SINK_SD, id) != o.sd_mode ||
+                filter->getMode(ChangeFilter::SINK_MQTT, id) != o.mqtt_mode) {
+                return fail("override", 0, describe("sd/mqtt", id, 0));
+            }
+        }
+    }
+
+    // 0x10000123 must not pick up what was set for 0x123
+    filter->setMode(ChangeFilter::SINK_SD, 0x123, ChangeFilter::MODE_OFF);
+    if (filter->setMode(ChangeFilter::SINK_SD, 0x10000123, ChangeFilter::MODE_OFF)) {
+        return fail("extended setMode accepted", 0, describe("sd", 0x10000123, 0));
+    }
+    ChangeFilter::Mode extended = filter->getMode(ChangeFilter::SINK_SD, 0x10000123);
+    ChangeFilter::Mode expected = CHANGE_FILTER_SD_DEFAULT == ChangeFilter::MODE_OFF
+                                      ? ChangeFilter::MODE_OFF : ChangeFilter::MODE_ALL;
+    if (extended != expected) return fail("extended getMode", 0, describe("sd", 0x10000123, 0));
+
+    CanFrame frame = {};
+    frame.id = 0x10000123;
+    frame.dlc = 8;
+    ChangeFilter::Result result;
+    filter->process(frame, result);
+    if (result.emit[ChangeFilter::SINK_SD] != (expected != ChangeFilter::MODE_OFF)) {
+        return fail("extended frame filtered", 0, describe("sd", frame.id, 0));
+    }
+    return true;
+}
+
+bool runRound(unsigned round, std::mt19937& rng, size_t frame_count, unsigned fail_pct, bool lose_batches) {
+    auto chance = [&rng](unsigned pct) { return rng() % 100 < pct; };
+
+    std::unique_ptr<ChangeFilter> filter(new ChangeFilter());
+    filter->init();
+
+    // IDs, each with its own payload change rate and a small payload pool
+    // so payloads also change back to an earlier value
+    std::vector<uint32_t> ids;
+    std::map<uint32_t, unsigned> change_pct;
+    // Every eighth round has more IDs than the filter has entries
+    size_t id_count = round % 8 == 1 ? CHANGE_FILTER_MAX_IDS + 64 : 4 + rng() % 60;
+    while (ids.size() < id_count) {
+        uint32_t id = chance(5) ? 0x18000000 | (rng() & 0xFFFFF) : rng() % (MAX_CAN_ID + 1);
+        if (change_pct.count(id)) continue;
+        ids.push_back(id);
+        change_pct[id] = rng() % 60;
+        for (ChangeFilter::Sink sink : SINKS) {
+            unsigned pick = rng() % 10;
+            if (pick < 2) filter->setMode(sink, id, ChangeFilter::MODE_ALL);
+            else if (pick < 3) filter->setMode(sink, id, ChangeFilter::MODE_OFF);
+            else filter->setMode(sink, id, ChangeFilter::MODE_ON_CHANGE);
+        }
+    }
+
+    std::vector<CanFrame> frames;
+    std::map<uint32_t, CanFrame> current;
+    uint32_t now = rng() % 100000;
+    SinkState sinks[ChangeFilter::SINK_COUNT];
+
+    for (size_t i = 0; i < frame_count; i++) {
+        uint32_t id = ids[rng() % ids.size()];
+        now += rng() % 4;
+        CanFrame frame = {};
+        auto it = current.find(id);
+        if (it == current.end() || chance(change_pct[id])) {
+            frame.id = id;
+            frame.dlc = chance(90) ? 8 : rng() % 9;
+            for (uint8_t b = 0; b < 8; b++) frame.data[b] = rng() % 3;
+        } else {
+            frame = it->second;
+        }
+        frame.timestamp = now;
+        current[id] = frame;
+        frames.push_back(frame);
+
+        SinkState& mqtt = sinks[ChangeFilter::SINK_MQTT];
+        if (lose_batches && mqtt.batch.size() == MQTT_BATCH) {
+            if (rng() % BATCH_LOSS_ONE_IN == 0) {
+                filter->resync(ChangeFilter::SINK_MQTT);
+                mqtt.losses.push_back(i);
+            } else {
+                for (auto& entry : mqtt.batch) mqtt.records[entry.first].push_back(entry.second);
+            }
+            mqtt.batch.clear();
+        }
+
+        ChangeFilter::Result result;
+        filter->process(frame, result);
+
+        for (ChangeFilter::Sink sink : SINKS) {
+            SinkState& state = sinks[sink];
+            ChangeFilter::Mode mode = filter->getMode(sink, id);
+            if (mode == ChangeFilter::MODE_ALL && !result.emit[sink]) {
+                return fail("MODE_ALL frame not emitted", round, describe(SINK_NAMES[sink], id, i));
+            }
+            if (mode == ChangeFilter::MODE_OFF && result.emit[sink]) {
+                return fail("MODE_OFF frame emitted", round, describe(SINK_NAMES[sink], id, i));
+            }
+            auto last = state.last_written.find(id);
+            if (mode == ChangeFilter::MODE_ON_CHANGE && !result.emit[sink] && last != state.last_written.end() &&
+                frame.timestamp - last->second >= CHANGE_FILTER_HEARTBEAT_MS) {
+                return fail("heartbeat missed", round, describe(SINK_NAMES[sink], id, i));
+            }
+            if (!result.emit[sink]) continue;
+
+            bool written = !chance(fail_pct);
+            filter->confirm(sink, frame, written);
+            if (!written) continue;
+            state.confirmed++;
+            state.last_written[id] = frame.timestamp;
+            Record record = {i, result.suppressed[sink]};
+            if (sink == ChangeFilter::SINK_MQTT && lose_batches) state.batch.push_back({id, record});
+            else state.records[id].push_back(record);
+        }
+    }
+    if (id_count > CHANGE_FILTER_MAX_IDS && filter->getStats().overflow == 0) {
+        return fail("no IDs passed through with every entry taken", round, "");
+    }
+
+    SinkState& mqtt = sinks[ChangeFilter::SINK_MQTT];
+    for (auto& entry : mqtt.batch) mqtt.records[entry.first].push_back(entry.second);
+    mqtt.batch.clear();
+
+    for (ChangeFilter::Sink sink : SINKS) {
+        SinkState& state = sinks[sink];
+        if (filter->getStats().emitted[sink] != state.confirmed) {
+            return fail("emitted count", round, SINK_NAMES[sink]);
+        }
+
+        size_t rebuilt = 0;
+        for (auto& per_id : state.records) {
+            uint32_t id = per_id.first;
+            std::vector<size_t> positions;  // Input frames of this ID, in order
+            for (size_t i = 0; i < frames.size(); i++) {
+                if (frames[i].id == id) positions.push_back(i);
+            }
+            bool on_change = filter->getMode(sink, id) == ChangeFilter::MODE_ON_CHANGE;
+            const std::vector<Record>& records = per_id.second;
+            const CanFrame* previous = nullptr;
+            size_t previous_input = 0;
+            size_t p = 0;
+            for (const Record& record : records) {
+                const CanFrame& frame = frames[record.input];
+                if (!previous) {
+                    if (record.suppressed != 0) {
+                        return fail("repeats with nothing to repeat", round,
+                                    describe(SINK_NAMES[sink], id, record.input));
+                    }
+                } else {
+                    // Frames of this ID strictly between the two records
+                    size_t repeats = 0;
+                    bool all_repeats = true;
+                    while (p < positions.size() && positions[p] < record.input) {
+                        if (positions[p] > previous_input) {
+                            const CanFrame& between = frames[positions[p]];
+                            bool same = between.dlc == previous->dlc &&
+                                        memcmp(between.data, previous->data, previous->dlc > 8 ? 8 : previous->dlc) == 0;
+                            if (same) repeats++;
+                            else all_repeats = false;
+                        }
+                        p++;
+                    }
+                    if (record.suppressed > repeats) {
+                        return fail("more repeats than the input had", round,
+                                    describe(SINK_NAMES[sink], id, record.input));
+                    }
+                    bool lost = false;
+                    for (size_t loss : state.losses) {
+                        if (loss > previous_input && loss <= record.input) lost = true;
+                    }
+                    if (on_change && all_repeats && !lost && record.suppressed != repeats) {
+                        return fail("repeats missing", round, describe(SINK_NAMES[sink], id, record.input));
+                    }
+                }
+                rebuilt += 1 + record.suppressed;
+                previous = &frame;
+                previous_input = record.input;
+            }
+        }
+
+        if (fail_pct == 0 && state.losses.empty()) {
+            // Everything up to each ID's last record must come back; later
+            // repeats are still pending in the filter
+            size_t expected = 0;
+            for (auto& per_id : state.records) {
+                ChangeFilter::Mode mode = filter->getMode(sink, per_id.first);
+                if (mode == ChangeFilter::MODE_OFF) continue;
+                size_t last = per_id.second.back().input;
+                for (size_t i = 0; i <= last; i++) {
+                    if (frames[i].id == per_id.first) expected++;
+                }
+            }
+            if (rebuilt != expected) {
+                char detail[96];
+                snprintf(detail, sizeof(detail), "%s rebuilt %zu of %zu frames", SINK_NAMES[sink], rebuilt, expected);
+                return fail("lossless run lost frames", round, detail);
+            }
+        }
+    }
+    return true;
+}
+
+void usage() {
+    fprintf(stderr, "usage: change_filter_check [--seed N] [--rounds N] [--frames N] [--fail PCT]\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    unsigned seed = 1;
+    unsigned rounds = 200;
+    size_t frames = 20000;
+    unsigned fail_pct = 25;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--rounds" && i + 1 < argc) {
+            rounds = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frames = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--fail" && i + 1 < argc) {
+            fail_pct = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (!checkConfig()) return 1;
+
+    std::mt19937 rng(seed);
+    for (unsigned round = 1; round <= rounds; round++) {
+        // Every fourth round runs without failures to check the lossless case
+        bool clean = round % 4 == 0;
+        if (!runRound(round, rng, frames, clean ? 0 : fail_pct, !clean)) return 1;
+    }
+    printf("change filter: %u rounds of %zu frames, %u%% failed writes: ok\n", rounds, frames, fail_pct);
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Check of the integer decimal and coordinate parsing (see fixed_point.h)
+// against exact integer arithmetic.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Ifirmware/include -o fixed_point_check
+//       tools/fixed_point_check.cpp firmware/src/utils/fixed_point.cpp
+//
+// Usage:
+//   fixed_point_check [--seed N] [--samples N]
+//
+// Checked:
+//   - parseNmeaCoordinate on every ddmm.mmmmm minute value (five decimals,
+//     as receivers send) and on --samples (default 2000000) random inputs
+//     with six to nine minute decimals, in every hemisphere: the error
+//     against the exact value stays within COORDINATE_BOUND_UDEG
+//   - parseDecimal rounds half away from zero at the last kept digit, for
+//     0-6 kept decimals and up to three extra digits
+//   - formatMicrodegrees output parses back to the same microdegrees
+// Prints the worst coordinate error and the input that produced it. Exits
+// 1 on the first failure.
+
+#include "fixed_point.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+namespace {
+
+const double COORDINATE_BOUND_UDEG = 0.6;   // As documented in fixed_point.h
+const char* const HEMISPHERES[] = {"N", "S", "E", "W"};
+
+const uint64_t POW10[] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+                          10000000ULL, 100000000ULL, 1000000000ULL};
+
+struct Worst {
+    double error = 0;
+    std::string input;
+};
+
+// minutes is the ddmm.m... minute value in units of 10^-decimals
+bool checkCoordinate(uint32_t degrees, uint64_t minutes, uint8_t decimals, const char* hemisphere,
+                     Worst& worst) {
+    char text[64];
+    snprintf(text, sizeof(text), "%u%02llu.%0*llu", degrees, (unsigned long long)(minutes / POW10[decimals]),
+             (int)decimals, (unsigned long long)(minutes % POW10[decimals]));
+    int32_t value = FixedPoint::parseNmeaCoordinate(text, hemisphere);
+
+    bool negative = hemisphere[0] == 'S' || hemisphere[0] == 'W';
+    if (value != 0 && (value < 0) != negative) {
+        fprintf(stderr, "FAIL coordinate %s %s: sign of %d\n", text, hemisphere, value);
+        return false;
+    }
+    // Exact microdegrees past the whole degrees are minutes * 1e6 / 60 /
+    // 10^decimals; compare scaled by 60 * 10^decimals to stay in integers
+    int64_t fraction = (int64_t)(negative ? -(int64_t)value : value) - (int64_t)degrees * 1000000;
+    int64_t scale = 60 * (int64_t)POW10[decimals];
+    int64_t diff = fraction * scale - (int64_t)minutes * 1000000;
+    double error = (double)(diff < 0 ? -diff : diff) / (double)scale;
+    if (error > worst.error) {
+        worst.error = error;
+        worst.input = std::string(text) + " " + hemisphere;
+    }
+    if (error > COORDINATE_BOUND_UDEG) {
+        fprintf(stderr, "FAIL coordinate %s %s: %d is %.3f microdegrees off\n", text, hemisphere, value, error);
+        return false;
+    }
+    return true;
+}
+
+bool checkCoordinates(std::mt19937_64& rng, uint64_t samples) {
+    Worst worst;
+    uint64_t inputs = 0;
+
+    // The error depends only on the minutes, so one degree value covers
+    // every five-decimal input
+    for (uint64_t minutes = 0; minutes < 60 * POW10[5]; minutes++, inputs++) {
+        if (!checkCoordinate(48, minutes, 5, "N", worst)) return false;
+    }
+
+    std::uniform_int_distribution<uint32_t> degrees(0, 179);
+    std::uniform_int_distribution<uint32_t> decimals(6, 9);
+    for (uint64_t i = 0; i < samples; i++, inputs++) {
+        uint8_t kept = (uint8_t)decimals(rng);
+        uint64_t minutes = rng() % (60 * POW10[kept]);
+        if (!checkCoordinate(degrees(rng), minutes, kept, HEMISPHERES[i % 4], worst)) return false;
+    }
+
+    printf("parseNmeaCoordinate: %llu inputs, worst %.3f microdegrees at %s (bound %.1f): ok\n",
+           (unsigned long long)inputs, worst.error, worst.input.c_str(), COORDINATE_BOUND_UDEG);
+    return true;
+}
+
+bool checkDecimals(std::mt19937_64& rng, uint64_t samples) {
+    for (uint64_t i = 0; i < samples; i++) {
+        uint8_t kept = (uint8_t)(rng() % 7);
+        uint8_t extra = (uint8_t)(rng() % 4);
+        uint8_t digits = kept + extra;
+        // Keep the scaled result within 32 bits
+        uint64_t magnitude = rng() % (2000ULL * POW10[digits]);
+        bool negative = rng() & 1;
+
+        char text[64];
+        if (digits) {
+            snprintf(text, sizeof(text), "%s%llu.%0*llu", negative ? "-" : "",
+                     (unsigned long long)(magnitude / POW10[digits]), (int)digits,
+                     (unsigned long long)(magnitude % POW10[digits]));
+        } else {
+            snprintf(text, sizeof(text), "%s%llu", negative ? "-" : "", (unsigned long long)magnitude);
+        }
+
+        int64_t expected = (int64_t)((magnitude + POW10[extra] / 2) / POW10[extra]);
+        if (negative) expected = -expected;
+        int32_t value = FixedPoint::parseDecimal(text, kept);
+        if (value != expected) {
+            fprintf(stderr, "FAIL parseDecimal(\"%s\", %u) = %d, expected %lld\n", text, kept, value,
+                    (long long)expected);
+            return false;
+        }
+    }
+    printf("parseDecimal: %llu inputs: ok\n", (unsigned long long)samples);
+    return true;
+}
+
+bool checkFormat(std::mt19937_64& rng, uint64_t samples) {
+    std::uniform_int_distribution<int32_t> microdegrees(-180 * FixedPoint::MICRODEGREES_PER_DEGREE,
+                                                        180 * FixedPoint::MICRODEGREES_PER_DEGREE);
+    for (uint64_t i = 0; i < samples; i++) {
+        int32_t value = i < 3 ? (int32_t)i - 1 : microdegrees(rng);
+        char text[24];
+        size_t length = FixedPoint::formatMicrodegrees(value, text, sizeof(text));
+        int32_t parsed = FixedPoint::parseDecimal(text, 6);
+        if (length != strlen(text) || parsed != value) {
+            fprintf(stderr, "FAIL formatMicrodegrees(%d) = \"%s\", parses back as %d\n", value, text, parsed);
+            return false;
+        }
+    }
+    printf("formatMicrodegrees: %llu round trips: ok\n", (unsigned long long)samples);
+    return true;
+}
+
+void usage() {
+    fprintf(stderr, "usage: fixed_point_check [--seed N] [--samples N]\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    unsigned seed = 1;
+    uint64_t samples = 2000000;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--samples" && i + 1 < argc) {
+            samples = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    std::mt19937_64 rng(seed);
+    if (!checkCoordinates(rng, samples)) return 1;
+    if (!checkDecimals(rng, samples)) return 1;
+    if (!checkFormat(rng, samples)) return 1;
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Randomised check of the journal time lookup (see journal_index.h): runs
+// JournalIndex::findTime over generated index.bin layouts and compares the
+// segment it picks with a linear scan.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Ifirmware/include -o journal_index_check
+//       tools/journal_index_check.cpp firmware/src/utils/journal_index.cpp
+//
+// Usage:
+//   journal_index_check [--seed N] [--layouts N] [--entries N]
+//
+// Each layout (default 200000) holds up to --entries (default 64) segment
+// summaries in segment order, with gaps in segment_seq. As on the card,
+// summaries closed before the clock synced have last_utc_ms 0 and sit
+// between synced ones, whose ranges only grow; some entries fail their CRC,
+// and first_seq marks the oldest segment not yet deleted. Each layout is
+// queried from 0, before, inside, at and past the synced ranges. The
+// expected answer is the first intact summary from first_seq on whose
+// range reaches the target, any summary for a query from 0. Reports the
+// mean entries read per query against the scan. Exits 1 on the first
+// mismatch.
+
+#include "config.h"
+#include "types.h"
+#include "journal_index.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Layout {
+    std::vector<JournalIndexEntry> entries;
+    std::vector<bool> corrupt;
+    uint64_t reads = 0;
+};
+
+bool readEntry(void* context, uint32_t position, JournalIndexEntry& entry) {
+    Layout* layout = (Layout*)context;
+    layout->reads++;
+    if (position >= layout->entries.size() || layout->corrupt[position]) return false;
+    entry = layout->entries[position];
+    return true;
+}
+
+// Reference: the first entry that qualifies, in position order
+bool scan(const Layout& layout, uint32_t first_seq, uint64_t utc_ms, JournalIndexEntry& entry) {
+    for (size_t i = 0; i < layout.entries.size(); i++) {
+        const JournalIndexEntry& candidate = layout.entries[i];
+        if (layout.corrupt[i] || candidate.segment_seq < first_seq) continue;
+        if (utc_ms && (!candidate.last_utc_ms || candidate.last_utc_ms < utc_ms)) continue;
+        entry = candidate;
+        return true;
+    }
+    return false;
+}
+
+Layout generate(std::mt19937& rng, uint32_t max_entries) {
+    Layout layout;
+    uint32_t count = rng() % (max_entries + 1);
+    // Per layout, so some are mostly unsynced or mostly corrupt
+    uint32_t unsynced_pct = rng() % 101;
+    uint32_t corrupt_pct = rng() % 4 ? rng() % 30 : 0;
+
+    uint32_t seq = 1 + rng() % 100;
+    uint64_t utc = 1700000000000ULL + rng() % 1000000;
+    for (uint32_t i = 0; i < count; i++) {
+        JournalIndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.segment_seq = seq;
+        seq += 1 + (rng() % 8 == 0 ? rng() % 5 : 0);
+        if (rng() % 100 >= unsynced_pct) {
+            // Boundaries repeat now and then: a segment can close in the
+            // millisecond the next one opens
+            utc += rng() % 4 ? 1 + rng() % 600000 : 0;
+            entry.first_utc_ms = utc;
+            utc += rng() % 600000;
+            entry.last_utc_ms = utc;
+        }
+        layout.entries.push_back(entry);
+        layout.corrupt.push_back(rng() % 100 < corrupt_pct);
+    }
+    return layout;
+}
+
+std::vector<uint64_t> targets(std::mt19937& rng, const Layout& layout) {
+    std::vector<uint64_t> out = {0, 1};
+    for (const JournalIndexEntry& entry : layout.entries) {
+        if (!entry.last_utc_ms) continue;
+        out.push_back(entry.first_utc_ms);
+        out.push_back(entry.last_utc_ms);
+        out.push_back(entry.last_utc_ms + 1);
+        if (entry.last_utc_ms > entry.first_utc_ms) {
+            out.push_back(entry.first_utc_ms + rng() % (entry.last_utc_ms - entry.first_utc_ms));
+        }
+    }
+    out.push_back(UINT64_MAX);
+    return out;
+}
+
+std::string describe(const Layout& layout, uint32_t first_seq, uint64_t utc_ms) {
+    std::string text;
+    char item[64];
+    snprintf(item, sizeof(item), "first_seq %u, utc %llu, entries", first_seq, (unsigned long long)utc_ms);
+    text = item;
+    for (size_t i = 0; i < layout.entries.size(); i++) {
+        snprintf(item, sizeof(item), " [%u %llu%s]", layout.entries[i].segment_seq,
+                 (unsigned long long)layout.entries[i].last_utc_ms, layout.corrupt[i] ? " bad" : "");
+        text += item;
+    }
+    return text;
+}
+
+void usage() {
+    fprintf(stderr, "usage: journal_index_check [--seed N] [--layouts N] [--entries N]\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    unsigned seed = 1;
+    unsigned layouts = 200000;
+    uint32_t max_entries = 64;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--layouts" && i + 1 < argc) {
+            layouts = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--entries" && i + 1 < argc) {
+            max_entries = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    std::mt19937 rng(seed);
+    uint64_t queries = 0;
+    uint64_t scanned = 0;
+    uint64_t reads = 0;
+    for (unsigned n = 1; n <= layouts; n++) {
+        Layout layout = generate(rng, max_entries);
+        uint32_t count = (uint32_t)layout.entries.size();
+        uint32_t oldest = count ? layout.entries.front().segment_seq : 1;
+        uint32_t newest = count ? layout.entries.back().segment_seq : 1;
+        uint32_t first_seq = rng() % 2 ? oldest : oldest + rng() % (newest - oldest + 2);
+
+        for (uint64_t utc_ms : targets(rng, layout)) {
+            JournalIndexEntry expected = {};
+            JournalIndexEntry found = {};
+            bool want = scan(layout, first_seq, utc_ms, expected);
+            layout.reads = 0;
+            bool got = JournalIndex::findTime(readEntry, &layout, count, first_seq, utc_ms, found);
+            if (want != got || (want && expected.segment_seq != found.segment_seq)) {
+                fprintf(stderr, "FAIL layout %u: expected %s %u, got %s %u; %s\n", n, want ? "segment" : "none",
+                        want ? expected.segment_seq : 0, got ? "segment" : "none", got ? found.segment_seq : 0,
+                        describe(layout, first_seq, utc_ms).c_str());
+                return 1;
+            }
+            queries++;
+            scanned += count;
+            reads += layout.reads;
+        }
+    }
+    printf("journal index: %u layouts, %llu queries, %.1f reads per query (scan %.1f): ok\n", layouts,
+           (unsigned long long)queries, queries ? (double)reads / queries : 0.0,
+           queries ? (double)scanned / queries : 0.0);
+    return 0;
+}
@@ -0,0 +1,636 @@
+// Decodes, validates, indexes and exports the CAN/GPS/anomaly journal the
+// logger writes to /journal on the SD card (block layout in types.h).
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -pthread -Ifirmware/include -o journal_tool tools/journal_tool.cpp
+//       firmware/src/utils/crc32.cpp
+//
+// Usage:
+//   journal_tool [--threads N] [--from MS] [--to MS] [--id ID]... [--csv PREFIX]
+//                [--columns DIR] [--json FILE --device ID [--batch N]] [--index FILE] PATH...
+//
+// PATH is a journal directory or seg_NNNNNNNN.bin files. Segments are
+// memory-mapped and decoded on --threads workers (default: every core),
+// one segment per task; output stays in segment order.
+//   --from/--to  UTC ms range (device uptime for records from before the clock synced)
+//   --id         CAN ID, hex with 0x or decimal; repeatable. Applies to frames only.
+//   --csv        PREFIX_can.csv, PREFIX_gps.csv, PREFIX_anomaly.csv, in the
+//                column order of the CSV logs the journal replaced
+//   --columns    CAN frames as one little-endian array per column in DIR
+//                (numpy.fromfile), described by DIR/schema.json
+//   --json       one JSON array of up to --batch (default 1000) CANLog
+//                documents per line, ready for CANLog.insertMany()
+//   --index      per-ID and per-segment summaries plus a time index with
+//                one entry per JOURNAL_TIME_INDEX_STRIDE data blocks, as JSON
+// Block validation counts and decode throughput (frames/s per thread and
+// overall) go to stderr.
+
+#include "config.h"
+#include "types.h"
+#include "crc32.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Segment {
+    std::string path;
+    uint32_t seq = 0;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+struct Options {
+    unsigned threads = 0;
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    std::set<uint32_t> ids;
+    std::string csv;
+    std::string columns;
+    std::string json;
+    std::string device;
+    size_t batch = 1000;
+    std::string index;
+};
+
+struct BlockCounts {
+    uint64_t data = 0;
+    uint64_t trailer = 0;     // Segment header and index blocks
+    uint64_t corrupt = 0;     // Bad magic or CRC before the last good block: a torn write
+    uint64_t stale = 0;       // Left over from an earlier file
+    uint64_t empty = 0;       // Past the last good block: preallocated, never written
+
+    void add(const BlockCounts& other) {
+        data += other.data;
+        trailer += other.trailer;
+        corrupt += other.corrupt;
+        stale += other.stale;
+        empty += other.empty;
+    }
+};
+
+struct IdStats {
+    uint64_t frames = 0;
+    uint64_t first_time = 0;
+    uint64_t last_time = 0;
+    uint32_t first_segment = 0;
+    uint32_t last_segment = 0;
+};
+
+struct TimePoint {
+    uint64_t time;
+    uint32_t segment;
+    uint16_t block;
+};
+
+// Everything decoded from one segment; filled by a worker, written out in
+// segment order by the main thread
+struct Result {
+    BlockCounts counts;
+    uint64_t frames = 0;       // Selected by the filters
+    uint64_t can_records = 0;  // Decoded, before filtering
+    uint64_t records = 0;
+    uint64_t first_time = 0;
+    uint64_t last_time = 0;
+    std::string can_csv;
+    std::string gps_csv;
+    std::string anomaly_csv;
+    std::string json;
+    size_t json_docs = 0;
+
+    // Columnar output
+    std::vector<uint32_t> timestamp;
+    std::vector<uint64_t> utc_ms;
+    std::vector<uint32_t> can_id;
+    std::vector<uint8_t> channel;
+    std::vector<uint8_t> dlc;
+    std::vector<uint8_t> data;
+    std::vector<uint16_t> suppressed;
+
+    std::map<uint32_t, IdStats> ids;
+    std::vector<TimePoint> time_index;
+};
+
+struct ThreadStats {
+    uint64_t frames = 0;
+    uint64_t busy_ns = 0;
+};
+
+// Same test as LogJournal::validateBlock on the device
+static bool blockCrcOk(const uint8_t* block) {
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    static const uint8_t zero[4] = {0};
+    const size_t crc_at = offsetof(JournalBlockHeader, crc);
+    const size_t after = crc_at + sizeof(header->crc);
+    uint32_t crc = Crc32::update(0, block, crc_at);
+    crc = Crc32::update(crc, zero, sizeof(zero));
+    crc = Crc32::update(crc, block + after, JOURNAL_BLOCK_SIZE - after);
+    return crc == header->crc;
+}
+
+static bool blockValid(const uint8_t* block, uint32_t seq, uint32_t index, BlockCounts& counts) {
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    // Preallocation does not clear the clusters, so a bad magic is only
+    // known to be unwritten once the segment has been scanned; Decoder moves
+    // the ones past the last good block to empty
+    if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION) {
+        counts.corrupt++;
+        return false;
+    }
+    if (header->segment_seq != seq || header->block_index != index) {
+        counts.stale++;
+        return false;
+    }
+    if (header->payload_length > JOURNAL_PAYLOAD_SIZE || !blockCrcOk(block)) {
+        counts.corrupt++;
+        return false;
+    }
+    return true;
+}
+
+static void appendf(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string& out, const char* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > 0) out.append(buffer, std::min<size_t>(length, sizeof(buffer) - 1));
+}
+
+static void jsonEscape(std::string& out, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            appendf(out, "\\u%04x", c);
+        } else {
+            out += c;
+        }
+    }
+}
+
+class Decoder {
+public:
+    explicit Decoder(const Options& options) : _opt(options) {}
+
+    void decode(const Segment& segment, Result& result) {
+        uint32_t blocks = segment.size / JOURNAL_BLOCK_SIZE;
+        uint32_t data_blocks = 0;
+        uint64_t unreached = 0;   // Bad-magic blocks since the last good one
+        for (uint32_t i = 0; i < blocks; i++) {
+            const uint8_t* block = segment.data + (size_t)i * JOURNAL_BLOCK_SIZE;
+            const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+            if (!blockValid(block, segment.seq, i, result.counts)) {
+                if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION) unreached++;
+                continue;
+            }
+            unreached = 0;
+
+            if (header->kind != JOURNAL_BLOCK_DATA) {
+                result.counts.trailer++;
+                continue;
+            }
+            result.counts.data++;
+
+            uint64_t block_time = header->first_utc_ms ? header->first_utc_ms : header->first_timestamp;
+            if (data_blocks++ % JOURNAL_TIME_INDEX_STRIDE == 0) {
+                result.time_index.push_back({block_time, segment.seq, (uint16_t)i});
+            }
+            decodeBlock(block, segment.seq, result);
+        }
+        result.counts.corrupt -= unreached;
+        result.counts.empty += unreached;
+        if (!_opt.json.empty()) closeBatch(result);
+    }
+
+private:
+    const Options& _opt;
+    size_t _in_batch = 0;
+
+    void decodeBlock(const uint8_t* block, uint32_t seq, Result& result) {
+        const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+        size_t offset = sizeof(JournalBlockHeader);
+        size_t end = offset + header->payload_length;
+        while (offset + sizeof(JournalRecordHeader) <= end) {
+            const JournalRecordHeader* rec = (const JournalRecordHeader*)(block + offset);
+            offset += sizeof(JournalRecordHeader);
+            if (offset + rec->length > end) break;
+            const uint8_t* payload = block + offset;
+            offset += rec->length;
+            result.records++;
+            if (rec->type == JOURNAL_REC_CAN) result.can_records++;
+
+            // Block UTC is taken at its first record; later ones are offset by uptime
+            uint32_t timestamp;
+            memcpy(&timestamp, payload, sizeof(timestamp));
+            uint64_t utc = header->first_utc_ms ? header->first_utc_ms + (int32_t)(timestamp - header->first_timestamp) : 0;
+            uint64_t time = utc ? utc : timestamp;
+            if (time < _opt.from || time > _opt.to) continue;
+
+            if (rec->type == JOURNAL_REC_CAN && rec->length >= sizeof(JournalCanRecord)) {
+                decodeCan(payload, rec->length, utc, time, seq, result);
+            } else if (rec->type == JOURNAL_REC_GPS && rec->length >= sizeof(JournalGpsRecord)) {
+                decodeGps(payload, result);
+            } else if (rec->type == JOURNAL_REC_ANOMALY && rec->length >= sizeof(JournalAnomalyRecord)) {
+                decodeAnomaly(payload, rec->length, utc, result);
+            }
+        }
+    }
+
+    void decodeCan(const uint8_t* payload, uint8_t length, uint64_t utc, uint64_t time, uint32_t seq,
+                   Result& result) {
+        JournalCanRecord can;
+        memcpy(&can, payload, sizeof(can));
+        uint8_t dlc = std::min<uint8_t>(can.dlc, 8);
+        if (sizeof(JournalCanRecord) + dlc > length) return;
+        if (!_opt.ids.empty() && !_opt.ids.count(can.id)) return;
+
+        uint8_t data[8] = {0};
+        memcpy(data, payload + sizeof(JournalCanRecord), dlc);
+        result.frames++;
+
+        if (!result.first_time || time < result.first_time) result.first_time = time;
+        if (time > result.last_time) result.last_time = time;
+
+        if (!_opt.index.empty()) {
+            IdStats& stats = result.ids[can.id];
+            if (!stats.frames) {
+                stats.first_time = time;
+                stats.first_segment = seq;
+            }
+            stats.frames++;
+            stats.last_time = time;
+            stats.last_segment = seq;
+        }
+
+        if (!_opt.csv.empty()) {
+            appendf(result.can_csv, "%u,%03X,%u", can.timestamp, can.id, dlc);
+            for (int i = 0; i < 8; i++) appendf(result.can_csv, ",%02X", data[i]);
+            appendf(result.can_csv, ",%llu,%u,%u\n", (unsigned long long)utc, can.suppressed, can.channel);
+        }
+
+        if (!_opt.columns.empty()) {
+            result.timestamp.push_back(can.timestamp);
+            result.utc_ms.push_back(utc);
+            result.can_id.push_back(can.id);
+            result.channel.push_back(can.channel);
+            result.dlc.push_back(dlc);
+            result.data.insert(result.data.end(), data, data + 8);
+            result.suppressed.push_back(can.suppressed);
+        }
+
+        if (!_opt.json.empty()) {
+            result.json += _in_batch ? "," : "[";
+            appendf(result.json, "{\"timestamp\":%llu,\"canId\":\"0x%x\",\"dlc\":%u,\"data\":[",
+                    (unsigned long long)time, can.id, dlc);
+            for (uint8_t i = 0; i < dlc; i++) appendf(result.json, i ? ",%u" : "%u", data[i]);
+            appendf(result.json, "],\"channel\":%u,\"suppressed\":%u,\"deviceId\":\"", can.channel, can.suppressed);
+            jsonEscape(result.json, _opt.device.data(), _opt.device.size());
+            result.json += "\"}";
+            result.json_docs++;
+            if (++_in_batch == _opt.batch) closeBatch(result);
+        }
+    }
+
+    void decodeGps(const uint8_t* payload, Result& result) {
+        if (_opt.csv.empty()) return;
+        JournalGpsRecord gps;
+        memcpy(&gps, payload, sizeof(gps));
+        appendf(result.gps_csv, "%u,%.6f,%.6f,%.2f,%.2f,%u,%u,%llu\n", gps.timestamp, gps.latitude,
+                gps.longitude, gps.altitude, gps.speed, gps.fix_quality, gps.satellites,
+                (unsigned long long)gps.utc_ms);
+    }
+
+    void decodeAnomaly(const uint8_t* payload, uint8_t length, uint64_t utc, Result& result) {
+        if (_opt.csv.empty()) return;
+        JournalAnomalyRecord anomaly;
+        memcpy(&anomaly, payload, sizeof(anomaly));
+        std::string text((const char*)payload + sizeof(anomaly), length - sizeof(anomaly));
+        std::replace(text.begin(), text.end(), '\n', ' ');
+        // Description stays last since it is free text
+        appendf(result.anomaly_csv, "%u,%u,%u,%03X,%llu,%u,", anomaly.timestamp, anomaly.type, anomaly.severity,
+                anomaly.can_id, (unsigned long long)utc, anomaly.snapshot_id);
+        result.anomaly_csv += text;
+        result.anomaly_csv += '\n';
+    }
+
+    void closeBatch(Result& result) {
+        if (!_in_batch) return;
+        result.json += "]\n";
+        _in_batch = 0;
+    }
+};
+
+static bool mapSegment(Segment& segment) {
+    int fd = open(segment.path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < JOURNAL_BLOCK_SIZE) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    segment.data = (const uint8_t*)data;
+    segment.size = st.st_size;
+    return true;
+}
+
+static bool segmentSeq(const std::string& path, uint32_t& seq) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    unsigned long value = 0;
+    if (sscanf(name.c_str(), "seg_%lu.bin", &value) != 1 || value == 0) return false;
+    seq = value;
+    return true;
+}
+
+static void collect(const std::string& path, std::vector<Segment>& segments) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        fprintf(stderr, "journal_tool: cannot open %s\n", path.c_str());
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        Segment segment;
+        segment.path = path;
+        if (segmentSeq(path, segment.seq)) segments.push_back(segment);
+        else fprintf(stderr, "journal_tool: %s is not a segment file\n", path.c_str());
+        return;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return;
+    while (struct dirent* entry = readdir(dir)) {
+        Segment segment;
+        segment.path = path + "/" + entry->d_name;
+        if (segmentSeq(entry->d_name, segment.seq)) segments.push_back(segment);
+    }
+    closedir(dir);
+}
+
+static FILE* openOutput(const std::string& path, const char* header) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "journal_tool: cannot write %s\n", path.c_str());
+        exit(1);
+    }
+    if (header) fputs(header, out);
+    return out;
+}
+
+template <typename T>
+static void writeColumn(FILE* out, const std::vector<T>& column) {
+    if (!column.empty()) fwrite(column.data(), sizeof(T), column.size(), out);
+}
+
+static uint32_t parseId(const char* text) {
+    return strtoul(text, nullptr, strncmp(text, "0x", 2) == 0 || strncmp(text, "0X", 2) == 0 ? 16 : 10);
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: journal_tool [--threads N] [--from MS] [--to MS] [--id ID]... [--csv PREFIX]\n"
+            "                    [--columns DIR] [--json FILE --device ID [--batch N]] [--index FILE] PATH...\n");
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            opt.threads = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--from" && i + 1 < argc) {
+            opt.from = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--to" && i + 1 < argc) {
+            opt.to = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--id" && i + 1 < argc) {
+            opt.ids.insert(parseId(argv[++i]));
+        } else if (arg == "--csv" && i + 1 < argc) {
+            opt.csv = argv[++i];
+        } else if (arg == "--columns" && i + 1 < argc) {
+            opt.columns = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            opt.json = argv[++i];
+        } else if (arg == "--device" && i + 1 < argc) {
+            opt.device = argv[++i];
+        } else if (arg == "--batch" && i + 1 < argc) {
+            opt.batch = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--index" && i + 1 < argc) {
+            opt.index = argv[++i];
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty() || (!opt.json.empty() && opt.device.empty()) || opt.batch == 0) {
+        usage();
+        return 2;
+    }
+    if (opt.threads == 0) opt.threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<Segment> segments;
+    for (const std::string& path : paths) collect(path, segments);
+    std::sort(segments.begin(), segments.end(),
+              [](const Segment& a, const Segment& b) { return a.seq < b.seq; });
+    if (segments.empty()) {
+        fprintf(stderr, "journal_tool: no segments found\n");
+        return 1;
+    }
+
+    FILE* can_csv = nullptr;
+    FILE* gps_csv = nullptr;
+    FILE* anomaly_csv = nullptr;
+    if (!opt.csv.empty()) {
+        can_csv = openOutput(opt.csv + "_can.csv",
+                             "timestamp,can_id,dlc,data0,data1,data2,data3,data4,data5,data6,data7,utc_ms,suppressed,channel\n");
+        gps_csv = openOutput(opt.csv + "_gps.csv",
+                             "timestamp,latitude,longitude,altitude,speed,fix_quality,satellites,utc_ms\n");
+        anomaly_csv = openOutput(opt.csv + "_anomaly.csv",
+                                 "timestamp,type,severity,can_id,utc_ms,snapshot,description\n");
+    }
+
+    static const char* COLUMN_NAMES[] = {"timestamp", "utc_ms", "can_id", "channel", "dlc", "data", "suppressed"};
+    static const char* COLUMN_TYPES[] = {"<u4", "<u8", "<u4", "u1", "u1", "u1", "<u2"};
+    const size_t column_count = sizeof(COLUMN_NAMES) / sizeof(COLUMN_NAMES[0]);
+    FILE* columns[column_count] = {nullptr};
+    if (!opt.columns.empty()) {
+        mkdir(opt.columns.c_str(), 0755);
+        for (size_t c = 0; c < column_count; c++) {
+            columns[c] = openOutput(opt.columns + "/" + COLUMN_NAMES[c] + ".bin", nullptr);
+        }
+    }
+
+    FILE* json = opt.json.empty() ? nullptr : openOutput(opt.json, nullptr);
+
+    // Segments are decoded a wave at a time so memory stays bounded by the
+    // wave, not the card; each wave is written out in order before the next
+    const size_t wave = opt.threads * 4;
+    std::vector<ThreadStats> thread_stats(opt.threads);
+    BlockCounts counts;
+    uint64_t frames = 0;
+    uint64_t can_records = 0;
+    uint64_t records = 0;
+    uint64_t rows = 0;
+    uint64_t json_docs = 0;
+    uint64_t bytes = 0;
+    std::map<uint32_t, IdStats> ids;
+    std::vector<TimePoint> time_index;
+    std::string segment_json;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t base = 0; base < segments.size(); base += wave) {
+        size_t count = std::min(wave, segments.size() - base);
+        std::vector<Result> results(count);
+        std::atomic<size_t> next(0);
+
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < opt.threads; t++) {
+            workers.emplace_back([&, t]() {
+                Decoder decoder(opt);
+                for (size_t k = next++; k < count; k = next++) {
+                    Segment& segment = segments[base + k];
+                    auto begin = std::chrono::steady_clock::now();
+                    if (mapSegment(segment)) {
+                        decoder.decode(segment, results[k]);
+                        munmap((void*)segment.data, segment.size);
+                    } else {
+                        fprintf(stderr, "journal_tool: cannot map %s\n", segment.path.c_str());
+                    }
+                    thread_stats[t].busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - begin).count();
+                    thread_stats[t].frames += results[k].can_records;
+                }
+            });
+        }
+        for (std::thread& worker : workers) worker.join();
+
+        for (size_t k = 0; k < count; k++) {
+            Result& r = results[k];
+            const Segment& segment = segments[base + k];
+            counts.add(r.counts);
+            frames += r.frames;
+            records += r.records;
+            can_records += r.can_records;
+            bytes += segment.size;
+
+            if (can_csv) {
+                fwrite(r.can_csv.data(), 1, r.can_csv.size(), can_csv);
+                fwrite(r.gps_csv.data(), 1, r.gps_csv.size(), gps_csv);
+                fwrite(r.anomaly_csv.data(), 1, r.anomaly_csv.size(), anomaly_csv);
+            }
+            if (columns[0]) {
+                writeColumn(columns[0], r.timestamp);
+                writeColumn(columns[1], r.utc_ms);
+                writeColumn(columns[2], r.can_id);
+                writeColumn(columns[3], r.channel);
+                writeColumn(columns[4], r.dlc);
+                writeColumn(columns[5], r.data);
+                writeColumn(columns[6], r.suppressed);
+                rows += r.timestamp.size();
+            }
+            if (json) {
+                fwrite(r.json.data(), 1, r.json.size(), json);
+                json_docs += r.json_docs;
+            }
+            if (!opt.index.empty()) {
+                for (const auto& item : r.ids) {
+                    IdStats& total = ids[item.first];
+                    if (!total.frames) {
+                        total.first_time = item.second.first_time;
+                        total.first_segment = item.second.first_segment;
+                    }
+                    total.frames += item.second.frames;
+                    total.last_time = item.second.last_time;
+                    total.last_segment = item.second.last_segment;
+                }
+                time_index.insert(time_index.end(), r.time_index.begin(), r.time_index.end());
+                appendf(segment_json, "%s\n  {\"seq\":%u,\"data_blocks\":%llu,\"frames\":%llu,\"first\":%llu,\"last\":%llu}",
+                        segment_json.empty() ? "" : ",", segment.seq, (unsigned long long)r.counts.data,
+                        (unsigned long long)r.frames, (unsigned long long)r.first_time,
+                        (unsigned long long)r.last_time);
+            }
+        }
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (can_csv) {
+        fclose(can_csv);
+        fclose(gps_csv);
+        fclose(anomaly_csv);
+    }
+    if (columns[0]) {
+        for (size_t c = 0; c < column_count; c++) fclose(columns[c]);
+        FILE* schema = openOutput(opt.columns + "/schema.json", nullptr);
+        fprintf(schema, "{\"rows\":%llu,\"columns\":[", (unsigned long long)rows);
+        for (size_t c = 0; c < column_count; c++) {
+            fprintf(schema, "%s{\"name\":\"%s\",\"file\":\"%s.bin\",\"dtype\":\"%s\",\"per_row\":%u}",
+                    c ? "," : "", COLUMN_NAMES[c], COLUMN_NAMES[c], COLUMN_TYPES[c], c == 5 ? 8 : 1);
+        }
+        fprintf(schema, "]}\n");
+        fclose(schema);
+    }
+    if (json) fclose(json);
+
+    if (!opt.index.empty()) {
+        FILE* out = openOutput(opt.index, nullptr);
+        fprintf(out, "{\"segments\":[%s\n],\n\"ids\":[", segment_json.c_str());
+        bool first = true;
+        for (const auto& item : ids) {
+            fprintf(out, "%s\n  {\"id\":\"0x%x\",\"frames\":%llu,\"first\":%llu,\"last\":%llu,"
+                         "\"first_segment\":%u,\"last_segment\":%u}",
+                    first ? "" : ",", item.first, (unsigned long long)item.second.frames,
+                    (unsigned long long)item.second.first_time, (unsigned long long)item.second.last_time,
+                    item.second.first_segment, item.second.last_segment);
+            first = false;
+        }
+        fprintf(out, "\n],\n\"time\":[");
+        for (size_t i = 0; i < time_index.size(); i++) {
+            fprintf(out, "%s\n  {\"time\":%llu,\"segment\":%u,\"block\":%u}", i ? "," : "",
+                    (unsigned long long)time_index[i].time, time_index[i].segment, time_index[i].block);
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+    }
+
+    fprintf(stderr, "%zu segments, %.1f MiB: %llu data, %llu header/index, %llu torn, %llu stale, %llu unused blocks\n",
+            segments.size(), bytes / 1048576.0, (unsigned long long)counts.data,
+            (unsigned long long)counts.trailer, (unsigned long long)counts.corrupt,
+            (unsigned long long)counts.stale, (unsigned long long)counts.empty);
+    fprintf(stderr, "%llu records decoded, %llu frames selected", (unsigned long long)records,
+            (unsigned long long)frames);
+    if (json) fprintf(stderr, ", %llu documents", (unsigned long long)json_docs);
+    fprintf(stderr, "\n");
+    for (unsigned t = 0; t < opt.threads; t++) {
+        double busy = thread_stats[t].busy_ns / 1e9;
+        fprintf(stderr, "thread %u: %llu frames, %.0f frames/s\n", t, (unsigned long long)thread_stats[t].frames,
+                busy > 0 ? thread_stats[t].frames / busy : 0.0);
+    }
+    fprintf(stderr, "total: %.3f s wall, %.0f frames/s, %.0f frames/s per thread\n", wall,
+            wall > 0 ? can_records / wall : 0.0, wall > 0 ? can_records / wall / opt.threads : 0.0);
+    return 0;
+}
@@ -0,0 +1,310 @@
+// Replays CAN frames from recorded journal segments through the uplink
+// payload coding the logger uses (PayloadHeader and LzCodec, see types.h
+// and mqtt_client.h) and reports what compression buys on real traffic.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Ifirmware/include -o payload_bench tools/payload_bench.cpp
+//       firmware/src/utils/crc32.cpp firmware/src/utils/lz_codec.cpp
+//
+// Usage:
+//   payload_bench [--batch N] [--repeat N] [--min-bytes N] PATH...
+//
+// PATH is a journal directory or seg_NNNNNNNN.bin files. Three payloads
+// are built from the same frames:
+//   frame batch  vehicle/data/batch as sent: FrameBatchHeader and N
+//                (default MQTT_BATCH_FRAMES) JournalCanRecords
+//   json batch   the same N frames as a JSON array of vehicle/data objects
+//   json frame   one vehicle/data object per frame, as with batching off
+// For each: messages, bytes before and after coding (header included, and
+// falling back to uncompressed exactly as the firmware does), how many were
+// worth compressing, and host CPU time per KB to compress and decompress,
+// best of --repeat (default 10) passes. Every message is decoded again and
+// compared. The device reports its own time per KB on vehicle/mqtt.
+
+#include "config.h"
+#include "types.h"
+#include "crc32.h"
+#include "lz_codec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+struct Options {
+    unsigned batch = MQTT_BATCH_FRAMES ? MQTT_BATCH_FRAMES : 64;
+    unsigned repeat = 10;
+    size_t min_bytes = MQTT_COMPRESS_MIN_BYTES;
+};
+
+struct Frame {
+    JournalCanRecord record;
+    uint8_t data[8];
+    uint64_t utc_ms;
+};
+
+struct Workload {
+    const char* name;
+    PayloadContent content;
+    std::vector<std::vector<uint8_t>> messages;
+};
+
+struct Result {
+    size_t raw_bytes = 0;
+    size_t sent_bytes = 0;
+    size_t compressed = 0;
+    size_t compress_input = 0;
+    size_t decompress_output = 0;
+    double compress_ns = 0;
+    double decompress_ns = 0;
+    size_t mismatches = 0;
+};
+
+static Options opts;
+
+static bool blockCrcOk(const uint8_t* block) {
+    const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+    static const uint8_t zero[4] = {0};
+    const size_t crc_at = offsetof(JournalBlockHeader, crc);
+    const size_t after = crc_at + sizeof(header->crc);
+    uint32_t crc = Crc32::update(0, block, crc_at);
+    crc = Crc32::update(crc, zero, sizeof(zero));
+    crc = Crc32::update(crc, block + after, JOURNAL_BLOCK_SIZE - after);
+    return crc == header->crc;
+}
+
+static bool segmentSeq(const std::string& path, uint32_t& seq) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    unsigned long value = 0;
+    if (sscanf(name.c_str(), "seg_%lu.bin", &value) != 1 || value == 0) return false;
+    seq = value;
+    return true;
+}
+
+static void collect(const std::string& path, std::vector<std::pair<uint32_t, std::string>>& segments) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        fprintf(stderr, "payload_bench: cannot open %s\n", path.c_str());
+        return;
+    }
+    uint32_t seq;
+    if (!S_ISDIR(st.st_mode)) {
+        if (segmentSeq(path, seq)) segments.push_back({seq, path});
+        else fprintf(stderr, "payload_bench: %s is not a segment file\n", path.c_str());
+        return;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return;
+    while (struct dirent* entry = readdir(dir)) {
+        if (segmentSeq(entry->d_name, seq)) segments.push_back({seq, path + "/" + entry->d_name});
+    }
+    closedir(dir);
+}
+
+// CAN frames of one segment in block order; other records are skipped
+static void readFrames(uint32_t seq, const std::string& path, std::vector<Frame>& frames) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return;
+    uint8_t block[JOURNAL_BLOCK_SIZE];
+    for (uint32_t index = 0; fread(block, 1, sizeof(block), f) == sizeof(block); index++) {
+        const JournalBlockHeader* header = (const JournalBlockHeader*)block;
+        if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION ||
+            header->segment_seq != seq || header->block_index != index || header->kind != JOURNAL_BLOCK_DATA ||
+            header->payload_length > JOURNAL_PAYLOAD_SIZE || !blockCrcOk(block)) {
+            continue;
+        }
+        size_t offset = sizeof(JournalBlockHeader);
+        size_t end = offset + header->payload_length;
+        while (offset + sizeof(JournalRecordHeader) <= end) {
+            const JournalRecordHeader* rec = (const JournalRecordHeader*)(block + offset);
+            offset += sizeof(JournalRecordHeader);
+            if (offset + rec->length > end) break;
+            const uint8_t* payload = block + offset;
+            offset += rec->length;
+            if (rec->type != JOURNAL_REC_CAN || rec->length < sizeof(JournalCanRecord)) continue;
+
+            Frame frame = {};
+            memcpy(&frame.record, payload, sizeof(JournalCanRecord));
+            frame.record.dlc = std::min<uint8_t>(frame.record.dlc, 8);
+            if (sizeof(JournalCanRecord) + frame.record.dlc > rec->length) continue;
+            memcpy(frame.data, payload + sizeof(JournalCanRecord), frame.record.dlc);
+            frame.utc_ms = header->first_utc_ms
+                               ? header->first_utc_ms + (int32_t)(frame.record.timestamp - header->first_timestamp)
+                               : 0;
+            frames.push_back(frame);
+        }
+    }
+    fclose(f);
+}
+
+static void appendf(std::string& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void appendf(std::string& out, const char* format, ...) {
+    char buffer[128];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    out.append(buffer, std::min<int>(n, sizeof(buffer) - 1));
+}
+
+// Field order and formatting of MQTTClient::publishCANData with batching off
+static void appendJson(std::string& out, const Frame& frame) {
+    appendf(out, "{\"timestamp\":%u,\"utc\":%llu,\"can_id\":\"0x%x\",\"dlc\":%u,\"channel\":%u",
+            frame.record.timestamp, (unsigned long long)frame.utc_ms, frame.record.id, frame.record.dlc,
+            frame.record.channel);
+    if (frame.record.suppressed) appendf(out, ",\"suppressed\":%u", frame.record.suppressed);
+    out += ",\"data\":[";
+    for (uint8_t i = 0; i < frame.record.dlc; i++) appendf(out, i ? ",\"0x%x\"" : "\"0x%x\"", frame.data[i]);
+    out += "]}";
+}
+
+static void buildWorkloads(const std::vector<Frame>& frames, Workload& batch, Workload& json_batch,
+                           Workload& json_frame) {
+    for (size_t start = 0; start < frames.size(); start += opts.batch) {
+        size_t count = std::min<size_t>(opts.batch, frames.size() - start);
+
+        std::vector<uint8_t> message(sizeof(FrameBatchHeader));
+        FrameBatchHeader header = {};
+        header.count = count;
+        header.first_timestamp = frames[start].record.timestamp;
+        header.first_utc_ms = frames[start].utc_ms;
+        memcpy(message.data(), &header, sizeof(header));
+        std::string json = "[";
+        for (size_t i = start; i < start + count; i++) {
+            const uint8_t* record = (const uint8_t*)&frames[i].record;
+            message.insert(message.end(), record, record + sizeof(JournalCanRecord));
+            message.insert(message.end(), frames[i].data, frames[i].data + frames[i].record.dlc);
+
+            if (i > start) json += ",";
+            appendJson(json, frames[i]);
+            std::string single;
+            appendJson(single, frames[i]);
+            json_frame.messages.emplace_back(single.begin(), single.end());
+        }
+        json += "]";
+        batch.messages.push_back(std::move(message));
+        json_batch.messages.emplace_back(json.begin(), json.end());
+    }
+}
+
+// Codes every message as MQTTClient::publishPayload does, then times the
+// compressor and decompressor over the whole set
+static Result run(const Workload& workload) {
+    Result result;
+    LzCodec codec;
+    std::vector<uint8_t> packed(MQTT_MAX_PACKET_SIZE), back(LzCodec::MAX_BLOCK);
+    std::vector<std::vector<uint8_t>> compressed(workload.messages.size());
+
+    for (size_t m = 0; m < workload.messages.size(); m++) {
+        const std::vector<uint8_t>& message = workload.messages[m];
+        size_t length = message.size();
+        result.raw_bytes += length;
+        size_t sent = workload.content == PAYLOAD_JSON ? length : length + sizeof(PayloadHeader);
+        if (length >= opts.min_bytes) {
+            size_t limit = std::min(length - sizeof(PayloadHeader) - 1, packed.size());
+            size_t n = codec.compress(message.data(), length, packed.data(), limit);
+            result.compress_input += length;
+            if (n) {
+                compressed[m].assign(packed.begin(), packed.begin() + n);
+                sent = n + sizeof(PayloadHeader);
+                result.compressed++;
+                result.decompress_output += length;
+                if (LzCodec::decompress(packed.data(), n, back.data(), back.size()) != length ||
+                    memcmp(back.data(), message.data(), length) != 0) {
+                    result.mismatches++;
+                }
+            }
+        }
+        result.sent_bytes += sent;
+    }
+
+    double best_compress = 0, best_decompress = 0;
+    for (unsigned pass = 0; pass < opts.repeat; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        for (const std::vector<uint8_t>& message : workload.messages) {
+            if (message.size() < opts.min_bytes) continue;
+            codec.compress(message.data(), message.size(), packed.data(), packed.size());
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (const std::vector<uint8_t>& block : compressed) {
+            if (!block.empty()) LzCodec::decompress(block.data(), block.size(), back.data(), back.size());
+        }
+        auto end = std::chrono::steady_clock::now();
+        double compress_ns = std::chrono::duration<double, std::nano>(middle - start).count();
+        double decompress_ns = std::chrono::duration<double, std::nano>(end - middle).count();
+        if (!pass || compress_ns < best_compress) best_compress = compress_ns;
+        if (!pass || decompress_ns < best_decompress) best_decompress = decompress_ns;
+    }
+    result.compress_ns = best_compress;
+    result.decompress_ns = best_decompress;
+    return result;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: payload_bench [--batch N] [--repeat N] [--min-bytes N] PATH...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::pair<uint32_t, std::string>> segments;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc) {
+            opts.batch = atoi(argv[++i]);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            opts.repeat = atoi(argv[++i]);
+        } else if (arg == "--min-bytes" && i + 1 < argc) {
+            opts.min_bytes = atoi(argv[++i]);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            usage();
+        } else {
+            collect(arg, segments);
+        }
+    }
+    size_t batch_max = sizeof(FrameBatchHeader) + (size_t)opts.batch * (sizeof(JournalCanRecord) + 8);
+    if (segments.empty() || opts.batch == 0 || opts.repeat == 0 || batch_max > LzCodec::MAX_BLOCK) usage();
+    std::sort(segments.begin(), segments.end());
+
+    std::vector<Frame> frames;
+    for (const auto& segment : segments) readFrames(segment.first, segment.second, frames);
+    if (frames.empty()) {
+        fprintf(stderr, "payload_bench: no CAN frames in %zu segments\n", segments.size());
+        return 1;
+    }
+
+    Workload workloads[] = {
+        {"frame batch", PAYLOAD_FRAME_BATCH, {}},
+        {"json batch", PAYLOAD_JSON, {}},
+        {"json frame", PAYLOAD_JSON, {}},
+    };
+    buildWorkloads(frames, workloads[0], workloads[1], workloads[2]);
+
+    printf("%zu frames from %zu segments, batches of %u, compressing payloads of %zu bytes and up\n\n",
+           frames.size(), segments.size(), opts.batch, opts.min_bytes);
+    printf("%-12s %9s %12s %12s %7s %11s %14s %16s\n", "payload", "messages", "raw bytes", "sent bytes",
+           "ratio", "compressed", "compress us/KB", "decompress us/KB");
+    int status = 0;
+    for (const Workload& workload : workloads) {
+        Result r = run(workload);
+        double kb_in = r.compress_input / 1024.0;
+        double kb_out = r.decompress_output / 1024.0;
+        printf("%-12s %9zu %12zu %12zu %6.1f%% %11zu %14.2f %16.2f\n", workload.name, workload.messages.size(),
+               r.raw_bytes, r.sent_bytes, 100.0 * r.sent_bytes / r.raw_bytes, r.compressed,
+               kb_in ? r.compress_ns / 1000.0 / kb_in : 0.0, kb_out ? r.decompress_ns / 1000.0 / kb_out : 0.0);
+        if (r.mismatches) {
+            fprintf(stderr, "payload_bench: %zu %s messages did not decode to the original\n", r.mismatches,
+                    workload.name);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,186 @@
+// Merges and queries the signal distribution sketches the logger writes to
+// /distributions.csv on the SD card or publishes on vehicle/distribution.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Ifirmware/include -o sketch_tool tools/sketch_tool.cpp
+//       firmware/src/utils/quantile_sketch.cpp firmware/src/utils/base64.cpp
+//
+// Usage:
+//   sketch_tool [--from MS] [--to MS] [--band SIGNAL:LOW:HIGH]... FILE...
+//
+// FILE is a distributions.csv or a capture of vehicle/distribution payloads,
+// one JSON object per line ("-" reads stdin). --from/--to select windows by
+// their start time in UTC ms (device uptime if the clock was never synced).
+// Every window in range is merged per signal and reported as p50/p95/p99
+// plus time-in-band for each --band.
+
+#include "quantile_sketch.h"
+#include "base64.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+struct Band {
+    std::string signal;
+    uint16_t low;
+    uint16_t high;
+};
+
+struct Merged {
+    QuantileSketch sketch;
+    uint32_t windows = 0;
+};
+
+static bool jsonField(const std::string& line, const char* key, std::string& value) {
+    std::string needle = std::string("\"") + key + "\":";
+    size_t pos = line.find(needle);
+    if (pos == std::string::npos) return false;
+    pos += needle.size();
+    if (pos < line.size() && line[pos] == '"') {
+        size_t end = line.find('"', pos + 1);
+        if (end == std::string::npos) return false;
+        value = line.substr(pos + 1, end - pos - 1);
+    } else {
+        size_t end = line.find_first_of(",}", pos);
+        value = line.substr(pos, end - pos);
+    }
+    return true;
+}
+
+// Extracts signal, window time and base64 sketch from either input format
+static bool parseLine(const std::string& line, std::string& signal, uint64_t& time, std::string& blob) {
+    if (line.empty()) return false;
+
+    if (line[0] == '{') {
+        std::string utc, start;
+        if (!jsonField(line, "signal", signal) || !jsonField(line, "sketch", blob)) return false;
+        jsonField(line, "utc", utc);
+        jsonField(line, "start", start);
+        time = strtoull(utc.c_str(), nullptr, 10);
+        if (time == 0) time = strtoull(start.c_str(), nullptr, 10);
+        return true;
+    }
+
+    // start,end,utc_ms,signal,weight_ms,p50,p95,p99,sketch
+    std::vector<std::string> fields;
+    size_t begin = 0;
+    while (true) {
+        size_t comma = line.find(',', begin);
+        fields.push_back(line.substr(begin, comma - begin));
+        if (comma == std::string::npos) break;
+        begin = comma + 1;
+    }
+    if (fields.size() != 9 || fields[0] == "start") return false;
+
+    signal = fields[3];
+    blob = fields[8];
+    time = strtoull(fields[2].c_str(), nullptr, 10);
+    if (time == 0) time = strtoull(fields[0].c_str(), nullptr, 10);
+    return true;
+}
+
+static void readStream(std::istream& in, uint64_t from, uint64_t to, std::map<std::string, Merged>& merged,
+                       uint32_t& rejected) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+
+        std::string signal, blob;
+        uint64_t time = 0;
+        if (!parseLine(line, signal, time, blob)) continue;
+        if (time < from || time > to) continue;
+
+        std::vector<uint8_t> bytes(blob.size());
+        size_t length = Base64::decode(blob.data(), blob.size(), bytes.data(), bytes.size());
+        QuantileSketch window;
+        if (length == 0 || !window.deserialize(bytes.data(), length)) {
+            rejected++;
+            continue;
+        }
+
+        Merged& entry = merged[signal];
+        entry.sketch.merge(window);
+        entry.windows++;
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "usage: sketch_tool [--from MS] [--to MS] [--band SIGNAL:LOW:HIGH]... FILE...\n");
+}
+
+int main(int argc, char** argv) {
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    std::vector<Band> bands;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--from" && i + 1 < argc) {
+            from = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--to" && i + 1 < argc) {
+            to = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--band" && i + 1 < argc) {
+            char name[32];
+            unsigned low, high;
+            if (sscanf(argv[++i], "%31[^:]:%u:%u", name, &low, &high) != 3 || low > high || high > 0xFFFF) {
+                usage();
+                return 2;
+            }
+            bands.push_back({name, (uint16_t)low, (uint16_t)high});
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty()) {
+        usage();
+        return 2;
+    }
+
+    std::map<std::string, Merged> merged;
+    uint32_t rejected = 0;
+    for (const std::string& path : files) {
+        if (path == "-") {
+            readStream(std::cin, from, to, merged, rejected);
+            continue;
+        }
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "sketch_tool: cannot open %s\n", path.c_str());
+            return 1;
+        }
+        readStream(in, from, to, merged, rejected);
+    }
+
+    if (rejected) fprintf(stderr, "sketch_tool: skipped %u malformed sketches\n", rejected);
+
+    printf("%-10s %8s %12s %7s %7s %7s %7s %7s\n", "signal", "windows", "time_s", "min", "p50", "p95", "p99", "max");
+    for (const auto& item : merged) {
+        const QuantileSketch& s = item.second.sketch;
+        printf("%-10s %8u %12.1f %7u %7u %7u %7u %7u\n", item.first.c_str(), item.second.windows,
+               s.total() / 1000.0, s.min(), s.quantile(0.50f), s.quantile(0.95f), s.quantile(0.99f), s.max());
+    }
+
+    for (const Band& band : bands) {
+        auto it = merged.find(band.signal);
+        if (it == merged.end()) {
+            printf("band %s %u-%u: no data\n", band.signal.c_str(), band.low, band.high);
+            continue;
+        }
+        const QuantileSketch& s = it->second.sketch;
+        uint64_t total = s.total();
+        uint64_t in_band = s.weightInRange(band.low, band.high);
+        printf("band %s %u-%u: %.1f s (%.1f%%)\n", band.signal.c_str(), band.low, band.high,
+               in_band / 1000.0, total ? 100.0 * in_band / total : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,306 @@
+// Local stand-in for the backend's segment upload endpoint (see
+// segment_uploader.h for the protocol), for bench-testing the logger's
+// uploader without the backend or its database, including interrupted and
+// corrupted transfers.
+//
+// Build from the repository root:
+//   g++ -std=c++17 -O2 -Ifirmware/include -o upload_server tools/upload_server.cpp
+//       firmware/src/utils/crc32.cpp
+//
+// Usage:
+//   upload_server [--port N] [--dir DIR] [--path PREFIX] [--drop-every N]
+//                 [--corrupt-every N]
+//
+// Segments are stored as DIR/<device>/seg_NNNNNNNN.bin (default DIR
+// "uploads", PREFIX "/api/uploads", port 3000); partial uploads keep a .part
+// suffix until the last byte arrives, so the output directory can be fed
+// straight to journal_tool.
+//   --drop-every     close the connection instead of storing every Nth chunk
+//   --corrupt-every  flip a bit in every Nth chunk before checking its CRC
+// Each completed segment and a running total (chunks stored, dropped and
+// rejected, bytes received vs. kept, throughput) are printed to stderr.
+
+#include "crc32.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Options {
+    uint16_t port = 3000;
+    std::string dir = "uploads";
+    std::string path = "/api/uploads";
+    unsigned drop_every = 0;
+    unsigned corrupt_every = 0;
+};
+
+struct Totals {
+    unsigned long chunks = 0;        // Received in full
+    unsigned long stored = 0;
+    unsigned long dropped = 0;       // Connection closed on purpose
+    unsigned long bad_crc = 0;
+    unsigned long bad_offset = 0;
+    unsigned long segments = 0;
+    unsigned long long bytes_received = 0;
+    unsigned long long bytes_stored = 0;
+};
+
+struct Transfer {
+    std::chrono::steady_clock::time_point started;
+    unsigned long long received = 0;
+};
+
+static Options opts;
+static Totals totals;
+static std::map<std::string, Transfer> transfers;
+static std::chrono::steady_clock::time_point first_chunk;
+static bool any_chunk = false;
+
+static double secondsSince(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+static void printTotals() {
+    double seconds = any_chunk ? secondsSince(first_chunk) : 0.0;
+    fprintf(stderr,
+            "total: %lu segments, %lu chunks (%lu stored, %lu dropped, %lu bad crc, %lu bad offset), "
+            "%llu bytes received, %llu kept (%.1f%%), %.1f kB/s\n",
+            totals.segments, totals.chunks, totals.stored, totals.dropped, totals.bad_crc,
+            totals.bad_offset, totals.bytes_received, totals.bytes_stored,
+            totals.bytes_received ? 100.0 * totals.bytes_stored / totals.bytes_received : 100.0,
+            seconds > 0 ? totals.bytes_stored / seconds / 1000.0 : 0.0);
+}
+
+static void onSignal(int) {
+    printTotals();
+    _exit(0);
+}
+
+static bool validName(const std::string& s) {
+    if (s.empty() || s.size() > 64) return false;
+    for (char c : s) {
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_') return false;
+    }
+    return true;
+}
+
+static std::string segmentFile(const std::string& device, unsigned long seq, bool part) {
+    char name[40];
+    snprintf(name, sizeof(name), "seg_%08lu.bin%s", seq, part ? ".part" : "");
+    return opts.dir + "/" + device + "/" + name;
+}
+
+// Bytes held so far: the whole file once complete, else the partial file
+static unsigned long long storedOffset(const std::string& device, unsigned long seq) {
+    struct stat st;
+    if (stat(segmentFile(device, seq, false).c_str(), &st) == 0) return st.st_size;
+    if (stat(segmentFile(device, seq, true).c_str(), &st) == 0) return st.st_size;
+    return 0;
+}
+
+static bool sendAll(int fd, const char* data, size_t length) {
+    while (length) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool respond(int fd, int status, const char* reason, unsigned long long offset) {
+    char body[64];
+    int body_length = snprintf(body, sizeof(body), "{\"offset\":%llu}", offset);
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n"
+                          "Connection: keep-alive\r\n\r\n%s",
+                          status, reason, body_length, body);
+    return sendAll(fd, response, length);
+}
+
+static bool respondError(int fd, int status, const char* reason) {
+    char response[160];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status, reason);
+    sendAll(fd, response, length);
+    return false;
+}
+
+static const char* header(const std::string& head, const char* name) {
+    size_t n = strlen(name);
+    for (size_t line = head.find("\r\n"); line != std::string::npos; line = head.find("\r\n", line + 2)) {
+        if (strncasecmp(head.c_str() + line + 2, name, n) == 0 && head[line + 2 + n] == ':') {
+            return head.c_str() + line + 3 + n;
+        }
+    }
+    return nullptr;
+}
+
+static unsigned long long queryValue(const std::string& query, const char* key) {
+    std::string k = std::string(key) + "=";
+    for (size_t pos = 0; pos < query.size();) {
+        size_t end = query.find('&', pos);
+        if (end == std::string::npos) end = query.size();
+        if (query.compare(pos, k.size(), k) == 0) return strtoull(query.c_str() + pos + k.size(), nullptr, 10);
+        pos = end + 1;
+    }
+    return 0;
+}
+
+// One request on fd; false closes the connection
+static bool handle(int fd, std::string& buffer) {
+    size_t head_end;
+    while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+        if (buffer.size() > 16384) return respondError(fd, 431, "Request Header Fields Too Large");
+    }
+    std::string head = buffer.substr(0, head_end);
+    size_t content_length = 0;
+    if (const char* value = header(head, "Content-Length")) content_length = strtoul(value, nullptr, 10);
+    while (buffer.size() < head_end + 4 + content_length) {
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+    }
+    std::string body = buffer.substr(head_end + 4, content_length);
+    buffer.erase(0, head_end + 4 + content_length);
+
+    // "METHOD /prefix/<device>/<segment>?query HTTP/1.1"
+    char method[8], target[512];
+    if (sscanf(head.c_str(), "%7s %511s", method, target) != 2) return respondError(fd, 400, "Bad Request");
+    std::string url = target;
+    std::string query;
+    size_t q = url.find('?');
+    if (q != std::string::npos) {
+        query = url.substr(q + 1);
+        url.resize(q);
+    }
+    if (url.compare(0, opts.path.size() + 1, opts.path + "/") != 0) return respondError(fd, 404, "Not Found");
+    url.erase(0, opts.path.size() + 1);
+    size_t slash = url.find('/');
+    std::string device = url.substr(0, slash);
+    char* end = nullptr;
+    unsigned long seq = slash == std::string::npos ? 0 : strtoul(url.c_str() + slash + 1, &end, 10);
+    if (!validName(device) || !seq || *end) return respondError(fd, 400, "Bad Request");
+
+    unsigned long long offset = storedOffset(device, seq);
+    if (strcmp(method, "GET") == 0) return respond(fd, 200, "OK", offset);
+    if (strcmp(method, "PUT") != 0) return respondError(fd, 405, "Method Not Allowed");
+
+    totals.chunks++;
+    totals.bytes_received += body.size();
+    if (!any_chunk) {
+        first_chunk = std::chrono::steady_clock::now();
+        any_chunk = true;
+    }
+    std::string key = device + "/" + std::to_string(seq);
+    Transfer& transfer = transfers[key];
+    if (!transfer.received) transfer.started = std::chrono::steady_clock::now();
+    transfer.received += body.size();
+
+    if (opts.drop_every && totals.chunks % opts.drop_every == 0) {
+        totals.dropped++;
+        return false;
+    }
+    if (opts.corrupt_every && totals.chunks % opts.corrupt_every == 0 && !body.empty()) body[0] ^= 0x01;
+
+    const char* crc_header = header(head, "X-Chunk-Crc32");
+    uint32_t expected = crc_header ? strtoul(crc_header, nullptr, 16) : 0;
+    if (!crc_header || Crc32::update(0, body.data(), body.size()) != expected) {
+        totals.bad_crc++;
+        return respond(fd, 422, "Unprocessable Entity", offset);
+    }
+    unsigned long long at = queryValue(query, "offset");
+    unsigned long long total = queryValue(query, "total");
+    if (at != offset || !total || at + body.size() > total) {
+        totals.bad_offset++;
+        return respond(fd, 409, "Conflict", offset);
+    }
+
+    mkdir(opts.dir.c_str(), 0755);
+    mkdir((opts.dir + "/" + device).c_str(), 0755);
+    std::string part = segmentFile(device, seq, true);
+    FILE* f = fopen(part.c_str(), "ab");
+    if (!f || fwrite(body.data(), 1, body.size(), f) != body.size()) {
+        if (f) fclose(f);
+        return respondError(fd, 500, "Internal Server Error");
+    }
+    fclose(f);
+    offset += body.size();
+    totals.stored++;
+    totals.bytes_stored += body.size();
+
+    if (offset == total) {
+        rename(part.c_str(), segmentFile(device, seq, false).c_str());
+        double seconds = secondsSince(transfer.started);
+        fprintf(stderr, "%s segment %lu: %llu bytes, %llu received this run in %.2f s (%.1f kB/s)\n",
+                device.c_str(), seq, total, transfer.received, seconds,
+                seconds > 0 ? transfer.received / seconds / 1000.0 : 0.0);
+        transfers.erase(key);
+        totals.segments++;
+        printTotals();
+    }
+    return respond(fd, 200, "OK", offset);
+}
+
+static bool parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) return false;
+        const char* value = argv[++i];
+        if (strcmp(arg, "--port") == 0) opts.port = (uint16_t)atoi(value);
+        else if (strcmp(arg, "--dir") == 0) opts.dir = value;
+        else if (strcmp(arg, "--path") == 0) opts.path = value;
+        else if (strcmp(arg, "--drop-every") == 0) opts.drop_every = atoi(value);
+        else if (strcmp(arg, "--corrupt-every") == 0) opts.corrupt_every = atoi(value);
+        else return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (!parseArgs(argc, argv)) {
+        fprintf(stderr, "usage: upload_server [--port N] [--dir DIR] [--path PREFIX] "
+                        "[--drop-every N] [--corrupt-every N]\n");
+        return 2;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(opts.port);
+    if (bind(server, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 4) != 0) {
+        perror("upload_server");
+        return 1;
+    }
+    fprintf(stderr, "listening on :%u%s, storing in %s\n", opts.port, opts.path.c_str(), opts.dir.c_str());
+
+    // The logger keeps one connection open; serve them one at a time
+    for (;;) {
+        int fd = accept(server, nullptr, nullptr);
+        if (fd < 0) continue;
+        std::string buffer;
+        while (handle(fd, buffer)) {}
+        close(fd);
+    }
+}